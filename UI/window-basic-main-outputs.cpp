@@ -254,6 +254,9 @@ void SimpleOutput::LoadRecordingPreset_h264(const char *encoderId)
 	if (!h264Recording)
 		throw "Failed to create h264 recording encoder (simple output)";
 	obs_encoder_release(h264Recording);
+
+	/* runs alongside the stream encoder instead of after it */
+	obs_encoder_set_threaded(h264Recording, true);
 }
 
 void SimpleOutput::LoadStreamingPreset_h264(const char *encoderId)
@@ -752,6 +755,8 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 			"NewSocketLoopEnable");
 	bool enableLowLatencyMode = config_get_bool(main->Config(), "Output",
 			"LowLatencyEnable");
+	bool enableDynBitrate = config_get_bool(main->Config(), "Output",
+			"DynBitrate");
 
 	obs_data_t *settings = obs_data_create();
 	obs_data_set_string(settings, "bind_ip", bindIP);
@@ -759,6 +764,7 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 			enableNewSocketLoop);
 	obs_data_set_bool(settings, "low_latency_mode_enabled",
 			enableLowLatencyMode);
+	obs_data_set_bool(settings, "dyn_bitrate", enableDynBitrate);
 	obs_output_update(streamOutput, settings);
 	obs_data_release(settings);
 
@@ -1140,6 +1146,8 @@ AdvancedOutput::AdvancedOutput(OBSBasic *main_) : BasicOutputHandler(main_)
 				throw "Failed to create recording h264 "
 				      "encoder (advanced output)";
 			obs_encoder_release(h264Recording);
+
+			obs_encoder_set_threaded(h264Recording, true);
 		}
 	}
 
@@ -1531,6 +1539,8 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 			"NewSocketLoopEnable");
 	bool enableLowLatencyMode = config_get_bool(main->Config(), "Output",
 			"LowLatencyEnable");
+	bool enableDynBitrate = config_get_bool(main->Config(), "Output",
+			"DynBitrate");
 
 	obs_data_t *settings = obs_data_create();
 	obs_data_set_string(settings, "bind_ip", bindIP);
@@ -1538,6 +1548,7 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 			enableNewSocketLoop);
 	obs_data_set_bool(settings, "low_latency_mode_enabled",
 			enableLowLatencyMode);
+	obs_data_set_bool(settings, "dyn_bitrate", enableDynBitrate);
 	obs_output_update(streamOutput, settings);
 	obs_data_release(settings);
 
@@ -1102,6 +1102,8 @@ bool OBSBasic::InitBasicConfigDefaults()
 			false);
 	config_set_default_bool  (basicConfig, "Output", "LowLatencyEnable",
 			false);
+	config_set_default_bool  (basicConfig, "Output", "DynBitrate",
+			true);
 
 	int i = 0;
 	uint32_t scale_cx = cx;
@@ -2973,6 +2975,9 @@ int OBSBasic::ResetVideo()
 				ovi.base_height);
 	}
 
+	obs_set_video_staging_depth((uint32_t)config_get_uint(basicConfig,
+			"Video", "StagingDepth"));
+
 	ret = AttemptToResetVideo(&ovi);
 	if (IS_WIN32 && ret != OBS_VIDEO_SUCCESS) {
 		if (ret == OBS_VIDEO_CURRENTLY_ACTIVE) {
@@ -40,4 +40,18 @@ gs_stage_surface::gs_stage_surface(gs_device_t *device, uint32_t width,
 	hr = device->device->CreateTexture2D(&td, NULL, texture.Assign());
 	if (FAILED(hr))
 		throw HRError("Failed to create staging surface", hr);
+
+	InitFence(device->device);
+}
+
+void gs_stage_surface::InitFence(ID3D11Device *dev)
+{
+	D3D11_QUERY_DESC qd = {};
+	qd.Query = D3D11_QUERY_EVENT;
+
+	/* without a fence the surface just always reports as ready */
+	HRESULT hr = dev->CreateQuery(&qd, fence.Assign());
+	if (FAILED(hr))
+		blog(LOG_WARNING, "Failed to create staging surface fence "
+		                  "(%08lX)", hr);
 }
@@ -1321,6 +1321,11 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 
 		device->CopyTex(dst->texture, 0, 0, src, 0, 0, 0, 0);
 
+		if (dst->fence) {
+			device->context->End(dst->fence);
+			dst->staged = true;
+		}
+
 	} catch (const char *error) {
 		blog(LOG_ERROR, "device_copy_texture (D3D11): %s", error);
 	}
@@ -1906,6 +1911,21 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 	stagesurf->device->context->Unmap(stagesurf->texture, 0);
 }
 
+bool gs_stagesurface_is_ready(gs_stagesurf_t *stagesurf)
+{
+	if (!stagesurf->staged)
+		return true;
+
+	/* polls the event query without forcing a flush */
+	HRESULT hr = stagesurf->device->context->GetData(stagesurf->fence,
+			nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH);
+	if (hr == S_FALSE)
+		return false;
+
+	stagesurf->staged = false;
+	return true;
+}
+
 
 void gs_zstencil_destroy(gs_zstencil_t *zstencil)
 {
@@ -421,17 +421,23 @@ struct gs_zstencil_buffer : gs_obj {
 
 struct gs_stage_surface : gs_obj {
 	ComPtr<ID3D11Texture2D> texture;
+	ComPtr<ID3D11Query>     fence;
 	D3D11_TEXTURE2D_DESC td = {};
 
 	uint32_t        width, height;
 	gs_color_format format;
 	DXGI_FORMAT     dxgiFormat;
+	bool            staged = false;
+
+	void InitFence(ID3D11Device *dev);
 
 	inline void Rebuild(ID3D11Device *dev);
 
 	inline void Release()
 	{
 		texture.Release();
+		fence.Release();
+		staged = false;
 	}
 
 	gs_stage_surface(gs_device_t *device, uint32_t width, uint32_t height,
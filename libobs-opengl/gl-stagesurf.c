@@ -68,6 +68,8 @@ gs_stagesurf_t *device_stagesurface_create(gs_device_t *device, uint32_t width,
 void gs_stagesurface_destroy(gs_stagesurf_t *stagesurf)
 {
 	if (stagesurf) {
+		if (stagesurf->fence)
+			glDeleteSync(stagesurf->fence);
 		if (stagesurf->pack_buffer)
 			gl_delete_buffers(1, &stagesurf->pack_buffer);
 
@@ -106,6 +108,15 @@ static bool can_stage(struct gs_stage_surface *dst, struct gs_texture_2d *src)
 	return true;
 }
 
+static void set_stage_fence(struct gs_stage_surface *dst)
+{
+	if (dst->fence)
+		glDeleteSync(dst->fence);
+
+	dst->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	gl_success("glFenceSync");
+}
+
 #ifdef __APPLE__
 
 /* Apparently for mac, PBOs won't do an asynchronous transfer unless you use
@@ -141,6 +152,7 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 	if (!gl_success("glReadPixels"))
 		goto failed_unbind_all;
 
+	set_stage_fence(dst);
 	success = true;
 
 failed_unbind_all:
@@ -172,6 +184,8 @@ void device_stage_texture(gs_device_t *device, gs_stagesurf_t *dst,
 	if (!gl_success("glGetTexImage"))
 		goto failed;
 
+	set_stage_fence(dst);
+
 	gl_bind_texture(GL_TEXTURE_2D, 0);
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 	return;
@@ -232,3 +246,20 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 
 	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
 }
+
+bool gs_stagesurface_is_ready(gs_stagesurf_t *stagesurf)
+{
+	GLenum status;
+
+	if (!stagesurf->fence)
+		return true;
+
+	/* zero timeout, only polls the fence */
+	status = glClientWaitSync(stagesurf->fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	glDeleteSync(stagesurf->fence);
+	stagesurf->fence = NULL;
+	return true;
+}
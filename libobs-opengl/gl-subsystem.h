@@ -438,6 +438,9 @@ struct gs_stage_surface {
 	GLint                gl_internal_format;
 	GLenum               gl_type;
 	GLuint               pack_buffer;
+
+	/* signaled once the last staged copy has completed */
+	GLsync               fence;
 };
 
 struct gs_zstencil_buffer {
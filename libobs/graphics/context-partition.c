@@ -15,151 +15,340 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+
 #include "context-partition.h"
 #include "obs.h"
+#include "util/bmem.h"
 #include "util/platform.h"
-#include "stdio.h"
 
-#define CHROMAKEY "chromakey"
-#define COLORKEY "colorkey"
+#define SETTING_KEY_COLOR  "partition_key_color"
+#define SETTING_SIMILARITY "partition_similarity"
+#define SETTING_BLEND      "partition_smoothness"
+#define SETTING_THREADS    "partition_threads"
+
+/* similarity and smoothness are stored as 1-1000 like the chroma key
+ * filter settings */
+#define DEFAULT_KEY_COLOR  0x00fa00
+#define DEFAULT_SIMILARITY 730
+#define DEFAULT_BLEND      20
+
+struct partition_band {
+	video_partitioner* context;
+	pthread_t thread;
+	os_sem_t* start;
+	uint32_t index;
+	volatile bool stop;
+};
+
+/* ------------------------------------------------------------------------- */
+/* color key
+ *
+ * alpha = clamp((|pixel - key| - similarity) / blend) with the distance
+ * normalized so that one full channel step is 1.0, the same curve as the
+ * colorkey filter this replaces. */
+
+struct key_consts {
+	float key[3];
+	float similarity;
+	float inv_blend;
+	bool hard;
+};
+
+static inline uint8_t key_pixel_c(const struct key_consts* k,
+		const uint8_t* px)
+{
+	float d0 = (float)px[0] - k->key[0];
+	float d1 = (float)px[1] - k->key[1];
+	float d2 = (float)px[2] - k->key[2];
+	float diff = sqrtf((d0 * d0 + d1 * d1 + d2 * d2) *
+			(1.0f / (255.0f * 255.0f)));
+
+	if (k->hard)
+		return diff > k->similarity ? 255 : 0;
+
+	float alpha = (diff - k->similarity) * k->inv_blend;
+	alpha = alpha < 0.0f ? 0.0f : (alpha > 1.0f ? 1.0f : alpha);
+	return (uint8_t)(alpha * 255.0f);
+}
 
-static inline enum AVPixelFormat get_ffmpeg_video_format(enum video_format format)
+/* 4 pixels per iteration */
+static void key_row_sse2(const struct key_consts* k, uint8_t* row,
+		uint32_t width)
 {
-	switch (format) {
-	case VIDEO_FORMAT_NONE: return AV_PIX_FMT_NONE;
-	case VIDEO_FORMAT_I420: return AV_PIX_FMT_YUV420P;
-	case VIDEO_FORMAT_NV12: return AV_PIX_FMT_NV12;
-	case VIDEO_FORMAT_YVYU: return AV_PIX_FMT_NONE;
-	case VIDEO_FORMAT_YUY2: return AV_PIX_FMT_YUYV422;
-	case VIDEO_FORMAT_UYVY: return AV_PIX_FMT_UYVY422;
-	case VIDEO_FORMAT_RGBA: return AV_PIX_FMT_RGBA;
-	case VIDEO_FORMAT_BGRA: return AV_PIX_FMT_BGRA;
-	case VIDEO_FORMAT_BGRX: return AV_PIX_FMT_BGRA;
-	case VIDEO_FORMAT_Y800: return AV_PIX_FMT_GRAY8;
-	case VIDEO_FORMAT_I444: return AV_PIX_FMT_YUV444P;
+	const __m128i byte_mask  = _mm_set1_epi32(0xFF);
+	const __m128i color_mask = _mm_set1_epi32(0x00FFFFFF);
+	const __m128  key0       = _mm_set1_ps(k->key[0]);
+	const __m128  key1       = _mm_set1_ps(k->key[1]);
+	const __m128  key2       = _mm_set1_ps(k->key[2]);
+	const __m128  norm       = _mm_set1_ps(1.0f / (255.0f * 255.0f));
+	const __m128  similarity = _mm_set1_ps(k->similarity);
+	const __m128  inv_blend  = _mm_set1_ps(k->inv_blend);
+	const __m128  zero       = _mm_setzero_ps();
+	const __m128  one        = _mm_set1_ps(1.0f);
+	const __m128  full       = _mm_set1_ps(255.0f);
+	uint32_t x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		__m128i* ptr = (__m128i*)(row + x * 4);
+		__m128i px = _mm_loadu_si128(ptr);
+
+		__m128 d0 = _mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_and_si128(px, byte_mask)), key0);
+		__m128 d1 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_and_si128(
+				_mm_srli_epi32(px, 8), byte_mask)), key1);
+		__m128 d2 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_and_si128(
+				_mm_srli_epi32(px, 16), byte_mask)), key2);
+
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0),
+				_mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2));
+		__m128 diff = _mm_sqrt_ps(_mm_mul_ps(sum, norm));
+		__m128 alpha;
+
+		if (k->hard) {
+			alpha = _mm_and_ps(_mm_cmpgt_ps(diff, similarity),
+					full);
+		} else {
+			alpha = _mm_mul_ps(_mm_sub_ps(diff, similarity),
+					inv_blend);
+			alpha = _mm_min_ps(_mm_max_ps(alpha, zero), one);
+			alpha = _mm_mul_ps(alpha, full);
+		}
+
+		px = _mm_or_si128(_mm_and_si128(px, color_mask),
+				_mm_slli_epi32(_mm_cvttps_epi32(alpha), 24));
+		_mm_storeu_si128(ptr, px);
 	}
 
-	return AV_PIX_FMT_NONE;
+	for (; x < width; x++) {
+		uint8_t* px = row + x * 4;
+		px[3] = key_pixel_c(k, px);
+	}
 }
 
-static inline enum video_format convert_pixel_format(int f)
+static void init_key_consts(struct key_consts* k,
+		const partition_param* param, enum video_format format)
 {
-	switch (f) {
-	case AV_PIX_FMT_NONE:    return VIDEO_FORMAT_NONE;
-	case AV_PIX_FMT_YUV420P: return VIDEO_FORMAT_I420;
-	case AV_PIX_FMT_NV12:    return VIDEO_FORMAT_NV12;
-	case AV_PIX_FMT_YUYV422: return VIDEO_FORMAT_YUY2;
-	case AV_PIX_FMT_UYVY422: return VIDEO_FORMAT_UYVY;
-	case AV_PIX_FMT_RGBA:    return VIDEO_FORMAT_RGBA;
-	case AV_PIX_FMT_BGRA:    return VIDEO_FORMAT_BGRA;
-	case AV_PIX_FMT_BGR0:    return VIDEO_FORMAT_BGRX;
-	default:;
+	float r = (float)(param->key_color & 0xFF);
+	float g = (float)((param->key_color >> 8) & 0xFF);
+	float b = (float)((param->key_color >> 16) & 0xFF);
+
+	k->key[1] = g;
+	if (format == VIDEO_FORMAT_RGBA) {
+		k->key[0] = r;
+		k->key[2] = b;
+	} else {
+		k->key[0] = b;
+		k->key[2] = r;
 	}
 
-	return VIDEO_FORMAT_NONE;
+	k->similarity = (float)param->similarity;
+	k->hard       = param->blend <= 0.0001;
+	k->inv_blend  = k->hard ? 0.0f : (float)(1.0 / param->blend);
 }
 
-bool did_video_frame_property_changed(video_partitioner* context, struct obs_source_frame *frame) {
-	if (!context || !frame) {
-		return true;
+/* ------------------------------------------------------------------------- */
+/* unchanged frames
+ *
+ * Async frames are always fresh copies, so an unchanged frame still needs its
+ * alpha written.  The colour data (alpha ignored, it is garbage for BGRX) is
+ * hashed, and if it matches the last keyed frame the saved alpha is copied
+ * back instead of running the key again. */
+
+#define HASH_PRIME 0x100000001B3ULL
+#define COLOR_MASK_2PX 0x00FFFFFF00FFFFFFULL
+
+static uint64_t hash_row(uint64_t hash, const uint8_t* row, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x + 2 <= width; x += 2) {
+		uint64_t px;
+		memcpy(&px, row + x * 4, sizeof(px));
+		hash = (hash ^ (px & COLOR_MASK_2PX)) * HASH_PRIME;
 	}
 
-	if (frame->width != context->info.width || frame->height != context->info.height || frame->format != context->info.format) {
-		return true;
+	if (x < width) {
+		uint32_t px;
+		memcpy(&px, row + x * 4, sizeof(px));
+		hash = (hash ^ (px & 0x00FFFFFF)) * HASH_PRIME;
 	}
 
-	return false;
+	return hash;
 }
 
-static video_partitioner* create_context_partition(struct obs_source_frame *frame) {
-	video_partitioner* partitioner = (video_partitioner*)bmalloc(sizeof(struct ffmpeg_video_context_partition_t));
-	if (!partitioner) {
-		blog(LOG_ERROR, "ffmpeg_video_context_partition_t bmalloc failed.");
-		return NULL;
-	}
+static inline void save_alpha_row(uint8_t* alpha, const uint8_t* row,
+		uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++)
+		alpha[x] = row[x * 4 + 3];
+}
 
-	avfilter_register_all();
-	partitioner->filter_graph = avfilter_graph_alloc();
-	partitioner->info.format = frame->format;
-	partitioner->info.width = frame->width;
-	partitioner->info.height = frame->height;
-	partitioner->format = get_ffmpeg_video_format(frame->format);
-
-	if (format_is_yuv(frame->format)) {
-		partitioner->param.type = chroma_key;
-		snprintf(partitioner->param.color, sizeof(partitioner->param.color), "0x70de77");
-		partitioner->param.similarity = 0.12;
-		partitioner->param.blend = 0.05;
-	}
-	else {
-		partitioner->param.type = color_key;
-		snprintf(partitioner->param.color, sizeof(partitioner->param.color), "0x00fa00");
-		partitioner->param.similarity = 0.73;
-		partitioner->param.blend = 0.02;
+static inline void restore_alpha_row(const uint8_t* alpha, uint8_t* row,
+		uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++)
+		row[x * 4 + 3] = alpha[x];
+}
+
+static void process_band(video_partitioner* context, uint32_t index,
+		uint32_t count)
+{
+	struct obs_source_frame* frame = context->frame;
+	uint32_t start_y = frame->height * index / count;
+	uint32_t end_y   = frame->height * (index + 1) / count;
+	uint32_t width   = frame->width;
+	struct key_consts k;
+	uint64_t hash = 0xCBF29CE484222325ULL ^ index;
+
+	if (context->op == PARTITION_KEY)
+		init_key_consts(&k, &context->frame_param, frame->format);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		uint8_t* row   = frame->data[0] + y * frame->linesize[0];
+		uint8_t* alpha = context->last_alpha + (size_t)y * width;
+
+		switch (context->op) {
+		case PARTITION_HASH:
+			hash = hash_row(hash, row, width);
+			break;
+		case PARTITION_KEY:
+			key_row_sse2(&k, row, width);
+			save_alpha_row(alpha, row, width);
+			break;
+		case PARTITION_RESTORE:
+			restore_alpha_row(alpha, row, width);
+			break;
+		}
 	}
 
-	partitioner->input_frame = av_frame_alloc();
-	partitioner->output_frame = av_frame_alloc();
+	context->band_hash[index] = hash;
+}
 
-	snprintf(partitioner->input_filter_config, sizeof(partitioner->input_filter_config), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d", 
-		frame->width, frame->height, partitioner->format, 1, 25, 1, 1);
-	int err_code = avfilter_graph_create_filter(&partitioner->filter_buffer_ctx, avfilter_get_by_name("buffer"), 
-		"in", partitioner->input_filter_config, NULL, partitioner->filter_graph);
-	if (err_code < 0) {
-		blog(LOG_ERROR, "avfilter_graph_create_filter buffer failed with error code %d", err_code);
-		goto fail;
-	}
+/* ------------------------------------------------------------------------- */
+/* row band threads */
 
-	snprintf(partitioner->colorspacekey_filter_config, sizeof(partitioner->colorspacekey_filter_config), "color=%s:similarity=%f:blend=%f",
-		partitioner->param.color, partitioner->param.similarity, partitioner->param.blend);
-	if (partitioner->param.type == chroma_key) {
-		err_code = avfilter_graph_create_filter(&partitioner->filter_colorspacekey_ctx, avfilter_get_by_name(CHROMAKEY), CHROMAKEY, partitioner->colorspacekey_filter_config, NULL, partitioner->filter_graph);
-	}
-	else if (partitioner->param.type == color_key) {
-		err_code = avfilter_graph_create_filter(&partitioner->filter_colorspacekey_ctx, avfilter_get_by_name(COLORKEY), COLORKEY, partitioner->colorspacekey_filter_config, NULL, partitioner->filter_graph);
-	}
-	if (err_code) {
-		blog(LOG_ERROR, "avfilter_graph_create_filter colorspace failed with error code %d", err_code);
-		goto fail;
-	}
+static void* band_thread(void* data)
+{
+	struct partition_band* band = data;
+	video_partitioner* context = band->context;
 
-	enum AVPixelFormat pix_fmts[] = { partitioner->format, AV_PIX_FMT_NONE };
-	AVBufferSinkParams* buffersink_params = av_buffersink_params_alloc();
-	buffersink_params->pixel_fmts = pix_fmts;
-	err_code = avfilter_graph_create_filter(&partitioner->filter_buffersink_ctx, avfilter_get_by_name("buffersink"), 
-		"out", NULL, buffersink_params, partitioner->filter_graph);
-	if (err_code < 0) {
-		blog(LOG_ERROR, "avfilter_graph_create_filter buffersink failed with error code %d", err_code);
-		av_free(buffersink_params);
-		goto fail;
-	}
-	av_free(buffersink_params);
+	os_set_thread_name("context-partition: band thread");
+
+	while (os_sem_wait(band->start) == 0) {
+		if (band->stop)
+			break;
 
-	err_code = avfilter_link(partitioner->filter_buffer_ctx, 0, partitioner->filter_colorspacekey_ctx, 0);
-	if (0 != err_code) {
-		blog(LOG_ERROR, "avfilter_link source with colorspace key failed %d.", err_code);
-		goto fail;
+		process_band(context, band->index, context->band_count);
+		os_sem_post(context->bands_done);
 	}
 
-	err_code = avfilter_link(partitioner->filter_colorspacekey_ctx, 0, partitioner->filter_buffersink_ctx, 0);
-	if (0 != err_code) {
-		blog(LOG_ERROR, "avfilter_link colorspace key with buffer sink failed %d.", err_code);
-		goto fail;
+	return NULL;
+}
+
+static void stop_band_threads(video_partitioner* context)
+{
+	/* band 0 always runs on the calling thread */
+	for (uint32_t i = 1; i < context->band_count; i++) {
+		struct partition_band* band = context->bands[i];
+
+		band->stop = true;
+		os_sem_post(band->start);
+		pthread_join(band->thread, NULL);
+		os_sem_destroy(band->start);
+		bfree(band);
+		context->bands[i] = NULL;
 	}
 
-	err_code = avfilter_graph_config(partitioner->filter_graph, NULL);
-	if (err_code < 0) {
-		blog(LOG_ERROR, "avfilter_graph_config failed with error code %d", err_code);
-		goto fail;
+	context->band_count = 1;
+}
+
+static void start_band_threads(video_partitioner* context, uint32_t count)
+{
+	for (uint32_t i = 1; i < count; i++) {
+		struct partition_band* band = bzalloc(sizeof(*band));
+		band->context = context;
+		band->index = i;
+
+		if (os_sem_init(&band->start, 0) != 0) {
+			bfree(band);
+			break;
+		}
+		if (pthread_create(&band->thread, NULL, band_thread,
+					band) != 0) {
+			os_sem_destroy(band->start);
+			bfree(band);
+			break;
+		}
+
+		context->bands[i] = band;
+		context->band_count = i + 1;
 	}
+}
+
+/* ------------------------------------------------------------------------- */
 
+static inline double get_setting_ratio(obs_data_t* settings, const char* name,
+		long long def)
+{
+	long long val = obs_data_has_user_value(settings, name) ?
+		obs_data_get_int(settings, name) : def;
+	return (double)val / 1000.0;
+}
+
+video_partitioner* create_context_partition(obs_data_t* settings)
+{
+	video_partitioner* partitioner = bzalloc(sizeof(video_partitioner));
+
+	pthread_mutex_init_value(&partitioner->frame_mutex);
+	if (pthread_mutex_init(&partitioner->param_mutex, NULL) != 0)
+		goto fail_mutex;
+	if (pthread_mutex_init(&partitioner->frame_mutex, NULL) != 0)
+		goto fail_sem;
+	if (os_sem_init(&partitioner->bands_done, 0) != 0)
+		goto fail_sem;
+
+	partitioner->band_count = 1;
+	update_context_partition(partitioner, settings);
 	return partitioner;
 
-fail:
-	destroy_context_partition(&partitioner);
+fail_sem:
+	pthread_mutex_destroy(&partitioner->frame_mutex);
+	pthread_mutex_destroy(&partitioner->param_mutex);
+fail_mutex:
+	blog(LOG_ERROR, "create_context_partition failed.");
+	bfree(partitioner);
 	return NULL;
 }
 
+void update_context_partition(video_partitioner* context, obs_data_t* settings)
+{
+	partition_param param;
+
+	if (!context)
+		return;
+
+	param.key_color = obs_data_has_user_value(settings, SETTING_KEY_COLOR) ?
+		(uint32_t)obs_data_get_int(settings, SETTING_KEY_COLOR) :
+		DEFAULT_KEY_COLOR;
+	param.similarity = get_setting_ratio(settings, SETTING_SIMILARITY,
+			DEFAULT_SIMILARITY);
+	param.blend = get_setting_ratio(settings, SETTING_BLEND,
+			DEFAULT_BLEND);
+	param.threads = (uint32_t)obs_data_get_int(settings, SETTING_THREADS);
+
+	if (param.threads < 1)
+		param.threads = 1;
+	if (param.threads > MAX_PARTITION_THREADS)
+		param.threads = MAX_PARTITION_THREADS;
+
+	pthread_mutex_lock(&context->param_mutex);
+	context->param = param;
+	pthread_mutex_unlock(&context->param_mutex);
+}
+
 void destroy_context_partition(video_partitioner** context) {
 	blog(LOG_INFO, "free context partition resource.");
 
@@ -167,139 +356,136 @@ void destroy_context_partition(video_partitioner** context) {
 		return;
 	}
 
-	avfilter_free((*context)->filter_buffer_ctx);
-	avfilter_free((*context)->filter_buffersink_ctx);
-	avfilter_free((*context)->filter_colorspacekey_ctx);
-	avfilter_graph_free(&((*context)->filter_graph));
-
-	av_free((*context)->input_frame);
-	av_free((*context)->output_frame);
+	stop_band_threads(*context);
+	os_sem_destroy((*context)->bands_done);
+	pthread_mutex_destroy(&(*context)->frame_mutex);
+	pthread_mutex_destroy(&(*context)->param_mutex);
+	bfree((*context)->last_alpha);
 
 	bfree((*context));
 	(*context) = NULL;
 }
 
-static void fill_avframe_from_obsframe(video_partitioner* context, struct obs_source_frame *obs_frame) {
-	for (int i = 0; i < AV_NUM_DATA_POINTERS; i++) {
-		context->input_frame->data[i] = obs_frame->data[i];
-		context->input_frame->linesize[i] = obs_frame->linesize[i];
-	}
-
-	context->input_frame->format = context->format;
-	context->input_frame->width = obs_frame->width;
-	context->input_frame->height = obs_frame->height;
-}
-
-static void fill_obsframe(struct obs_source_frame* obs_frame, AVFrame* av_frame)
-{
+static bool frame_format_suitable(struct obs_source_frame* obs_frame) {
 	switch (obs_frame->format) {
-	case VIDEO_FORMAT_I420:
-		memcpy(obs_frame->data[0], av_frame->data[0], av_frame->linesize[0] * av_frame->height);
-		memcpy(obs_frame->data[1], av_frame->data[1], av_frame->linesize[1] * av_frame->height / 2);
-		memcpy(obs_frame->data[2], av_frame->data[2], av_frame->linesize[2] * av_frame->height / 2);
-		break;
-
-	case VIDEO_FORMAT_NV12:
-		memcpy(obs_frame->data[0], av_frame->data[0], av_frame->linesize[0] * av_frame->height);
-		memcpy(obs_frame->data[1], av_frame->data[1], av_frame->linesize[1] * av_frame->height / 2);
-		break;
-
-	case VIDEO_FORMAT_I444:
-		memcpy(obs_frame->data[0], av_frame->data[0], av_frame->linesize[0] * av_frame->height);
-		memcpy(obs_frame->data[1], av_frame->data[1], av_frame->linesize[1] * av_frame->height);
-		memcpy(obs_frame->data[2], av_frame->data[2], av_frame->linesize[2] * av_frame->height);
-		break;
-
-	case VIDEO_FORMAT_YVYU:
-	case VIDEO_FORMAT_YUY2:
-	case VIDEO_FORMAT_UYVY:
-	case VIDEO_FORMAT_NONE:
 	case VIDEO_FORMAT_RGBA:
 	case VIDEO_FORMAT_BGRA:
 	case VIDEO_FORMAT_BGRX:
-		memcpy(obs_frame->data[0], av_frame->data[0], av_frame->linesize[0] * av_frame->height);
-		break;
+		return true;
+	default:
+		return false;
 	}
 }
 
-static void fill_obsframe_from_avframe(struct obs_source_frame* obs_frame, AVFrame* av_frame) {
-	if (av_frame) {
-		obs_frame->format = convert_pixel_format(av_frame->format);
-		blog(LOG_DEBUG, "video frame after context_partition with format(%s)", get_video_format_name(obs_frame->format));
-		if (memcmp(obs_frame->data[0], av_frame->data[0], obs_frame->linesize[0] * obs_frame->height) != 0) {
-			fill_obsframe(obs_frame, av_frame);
-		}
-	}
-}
+static void run_bands(video_partitioner* context, enum partition_op op)
+{
+	context->op = op;
 
-static bool frame_format_suitable(struct obs_source_frame* obs_frame) {
-	switch (obs_frame->format) {
-	case VIDEO_FORMAT_I420:
-	case VIDEO_FORMAT_NV12:
-	case VIDEO_FORMAT_I444:
-	case VIDEO_FORMAT_YVYU:
-	case VIDEO_FORMAT_YUY2:
-	case VIDEO_FORMAT_UYVY:
-	case VIDEO_FORMAT_RGBA:
-	case VIDEO_FORMAT_BGRA:
-	case VIDEO_FORMAT_BGRX:
-		return true;
-	}
-	return false;
+	for (uint32_t i = 1; i < context->band_count; i++)
+		os_sem_post(context->bands[i]->start);
+
+	process_band(context, 0, context->band_count);
+
+	for (uint32_t i = 1; i < context->band_count; i++)
+		os_sem_wait(context->bands_done);
 }
 
-void do_context_partition(video_partitioner** context, struct obs_source_frame* obs_frame) {
+static uint64_t frame_hash(video_partitioner* context)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
 
-	blog(LOG_DEBUG, "do_context_partition begin.");
+	run_bands(context, PARTITION_HASH);
 
-	if (!context || !obs_frame) {
-		return;
-	}
+	for (uint32_t i = 0; i < context->band_count; i++)
+		hash = (hash ^ context->band_hash[i]) * HASH_PRIME;
+	return hash;
+}
 
-	if (!frame_format_suitable(obs_frame)) {
-		blog(LOG_ERROR, "do_context_partition failed with video format(%s)", get_video_format_name(obs_frame->format));
-		return;
-	}
+static inline bool same_info(const struct video_info* a,
+		const struct video_info* b)
+{
+	return a->width == b->width && a->height == b->height &&
+	       a->format == b->format;
+}
 
-	blog(LOG_DEBUG, "do_context_partition with video frame format(%s)", get_video_format_name(obs_frame->format));
+static inline bool same_param(const partition_param* a,
+		const partition_param* b)
+{
+	return a->key_color == b->key_color &&
+	       a->similarity == b->similarity &&
+	       a->blend == b->blend;
+}
 
-	if (!*context) {
-		*context = create_context_partition(obs_frame);
+static void key_frame(video_partitioner* context,
+		struct obs_source_frame* obs_frame)
+{
+	struct video_info info = {obs_frame->width, obs_frame->height,
+		obs_frame->format};
+	size_t alpha_size = (size_t)obs_frame->width * obs_frame->height;
+	uint64_t hash;
+
+	pthread_mutex_lock(&context->param_mutex);
+	context->frame_param = context->param;
+	pthread_mutex_unlock(&context->param_mutex);
+
+	if (context->frame_param.threads != context->band_count) {
+		stop_band_threads(context);
+		start_band_threads(context, context->frame_param.threads);
 	}
 
-	if (did_video_frame_property_changed(*context, obs_frame)) {
-		destroy_context_partition(context);
-		*context = create_context_partition(obs_frame);
-	}
+	context->frame = obs_frame;
+	context->info = info;
+
+	hash = frame_hash(context);
 
-	if (!*context) {
-		blog(LOG_ERROR, "failed to create video context partition.");
+	if (context->last_valid && hash == context->last_hash &&
+	    same_info(&info, &context->last_info) &&
+	    same_param(&context->frame_param, &context->last_param)) {
+		run_bands(context, PARTITION_RESTORE);
 		return;
 	}
 
-	video_partitioner* ctx = *context;
+	if (alpha_size > context->last_alpha_size) {
+		bfree(context->last_alpha);
+		context->last_alpha = bmalloc(alpha_size);
+		context->last_alpha_size = alpha_size;
+	}
 
-	fill_avframe_from_obsframe(ctx, obs_frame);
+	run_bands(context, PARTITION_KEY);
 
-	int64_t now = os_gettime_ns();
+	context->last_valid = true;
+	context->last_hash = hash;
+	context->last_info = info;
+	context->last_param = context->frame_param;
+}
 
-	int err_code = av_buffersrc_add_frame(ctx->filter_buffer_ctx, ctx->input_frame);
-	if (err_code < 0) {
-		blog(LOG_ERROR, "av_buffersrc_add_frame failed with error %d", err_code);
+void do_context_partition(video_partitioner* context, struct obs_source_frame* obs_frame) {
+	if (!context || !obs_frame) {
 		return;
 	}
 
-	err_code = av_buffersink_get_frame(ctx->filter_buffersink_ctx, ctx->output_frame);
-	if (err_code < 0) {
-		blog(LOG_ERROR, "av_buffersink_get_frame failed with error %d", err_code);
+	/* none of the planar/packed YUV frame formats carry alpha, so there
+	 * is nothing to key into for them */
+	if (!frame_format_suitable(obs_frame)) {
+		if (obs_frame->format != context->info.format)
+			blog(LOG_WARNING, "context partition is not supported "
+					"for video format(%s)",
+					get_video_format_name(obs_frame->format));
+		context->info.format = obs_frame->format;
 		return;
 	}
 
-	int64_t after = os_gettime_ns();
-	int64_t duration = (after - now) / 1000000.;
-	blog(LOG_DEBUG, "context partition time used %d ms", duration);
+	uint64_t before = os_gettime_ns();
+
+	pthread_mutex_lock(&context->frame_mutex);
+	key_frame(context, obs_frame);
+	context->frame = NULL;
+	pthread_mutex_unlock(&context->frame_mutex);
+
+	/* the alpha channel is now meaningful */
+	if (obs_frame->format == VIDEO_FORMAT_BGRX)
+		obs_frame->format = VIDEO_FORMAT_BGRA;
 
-	fill_obsframe_from_avframe(obs_frame, ctx->output_frame);
-	av_frame_unref(ctx->output_frame);
-	blog(LOG_DEBUG, "do_context_partition end.");
+	blog(LOG_DEBUG, "context partition time used %d us",
+			(int)((os_gettime_ns() - before) / 1000));
 }
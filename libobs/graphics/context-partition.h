@@ -21,15 +21,10 @@
 #define inline __inline  
 #endif 
 
-#include <libavfilter/avfilter.h>
-#include <libavfilter/avfiltergraph.h>
-#include <libavfilter/buffersink.h>
-#include <libavfilter/buffersrc.h>
-#include <libavutil/avutil.h>
-#include <libavutil/imgutils.h>
-
 #include "obs.h"
+#include "util/threading.h"
 
+#define MAX_PARTITION_THREADS 8
 
 struct video_info {
 	uint32_t            width;
@@ -37,32 +32,52 @@ struct video_info {
 	enum video_format   format;
 };
 
-enum partition_type {
-	chroma_key = 0,
-	color_key
-};
-
+/* key_color is 0xBBGGRR, the layout of color properties in source settings */
 typedef struct partition_para_t {
-	enum partition_type type;
-	char color[128];
+	uint32_t key_color;
 	double similarity;
 	double blend;
+	uint32_t threads;
 }partition_param;
 
-typedef struct ffmpeg_video_context_partition_t {
-	AVFilterGraph* filter_graph;
-	AVFilterContext* filter_buffer_ctx;
-	AVFilterContext* filter_buffersink_ctx;
-	AVFilterContext* filter_colorspacekey_ctx;
-	enum AVPixelFormat format;
-	AVFrame* input_frame;
-	AVFrame* output_frame;
-	char input_filter_config[256];
-	char colorspacekey_filter_config[256];
-	struct video_info info;
+struct partition_band;
+
+enum partition_op {
+	PARTITION_HASH,
+	PARTITION_KEY,
+	PARTITION_RESTORE,
+};
+
+/* keys video frames in place by writing their alpha channel */
+typedef struct video_context_partition_t {
+	pthread_mutex_t param_mutex;
 	partition_param param;
+	struct video_info info;
+
+	/* serializes frames, they may come from more than one thread */
+	pthread_mutex_t frame_mutex;
+
+	/* frame currently being processed, shared with the band threads */
+	struct obs_source_frame* frame;
+	partition_param frame_param;
+	enum partition_op op;
+	uint64_t band_hash[MAX_PARTITION_THREADS];
+
+	/* colour hash and alpha of the last keyed frame, a frame with the
+	 * same content gets the saved alpha instead of being keyed again */
+	bool last_valid;
+	uint64_t last_hash;
+	struct video_info last_info;
+	partition_param last_param;
+	uint8_t* last_alpha;
+	size_t last_alpha_size;
+
+	struct partition_band* bands[MAX_PARTITION_THREADS];
+	uint32_t band_count;
+	os_sem_t* bands_done;
 }video_partitioner;
 
+video_partitioner* create_context_partition(obs_data_t* settings);
+void update_context_partition(video_partitioner* context, obs_data_t* settings);
 void destroy_context_partition(video_partitioner** context);
-void do_context_partition(video_partitioner** context, struct obs_source_frame* frame);
-
+void do_context_partition(video_partitioner* context, struct obs_source_frame* frame);
@@ -3,40 +3,163 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <mutex>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "util/base.h"
+#include "util/bmem.h"
+#include "util/platform.h"
 #include "FaceAREngine.h"
 #include "face_beauty.h"
 #include "media-io/video-scaler.h"
 
-unsigned char * LoadDataBuffer(char *filename, int & buf_size)
+/* ------------------------------------------------------------------------- */
+/* process-wide face model cache
+ *
+ * The model blob is identical for every camera, so it is memory-mapped once
+ * and shared by every engine through a reference count instead of being
+ * re-read from disk each time an engine is (re)created.  The mapping is
+ * read-only; each Initialize call gets its own copy, see InitializeEngine. */
+
+struct face_model
+{
+	std::string path;
+	unsigned char* data;
+	size_t size;
+	long refs;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+static std::mutex face_model_mutex;
+static face_model* face_model_cached = nullptr;
+
+static bool MapModelFile(face_model* model, const char* filename)
 {
-   unsigned char *model_buf = nullptr;
-   fpos_t pos;
-
-   FILE *fp;
-   fp = fopen(filename, "rb");
-   if (!fp)
-   {
-	   std::string file_path(filename);
-	   std::string file_path_next("../");
-	   std::string filename_next = file_path_next + file_path;
-	   fp = fopen(filename_next.c_str(), "rb");
-	   if(!fp)
-	   {
-		   return NULL;
-	   }
-   }
-   fseek(fp, 0, SEEK_END);
-   fgetpos(fp, &pos);
-   buf_size = pos;
-   model_buf = (unsigned char *) malloc(sizeof(char) * buf_size);
-   fseek(fp, 0, SEEK_SET);
-   fread(model_buf, sizeof(char), buf_size, fp);
-   fclose(fp);
-
-   return model_buf;
+#if defined(_WIN32)
+	wchar_t* wpath = nullptr;
+	os_utf8_to_wcs_ptr(filename, 0, &wpath);
+	if (!wpath)
+		return false;
+
+	model->file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	bfree(wpath);
+	if (model->file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(model->file, &size) || size.QuadPart == 0)
+		goto fail;
+
+	model->mapping = CreateFileMappingW(model->file, NULL, PAGE_READONLY,
+			0, 0, NULL);
+	if (!model->mapping)
+		goto fail;
+
+	model->data = (unsigned char*)MapViewOfFile(model->mapping,
+			FILE_MAP_READ, 0, 0, 0);
+	if (!model->data) {
+		CloseHandle(model->mapping);
+		goto fail;
+	}
+
+	model->size = (size_t)size.QuadPart;
+	return true;
+
+fail:
+	CloseHandle(model->file);
+	return false;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+			fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	model->data = (unsigned char*)data;
+	model->size = (size_t)st.st_size;
+	return true;
+#endif
 }
 
+static void UnmapModelFile(face_model* model)
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(model->data);
+	CloseHandle(model->mapping);
+	CloseHandle(model->file);
+#else
+	munmap(model->data, model->size);
+#endif
+}
+
+static face_model* AcquireFaceModel(const char* filename)
+{
+	std::lock_guard<std::mutex> lock(face_model_mutex);
+
+	if (face_model_cached && face_model_cached->path == filename) {
+		face_model_cached->refs++;
+		return face_model_cached;
+	}
+
+	face_model* model = new face_model();
+	std::string path(filename);
+	if (!MapModelFile(model, path.c_str())) {
+		path = std::string("../") + filename;
+		if (!MapModelFile(model, path.c_str())) {
+			blog(LOG_WARNING, "[face_beauty] failed to load model "
+					"'%s'", filename);
+			delete model;
+			return nullptr;
+		}
+	}
+
+	model->path = filename;
+	model->refs = 1;
+
+	/* an older model that is still in use keeps its own reference and
+	 * is unmapped when its last engine goes away */
+	face_model_cached = model;
+	return model;
+}
+
+static void ReleaseFaceModel(face_model* model)
+{
+	if (!model)
+		return;
+
+	std::lock_guard<std::mutex> lock(face_model_mutex);
+
+	if (--model->refs == 0) {
+		if (face_model_cached == model)
+			face_model_cached = nullptr;
+
+		UnmapModelFile(model);
+		delete model;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
 void SetFaceBeautyParam(CFaceAREngine* faceEng)
 {
    SetFaceBeaytifyParam param;
@@ -53,33 +176,18 @@ void SetFaceBeautyParam(CFaceAREngine* faceEng)
 extern "C" {
 
 
-FBEngine face_beauty_create(enum video_format format_src, int video_width, int video_height, char* face_model_file)
+static void InitializeEngine(FBEngine fb_engine, int video_width, int video_height)
 {
+	CFaceAREngine* engine = (CFaceAREngine*)fb_engine->engine;
 
-	FBEngine fb_engine = new FACE_BEAUTY_ENGINE;
-	if(!face_model_file)
-	{
-		return NULL;
-	}
-	fb_engine->data = nullptr;
-	fb_engine->engine = nullptr;
-
-	int face_buf_size = 0;
-	unsigned char *face_model_dat  = LoadDataBuffer(face_model_file, face_buf_size);
-	if(!face_model_dat)
-	{
-		face_beauty_release(fb_engine);
-		return nullptr;
-	}
-	CFaceAREngine* engine = CFaceAREngine::GetInstance();
-	if(!engine)
-	{
-		free(face_model_dat);
-		return nullptr;
-	}
-
-	engine->Initialize(face_model_dat, face_buf_size, video_width, video_height, PREVIEW_YUV420SPNV12);
-	free(face_model_dat);
+	/* Initialize takes a non-const buffer and may decode the model in
+	 * place, so like the old per-load read it gets a private copy that
+	 * is freed once it returns, and the shared mapping stays pristine */
+	unsigned char* model_data = (unsigned char*)bmemdup(
+			fb_engine->model->data, fb_engine->model->size);
+	engine->Initialize(model_data, (int)fb_engine->model->size,
+			video_width, video_height, PREVIEW_YUV420SPNV12);
+	bfree(model_data);
 
 	SetAlgorithmTypeParam typeParam;
 	typeParam.type = CPU_VERSION;
@@ -93,24 +201,96 @@ FBEngine face_beauty_create(enum video_format format_src, int video_width, int v
 //#endif
 
 	SetFaceBeautyParam(engine);
+
+	delete[] fb_engine->data;
 	fb_engine->data = new unsigned char[video_width * video_height * 3 / 2];
-	fb_engine->engine = (void*)engine;
 	fb_engine->width = video_width;
 	fb_engine->height = video_height;
 	fb_engine->rotate = 0;
+}
+
+static bool CreateScaler(FBEngine fb_engine, enum video_format format_src)
+{
+	if (fb_engine->scaler) {
+		video_scaler_destroy(fb_engine->scaler);
+		fb_engine->scaler = NULL;
+	}
+
 	fb_engine->scaler_info_dst.format = VIDEO_FORMAT_NV12;
-	fb_engine->scaler_info_dst.width = video_width;
-	fb_engine->scaler_info_dst.height = video_height;
+	fb_engine->scaler_info_dst.width = fb_engine->width;
+	fb_engine->scaler_info_dst.height = fb_engine->height;
 
 	fb_engine->scaler_info_src.format = format_src;
-	fb_engine->scaler_info_src.width = video_width;
-	fb_engine->scaler_info_src.height = video_height;
-	video_scaler_create(&fb_engine->scaler, &fb_engine->scaler_info_dst, &fb_engine->scaler_info_src, VIDEO_SCALE_DEFAULT);
+	fb_engine->scaler_info_src.width = fb_engine->width;
+	fb_engine->scaler_info_src.height = fb_engine->height;
+
+	int ret = video_scaler_create(&fb_engine->scaler,
+			&fb_engine->scaler_info_dst,
+			&fb_engine->scaler_info_src,
+			VIDEO_SCALE_DEFAULT);
+	if (ret != VIDEO_SCALER_SUCCESS) {
+		blog(LOG_ERROR, "[face_beauty] failed to create scaler for "
+				"format %d at %dx%d (%d)", (int)format_src,
+				fb_engine->width, fb_engine->height, ret);
+		fb_engine->scaler = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+FBEngine face_beauty_create(enum video_format format_src, int video_width, int video_height, char* face_model_file)
+{
+	if(!face_model_file)
+	{
+		return NULL;
+	}
+
+	FBEngine fb_engine = new FACE_BEAUTY_ENGINE();
+	fb_engine->model = AcquireFaceModel(face_model_file);
+	if(!fb_engine->model)
+	{
+		face_beauty_release(fb_engine);
+		return nullptr;
+	}
+
+	CFaceAREngine* engine = CFaceAREngine::GetInstance();
+	if(!engine)
+	{
+		face_beauty_release(fb_engine);
+		return nullptr;
+	}
+
+	fb_engine->engine = (void*)engine;
+	InitializeEngine(fb_engine, video_width, video_height);
+	if(!CreateScaler(fb_engine, format_src))
+	{
+		face_beauty_release(fb_engine);
+		return nullptr;
+	}
 
 	blog(LOG_INFO, "[face_beauty] set up success size:%d x %d\n", video_width, video_height);
 	return fb_engine;
 }
 
+bool face_beauty_reconfigure(FBEngine fb_engine, enum video_format format_src, int video_width, int video_height)
+{
+	if(!fb_engine || !fb_engine->engine)
+	{
+		return false;
+	}
+
+	/* the engine instance and the mapped model are kept, only the frame
+	 * size dependent state is rebuilt */
+	if(video_width != fb_engine->width || video_height != fb_engine->height)
+	{
+		InitializeEngine(fb_engine, video_width, video_height);
+		blog(LOG_INFO, "[face_beauty] reconfigured size:%d x %d", video_width, video_height);
+	}
+
+	return CreateScaler(fb_engine, format_src);
+}
+
 void face_beauty_release(FBEngine fb_engine)
 {
 	if(fb_engine)
@@ -126,6 +306,8 @@ void face_beauty_release(FBEngine fb_engine)
 			fb_engine->scaler = NULL;
 		}
 
+		ReleaseFaceModel(fb_engine->model);
+
 		delete fb_engine;
 	}
 }
@@ -149,12 +331,20 @@ void face_beauty(FBEngine fb_engine, unsigned char* y_data, unsigned char* uv_da
 	}
 
 	CFaceAREngine* engine = (CFaceAREngine*)fb_engine->engine;
+	const size_t y_size = (size_t)video_width * video_height;
 
-	memcpy(fb_engine->data, y_data, video_width * video_height);
-	memcpy(fb_engine->data + video_width * video_height, uv_data, video_width * video_height / 2);
+	// NV12 frames from the source's async cache are tightly packed, so the
+	// engine can work on them in place instead of on a staging copy
+	const bool contiguous = uv_data == y_data + y_size;
+	unsigned char* buf = contiguous ? y_data : fb_engine->data;
+
+	if (!contiguous) {
+		memcpy(fb_engine->data, y_data, y_size);
+		memcpy(fb_engine->data + y_size, uv_data, y_size / 2);
+	}
 
 	auto now = std::chrono::steady_clock::now();
-	int result = engine->DoVideoData(fb_engine->data, video_width, video_height);
+	int result = engine->DoVideoData(buf, video_width, video_height);
 	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - now);
 	if (duration < std::chrono::milliseconds(5)) {
 		fb_engine->rotate += 90;
@@ -164,8 +354,10 @@ void face_beauty(FBEngine fb_engine, unsigned char* y_data, unsigned char* uv_da
 	}
 	//blog(LOG_DEBUG, "FaceBeauty time used %lld ms with result(%d)", duration.count(), result);
 
-	memcpy(y_data, fb_engine->data, video_width * video_height);
-	memcpy(uv_data, fb_engine->data + video_width * video_height, video_width * video_height / 2);
+	if (!contiguous) {
+		memcpy(y_data, fb_engine->data, y_size);
+		memcpy(uv_data, fb_engine->data + y_size, y_size / 2);
+	}
 	return;
 }
 
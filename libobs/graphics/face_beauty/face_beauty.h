@@ -4,9 +4,12 @@
 #include "media-io/video-io.h"
 #include "media-io/video-scaler.h"
 
+struct face_model;
+
 typedef struct FACE_BEAUTY_ENGINE
 {
 	void* engine;
+	struct face_model* model;
 	unsigned char* data;
 	int width;
 	int height;
@@ -24,6 +27,7 @@ typedef struct FACE_BEAUTY_ENGINE* FBEngine;
 extern "C" {
 
 	FBEngine face_beauty_create(enum video_format format_src, int video_width, int video_height, char* face_model_file);
+	bool face_beauty_reconfigure(FBEngine fb_engine, enum video_format format_src, int video_width, int video_height);
 	void face_beauty_release(FBEngine fb_engine);
 	void face_beauty(FBEngine fb_engine, unsigned char* y_data, unsigned char* uv_data, int video_width, int video_height);
 
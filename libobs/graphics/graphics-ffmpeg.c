@@ -1,5 +1,6 @@
 #include "graphics.h"
 #include "image-file.h"
+#include "../util/darray.h"
 
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -28,7 +29,7 @@ typedef struct APNGDemuxContext {
 } APNGDemuxContext;
 
 typedef struct ffmpeg_image {
-    const char         *file;
+    char               *file;
     AVFormatContext    *fmt_ctx;
     AVCodecContext     *decoder_ctx;
     AVCodec            *decoder;
@@ -40,10 +41,47 @@ typedef struct ffmpeg_image {
 
     bool     initialized;
     bool     cached;
+
+    /* compressed frames of an animation, read once so that looping and
+     * seeking never go back to the file */
+    DARRAY(AVPacket) packets;
+    uint32_t next_frame;
 }ff_image_t;
 
+/* the decoder context is our own rather than the stream's, so that seeking
+ * back can start over on a fresh one */
+static AVCodecContext *ffmpeg_image_create_decoder(struct ffmpeg_image *info)
+{
+	AVCodecContext *ctx;
+	int ret;
+
+	ctx = avcodec_alloc_context3(info->decoder);
+	if (!ctx) {
+		blog(LOG_WARNING, "Failed to allocate video codec context for "
+		                  "file '%s'", info->file);
+		return NULL;
+	}
+
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 40, 101)
+	ret = avcodec_parameters_to_context(ctx, info->stream->codecpar);
+#else
+	ret = avcodec_copy_context(ctx, info->stream->codec);
+#endif
+	if (ret >= 0)
+		ret = avcodec_open2(ctx, info->decoder, NULL);
+	if (ret < 0) {
+		blog(LOG_WARNING, "Failed to open video codec for file '%s': "
+		                  "%s", info->file, av_err2str(ret));
+		avcodec_free_context(&ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
 static bool ffmpeg_image_open_decoder_context(struct ffmpeg_image *info)
 {
+	enum AVCodecID id;
 	int ret = av_find_best_stream(info->fmt_ctx, AVMEDIA_TYPE_VIDEO,
 			-1, 1, NULL, 0);
 	if (ret < 0) {
@@ -54,8 +92,12 @@ static bool ffmpeg_image_open_decoder_context(struct ffmpeg_image *info)
 
 	info->stream_idx  = ret;
 	info->stream      = info->fmt_ctx->streams[ret];
-	info->decoder_ctx = info->stream->codec;
-	info->decoder     = avcodec_find_decoder(info->decoder_ctx->codec_id);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 40, 101)
+	id = info->stream->codecpar->codec_id;
+#else
+	id = info->stream->codec->codec_id;
+#endif
+	info->decoder     = avcodec_find_decoder(id);
 
 	if (!info->decoder) {
 		blog(LOG_WARNING, "Failed to find decoder for file '%s'",
@@ -63,24 +105,30 @@ static bool ffmpeg_image_open_decoder_context(struct ffmpeg_image *info)
 		return false;
 	}
 
-	ret = avcodec_open2(info->decoder_ctx, info->decoder, NULL);
-	if (ret < 0) {
-		blog(LOG_WARNING, "Failed to open video codec for file '%s': "
-		                  "%s", info->file, av_err2str(ret));
-		return false;
-	}
+	info->decoder_ctx = ffmpeg_image_create_decoder(info);
+	return info->decoder_ctx != NULL;
+}
 
-	return true;
+static void ffmpeg_image_free_packets(struct ffmpeg_image *info)
+{
+	for (size_t i = 0; i < info->packets.num; i++)
+		av_free_packet(&info->packets.array[i]);
+	da_free(info->packets);
 }
 
 static void ffmpeg_image_free(struct ffmpeg_image *info)
 {
+    ffmpeg_image_free_packets(info);
+
     if (info->initialized){
         info->initialized = false;
 
-        avcodec_close(info->decoder_ctx);
+        avcodec_free_context(&info->decoder_ctx);
         avformat_close_input(&info->fmt_ctx);
     }
+
+    bfree(info->file);
+    info->file = NULL;
 }
 
 static bool ffmpeg_image_init(struct ffmpeg_image *info, const char *file)
@@ -94,7 +142,8 @@ static bool ffmpeg_image_init(struct ffmpeg_image *info, const char *file)
         return false;
 
 	memset(info, 0, sizeof(struct ffmpeg_image));
-	info->file       = file;
+	/* animated images can outlive the caller's path when shared */
+	info->file       = bstrdup(file);
 	info->stream_idx = -1;
     info->cached     = true;
 
@@ -103,6 +152,8 @@ static bool ffmpeg_image_init(struct ffmpeg_image *info, const char *file)
 	if (ret < 0) {
 		blog(LOG_WARNING, "Failed to open file '%s': %s",
 				info->file, av_err2str(ret));
+		bfree(info->file);
+		info->file = NULL;
 		return false;
 	}
 
@@ -186,14 +237,12 @@ static bool ffmpeg_image_reformat_frame(struct ffmpeg_image *info,
 	return true;
 }
 
-static int ffmpeg_image_decode(struct ffmpeg_image *info, uint8_t *out,
-		int linesize)
+static bool ffmpeg_image_decode_packet(struct ffmpeg_image *info,
+		AVPacket *packet, uint8_t *out, int linesize, int *pkt_duration)
 {
-	AVPacket          packet    = {0};
-	bool              success   = false;
 	AVFrame           *frame    = av_frame_alloc();
+	bool              success   = false;
 	int               got_frame = 0;
-    int               pkt_duration = 0;
 	int               ret;
 
 	if (!frame) {
@@ -202,16 +251,9 @@ static int ffmpeg_image_decode(struct ffmpeg_image *info, uint8_t *out,
 		return false;
 	}
 
-    ret = av_read_frame(info->fmt_ctx, &packet);
-	if (ret < 0) {
-		blog(LOG_WARNING, "Failed to read image frame from '%s': %s",
-				info->file, av_err2str(ret));
-		goto fail;
-	}
-
 	while (!got_frame) {
 		ret = avcodec_decode_video2(info->decoder_ctx, frame,
-				&got_frame, &packet);
+				&got_frame, packet);
 		if (ret < 0) {
 			blog(LOG_WARNING, "Failed to decode frame for '%s': %s",
 					info->file, av_err2str(ret));
@@ -220,15 +262,84 @@ static int ffmpeg_image_decode(struct ffmpeg_image *info, uint8_t *out,
 	}
 
 	success = ffmpeg_image_reformat_frame(info, frame, out, linesize);
-
-    pkt_duration = frame->pkt_duration;
+	*pkt_duration = (int)frame->pkt_duration;
 
 fail:
-	av_free_packet(&packet);
 	av_frame_free(&frame);
+	return success;
+}
+
+static int ffmpeg_image_decode(struct ffmpeg_image *info, uint8_t *out,
+		int linesize)
+{
+	AVPacket          packet    = {0};
+    int               pkt_duration = 0;
+	int               ret;
+
+    ret = av_read_frame(info->fmt_ctx, &packet);
+	if (ret < 0) {
+		blog(LOG_WARNING, "Failed to read image frame from '%s': %s",
+				info->file, av_err2str(ret));
+		return 0;
+	}
+
+	ffmpeg_image_decode_packet(info, &packet, out, linesize, &pkt_duration);
+
+	av_free_packet(&packet);
 	return pkt_duration;
 }
 
+static size_t ffmpeg_image_read_packets(struct ffmpeg_image *info)
+{
+	AVPacket packet = {0};
+	size_t size = 0;
+
+	while (av_read_frame(info->fmt_ctx, &packet) >= 0) {
+		if (packet.stream_index == info->stream_idx) {
+			size += packet.size;
+			da_push_back(info->packets, &packet);
+		} else {
+			av_free_packet(&packet);
+		}
+
+		memset(&packet, 0, sizeof(packet));
+	}
+
+	return size;
+}
+
+/* decodes frame index 'frame' from the packets in memory.  apng frames are
+ * drawn over the previous ones, so going backwards starts over on a new
+ * decoder, which keeps nothing of the old canvas, and decodes up to the
+ * frame again */
+static bool ffmpeg_image_decode_frame(struct ffmpeg_image *info,
+		uint32_t frame, uint8_t *out, int linesize)
+{
+	bool success = false;
+	int pkt_duration;
+
+	if (frame >= info->packets.num)
+		return false;
+
+	if (frame < info->next_frame) {
+		AVCodecContext *ctx = ffmpeg_image_create_decoder(info);
+		if (!ctx)
+			return false;
+
+		avcodec_free_context(&info->decoder_ctx);
+		info->decoder_ctx = ctx;
+		info->next_frame = 0;
+	}
+
+	while (info->next_frame <= frame) {
+		success = ffmpeg_image_decode_packet(info,
+				&info->packets.array[info->next_frame++],
+				out, linesize, &pkt_duration);
+	}
+
+	return success;
+}
+
 void gs_init_image_deps(void)
 {
 	av_register_all();
@@ -273,54 +384,60 @@ uint8_t *gs_create_texture_file_data(const char *file,
 
 	return data;
 }
-bool gs_process_animated_image(gs_image_file_t *image, ff_image_t *ff_image)
+static inline uint64_t packet_duration_ns(ff_image_t *ff_image,
+        int64_t duration)
 {
-    uint32_t buffer_num = 0;
-    uint32_t frame_size = 0;
-    int32_t  pkt_duration;
+    AVRational tb = ff_image->fmt_ctx->streams[ff_image->stream_idx]->time_base;
+    return duration * ((tb.num * 1000000000ULL) / tb.den);
+}
 
-    bool success = true;
+bool gs_process_animated_image(gs_image_file_t *image, ff_image_t *ff_image,
+        uint8_t *first_frame, uint64_t cache_budget)
+{
+    uint64_t full_size;
+    uint32_t frame_size;
+    size_t   packet_size;
 
     APNGDemuxContext *ctx = ff_image->fmt_ctx->priv_data;
     image->loops = ctx->num_play;
-    image->num_frames = ctx->num_frames;
 
-    image->cached = ff_image->cached;
+    packet_size = ffmpeg_image_read_packets(ff_image);
+    image->num_frames = (uint32_t)ff_image->packets.num;
+    if (image->num_frames < 2)
+        return false;
 
+    image->apng_duration = bzalloc(image->num_frames * sizeof(uint64_t));
+    for (uint32_t i = 0; i < image->num_frames; i++)
+        image->apng_duration[i] = packet_duration_ns(ff_image,
+                ff_image->packets.array[i].duration);
 
-    buffer_num = ff_image->cached ? image->num_frames : 1;
     frame_size = ff_image->cx * ff_image->cy * 4;
+    full_size = (uint64_t)frame_size * image->num_frames;
+    image->mem_usage = packet_size + frame_size;
 
-    image->animation_frame_data  = bzalloc(frame_size * buffer_num);
-    image->apng_duration         = bzalloc(image->num_frames * sizeof(uint64_t));
-    image->animation_frame_cache = bzalloc(image->num_frames*sizeof(uint8_t **));
+    /* the first frame is also the initial texture */
+    if (!ffmpeg_image_decode_frame(ff_image, 0, first_frame,
+                ff_image->cx * 4))
+        return false;
 
-    memset(image->apng_duration, 0,
-           image->num_frames * sizeof(uint64_t));
-    memset(image->animation_frame_cache, 0,
-           image->num_frames * sizeof(uint8_t *));
+    image->format = convert_format(ff_image->format);
 
-    if (ff_image->cached) {
-        image->animation_frame_cache[0] = image->animation_frame_data;
+    /* past the budget, image-file streams the frames instead */
+    image->cached = full_size <= cache_budget;
+    if (!image->cached)
+        return true;
 
-        pkt_duration = ffmpeg_image_decode(ff_image,
-                                      image->animation_frame_cache[0],
-                                      ff_image->cx * 4);
-        if (pkt_duration) {
-            image->format = convert_format(ff_image->format);
-            image->cx = (uint32_t)ff_image->cx;
-            image->cy = (uint32_t)ff_image->cy;
-
-            image->apng_duration[0] = pkt_duration
-                * ((ff_image->fmt_ctx->streams[0]->time_base.num * 1000000000ULL)
-                / ff_image->fmt_ctx->streams[0]->time_base.den);
-        }
-    }
+    image->animation_frame_data  = bmalloc((size_t)full_size);
+    image->animation_frame_cache = bzalloc(image->num_frames*sizeof(uint8_t **));
 
-    return success;
+    image->animation_frame_cache[0] = image->animation_frame_data;
+    memcpy(image->animation_frame_cache[0], first_frame, frame_size);
+    image->mem_usage += frame_size;
+    return true;
 }
 
-uint8_t *gs_create_texture_file_data_animated(const char *file, void *ptr)
+uint8_t *gs_create_texture_file_data_animated(const char *file, void *ptr,
+        uint64_t cache_budget)
 {
     gs_image_file_t *image = ptr;
     ff_image_t *ff_image = bmalloc(sizeof(ff_image_t));
@@ -349,7 +466,8 @@ uint8_t *gs_create_texture_file_data_animated(const char *file, void *ptr)
         }
 
         if (image->is_animated){
-            success = gs_process_animated_image(image, ff_image);
+            success = gs_process_animated_image(image, ff_image, data,
+                    cache_budget);
         } else {
             success = ffmpeg_image_decode(ff_image, data, ff_image->cx * 4);
             image->format = convert_format(ff_image->format);
@@ -382,97 +500,41 @@ void gs_free_ffmpeg_image(void *ptr)
     }
 }
 
-void gs_decode_ffmpeg_image(void *ptr, uint32_t new_frame)
+/* for streamed animations, called from the image-file decode thread */
+bool gs_decode_ffmpeg_image_frame(void *ptr, uint32_t frame, uint8_t *out)
 {
     gs_image_file_t *image = ptr;
     ff_image_t *ff_image = image->ff_image;
-    APNGDemuxContext *ctx = NULL;
-    uint32_t i;
 
-    if (new_frame > image->num_frames){
-        blog(LOG_ERROR, "frame(%d) more than max frame num(%d)",
-             new_frame, image->num_frames);
-        return;
-    }
-
-    if (new_frame < image->cur_frame){
-        if(!image->enable_loop){
-            image->play_finished = true;
-            return;
-        }
-
-        ffmpeg_image_free(ff_image);
-        ffmpeg_image_init(ff_image, ff_image->file);
-
-        image->animation_frame_cache[image->cur_frame] = NULL;
-        image->cur_frame = 0;
-    }
-
-    if (new_frame == 0){
-        ffmpeg_image_decode(ff_image, image->animation_frame_data, ff_image->cx * 4);
-
-        if (image->apng_duration[0] == 0){
-            ctx = ff_image->fmt_ctx->priv_data;
-            image->apng_duration[0] = ctx->pkt_duration*
-                ((ff_image->fmt_ctx->streams[0]->time_base.num * 1000000000ULL)
-                 / ff_image->fmt_ctx->streams[0]->time_base.den);
-        }
-    }
-
-    for (i = image->cur_frame; i < new_frame; i++){
-        ffmpeg_image_decode(ff_image, image->animation_frame_data, ff_image->cx * 4);
-
-        if (image->apng_duration[i+1] == 0) {
-            ctx = ff_image->fmt_ctx->priv_data;
-            image->apng_duration[i+1] = ctx->pkt_duration*
-                ((ff_image->fmt_ctx->streams[0]->time_base.num * 1000000000ULL)
-                 / ff_image->fmt_ctx->streams[0]->time_base.den);
-        }
-    }
-
-    image->animation_frame_cache[image->cur_frame] = NULL;
-    image->animation_frame_cache[new_frame] =
-        image->animation_frame_data;
-
-    if (image->cur_frame == image->num_frames - 1){
-        if (!image->enable_loop){
-            image->play_finished = true;
-        }
-        ffmpeg_image_free(ff_image);
-        ffmpeg_image_init(ff_image, ff_image->file);
-    }
+    return ffmpeg_image_decode_frame(ff_image, frame, out,
+            ff_image->cx * 4);
 }
 
-
 void gs_decode_ffmpeg_image_cached(void *ptr, uint32_t new_frame)
 {
     gs_image_file_t *image = ptr;
     ff_image_t *ff_image = image->ff_image;
-    APNGDemuxContext *ctx = NULL;
     uint32_t i, frame_size;
-    int32_t pkt_duration;
 
-    if (new_frame > image->num_frames){
+    if (new_frame >= image->num_frames){
         blog(LOG_ERROR, "frame(%d) more than max frame num(%d)",
              new_frame, image->num_frames);
         return;
     }
 
+    /* frames in between are decoded too, the decoder needs them anyway */
     frame_size = image->cx * image->cy * 4;
-    for (i = image->cur_frame + 1; i <= new_frame; i++){
-        image->animation_frame_cache[i] = (i-1) * frame_size
-            + image->animation_frame_data;
+    i = ff_image->next_frame <= new_frame ? ff_image->next_frame : 0;
+    for (; i <= new_frame; i++){
+        uint8_t *data = image->animation_frame_data + i * frame_size;
 
-        pkt_duration = ffmpeg_image_decode(ff_image,
-                                           image->animation_frame_cache[i],
-                                           ff_image->cx * 4);
-
-        ctx = ff_image->fmt_ctx->priv_data;
-        image->apng_duration[i] = pkt_duration
-            * ((ff_image->fmt_ctx->streams[0]->time_base.num * 1000000000ULL)
-            / ff_image->fmt_ctx->streams[0]->time_base.den);
+        if (!ffmpeg_image_decode_frame(ff_image, i, data,
+                    ff_image->cx * 4))
+            return;
 
-//        blog(LOG_INFO, "image->apng_duration[%d] = %lld, pkt_duration = %d, success = %d",
-//             i, image->apng_duration[i], ctx->pkt_duration, success);
+        if (!image->animation_frame_cache[i]) {
+            image->animation_frame_cache[i] = data;
+            image->mem_usage += frame_size;
+        }
     }
 }
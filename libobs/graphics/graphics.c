@@ -94,6 +94,7 @@ void gs_enum_adapters(
 
 extern void gs_init_image_deps(void);
 extern void gs_free_image_deps(void);
+extern void gs_image_cache_free(void);
 
 bool load_graphics_imports(struct gs_exports *exports, void *module,
 		const char *module_name);
@@ -228,6 +229,8 @@ void gs_destroy(graphics_t *graphics)
 		thread_graphics = graphics;
 		graphics->exports.device_enter_context(graphics->device);
 
+		gs_image_cache_free();
+
 		while (effect) {
 			struct gs_effect *next = effect->next;
 			gs_effect_actually_destroy(effect);
@@ -2390,6 +2393,19 @@ void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
 	graphics->exports.gs_stagesurface_unmap(stagesurf);
 }
 
+bool gs_stagesurface_is_ready(gs_stagesurf_t *stagesurf)
+{
+	graphics_t *graphics = thread_graphics;
+
+	if (!gs_valid_p("gs_stagesurface_is_ready", stagesurf))
+		return false;
+
+	if (graphics->exports.gs_stagesurface_is_ready)
+		return graphics->exports.gs_stagesurface_is_ready(stagesurf);
+	else
+		return true;
+}
+
 void gs_zstencil_destroy(gs_zstencil_t *zstencil)
 {
 	if (!gs_valid("gs_zstencil_destroy"))
@@ -512,8 +512,10 @@ EXPORT gs_texture_t *gs_texture_create_from_file(const char *file);
 EXPORT uint8_t *gs_create_texture_file_data(const char *file,
 		enum gs_color_format *format, uint32_t *cx, uint32_t *cy);
 
-EXPORT uint8_t *gs_create_texture_file_data_animated(const char *file, void *ptr);
-EXPORT void gs_decode_ffmpeg_image(void *ptr, uint32_t new_frame);
+EXPORT uint8_t *gs_create_texture_file_data_animated(const char *file, void *ptr,
+		uint64_t cache_budget);
+EXPORT bool gs_decode_ffmpeg_image_frame(void *ptr, uint32_t frame,
+		uint8_t *out);
 EXPORT void gs_decode_ffmpeg_image_cached(void *ptr, uint32_t new_frame);
 EXPORT void gs_free_ffmpeg_image(void *ptr);
 
@@ -714,6 +716,12 @@ EXPORT enum gs_color_format gs_stagesurface_get_color_format(
 EXPORT bool     gs_stagesurface_map(gs_stagesurf_t *stagesurf, uint8_t **data,
 		uint32_t *linesize);
 EXPORT void     gs_stagesurface_unmap(gs_stagesurf_t *stagesurf);
+/**
+ * Returns whether the last copy staged into the surface has finished on the
+ * GPU, meaning gs_stagesurface_map will not stall.  Always returns true if the
+ * graphics module cannot tell.
+ */
+EXPORT bool     gs_stagesurface_is_ready(gs_stagesurf_t *stagesurf);
 
 EXPORT void     gs_zstencil_destroy(gs_zstencil_t *zstencil);
 
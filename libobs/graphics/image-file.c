@@ -15,9 +15,12 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <sys/stat.h>
+
 #include "image-file.h"
 #include "../util/base.h"
 #include "../util/platform.h"
+#include "../util/threading.h"
 
 #define blog(level, format, ...) \
 	blog(level, "%s: " format, __FUNCTION__, __VA_ARGS__)
@@ -59,7 +62,178 @@ static inline int get_full_decoded_gif_size(gs_image_file_t *image)
 	return image->gif.width * image->gif.height * 4 * image->gif.frame_count;
 }
 
-static bool init_animated_gif(gs_image_file_t *image, const char *path)
+/* ------------------------------------------------------------------------- */
+/* streamed animations */
+
+/* number of decoded frames kept, including the one being displayed */
+#define IMAGE_STREAM_FRAMES 4
+
+typedef bool (*image_stream_decode_t)(gs_image_file_t *image, uint32_t frame,
+		uint8_t *out);
+
+/* the worker thread owns the decoder (image->gif or image->ff_image) once
+ * streaming has started.  frames are numbered by decode order across loops,
+ * and [first, decoded) of them are held in the ring */
+struct gs_image_stream {
+	image_stream_decode_t decode;
+
+	pthread_t       thread;
+	bool            thread_active;
+	pthread_mutex_t mutex;
+	os_sem_t        *sem;
+	volatile bool   stop;
+
+	uint8_t         *frames;
+	size_t          frame_size;
+
+	uint64_t        first;
+	uint64_t        decoded;
+	uint64_t        shown;
+};
+
+static inline uint8_t *stream_frame(struct gs_image_stream *stream,
+		uint64_t seq)
+{
+	return stream->frames + (seq % IMAGE_STREAM_FRAMES) * stream->frame_size;
+}
+
+static bool gif_stream_decode(gs_image_file_t *image, uint32_t frame,
+		uint8_t *out)
+{
+	bool success = gif_decode_frame(&image->gif, frame) == GIF_OK;
+
+	/* on failure the previous frame is repeated */
+	memcpy(out, image->gif.frame_image, image->cx * image->cy * 4);
+	return success;
+}
+
+static bool apng_stream_decode(gs_image_file_t *image, uint32_t frame,
+		uint8_t *out)
+{
+	return gs_decode_ffmpeg_image_frame(image, frame, out);
+}
+
+static void *image_stream_thread(void *data)
+{
+	gs_image_file_t *image = data;
+	struct gs_image_stream *stream = image->stream;
+
+	os_set_thread_name("image-file: animation stream");
+
+	while (os_sem_wait(stream->sem) == 0) {
+		if (os_atomic_load_bool(&stream->stop))
+			break;
+
+		for (;;) {
+			uint64_t seq;
+			bool full;
+
+			pthread_mutex_lock(&stream->mutex);
+			seq = stream->decoded;
+			full = seq - stream->first >= IMAGE_STREAM_FRAMES;
+			pthread_mutex_unlock(&stream->mutex);
+
+			if (full || os_atomic_load_bool(&stream->stop))
+				break;
+
+			stream->decode(image, (uint32_t)(seq % image->num_frames),
+					stream_frame(stream, seq));
+
+			pthread_mutex_lock(&stream->mutex);
+			stream->decoded++;
+			pthread_mutex_unlock(&stream->mutex);
+		}
+	}
+
+	return NULL;
+}
+
+static void image_stream_free(gs_image_file_t *image)
+{
+	struct gs_image_stream *stream = image->stream;
+	if (!stream)
+		return;
+
+	if (stream->thread_active) {
+		os_atomic_set_bool(&stream->stop, true);
+		os_sem_post(stream->sem);
+		pthread_join(stream->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&stream->mutex);
+	os_sem_destroy(stream->sem);
+	bfree(stream->frames);
+	bfree(stream);
+	image->stream = NULL;
+}
+
+/* first_frame is frame 0, already decoded */
+static bool init_image_stream(gs_image_file_t *image,
+		image_stream_decode_t decode, const uint8_t *first_frame)
+{
+	struct gs_image_stream *stream = bzalloc(sizeof(*stream));
+
+	image->stream = stream;
+	stream->decode = decode;
+	stream->frame_size = image->cx * image->cy * 4;
+	stream->frames = bmalloc(stream->frame_size * IMAGE_STREAM_FRAMES);
+
+	pthread_mutex_init_value(&stream->mutex);
+	if (pthread_mutex_init(&stream->mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&stream->sem, 0) != 0)
+		goto fail;
+
+	/* the first frame is needed for the initial texture */
+	memcpy(stream->frames, first_frame, stream->frame_size);
+	stream->decoded = 1;
+
+	if (pthread_create(&stream->thread, NULL, image_stream_thread,
+				image) != 0)
+		goto fail;
+
+	stream->thread_active = true;
+	os_sem_post(stream->sem);
+	return true;
+
+fail:
+	image_stream_free(image);
+	return false;
+}
+
+/* returns the decoded frame to show next if it changed.  when the decoder
+ * is behind, its newest frame is shown until it catches up */
+static const uint8_t *image_stream_next_frame(gs_image_file_t *image)
+{
+	struct gs_image_stream *stream = image->stream;
+	const uint8_t *data = NULL;
+	uint32_t n = image->num_frames;
+	uint64_t target;
+
+	pthread_mutex_lock(&stream->mutex);
+
+	target = stream->shown +
+		(image->cur_frame + n - stream->shown % n) % n;
+	if (target >= stream->decoded)
+		target = stream->decoded - 1;
+
+	if (target != stream->shown) {
+		stream->shown = target;
+		stream->first = target;
+		data = stream_frame(stream, target);
+	}
+
+	pthread_mutex_unlock(&stream->mutex);
+
+	if (data)
+		os_sem_post(stream->sem);
+	return data;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool init_animated_gif(gs_image_file_t *image, const char *path,
+		uint64_t cache_budget)
 {
 	bool is_animated_gif = true;
 	gif_result result;
@@ -121,24 +295,27 @@ static bool init_animated_gif(gs_image_file_t *image, const char *path)
         (image->gif.frame_count > 1 && result >= 0);
 	if (image->is_animated_gif) {
         image->ani_type = GIF_ANIMATION_TYPE;
-        gif_decode_frame(&image->gif, 0);
-
-		image->animation_frame_cache = bzalloc(
-				image->gif.frame_count * sizeof(uint8_t*));
-		image->animation_frame_data = bzalloc(
-				get_full_decoded_gif_size(image));
-
-		for (unsigned int i = 0; i < image->gif.frame_count; i++) {
-			if (gif_decode_frame(&image->gif, i) != GIF_OK)
-				blog(LOG_WARNING, "Couldn't decode frame %u "
-						"of '%s'", i, path);
-		}
-
-		gif_decode_frame(&image->gif, 0);
 
 		image->cx = (uint32_t)image->gif.width;
 		image->cy = (uint32_t)image->gif.height;
 		image->format = GS_RGBA;
+		image->mem_usage = size + image->cx * image->cy * 4;
+
+		/* frames are decoded as they are played, either into a cache
+		 * of every frame or, past the budget, into a small ring */
+		gif_decode_frame(&image->gif, 0);
+
+		if (max_size > cache_budget &&
+		    init_image_stream(image, gif_stream_decode,
+				    image->gif.frame_image)) {
+			image->mem_usage += image->stream->frame_size *
+				IMAGE_STREAM_FRAMES;
+		} else {
+			image->animation_frame_cache = bzalloc(
+					image->gif.frame_count *
+					sizeof(uint8_t*));
+			image->animation_frame_data = bmalloc((size_t)max_size);
+		}
 	} else {
 		gif_finalise(&image->gif);
 		bfree(image->gif_data);
@@ -159,32 +336,488 @@ not_animated:
 	return is_animated_gif;
 }
 
-void gs_image_file_init(gs_image_file_t *image, const char *file)
+/* ------------------------------------------------------------------------- */
+/* shared images */
+
+/* images no longer in use are kept up to this many bytes and entries */
+#define IMAGE_CACHE_UNUSED_BUDGET  (128ULL * 1024 * 1024)
+#define IMAGE_CACHE_UNUSED_ENTRIES 64
+
+/* what a load is matched against the cache with.  files are matched by
+ * path, size and modification time first, so loading an unchanged file
+ * again never reads it, and only hashed when that misses, which finds
+ * copies of the same file under other paths.  urls can't be checked
+ * without fetching them, so they're matched by the url alone */
+struct image_cache_key {
+	const char                  *path;
+	bool                        url;
+	time_t                      mtime;
+	uint64_t                    size;
+	bool                        hashed;
+	uint64_t                    hash;
+};
+
+/* a loaded image shared by every gs_image_file_t with the same file
+ * contents.  static images share the texture too, animations share the
+ * decoded frames and each upload them into their own texture.  the mutex
+ * guards decoding into the shared image and its mem_usage, it may be
+ * locked while holding the cache mutex but not the other way around */
+struct gs_image_cache_entry {
+	struct gs_image_cache_entry *next;
+	char                        *path;
+	bool                        url;
+	time_t                      mtime;
+	uint64_t                    size;
+	uint64_t                    hash;
+	long                        refs;
+	uint64_t                    last_used;
+	pthread_mutex_t             mutex;
+	gs_image_file_t             image;
+};
+
+static struct {
+	pthread_mutex_t             mutex;
+	struct gs_image_cache_entry *first;
+
+	uint64_t                    hits;
+	uint64_t                    misses;
+	uint64_t                    evictions;
+} image_cache = {PTHREAD_MUTEX_INITIALIZER};
+
+static void decode_new_frame(gs_image_file_t *image, int new_frame);
+
+static inline bool is_url(const char *path)
 {
-	size_t len;
+	return strstr(path, "://") != NULL;
+}
 
-	if (!image)
-		return;
+/* returns false if the file can't be shared, when it doesn't exist */
+static bool image_cache_key_init(struct image_cache_key *key,
+		const char *path)
+{
+	struct stat st;
 
-	memset(image, 0, sizeof(*image));
+	memset(key, 0, sizeof(*key));
+	key->path = path;
+	key->url = is_url(path);
+
+	if (key->url)
+		return true;
+	if (os_stat(path, &st) != 0)
+		return false;
 
+	key->mtime = st.st_mtime;
+	key->size = (uint64_t)st.st_size;
+	return true;
+}
+
+/* 64-bit FNV-1a of the file contents */
+static bool hash_file(const char *path, uint64_t *hash, uint64_t *size)
+{
+	uint8_t buf[65536];
+	uint64_t h = 0xCBF29CE484222325ULL;
+	uint64_t total = 0;
+	size_t read;
+	FILE *file;
+
+	file = os_fopen(path, "rb");
 	if (!file)
+		return false;
+
+	while ((read = fread(buf, 1, sizeof(buf), file)) > 0) {
+		for (size_t i = 0; i < read; i++) {
+			h ^= buf[i];
+			h *= 0x100000001B3ULL;
+		}
+
+		total += read;
+	}
+
+	fclose(file);
+
+	*hash = h;
+	*size = total;
+	return true;
+}
+
+static inline bool entry_matches(const struct gs_image_cache_entry *entry,
+		const struct image_cache_key *key)
+{
+	if (entry->url != key->url)
+		return false;
+	if (strcmp(entry->path, key->path) == 0 &&
+	    (key->url || (entry->mtime == key->mtime &&
+	                  entry->size == key->size)))
+		return true;
+
+	return key->hashed && entry->hash == key->hash &&
+		entry->size == key->size;
+}
+
+static struct gs_image_cache_entry *image_cache_find(
+		const struct image_cache_key *key)
+{
+	struct gs_image_cache_entry *entry = image_cache.first;
+
+	while (entry) {
+		if (entry_matches(entry, key)) {
+			entry->refs++;
+			return entry;
+		}
+
+		entry = entry->next;
+	}
+
+	return NULL;
+}
+
+/* a file is only counted as a miss once its hash has missed too */
+static struct gs_image_cache_entry *image_cache_acquire(
+		const struct image_cache_key *key)
+{
+	struct gs_image_cache_entry *entry;
+
+	pthread_mutex_lock(&image_cache.mutex);
+	entry = image_cache_find(key);
+	if (entry)
+		image_cache.hits++;
+	else if (key->url || key->hashed)
+		image_cache.misses++;
+	pthread_mutex_unlock(&image_cache.mutex);
+
+	return entry;
+}
+
+/* mem_usage is only tracked for animations, which grow as frames are
+ * decoded.  static images are the decoded texture */
+static inline uint64_t image_mem_usage(const gs_image_file_t *image)
+{
+	if (image->is_animated)
+		return image->mem_usage;
+	return image->loaded ? (uint64_t)image->cx * image->cy * 4 : 0;
+}
+
+/* frames decoded into the shared image grow its mem_usage under the
+ * entry mutex */
+static uint64_t entry_mem_usage(struct gs_image_cache_entry *entry)
+{
+	uint64_t mem_usage;
+
+	pthread_mutex_lock(&entry->mutex);
+	mem_usage = image_mem_usage(&entry->image);
+	pthread_mutex_unlock(&entry->mutex);
+	return mem_usage;
+}
+
+/* turns image into a view of the shared one, the memory is accounted to
+ * the cache entry only */
+static void share_image(gs_image_file_t *image,
+		struct gs_image_cache_entry *entry)
+{
+	*image = entry->image;
+	image->shared = entry;
+	image->mem_usage = 0;
+	image->texture = NULL;
+	image->texture_data = NULL;
+	image->cur_time = 0;
+	image->cur_frame = 0;
+	image->cur_loop = 0;
+	image->last_decoded_frame = 0;
+}
+
+/* moves a freshly loaded image into the cache */
+static void image_cache_insert(gs_image_file_t *image,
+		const struct image_cache_key *key)
+{
+	struct gs_image_cache_entry *entry;
+
+	pthread_mutex_lock(&image_cache.mutex);
+
+	/* another source loaded the same file in the meantime */
+	entry = image_cache_find(key);
+	if (!entry) {
+		entry = bzalloc(sizeof(*entry));
+		entry->path = bstrdup(key->path);
+		entry->url = key->url;
+		entry->mtime = key->mtime;
+		entry->size = key->size;
+		entry->hash = key->hash;
+		entry->refs = 1;
+		entry->image = *image;
+		pthread_mutex_init(&entry->mutex, NULL);
+
+		entry->next = image_cache.first;
+		image_cache.first = entry;
+		memset(image, 0, sizeof(*image));
+	}
+
+	pthread_mutex_unlock(&image_cache.mutex);
+
+	if (image->loaded)
+		gs_image_file_free(image);
+
+	share_image(image, entry);
+}
+
+static void image_cache_entry_free(struct gs_image_cache_entry *entry)
+{
+	gs_image_file_free(&entry->image);
+	pthread_mutex_destroy(&entry->mutex);
+	bfree(entry->path);
+	bfree(entry);
+}
+
+/* evicts the least recently used unused images past the budget, must be
+ * called with the cache mutex held */
+static struct gs_image_cache_entry *image_cache_evict(void)
+{
+	struct gs_image_cache_entry *evicted = NULL;
+
+	for (;;) {
+		struct gs_image_cache_entry **oldest = NULL;
+		struct gs_image_cache_entry **cur = &image_cache.first;
+		struct gs_image_cache_entry *entry;
+		uint64_t unused_bytes = 0;
+		size_t unused_entries = 0;
+
+		for (; *cur; cur = &(*cur)->next) {
+			if ((*cur)->refs)
+				continue;
+
+			unused_bytes += entry_mem_usage(*cur);
+			unused_entries++;
+			if (!oldest || (*cur)->last_used < (*oldest)->last_used)
+				oldest = cur;
+		}
+
+		if (unused_bytes <= IMAGE_CACHE_UNUSED_BUDGET &&
+		    unused_entries <= IMAGE_CACHE_UNUSED_ENTRIES)
+			break;
+
+		entry = *oldest;
+		*oldest = entry->next;
+		entry->next = evicted;
+		evicted = entry;
+		image_cache.evictions++;
+	}
+
+	return evicted;
+}
+
+static void image_cache_remove(struct gs_image_cache_entry *entry)
+{
+	struct gs_image_cache_entry **cur = &image_cache.first;
+
+	for (; *cur; cur = &(*cur)->next) {
+		if (*cur == entry) {
+			*cur = entry->next;
+			break;
+		}
+	}
+}
+
+static void image_cache_release(struct gs_image_cache_entry *entry)
+{
+	struct gs_image_cache_entry *evicted;
+	bool drop = false;
+
+	pthread_mutex_lock(&image_cache.mutex);
+	if (--entry->refs == 0) {
+		entry->last_used = os_gettime_ns();
+
+		/* urls aren't checked for changes, so an unused one is
+		 * dropped to be fetched again the next time it's loaded */
+		if (entry->url) {
+			image_cache_remove(entry);
+			image_cache.evictions++;
+			drop = true;
+		}
+	}
+	evicted = image_cache_evict();
+	pthread_mutex_unlock(&image_cache.mutex);
+
+	if (drop)
+		image_cache_entry_free(entry);
+
+	while (evicted) {
+		struct gs_image_cache_entry *next = evicted->next;
+		image_cache_entry_free(evicted);
+		evicted = next;
+	}
+}
+
+static void init_shared_texture(gs_image_file_t *image)
+{
+	struct gs_image_cache_entry *entry = image->shared;
+	gs_image_file_t *shared = &entry->image;
+
+	pthread_mutex_lock(&entry->mutex);
+
+	if (!image->is_animated) {
+		if (!shared->texture)
+			gs_image_file_init_texture(shared);
+		image->texture = shared->texture;
+	} else {
+		const uint8_t *data;
+
+		if (!shared->animation_frame_cache[0])
+			decode_new_frame(shared, 0);
+
+		data = shared->animation_frame_cache[0];
+		if (data)
+			image->texture = gs_texture_create(image->cx, image->cy,
+					image->format, 1, &data, GS_DYNAMIC);
+	}
+
+	pthread_mutex_unlock(&entry->mutex);
+}
+
+static void update_shared_texture(gs_image_file_t *image)
+{
+	struct gs_image_cache_entry *entry = image->shared;
+	gs_image_file_t *shared = &entry->image;
+	const uint8_t *data;
+
+	pthread_mutex_lock(&entry->mutex);
+
+	if (!shared->animation_frame_cache[image->cur_frame])
+		decode_new_frame(shared, image->cur_frame);
+
+	data = shared->animation_frame_cache[image->cur_frame];
+	if (data)
+		gs_texture_set_image(image->texture, data, image->cx * 4,
+				false);
+
+	pthread_mutex_unlock(&entry->mutex);
+}
+
+void gs_image_cache_get_stats(struct gs_image_cache_stats *stats)
+{
+	struct gs_image_cache_entry *entry;
+
+	if (!stats)
 		return;
 
-	len = strlen(file);
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&image_cache.mutex);
+	stats->hits      = image_cache.hits;
+	stats->misses    = image_cache.misses;
+	stats->evictions = image_cache.evictions;
+
+	for (entry = image_cache.first; entry; entry = entry->next) {
+		stats->entries++;
+		stats->resident_bytes += entry_mem_usage(entry);
+	}
+	pthread_mutex_unlock(&image_cache.mutex);
+}
+
+uint64_t gs_image_file_get_mem_usage(gs_image_file_t *image)
+{
+	if (!image)
+		return 0;
+	if (!image->shared)
+		return image_mem_usage(image);
+
+	/* the image's reference keeps the entry alive */
+	return entry_mem_usage(image->shared);
+}
+
+/* called by gs_destroy, in the graphics context */
+void gs_image_cache_free(void)
+{
+	struct gs_image_cache_entry *entry;
+
+	pthread_mutex_lock(&image_cache.mutex);
+	entry = image_cache.first;
+	image_cache.first = NULL;
+	pthread_mutex_unlock(&image_cache.mutex);
+
+	while (entry) {
+		struct gs_image_cache_entry *next = entry->next;
+		image_cache_entry_free(entry);
+		entry = next;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+void gs_image_file_init(gs_image_file_t *image, const char *file)
+{
+	gs_image_file_init_with_budget(image, file, GS_IMAGE_FILE_CACHE_BUDGET);
+}
+
+static void image_file_load(gs_image_file_t *image, const char *file,
+		uint64_t cache_budget)
+{
+	size_t len = strlen(file);
 
 	if (len > 4 && strcmp(file + len - 4, ".gif") == 0) {
-		if (init_animated_gif(image, file))
+		if (init_animated_gif(image, file, cache_budget))
 			return;
 	}
 
-	image->texture_data = gs_create_texture_file_data_animated(file, image);
+	image->texture_data = gs_create_texture_file_data_animated(file, image,
+			cache_budget);
 
 	image->loaded = !!image->texture_data;
 	if (!image->loaded) {
 		blog(LOG_WARNING, "Failed to load file '%s'", file);
 		gs_image_file_free(image);
+		return;
+	}
+
+	if (image->ani_type == APNG_ANIMATION_TYPE && !image->cached) {
+		if (init_image_stream(image, apng_stream_decode,
+					image->texture_data)) {
+			image->mem_usage += image->stream->frame_size *
+				IMAGE_STREAM_FRAMES;
+		} else {
+			blog(LOG_WARNING, "Failed to stream '%s'", file);
+			image->loaded = false;
+			gs_free_ffmpeg_image(image);
+			gs_image_file_free(image);
+		}
+	}
+}
+
+void gs_image_file_init_with_budget(gs_image_file_t *image, const char *file,
+		uint64_t cache_budget)
+{
+	struct gs_image_cache_entry *entry = NULL;
+	struct image_cache_key key;
+	bool keyed;
+
+	if (!image)
+		return;
+
+	memset(image, 0, sizeof(*image));
+
+	if (!file)
+		return;
+
+	keyed = image_cache_key_init(&key, file);
+	if (keyed)
+		entry = image_cache_acquire(&key);
+
+	/* a new or changed file, or a copy under another path */
+	if (keyed && !entry && !key.url) {
+		key.hashed = hash_file(file, &key.hash, &key.size);
+		keyed = key.hashed;
+		if (keyed)
+			entry = image_cache_acquire(&key);
+	}
+
+	if (entry) {
+		share_image(image, entry);
+		return;
 	}
+
+	image_file_load(image, file, cache_budget);
+
+	/* streamed images keep their own decoder */
+	if (keyed && image->loaded && !image->stream)
+		image_cache_insert(image, &key);
 }
 
 void gs_image_file_free(gs_image_file_t *image)
@@ -192,7 +825,18 @@ void gs_image_file_free(gs_image_file_t *image)
 	if (!image)
 		return;
 
+	if (image->shared) {
+		if (image->is_animated)
+			gs_texture_destroy(image->texture);
+
+		image_cache_release(image->shared);
+		memset(image, 0, sizeof(*image));
+		return;
+	}
+
 	if (image->loaded) {
+		image_stream_free(image);
+
 		if (image->is_animated) {
 			bfree(image->animation_frame_cache);
 			bfree(image->animation_frame_data);
@@ -220,17 +864,26 @@ void gs_image_file_init_texture(gs_image_file_t *image)
 	if (!image->loaded)
 		return;
 
+	if (image->shared) {
+		init_shared_texture(image);
+		return;
+	}
+
 	if (image->is_animated_gif) {
+		const uint8_t *data = image->stream ?
+			image->stream->frames : image->gif.frame_image;
+
 		image->texture = gs_texture_create(
 				image->cx, image->cy, image->format, 1,
-				(const uint8_t**)&image->gif.frame_image,
-				GS_DYNAMIC);
+				&data, GS_DYNAMIC);
     }
     else {
+        const uint8_t *data = image->stream ?
+            image->stream->frames : image->texture_data;
+
         image->texture = gs_texture_create(
             image->cx, image->cy, image->format, 1,
-            (const uint8_t**)&image->texture_data,
-            (image->is_animated ? GS_DYNAMIC : 0));
+            &data, (image->is_animated ? GS_DYNAMIC : 0));
 
         if (!image->is_animated){
             bfree(image->texture_data);
@@ -280,13 +933,26 @@ static inline int calculate_new_frame(gs_image_file_t *image,
 
 static void decode_new_frame(gs_image_file_t *image, int new_frame)
 {
+	if (image->shared) {
+		struct gs_image_cache_entry *entry = image->shared;
+
+		pthread_mutex_lock(&entry->mutex);
+		decode_new_frame(&entry->image, new_frame);
+		pthread_mutex_unlock(&entry->mutex);
+
+		image->cur_frame = new_frame;
+		return;
+	}
+
+	/* streamed frames are picked up in gs_image_file_update_texture */
+	if (image->stream) {
+		image->cur_frame = new_frame;
+		return;
+	}
+
     if (image->ani_type == APNG_ANIMATION_TYPE) {
-        if (image->cached) {
-            if (!image->animation_frame_cache[new_frame])
-                gs_decode_ffmpeg_image_cached(image, new_frame);
-        } else {
-            gs_decode_ffmpeg_image(image, new_frame);
-        }
+        if (!image->animation_frame_cache[new_frame])
+            gs_decode_ffmpeg_image_cached(image, new_frame);
 
         image->cur_frame = new_frame;
         return;
@@ -316,6 +982,8 @@ static void decode_new_frame(gs_image_file_t *image, int new_frame)
 					image->gif.frame_image,
 					image->gif.width *
 					image->gif.height * 4);
+			image->mem_usage += image->gif.width *
+				image->gif.height * 4;
 
 			image->last_decoded_frame = new_frame;
 		}
@@ -341,6 +1009,15 @@ bool gs_image_file_tick(gs_image_file_t *image, uint64_t elapsed_time_ns)
 
 		if (new_frame != image->cur_frame
             || new_frame == 0) {
+			/* a non-looping apng stops on its last frame, whether
+			 * it is cached, streamed or shared */
+			if (image->ani_type == APNG_ANIMATION_TYPE &&
+			    !image->enable_loop &&
+			    new_frame < image->cur_frame) {
+				image->play_finished = true;
+				return false;
+			}
+
 			decode_new_frame(image, new_frame);
 			return true;
 		}
@@ -354,6 +1031,19 @@ void gs_image_file_update_texture(gs_image_file_t *image)
 	if (!image->is_animated || !image->loaded)
 		return;
 
+	if (image->shared) {
+		update_shared_texture(image);
+		return;
+	}
+
+	if (image->stream) {
+		const uint8_t *data = image_stream_next_frame(image);
+		if (data)
+			gs_texture_set_image(image->texture, data,
+					image->cx * 4, false);
+		return;
+	}
+
 	if (!image->animation_frame_cache[image->cur_frame])
 		decode_new_frame(image, image->cur_frame);
 
@@ -20,6 +20,13 @@
 #include "graphics.h"
 #include "libnsgif/libnsgif.h"
 
+/* animated gifs larger than this when fully decoded are streamed from a
+ * worker thread instead of caching every frame */
+#define GS_IMAGE_FILE_CACHE_BUDGET (64ULL * 1024 * 1024)
+
+struct gs_image_stream;
+struct gs_image_cache_entry;
+
 enum animation_type {
     NO_ANIMATION_TYPE,
     GIF_ANIMATION_TYPE,
@@ -59,14 +66,38 @@ struct gs_image_file {
 
 	uint8_t *texture_data;
 	gif_bitmap_callback_vt bitmap_callbacks;
+
+	struct gs_image_stream *stream;
+	uint64_t mem_usage;
+
+	/* set if this is a view of an image shared through the cache */
+	struct gs_image_cache_entry *shared;
 };
 
 typedef struct gs_image_file gs_image_file_t;
 
 EXPORT void gs_image_file_init(gs_image_file_t *image, const char *file);
+EXPORT void gs_image_file_init_with_budget(gs_image_file_t *image,
+		const char *file, uint64_t cache_budget);
 EXPORT void gs_image_file_free(gs_image_file_t *image);
 
 EXPORT void gs_image_file_init_texture(gs_image_file_t *image);
 EXPORT bool gs_image_file_tick(gs_image_file_t *image,
 		uint64_t elapsed_time_ns);
 EXPORT void gs_image_file_update_texture(gs_image_file_t *image);
+
+struct gs_image_cache_stats {
+	uint64_t hits;           /**< Loads served by an already loaded image */
+	uint64_t misses;         /**< Loads that had to decode the file */
+	uint64_t evictions;      /**< Unused images dropped from the cache */
+	size_t   entries;        /**< Images in the cache, used or not */
+	uint64_t resident_bytes; /**< Memory used by the cached images */
+};
+
+/** Gets statistics of the cache that shares images loaded from identical
+ * files */
+EXPORT void gs_image_cache_get_stats(struct gs_image_cache_stats *stats);
+
+/** Gets the memory used by an image, for an image shared through the cache
+ * this is the memory of the shared image */
+EXPORT uint64_t gs_image_file_get_mem_usage(gs_image_file_t *image);
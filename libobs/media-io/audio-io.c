@@ -25,6 +25,7 @@
 #include "../util/profiler.h"
 
 #include "audio-io.h"
+#include "audio-kernels.h"
 #include "audio-resampler.h"
 
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
@@ -66,6 +67,9 @@ struct audio_output {
 	void                       *input_param;
 	pthread_mutex_t            input_mutex;
 	struct audio_mix           mixes[MAX_AUDIO_MIXES];
+
+	/* mixes whose buffers may hold data from an earlier tick */
+	uint32_t                   dirty_mixes;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -175,17 +179,8 @@ static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
 		if (!mix->inputs.num)
 			continue;
 
-		for (size_t plane = 0; plane < audio->planes; plane++) {
-			float *mix_data = mix->buffer[plane];
-			float *mix_end = &mix_data[float_size];
-
-			while (mix_data < mix_end) {
-				float val = *mix_data;
-				val = (val >  1.0f) ?  1.0f : val;
-				val = (val < -1.0f) ? -1.0f : val;
-				*(mix_data++) = val;
-			}
-		}
+		for (size_t plane = 0; plane < audio->planes; plane++)
+			audio_kernel_clamp(mix->buffer[plane], float_size);
 	}
 }
 
@@ -213,17 +208,21 @@ static void input_and_output(struct audio_output *audio,
 	}
 	pthread_mutex_unlock(&audio->input_mutex);
 
-	/* clear mix buffers */
+	/* clear mix buffers.  inactive mixes are not mixed into, so they
+	 * only need clearing once after they were last used */
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
 		struct audio_mix *mix = &audio->mixes[mix_idx];
 
-		memset(mix->buffer[0], 0, AUDIO_OUTPUT_FRAMES *
-				MAX_AUDIO_CHANNELS * sizeof(float));
+		if ((audio->dirty_mixes | active_mixes) & (1 << mix_idx))
+			memset(mix->buffer[0], 0, AUDIO_OUTPUT_FRAMES *
+					MAX_AUDIO_CHANNELS * sizeof(float));
 
 		for (size_t i = 0; i < audio->planes; i++)
 			data[mix_idx].data[i] = mix->buffer[i];
 	}
 
+	audio->dirty_mixes = active_mixes;
+
 	/* get new audio data */
 	success = audio->input_cb(audio->input_param, prev_time, audio_time,
 			&new_ts, active_mixes, data);
@@ -0,0 +1,322 @@
+/******************************************************************************
+    Copyright (C) 2016 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "audio-kernels.h"
+#include "../util/threading.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#elif defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+      defined(__i386__)
+#define KERNELS_SSE
+#define KERNELS_AVX
+#include <xmmintrin.h>
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* SSE/NEON, four floats at a time */
+
+/* dst[i] += src[i] */
+static void add_base(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+#if defined(KERNELS_SSE)
+	for (; i < (count & ~(size_t)3); i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+					_mm_loadu_ps(src + i)));
+#elif defined(KERNELS_NEON)
+	for (; i < (count & ~(size_t)3); i += 4)
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i),
+					vld1q_f32(src + i)));
+#endif
+
+	for (; i < count; i++)
+		dst[i] += src[i];
+}
+
+/* dst[i] += src[i] * gain[i] */
+static void add_mul_base(float *dst, const float *src,
+		const float *gain, size_t count)
+{
+	size_t i = 0;
+
+#if defined(KERNELS_SSE)
+	for (; i < (count & ~(size_t)3); i += 4) {
+		__m128 val = _mm_mul_ps(_mm_loadu_ps(src + i),
+				_mm_loadu_ps(gain + i));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), val));
+	}
+#elif defined(KERNELS_NEON)
+	for (; i < (count & ~(size_t)3); i += 4)
+		vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i),
+					vld1q_f32(src + i),
+					vld1q_f32(gain + i)));
+#endif
+
+	for (; i < count; i++)
+		dst[i] += src[i] * gain[i];
+}
+
+/* data[i] *= gain */
+static void gain_base(float *data, float gain, size_t count)
+{
+	size_t i = 0;
+
+#if defined(KERNELS_SSE)
+	__m128 vol = _mm_set1_ps(gain);
+
+	for (; i < (count & ~(size_t)3); i += 4)
+		_mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), vol));
+#elif defined(KERNELS_NEON)
+	for (; i < (count & ~(size_t)3); i += 4)
+		vst1q_f32(data + i, vmulq_n_f32(vld1q_f32(data + i), gain));
+#endif
+
+	for (; i < count; i++)
+		data[i] *= gain;
+}
+
+/* data[i] *= ramp[i], for volume fades */
+static void gain_ramp_base(float *data, const float *ramp,
+		size_t count)
+{
+	size_t i = 0;
+
+#if defined(KERNELS_SSE)
+	for (; i < (count & ~(size_t)3); i += 4)
+		_mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i),
+					_mm_loadu_ps(ramp + i)));
+#elif defined(KERNELS_NEON)
+	for (; i < (count & ~(size_t)3); i += 4)
+		vst1q_f32(data + i, vmulq_f32(vld1q_f32(data + i),
+					vld1q_f32(ramp + i)));
+#endif
+
+	for (; i < count; i++)
+		data[i] *= ramp[i];
+}
+
+/* clamps data to [-1.0, 1.0] */
+static void clamp_base(float *data, size_t count)
+{
+	size_t i = 0;
+
+#if defined(KERNELS_SSE)
+	__m128 max_val = _mm_set1_ps(1.0f);
+	__m128 min_val = _mm_set1_ps(-1.0f);
+
+	for (; i < (count & ~(size_t)3); i += 4) {
+		__m128 val = _mm_loadu_ps(data + i);
+		val = _mm_max_ps(_mm_min_ps(val, max_val), min_val);
+		_mm_storeu_ps(data + i, val);
+	}
+#elif defined(KERNELS_NEON)
+	float32x4_t max_val = vdupq_n_f32(1.0f);
+	float32x4_t min_val = vdupq_n_f32(-1.0f);
+
+	for (; i < (count & ~(size_t)3); i += 4) {
+		float32x4_t val = vld1q_f32(data + i);
+		val = vmaxq_f32(vminq_f32(val, max_val), min_val);
+		vst1q_f32(data + i, val);
+	}
+#endif
+
+	for (; i < count; i++) {
+		float val = data[i];
+		val = (val >  1.0f) ?  1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		data[i] = val;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* AVX, eight floats at a time, the rest is left to the SSE kernels */
+
+#ifdef KERNELS_AVX
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#include <cpuid.h>
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+#include <immintrin.h>
+
+TARGET_AVX
+static void add_avx(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)7); i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(
+					_mm256_loadu_ps(dst + i),
+					_mm256_loadu_ps(src + i)));
+
+	_mm256_zeroupper();
+	add_base(dst + i, src + i, count - i);
+}
+
+TARGET_AVX
+static void add_mul_avx(float *dst, const float *src, const float *gain,
+		size_t count)
+{
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)7); i += 8) {
+		__m256 val = _mm256_mul_ps(_mm256_loadu_ps(src + i),
+				_mm256_loadu_ps(gain + i));
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(
+					_mm256_loadu_ps(dst + i), val));
+	}
+
+	_mm256_zeroupper();
+	add_mul_base(dst + i, src + i, gain + i, count - i);
+}
+
+TARGET_AVX
+static void gain_avx(float *data, float gain, size_t count)
+{
+	__m256 vol = _mm256_set1_ps(gain);
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)7); i += 8)
+		_mm256_storeu_ps(data + i, _mm256_mul_ps(
+					_mm256_loadu_ps(data + i), vol));
+
+	_mm256_zeroupper();
+	gain_base(data + i, gain, count - i);
+}
+
+TARGET_AVX
+static void gain_ramp_avx(float *data, const float *ramp, size_t count)
+{
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)7); i += 8)
+		_mm256_storeu_ps(data + i, _mm256_mul_ps(
+					_mm256_loadu_ps(data + i),
+					_mm256_loadu_ps(ramp + i)));
+
+	_mm256_zeroupper();
+	gain_ramp_base(data + i, ramp + i, count - i);
+}
+
+TARGET_AVX
+static void clamp_avx(float *data, size_t count)
+{
+	__m256 max_val = _mm256_set1_ps(1.0f);
+	__m256 min_val = _mm256_set1_ps(-1.0f);
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)7); i += 8) {
+		__m256 val = _mm256_loadu_ps(data + i);
+		val = _mm256_max_ps(_mm256_min_ps(val, max_val), min_val);
+		_mm256_storeu_ps(data + i, val);
+	}
+
+	_mm256_zeroupper();
+	clamp_base(data + i, count - i);
+}
+
+static bool cpu_has_avx(void)
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 1);
+
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx     = (info[2] & (1 << 28)) != 0;
+
+	return avx && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx") != 0;
+#endif
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+struct audio_kernel_funcs {
+	void (*add)(float *dst, const float *src, size_t count);
+	void (*add_mul)(float *dst, const float *src, const float *gain,
+			size_t count);
+	void (*gain)(float *data, float gain, size_t count);
+	void (*gain_ramp)(float *data, const float *ramp, size_t count);
+	void (*clamp)(float *data, size_t count);
+};
+
+static struct audio_kernel_funcs kernels = {
+	add_base,
+	add_mul_base,
+	gain_base,
+	gain_ramp_base,
+	clamp_base
+};
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void)
+{
+#ifdef KERNELS_AVX
+	if (cpu_has_avx()) {
+		kernels.add       = add_avx;
+		kernels.add_mul   = add_mul_avx;
+		kernels.gain      = gain_avx;
+		kernels.gain_ramp = gain_ramp_avx;
+		kernels.clamp     = clamp_avx;
+	}
+#endif
+}
+
+static inline void init_kernels(void)
+{
+	pthread_once(&kernels_once, select_kernels);
+}
+
+void audio_kernel_add(float *dst, const float *src, size_t count)
+{
+	init_kernels();
+	kernels.add(dst, src, count);
+}
+
+void audio_kernel_add_mul(float *dst, const float *src, const float *gain,
+		size_t count)
+{
+	init_kernels();
+	kernels.add_mul(dst, src, gain, count);
+}
+
+void audio_kernel_gain(float *data, float gain, size_t count)
+{
+	init_kernels();
+	kernels.gain(data, gain, count);
+}
+
+void audio_kernel_gain_ramp(float *data, const float *ramp, size_t count)
+{
+	init_kernels();
+	kernels.gain_ramp(data, ramp, count);
+}
+
+void audio_kernel_clamp(float *data, size_t count)
+{
+	init_kernels();
+	kernels.clamp(data, count);
+}
@@ -0,0 +1,53 @@
+/******************************************************************************
+    Copyright (C) 2016 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Float audio kernels for the mixing hot paths.  The implementation is
+ * picked once at runtime: AVX where the CPU and OS support it, otherwise SSE
+ * (which libobs already requires on x86) or NEON, with plain loops for the
+ * remainder and other architectures.  Pointers do not need to be aligned,
+ * mixing often starts partway into a buffer.
+ */
+
+/* dst[i] += src[i] */
+EXPORT void audio_kernel_add(float *dst, const float *src, size_t count);
+
+/* dst[i] += src[i] * gain[i] */
+EXPORT void audio_kernel_add_mul(float *dst, const float *src,
+		const float *gain, size_t count);
+
+/* data[i] *= gain */
+EXPORT void audio_kernel_gain(float *data, float gain, size_t count);
+
+/* data[i] *= ramp[i], for volume fades */
+EXPORT void audio_kernel_gain_ramp(float *data, const float *ramp,
+		size_t count);
+
+/* clamps data to [-1.0, 1.0] */
+EXPORT void audio_kernel_clamp(float *data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,7 @@
 ******************************************************************************/
 
 #include "format-conversion.h"
+#include "../util/threading.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
 
@@ -322,3 +323,396 @@ void decompress_422(
 		}
 	}
 }
+
+/* ------------------------------------------------------------------------- */
+/* packed 422 (UYVY/YUY2) to planar 420
+ *
+ * Each row kernel converts a pair of input lines, writing both luma lines and
+ * one chroma line (the rounded average of the two input lines), and returns
+ * the number of pixels it handled.  The remainder of the line (including odd
+ * widths) is always finished by the C kernel.  The fastest kernel supported
+ * by the CPU is picked once at runtime. */
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+#include <tmmintrin.h>
+#include <immintrin.h>
+
+typedef uint32_t (*pack422_nv12_row_t)(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *uv, uint32_t width, bool leading_lum);
+
+typedef uint32_t (*pack422_i420_row_t)(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *u, uint8_t *v, uint32_t width, bool leading_lum);
+
+/* writes chroma with a stride of 'step' so both the interleaved NV12 plane
+ * (step 2, v = u + 1) and separate I420 planes (step 1) are covered */
+static void pack422_row_c(const uint8_t *row0, const uint8_t *row1,
+		uint8_t *lum0, uint8_t *lum1, uint8_t *u, uint8_t *v,
+		uint32_t step, uint32_t x, uint32_t width, bool leading_lum)
+{
+	const uint32_t lum_ofs    = leading_lum ? 0 : 1;
+	const uint32_t chroma_ofs = leading_lum ? 1 : 0;
+
+	for (; x < width; x += 2) {
+		const uint8_t *p0 = row0 + x * 2;
+		const uint8_t *p1 = row1 + x * 2;
+		uint32_t chroma_pos = (x >> 1) * step;
+
+		lum0[x] = p0[lum_ofs];
+		if (lum1)
+			lum1[x] = p1[lum_ofs];
+
+		if (x + 1 < width) {
+			lum0[x + 1] = p0[lum_ofs + 2];
+			if (lum1)
+				lum1[x + 1] = p1[lum_ofs + 2];
+		}
+
+		u[chroma_pos] = (uint8_t)((p0[chroma_ofs] +
+					p1[chroma_ofs] + 1) >> 1);
+		v[chroma_pos] = (uint8_t)((p0[chroma_ofs + 2] +
+					p1[chroma_ofs + 2] + 1) >> 1);
+	}
+}
+
+static inline __m128i unpack422_lum_sse2(__m128i a, __m128i b,
+		bool leading_lum)
+{
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	if (leading_lum)
+		return _mm_packus_epi16(_mm_and_si128(a, mask),
+				_mm_and_si128(b, mask));
+	return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static inline __m128i unpack422_chroma_sse2(__m128i a, __m128i b,
+		bool leading_lum)
+{
+	return unpack422_lum_sse2(a, b, !leading_lum);
+}
+
+/* 16 pixels per iteration */
+static uint32_t pack422_nv12_row_sse2(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *uv, uint32_t width, bool leading_lum)
+{
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		const __m128i *in0 = (const __m128i*)(row0 + x * 2);
+		const __m128i *in1 = (const __m128i*)(row1 + x * 2);
+		__m128i a0 = _mm_loadu_si128(in0);
+		__m128i b0 = _mm_loadu_si128(in0 + 1);
+		__m128i a1 = _mm_loadu_si128(in1);
+		__m128i b1 = _mm_loadu_si128(in1 + 1);
+
+		_mm_storeu_si128((__m128i*)(lum0 + x),
+				unpack422_lum_sse2(a0, b0, leading_lum));
+		if (lum1)
+			_mm_storeu_si128((__m128i*)(lum1 + x),
+					unpack422_lum_sse2(a1, b1,
+						leading_lum));
+
+		_mm_storeu_si128((__m128i*)(uv + x), _mm_avg_epu8(
+				unpack422_chroma_sse2(a0, b0, leading_lum),
+				unpack422_chroma_sse2(a1, b1, leading_lum)));
+	}
+
+	return x;
+}
+
+/* 16 pixels per iteration */
+static uint32_t pack422_i420_row_sse2(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *u, uint8_t *v, uint32_t width, bool leading_lum)
+{
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		const __m128i *in0 = (const __m128i*)(row0 + x * 2);
+		const __m128i *in1 = (const __m128i*)(row1 + x * 2);
+		__m128i a0 = _mm_loadu_si128(in0);
+		__m128i b0 = _mm_loadu_si128(in0 + 1);
+		__m128i a1 = _mm_loadu_si128(in1);
+		__m128i b1 = _mm_loadu_si128(in1 + 1);
+		__m128i uv;
+
+		_mm_storeu_si128((__m128i*)(lum0 + x),
+				unpack422_lum_sse2(a0, b0, leading_lum));
+		if (lum1)
+			_mm_storeu_si128((__m128i*)(lum1 + x),
+					unpack422_lum_sse2(a1, b1,
+						leading_lum));
+
+		uv = _mm_avg_epu8(
+				unpack422_chroma_sse2(a0, b0, leading_lum),
+				unpack422_chroma_sse2(a1, b1, leading_lum));
+
+		_mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(
+				_mm_and_si128(uv, mask), _mm_setzero_si128()));
+		_mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(
+				_mm_srli_epi16(uv, 8), _mm_setzero_si128()));
+	}
+
+	return x;
+}
+
+/* same as the SSE2 version, but pulls U and V apart with a single shuffle
+ * instead of a mask/shift and two packs */
+TARGET_SSSE3
+static uint32_t pack422_i420_row_ssse3(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *u, uint8_t *v, uint32_t width, bool leading_lum)
+{
+	const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+			1, 3, 5, 7, 9, 11, 13, 15);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		const __m128i *in0 = (const __m128i*)(row0 + x * 2);
+		const __m128i *in1 = (const __m128i*)(row1 + x * 2);
+		__m128i a0 = _mm_loadu_si128(in0);
+		__m128i b0 = _mm_loadu_si128(in0 + 1);
+		__m128i a1 = _mm_loadu_si128(in1);
+		__m128i b1 = _mm_loadu_si128(in1 + 1);
+		__m128i uv;
+
+		_mm_storeu_si128((__m128i*)(lum0 + x),
+				unpack422_lum_sse2(a0, b0, leading_lum));
+		if (lum1)
+			_mm_storeu_si128((__m128i*)(lum1 + x),
+					unpack422_lum_sse2(a1, b1,
+						leading_lum));
+
+		uv = _mm_avg_epu8(
+				unpack422_chroma_sse2(a0, b0, leading_lum),
+				unpack422_chroma_sse2(a1, b1, leading_lum));
+		uv = _mm_shuffle_epi8(uv, split);
+
+		_mm_storel_epi64((__m128i*)(u + x / 2), uv);
+		_mm_storel_epi64((__m128i*)(v + x / 2),
+				_mm_srli_si128(uv, 8));
+	}
+
+	return x;
+}
+
+TARGET_AVX2
+static inline __m256i unpack422_lum_avx2(__m256i a, __m256i b,
+		bool leading_lum)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00FF);
+	__m256i val;
+
+	if (leading_lum)
+		val = _mm256_packus_epi16(_mm256_and_si256(a, mask),
+				_mm256_and_si256(b, mask));
+	else
+		val = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+				_mm256_srli_epi16(b, 8));
+
+	/* packus works per 128 bit lane, restore the pixel order */
+	return _mm256_permute4x64_epi64(val, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+/* 32 pixels per iteration */
+TARGET_AVX2
+static uint32_t pack422_nv12_row_avx2(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *uv, uint32_t width, bool leading_lum)
+{
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		const __m256i *in0 = (const __m256i*)(row0 + x * 2);
+		const __m256i *in1 = (const __m256i*)(row1 + x * 2);
+		__m256i a0 = _mm256_loadu_si256(in0);
+		__m256i b0 = _mm256_loadu_si256(in0 + 1);
+		__m256i a1 = _mm256_loadu_si256(in1);
+		__m256i b1 = _mm256_loadu_si256(in1 + 1);
+
+		_mm256_storeu_si256((__m256i*)(lum0 + x),
+				unpack422_lum_avx2(a0, b0, leading_lum));
+		if (lum1)
+			_mm256_storeu_si256((__m256i*)(lum1 + x),
+					unpack422_lum_avx2(a1, b1,
+						leading_lum));
+
+		_mm256_storeu_si256((__m256i*)(uv + x), _mm256_avg_epu8(
+				unpack422_lum_avx2(a0, b0, !leading_lum),
+				unpack422_lum_avx2(a1, b1, !leading_lum)));
+	}
+
+	_mm256_zeroupper();
+	return x;
+}
+
+/* 32 pixels per iteration */
+TARGET_AVX2
+static uint32_t pack422_i420_row_avx2(const uint8_t *row0,
+		const uint8_t *row1, uint8_t *lum0, uint8_t *lum1,
+		uint8_t *u, uint8_t *v, uint32_t width, bool leading_lum)
+{
+	const __m256i split = _mm256_setr_epi8(
+			0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+			0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		const __m256i *in0 = (const __m256i*)(row0 + x * 2);
+		const __m256i *in1 = (const __m256i*)(row1 + x * 2);
+		__m256i a0 = _mm256_loadu_si256(in0);
+		__m256i b0 = _mm256_loadu_si256(in0 + 1);
+		__m256i a1 = _mm256_loadu_si256(in1);
+		__m256i b1 = _mm256_loadu_si256(in1 + 1);
+		__m256i uv;
+
+		_mm256_storeu_si256((__m256i*)(lum0 + x),
+				unpack422_lum_avx2(a0, b0, leading_lum));
+		if (lum1)
+			_mm256_storeu_si256((__m256i*)(lum1 + x),
+					unpack422_lum_avx2(a1, b1,
+						leading_lum));
+
+		uv = _mm256_avg_epu8(
+				unpack422_lum_avx2(a0, b0, !leading_lum),
+				unpack422_lum_avx2(a1, b1, !leading_lum));
+
+		/* per lane: u0-u7 v0-v7 | u8-u15 v8-v15, then gather the
+		 * u and v quadwords into the low and high lane */
+		uv = _mm256_shuffle_epi8(uv, split);
+		uv = _mm256_permute4x64_epi64(uv, _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm_storeu_si128((__m128i*)(u + x / 2),
+				_mm256_castsi256_si128(uv));
+		_mm_storeu_si128((__m128i*)(v + x / 2),
+				_mm256_extracti128_si256(uv, 1));
+	}
+
+	_mm256_zeroupper();
+	return x;
+}
+
+static pack422_nv12_row_t pack422_nv12_row = NULL;
+static pack422_i420_row_t pack422_i420_row = NULL;
+static pthread_once_t pack422_funcs_once = PTHREAD_ONCE_INIT;
+
+static void cpu_features(bool *ssse3, bool *avx2)
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	*ssse3 = (info[2] & (1 << 9)) != 0;
+
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx     = (info[2] & (1 << 28)) != 0;
+	bool ymm_os  = osxsave && (_xgetbv(0) & 6) == 6;
+
+	*avx2 = false;
+	if (max_leaf >= 7 && avx && ymm_os) {
+		__cpuidex(info, 7, 0);
+		*avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	*ssse3 = __builtin_cpu_supports("ssse3") != 0;
+	*avx2  = __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static void select_pack422_funcs(void)
+{
+	bool ssse3, avx2;
+
+	cpu_features(&ssse3, &avx2);
+
+	if (avx2) {
+		pack422_i420_row = pack422_i420_row_avx2;
+		pack422_nv12_row = pack422_nv12_row_avx2;
+	} else {
+		pack422_i420_row = ssse3 ?
+			pack422_i420_row_ssse3 : pack422_i420_row_sse2;
+		pack422_nv12_row = pack422_nv12_row_sse2;
+	}
+}
+
+static inline void init_pack422_funcs(void)
+{
+	pthread_once(&pack422_funcs_once, select_pack422_funcs);
+}
+
+void compress_422_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t width, uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[],
+		bool leading_lum)
+{
+	uint32_t y;
+
+	init_pack422_funcs();
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *row0 = input + y * in_linesize;
+		const uint8_t *row1 = row0;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = NULL;
+		uint8_t *uv   = output[1] + (y >> 1) * out_linesize[1];
+		uint32_t x;
+
+		/* an odd last line takes its chroma from itself only */
+		if (y + 1 < end_y) {
+			row1 = row0 + in_linesize;
+			lum1 = lum0 + out_linesize[0];
+		}
+
+		x = pack422_nv12_row(row0, row1, lum0, lum1, uv, width,
+				leading_lum);
+		pack422_row_c(row0, row1, lum0, lum1, uv, uv + 1, 2, x, width,
+				leading_lum);
+	}
+}
+
+void compress_422_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t width, uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[],
+		bool leading_lum)
+{
+	uint32_t y;
+
+	init_pack422_funcs();
+
+	for (y = start_y; y < end_y; y += 2) {
+		const uint8_t *row0 = input + y * in_linesize;
+		const uint8_t *row1 = row0;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = NULL;
+		uint8_t *u    = output[1] + (y >> 1) * out_linesize[1];
+		uint8_t *v    = output[2] + (y >> 1) * out_linesize[2];
+		uint32_t x;
+
+		if (y + 1 < end_y) {
+			row1 = row0 + in_linesize;
+			lum1 = lum0 + out_linesize[0];
+		}
+
+		x = pack422_i420_row(row0, row1, lum0, lum1, u, v, width,
+				leading_lum);
+		pack422_row_c(row0, row1, lum0, lum1, u, v, 1, x, width,
+				leading_lum);
+	}
+}
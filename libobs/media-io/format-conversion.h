@@ -42,6 +42,27 @@ EXPORT void convert_uyvx_to_i444(
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[]);
 
+/*
+ * Functions for converting packed 422 YUV (UYVY/YUY2) to planar 420
+ *
+ * Unlike the packed 444 functions these take the width explicitly, so any
+ * width, height and stride is supported.  start_y must be even.  Chroma
+ * planes must hold (width+1)/2 samples by (height+1)/2 lines, as allocated
+ * by video_frame_init.
+ */
+
+EXPORT void compress_422_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t width, uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[],
+		bool leading_lum);
+
+EXPORT void compress_422_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t width, uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[],
+		bool leading_lum);
+
 EXPORT void decompress_nv12(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
@@ -28,6 +28,10 @@ void video_frame_init(struct video_frame *frame, enum video_format format,
 	size_t offsets[MAX_AV_PLANES];
 	int    alignment = base_get_alignment();
 
+	/* subsampled chroma covers odd last columns/lines too */
+	uint32_t chroma_cx = (width + 1) / 2;
+	uint32_t chroma_cy = (height + 1) / 2;
+
 	if (!frame) return;
 
 	memset(frame, 0, sizeof(struct video_frame));
@@ -41,29 +45,29 @@ void video_frame_init(struct video_frame *frame, enum video_format format,
 		size = width * height;
 		ALIGN_SIZE(size, alignment);
 		offsets[0] = size;
-		size += (width/2) * (height/2);
+		size += chroma_cx * chroma_cy;
 		ALIGN_SIZE(size, alignment);
 		offsets[1] = size;
-		size += (width/2) * (height/2);
+		size += chroma_cx * chroma_cy;
 		ALIGN_SIZE(size, alignment);
 		frame->data[0] = bmalloc(size);
 		frame->data[1] = (uint8_t*)frame->data[0] + offsets[0];
 		frame->data[2] = (uint8_t*)frame->data[0] + offsets[1];
 		frame->linesize[0] = width;
-		frame->linesize[1] = width/2;
-		frame->linesize[2] = width/2;
+		frame->linesize[1] = chroma_cx;
+		frame->linesize[2] = chroma_cx;
 		break;
 
 	case VIDEO_FORMAT_NV12:
 		size = width * height;
 		ALIGN_SIZE(size, alignment);
 		offsets[0] = size;
-		size += (width/2) * (height/2) * 2;
+		size += chroma_cx * chroma_cy * 2;
 		ALIGN_SIZE(size, alignment);
 		frame->data[0] = bmalloc(size);
 		frame->data[1] = (uint8_t*)frame->data[0] + offsets[0];
 		frame->linesize[0] = width;
-		frame->linesize[1] = width;
+		frame->linesize[1] = chroma_cx * 2;
 		break;
 
 	case VIDEO_FORMAT_Y800:
@@ -107,19 +111,21 @@ void video_frame_init(struct video_frame *frame, enum video_format format,
 void video_frame_copy(struct video_frame *dst, const struct video_frame *src,
 		enum video_format format, uint32_t cy)
 {
+	uint32_t chroma_cy = (cy + 1) / 2;
+
 	switch (format) {
 	case VIDEO_FORMAT_NONE:
 		return;
 
 	case VIDEO_FORMAT_I420:
 		memcpy(dst->data[0], src->data[0], src->linesize[0] * cy);
-		memcpy(dst->data[1], src->data[1], src->linesize[1] * cy / 2);
-		memcpy(dst->data[2], src->data[2], src->linesize[2] * cy / 2);
+		memcpy(dst->data[1], src->data[1], src->linesize[1] * chroma_cy);
+		memcpy(dst->data[2], src->data[2], src->linesize[2] * chroma_cy);
 		break;
 
 	case VIDEO_FORMAT_NV12:
 		memcpy(dst->data[0], src->data[0], src->linesize[0] * cy);
-		memcpy(dst->data[1], src->data[1], src->linesize[1] * cy / 2);
+		memcpy(dst->data[1], src->data[1], src->linesize[1] * chroma_cy);
 		break;
 
 	case VIDEO_FORMAT_Y800:
@@ -22,6 +22,7 @@
 #include "../util/profiler.h"
 #include "../util/threading.h"
 #include "../util/darray.h"
+#include "../util/circlebuf.h"
 
 #include "format-conversion.h"
 #include "video-io.h"
@@ -33,12 +34,26 @@ extern profiler_name_store_t *obs_get_profiler_name_store(void);
 #define MAX_CONVERT_BUFFERS 3
 #define MAX_CACHE_SIZE 16
 
+/* frames a threaded input may have waiting before it starts skipping */
+#define MAX_INPUT_QUEUE 2
+
+/* cache frames that always stay free of threaded inputs, so the video
+ * thread can keep outputting to the other inputs */
+#define MIN_UNPINNED_FRAMES 2
+
 struct cached_frame_info {
 	struct video_data frame;
 	int skipped;
 	int count;
+
+	/* waiting in the output queue */
+	bool queued;
+	/* frames of this slot queued to threaded inputs */
+	long refs;
 };
 
+struct video_input_worker;
+
 struct video_input {
 	struct video_scale_info   conversion;
 	video_scaler_t            *scaler;
@@ -47,10 +62,42 @@ struct video_input {
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
+
+	/* set if the input is called on its own thread */
+	struct video_input_worker *worker;
+};
+
+struct queued_frame {
+	size_t                    slot;
+	struct video_data         frame;
+};
+
+struct video_input_worker {
+	struct video_output       *video;
+	struct video_input        input;
+
+	pthread_t                 thread;
+	os_sem_t                  *sem;
+	volatile bool             stop;
+	bool                      detached;
+
+	pthread_mutex_t           mutex;
+	struct circlebuf          frames;
+	uint32_t                  total_frames;
+	uint32_t                  skipped_frames;
+	uint32_t                  pending_skipped;
+	uint32_t                  max_queued;
 };
 
+static void video_input_worker_stop(struct video_input_worker *worker);
+
 static inline void video_input_free(struct video_input *input)
 {
+	if (input->worker) {
+		video_input_worker_stop(input->worker);
+		return;
+	}
+
 	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
 		video_frame_free(&input->frame[i]);
 	video_scaler_destroy(input->scaler);
@@ -73,12 +120,49 @@ struct video_output {
 	pthread_mutex_t            input_mutex;
 	DARRAY(struct video_input) inputs;
 
-	size_t                     available_frames;
-	size_t                     first_added;
-	size_t                     last_added;
+	/* cache slots waiting to be output, oldest first.  a slot is free
+	 * once it has been output and threaded inputs are done with it */
+	size_t                     queue[MAX_CACHE_SIZE];
+	size_t                     queue_start;
+	size_t                     queue_size;
 	struct cached_frame_info   cache[MAX_CACHE_SIZE];
 };
 
+static inline size_t queue_slot(const struct video_output *video, size_t idx)
+{
+	return video->queue[(video->queue_start + idx) % video->info.cache_size];
+}
+
+static inline size_t find_free_slot(const struct video_output *video)
+{
+	for (size_t i = 0; i < video->info.cache_size; i++) {
+		const struct cached_frame_info *cfi = &video->cache[i];
+		if (!cfi->queued && !cfi->refs)
+			return i;
+	}
+
+	return DARRAY_INVALID;
+}
+
+static inline size_t num_pinned_slots(const struct video_output *video)
+{
+	size_t pinned = 0;
+
+	for (size_t i = 0; i < video->info.cache_size; i++) {
+		if (video->cache[i].refs)
+			pinned++;
+	}
+
+	return pinned;
+}
+
+static void release_cached_frame(struct video_output *video, size_t slot)
+{
+	pthread_mutex_lock(&video->data_mutex);
+	video->cache[slot].refs--;
+	pthread_mutex_unlock(&video->data_mutex);
+}
+
 /* ------------------------------------------------------------------------- */
 
 static inline bool scale_video_output(struct video_input *input,
@@ -112,9 +196,86 @@ static inline bool scale_video_output(struct video_input *input,
 	return success;
 }
 
+static void video_input_worker_free(struct video_input_worker *worker);
+
+static void *video_input_thread(void *param)
+{
+	struct video_input_worker *worker = param;
+	struct video_input *input = &worker->input;
+
+	os_set_thread_name("video-io: input thread");
+
+	while (os_sem_wait(worker->sem) == 0 && !worker->stop) {
+		struct queued_frame queued;
+
+		pthread_mutex_lock(&worker->mutex);
+		if (!worker->frames.size) {
+			pthread_mutex_unlock(&worker->mutex);
+			continue;
+		}
+		circlebuf_pop_front(&worker->frames, &queued, sizeof(queued));
+		pthread_mutex_unlock(&worker->mutex);
+
+		if (scale_video_output(input, &queued.frame))
+			input->callback(input->param, &queued.frame);
+
+		release_cached_frame(worker->video, queued.slot);
+	}
+
+	/* disconnected from its own callback */
+	if (worker->detached)
+		video_input_worker_free(worker);
+
+	return NULL;
+}
+
+/* hands a frame to a threaded input, or skips it if the input is still
+ * busy with earlier frames */
+static void queue_input_frame(struct video_output *video,
+		struct video_input_worker *worker, size_t slot,
+		struct video_data *frame)
+{
+	struct cached_frame_info *cfi = &video->cache[slot];
+	struct queued_frame queued = {slot, *frame};
+	size_t max_pinned = video->info.cache_size - MIN_UNPINNED_FRAMES;
+	bool pin;
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->total_frames++;
+
+	pthread_mutex_lock(&video->data_mutex);
+	pin = worker->frames.size / sizeof(queued) < MAX_INPUT_QUEUE &&
+		(cfi->refs || num_pinned_slots(video) < max_pinned);
+	if (pin)
+		cfi->refs++;
+	pthread_mutex_unlock(&video->data_mutex);
+
+	if (pin) {
+		uint32_t num;
+
+		queued.frame.skipped_frames = worker->pending_skipped;
+		worker->pending_skipped = 0;
+
+		circlebuf_push_back(&worker->frames, &queued, sizeof(queued));
+
+		num = (uint32_t)(worker->frames.size / sizeof(queued));
+		if (num > worker->max_queued)
+			worker->max_queued = num;
+	} else {
+		worker->skipped_frames++;
+		worker->pending_skipped++;
+	}
+
+	pthread_mutex_unlock(&worker->mutex);
+
+	if (pin)
+		os_sem_post(worker->sem);
+}
+
 static inline bool video_output_cur_frame(struct video_output *video)
 {
 	struct cached_frame_info *frame_info;
+	size_t slot;
 	bool complete;
 	bool skipped;
 
@@ -122,7 +283,13 @@ static inline bool video_output_cur_frame(struct video_output *video)
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	frame_info = &video->cache[video->first_added];
+	if (!video->queue_size) {
+		pthread_mutex_unlock(&video->data_mutex);
+		return true;
+	}
+
+	slot = queue_slot(video, 0);
+	frame_info = &video->cache[slot];
 
 	pthread_mutex_unlock(&video->data_mutex);
 
@@ -134,7 +301,9 @@ static inline bool video_output_cur_frame(struct video_output *video)
 		struct video_input *input = video->inputs.array+i;
 		struct video_data frame = frame_info->frame;
 
-		if (scale_video_output(input, &frame))
+		if (input->worker)
+			queue_input_frame(video, input->worker, slot, &frame);
+		else if (scale_video_output(input, &frame))
 			input->callback(input->param, &frame);
 	}
 
@@ -149,11 +318,11 @@ static inline bool video_output_cur_frame(struct video_output *video)
 	skipped = frame_info->skipped > 0;
 
 	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
+		frame_info->queued = false;
 
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
+		if (++video->queue_start == video->info.cache_size)
+			video->queue_start = 0;
+		video->queue_size--;
 	} else if (skipped) {
 		--frame_info->skipped;
 		++video->skipped_frames;
@@ -214,8 +383,6 @@ static inline void init_cache(struct video_output *video)
 		video_frame_init(frame, video->info.format,
 				video->info.width, video->info.height);
 	}
-
-	video->available_frames = video->info.cache_size;
 }
 
 int video_output_open(video_t **video, struct video_output_info *info)
@@ -328,10 +495,83 @@ static inline bool video_input_init(struct video_input *input,
 	return true;
 }
 
-bool video_output_connect(video_t *video,
+static struct video_input_worker *video_input_worker_create(
+		struct video_output *video, const struct video_input *input)
+{
+	struct video_input_worker *worker = bzalloc(sizeof(*worker));
+
+	worker->video = video;
+	worker->input = *input;
+
+	pthread_mutex_init_value(&worker->mutex);
+	if (pthread_mutex_init(&worker->mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&worker->sem, 0) != 0)
+		goto fail;
+	if (pthread_create(&worker->thread, NULL, video_input_thread,
+				worker) != 0)
+		goto fail;
+
+	return worker;
+
+fail:
+	os_sem_destroy(worker->sem);
+	pthread_mutex_destroy(&worker->mutex);
+	bfree(worker);
+	return NULL;
+}
+
+static void video_input_worker_free(struct video_input_worker *worker)
+{
+	struct video_input *input = &worker->input;
+
+	while (worker->frames.size) {
+		struct queued_frame queued;
+		circlebuf_pop_front(&worker->frames, &queued, sizeof(queued));
+		release_cached_frame(worker->video, queued.slot);
+	}
+
+	if (worker->skipped_frames)
+		blog(LOG_INFO, "video-io: threaded input stopped, number of "
+				"skipped frames due to encoding lag: "
+				"%"PRIu32"/%"PRIu32" (%0.1f%%), most frames "
+				"queued: %"PRIu32,
+				worker->skipped_frames, worker->total_frames,
+				(double)worker->skipped_frames /
+				(double)worker->total_frames * 100.0,
+				worker->max_queued);
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&input->frame[i]);
+	video_scaler_destroy(input->scaler);
+
+	circlebuf_free(&worker->frames);
+	os_sem_destroy(worker->sem);
+	pthread_mutex_destroy(&worker->mutex);
+	bfree(worker);
+}
+
+static void video_input_worker_stop(struct video_input_worker *worker)
+{
+	worker->stop = true;
+	os_sem_post(worker->sem);
+
+	/* can't join from the input's own callback, the thread frees the
+	 * worker itself once the callback returns */
+	if (pthread_equal(pthread_self(), worker->thread)) {
+		worker->detached = true;
+		pthread_detach(worker->thread);
+		return;
+	}
+
+	pthread_join(worker->thread, NULL);
+	video_input_worker_free(worker);
+}
+
+static bool connect_input(video_t *video,
 		const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
-		void *param)
+		void *param, bool threaded)
 {
 	bool success = false;
 
@@ -366,6 +606,23 @@ bool video_output_connect(video_t *video,
 			input.conversion.height = video->info.height;
 
 		success = video_input_init(&input, video);
+
+		if (success && threaded) {
+			struct video_input_worker *worker;
+
+			worker = video_input_worker_create(video, &input);
+			if (worker) {
+				memset(&input, 0, sizeof(input));
+				input.callback   = callback;
+				input.param      = param;
+				input.conversion = worker->input.conversion;
+				input.worker     = worker;
+			} else {
+				video_input_free(&input);
+				success = false;
+			}
+		}
+
 		if (success)
 			da_push_back(video->inputs, &input);
 	}
@@ -375,6 +632,22 @@ bool video_output_connect(video_t *video,
 	return success;
 }
 
+bool video_output_connect(video_t *video,
+		const struct video_scale_info *conversion,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
+{
+	return connect_input(video, conversion, callback, param, false);
+}
+
+bool video_output_connect_threaded(video_t *video,
+		const struct video_scale_info *conversion,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
+{
+	return connect_input(video, conversion, callback, param, true);
+}
+
 void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
@@ -407,6 +680,45 @@ void video_output_disconnect(video_t *video,
 	pthread_mutex_unlock(&video->input_mutex);
 }
 
+bool video_output_get_input_stats(video_t *video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param, struct video_input_stats *stats)
+{
+	bool found = false;
+
+	if (!video || !callback || !stats)
+		return false;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	size_t idx = video_get_input_idx(video, callback, param);
+	if (idx != DARRAY_INVALID) {
+		struct video_input_worker *worker =
+			video->inputs.array[idx].worker;
+
+		if (worker) {
+			pthread_mutex_lock(&worker->mutex);
+			stats->total_frames      = worker->total_frames;
+			stats->skipped_frames    = worker->skipped_frames;
+			stats->queued_frames     = (uint32_t)(worker->frames.size /
+					sizeof(struct queued_frame));
+			stats->max_queued_frames = worker->max_queued;
+			pthread_mutex_unlock(&worker->mutex);
+		} else {
+			stats->total_frames      = video->total_frames;
+			stats->skipped_frames    = video->skipped_frames;
+			stats->queued_frames     = 0;
+			stats->max_queued_frames = 0;
+		}
+
+		found = true;
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return found;
+}
+
 bool video_output_active(const video_t *video)
 {
 	if (!video) return false;
@@ -422,26 +734,34 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 		int count, uint64_t timestamp)
 {
 	struct cached_frame_info *cfi;
+	size_t slot;
 	bool locked;
 
 	if (!video) return false;
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
+	slot = find_free_slot(video);
+
+	if (slot == DARRAY_INVALID) {
+		if (video->queue_size) {
+			cfi = &video->cache[queue_slot(video,
+					video->queue_size - 1)];
+			cfi->count += count;
+			cfi->skipped += count;
+		} else {
+			video->skipped_frames += count;
+		}
 		locked = false;
 	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
-		}
+		video->queue[(video->queue_start + video->queue_size++) %
+			video->info.cache_size] = slot;
 
-		cfi = &video->cache[video->last_added];
+		cfi = &video->cache[slot];
 		cfi->frame.timestamp = timestamp;
 		cfi->count = count;
 		cfi->skipped = 0;
+		cfi->queued = true;
 
 		memcpy(frame, &cfi->frame, sizeof(*frame));
 
@@ -459,7 +779,6 @@ void video_output_unlock_frame(video_t *video)
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	video->available_frames--;
 	os_sem_post(video->update_semaphore);
 
 	pthread_mutex_unlock(&video->data_mutex);
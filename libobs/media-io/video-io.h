@@ -68,6 +68,10 @@ struct video_data {
 	uint8_t           *data[MAX_AV_PLANES];
 	uint32_t          linesize[MAX_AV_PLANES];
 	uint64_t          timestamp;
+
+	/* frames a threaded input skipped right before this one, so the
+	 * receiver can keep its timing.  always 0 for other inputs */
+	uint32_t          skipped_frames;
 };
 
 struct video_output_info {
@@ -140,6 +144,13 @@ struct video_scale_info {
 	enum video_colorspace colorspace;
 };
 
+struct video_input_stats {
+	uint32_t              total_frames;
+	uint32_t              skipped_frames;
+	uint32_t              queued_frames;
+	uint32_t              max_queued_frames;
+};
+
 EXPORT enum video_format video_format_from_fourcc(uint32_t fourcc);
 
 EXPORT bool video_format_get_parameters(enum video_colorspace color_space,
@@ -161,6 +172,22 @@ EXPORT void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param);
 
+/**
+ * Connects an input that is called on its own thread instead of the video
+ * thread, so a slow input does not hold up the others.  Frames stay in the
+ * output cache until the input is done with them; if the input falls too far
+ * behind, frames are skipped for that input only.
+ */
+EXPORT bool video_output_connect_threaded(video_t *video,
+		const struct video_scale_info *conversion,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param);
+
+/** Gets frame statistics of a connected input */
+EXPORT bool video_output_get_input_stats(video_t *video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param, struct video_input_stats *stats);
+
 EXPORT bool video_output_active(const video_t *video);
 
 EXPORT const struct video_output_info *video_output_get_info(
@@ -16,6 +16,7 @@
 ******************************************************************************/
 
 #include <inttypes.h>
+#include "media-io/audio-kernels.h"
 #include "obs-internal.h"
 
 struct ts_info {
@@ -30,7 +31,8 @@ static void push_audio_tree(obs_source_t *parent, obs_source_t *source, void *p)
 {
 	struct obs_core_audio *audio = p;
 
-	if (da_find(audio->render_order, &source, 0) == DARRAY_INVALID) {
+	if (source->audio_graph_mark != audio->graph_epoch) {
+		source->audio_graph_mark = audio->graph_epoch;
 		obs_source_addref(source);
 		da_push_back(audio->render_order, &source);
 	}
@@ -38,14 +40,64 @@ static void push_audio_tree(obs_source_t *parent, obs_source_t *source, void *p)
 	UNUSED_PARAMETER(parent);
 }
 
+/* rebuilds the render order of the output channel trees, only needed when
+ * a channel or an active child changed */
+static void update_audio_graph(struct obs_core_audio *audio)
+{
+	long gen = os_atomic_load_long(&audio->graph_gen);
+
+	if (audio->graph_valid && gen == audio->cached_graph_gen)
+		return;
+
+	audio->cached_graph_gen = gen;
+	audio->graph_valid = true;
+	audio->graph_epoch++;
+
+	for (size_t i = 0; i < audio->render_order.num; i++)
+		obs_source_release(audio->render_order.array[i]);
+	da_resize(audio->render_order, 0);
+	da_resize(audio->root_nodes, 0);
+
+	/* NOTE: these are source channels, not audio channels */
+	for (uint32_t i = 0; i < MAX_CHANNELS; i++) {
+		obs_source_t *source = obs_get_output_source(i);
+		if (source) {
+			obs_source_enum_active_tree(source, push_audio_tree,
+					audio);
+			push_audio_tree(NULL, source, audio);
+			da_push_back(audio->root_nodes, &source);
+			obs_source_release(source);
+		}
+	}
+}
+
+static void get_audio_sources(struct obs_core_data *data,
+		struct obs_core_audio *audio)
+{
+	struct obs_source *source;
+
+	da_resize(audio->audio_sources, 0);
+
+	pthread_mutex_lock(&data->audio_sources_mutex);
+
+	source = data->first_audio_source;
+	while (source) {
+		obs_source_addref(source);
+		da_push_back(audio->audio_sources, &source);
+		source = (struct obs_source*)source->next_audio_source;
+	}
+
+	pthread_mutex_unlock(&data->audio_sources_mutex);
+}
+
 static inline size_t convert_time_to_frames(size_t sample_rate, uint64_t t)
 {
 	return (size_t)(t * (uint64_t)sample_rate / 1000000000ULL);
 }
 
 static inline void mix_audio(struct audio_output_data *mixes,
-		obs_source_t *source, size_t channels, size_t sample_rate,
-		struct ts_info *ts)
+		obs_source_t *source, uint32_t mixers, size_t channels,
+		size_t sample_rate, struct ts_info *ts)
 {
 	size_t total_floats = AUDIO_OUTPUT_FRAMES;
 	size_t start_point = 0;
@@ -53,6 +105,11 @@ static inline void mix_audio(struct audio_output_data *mixes,
 	if (source->audio_ts < ts->start || ts->end <= source->audio_ts)
 		return;
 
+	/* output buffers of unrouted mixes are silent too */
+	mixers &= source->audio_mixers;
+	if (source->audio_silent || !mixers)
+		return;
+
 	if (source->audio_ts != ts->start) {
 		start_point = convert_time_to_frames(sample_rate,
 				source->audio_ts - ts->start);
@@ -63,17 +120,14 @@ static inline void mix_audio(struct audio_output_data *mixes,
 	}
 
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
-		for (size_t ch = 0; ch < channels; ch++) {
-			register float *mix = mixes[mix_idx].data[ch];
-			register float *aud =
-				source->audio_output_buf[mix_idx][ch];
-			register float *end;
+		if ((mixers & (1 << mix_idx)) == 0)
+			continue;
 
-			mix += start_point;
-			end = aud + total_floats;
+		for (size_t ch = 0; ch < channels; ch++) {
+			float *mix = mixes[mix_idx].data[ch];
+			float *aud = source->audio_output_buf[mix_idx][ch];
 
-			while (aud < end)
-				*(mix++) += *(aud++);
+			audio_kernel_add(mix + start_point, aud, total_floats);
 		}
 	}
 }
@@ -322,64 +376,62 @@ static bool audio_buffer_insuffient(struct obs_source *source,
 	return false;
 }
 
-static inline void find_min_ts(struct obs_core_data *data,
+static inline void find_min_ts(struct obs_core_audio *audio,
 		uint64_t *min_ts)
 {
-	struct obs_source *source = data->first_audio_source;
-	while (source) {
+	for (size_t i = 0; i < audio->audio_sources.num; i++) {
+		struct obs_source *source = audio->audio_sources.array[i];
+
 		if (!source->audio_pending && source->audio_ts &&
 				source->audio_ts < *min_ts)
 			*min_ts = source->audio_ts;
-
-		source = (struct obs_source*)source->next_audio_source;
 	}
 }
 
-static inline bool mark_invalid_sources(struct obs_core_data *data,
+static inline bool mark_invalid_sources(struct obs_core_audio *audio,
 		size_t sample_rate, uint64_t min_ts)
 {
 	bool recalculate = false;
 
-	struct obs_source *source = data->first_audio_source;
-	while (source) {
+	for (size_t i = 0; i < audio->audio_sources.num; i++) {
+		struct obs_source *source = audio->audio_sources.array[i];
 		recalculate |= audio_buffer_insuffient(source, sample_rate,
 				min_ts);
-		source = (struct obs_source*)source->next_audio_source;
 	}
 
 	return recalculate;
 }
 
-static inline void calc_min_ts(struct obs_core_data *data,
+static inline void calc_min_ts(struct obs_core_audio *audio,
 		size_t sample_rate, uint64_t *min_ts)
 {
-	find_min_ts(data, min_ts);
-	if (mark_invalid_sources(data, sample_rate, *min_ts))
-		find_min_ts(data, min_ts);
+	find_min_ts(audio, min_ts);
+	if (mark_invalid_sources(audio, sample_rate, *min_ts))
+		find_min_ts(audio, min_ts);
 }
 
 static inline void release_audio_sources(struct obs_core_audio *audio)
 {
-	for (size_t i = 0; i < audio->render_order.num; i++)
-		obs_source_release(audio->render_order.array[i]);
+	for (size_t i = 0; i < audio->audio_sources.num; i++)
+		obs_source_release(audio->audio_sources.array[i]);
 }
 
+static const char *render_audio_name = "render_audio";
+static const char *mix_audio_name = "mix_audio";
+static const char *discard_audio_name = "discard_audio";
+
 bool audio_callback(void *param,
 		uint64_t start_ts_in, uint64_t end_ts_in, uint64_t *out_ts,
 		uint32_t mixers, struct audio_output_data *mixes)
 {
 	struct obs_core_data *data = &obs->data;
 	struct obs_core_audio *audio = &obs->audio;
-	struct obs_source *source;
 	size_t sample_rate = audio_output_get_sample_rate(audio->audio);
 	size_t channels = audio_output_get_channels(audio->audio);
 	struct ts_info ts = {start_ts_in, end_ts_in};
 	size_t audio_size;
 	uint64_t min_ts;
 
-	da_resize(audio->render_order, 0);
-	da_resize(audio->root_nodes, 0);
-
 	circlebuf_push_back(&audio->buffered_timestamps, &ts, sizeof(ts));
 	circlebuf_peek_front(&audio->buffered_timestamps, &ts, sizeof(ts));
 	min_ts = ts.start;
@@ -391,42 +443,34 @@ bool audio_callback(void *param,
 #endif
 
 	/* ------------------------------------------------ */
-	/* build audio render order
-	 * NOTE: these are source channels, not audio channels */
-	for (uint32_t i = 0; i < MAX_CHANNELS; i++) {
-		obs_source_t *source = obs_get_output_source(i);
-		if (source) {
-			obs_source_enum_active_tree(source, push_audio_tree,
-					audio);
-			push_audio_tree(NULL, source, audio);
-			da_push_back(audio->root_nodes, &source);
-			obs_source_release(source);
-		}
-	}
-
-	pthread_mutex_lock(&data->audio_sources_mutex);
-
-	source = data->first_audio_source;
-	while (source) {
-		push_audio_tree(NULL, source, audio);
-		source = (struct obs_source*)source->next_audio_source;
-	}
-
-	pthread_mutex_unlock(&data->audio_sources_mutex);
+	/* get audio render order.  the audio source list is referenced for
+	 * the whole tick, so it doesn't need to be locked again */
+	update_audio_graph(audio);
+	get_audio_sources(data, audio);
 
 	/* ------------------------------------------------ */
 	/* render audio data */
+	profile_start(render_audio_name);
+
 	for (size_t i = 0; i < audio->render_order.num; i++) {
 		obs_source_t *source = audio->render_order.array[i];
 		obs_source_audio_render(source, mixers, channels, sample_rate,
 				audio_size);
 	}
 
+	/* audio sources outside of the output channel trees */
+	for (size_t i = 0; i < audio->audio_sources.num; i++) {
+		obs_source_t *source = audio->audio_sources.array[i];
+		if (source->audio_graph_mark != audio->graph_epoch)
+			obs_source_audio_render(source, mixers, channels,
+					sample_rate, audio_size);
+	}
+
+	profile_end(render_audio_name);
+
 	/* ------------------------------------------------ */
 	/* get minimum audio timestamp */
-	pthread_mutex_lock(&data->audio_sources_mutex);
-	calc_min_ts(data, sample_rate, &min_ts);
-	pthread_mutex_unlock(&data->audio_sources_mutex);
+	calc_min_ts(audio, sample_rate, &min_ts);
 
 	/* ------------------------------------------------ */
 	/* if a source has gone backward in time, buffer */
@@ -436,6 +480,8 @@ bool audio_callback(void *param,
 	/* ------------------------------------------------ */
 	/* mix audio */
 	if (!audio->buffering_wait_ticks) {
+		profile_start(mix_audio_name);
+
 		for (size_t i = 0; i < audio->root_nodes.num; i++) {
 			obs_source_t *source = audio->root_nodes.array[i];
 
@@ -445,27 +491,28 @@ bool audio_callback(void *param,
 			pthread_mutex_lock(&source->audio_buf_mutex);
 
 			if (source->audio_output_buf[0][0] && source->audio_ts)
-				mix_audio(mixes, source, channels, sample_rate,
-						&ts);
+				mix_audio(mixes, source, mixers, channels,
+						sample_rate, &ts);
 
 			pthread_mutex_unlock(&source->audio_buf_mutex);
 		}
+
+		profile_end(mix_audio_name);
 	}
 
 	/* ------------------------------------------------ */
 	/* discard audio */
-	pthread_mutex_lock(&data->audio_sources_mutex);
+	profile_start(discard_audio_name);
+
+	for (size_t i = 0; i < audio->audio_sources.num; i++) {
+		obs_source_t *source = audio->audio_sources.array[i];
 
-	source = data->first_audio_source;
-	while (source) {
 		pthread_mutex_lock(&source->audio_buf_mutex);
 		discard_audio(audio, source, channels, sample_rate, &ts);
 		pthread_mutex_unlock(&source->audio_buf_mutex);
-
-		source = (struct obs_source*)source->next_audio_source;
 	}
 
-	pthread_mutex_unlock(&data->audio_sources_mutex);
+	profile_end(discard_audio_name);
 
 	/* ------------------------------------------------ */
 	/* release audio sources */
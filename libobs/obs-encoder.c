@@ -196,8 +196,12 @@ static void add_connection(struct obs_encoder *encoder)
 		struct video_scale_info info = {0};
 		get_video_info(encoder, &info);
 
-		video_output_connect(encoder->media, &info, receive_video,
-			encoder);
+		if (encoder->threaded_video)
+			video_output_connect_threaded(encoder->media, &info,
+					receive_video, encoder);
+		else
+			video_output_connect(encoder->media, &info,
+					receive_video, encoder);
 	}
 
 	set_encoder_active(encoder, true);
@@ -587,6 +591,40 @@ void obs_encoder_set_scaled_size(obs_encoder_t *encoder, uint32_t width,
 	encoder->scaled_height = height;
 }
 
+void obs_encoder_set_threaded(obs_encoder_t *encoder, bool threaded)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_set_threaded"))
+		return;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING, "obs_encoder_set_threaded: "
+				"encoder '%s' is not a video encoder",
+				obs_encoder_get_name(encoder));
+		return;
+	}
+	if (encoder_active(encoder)) {
+		blog(LOG_WARNING, "encoder '%s': Cannot change threading "
+		                  "while the encoder is active",
+		                  obs_encoder_get_name(encoder));
+		return;
+	}
+
+	encoder->threaded_video = threaded;
+}
+
+bool obs_encoder_get_video_stats(const obs_encoder_t *encoder,
+		struct video_input_stats *stats)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_video_stats"))
+		return false;
+	if (!obs_ptr_valid(stats, "obs_encoder_get_video_stats"))
+		return false;
+	if (encoder->info.type != OBS_ENCODER_VIDEO || !encoder->media)
+		return false;
+
+	return video_output_get_input_stats(encoder->media, receive_video,
+			(void*)encoder, stats);
+}
+
 uint32_t obs_encoder_get_width(const obs_encoder_t *encoder)
 {
 	if (!obs_encoder_valid(encoder, "obs_encoder_get_width"))
@@ -728,6 +766,7 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 		struct encoder_callback *cb, struct encoder_packet *packet)
 {
 	struct encoder_packet first_packet;
+	struct encoder_packet sei_packet;
 	DARRAY(uint8_t)       data;
 	uint8_t               *sei;
 	size_t                size;
@@ -747,14 +786,18 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 	da_push_back_array(data, sei, size);
 	da_push_back_array(data, packet->data, packet->size);
 
-	first_packet      = *packet;
-	first_packet.data = data.array;
-	first_packet.size = data.num;
+	sei_packet      = *packet;
+	sei_packet.data = data.array;
+	sei_packet.size = data.num;
+
+	/* outputs reference packet data, so it has to be refcounted */
+	obs_encoder_packet_create_instance(&first_packet, &sei_packet);
+	da_free(data);
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
 
-	da_free(data);
+	obs_encoder_packet_release(&first_packet);
 }
 
 static inline void send_packet(struct obs_encoder *encoder,
@@ -820,10 +863,19 @@ static inline void do_encode(struct obs_encoder *encoder,
 
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
-		for (size_t i = encoder->callbacks.num; i > 0; i--) {
-			struct encoder_callback *cb;
-			cb = encoder->callbacks.array+(i-1);
-			send_packet(encoder, cb, &pkt);
+		/* copy the encoder's buffer once, outputs take references to
+		 * the copy instead of each making their own */
+		if (encoder->callbacks.num) {
+			struct encoder_packet shared;
+			obs_encoder_packet_create_instance(&shared, &pkt);
+
+			for (size_t i = encoder->callbacks.num; i > 0; i--) {
+				struct encoder_callback *cb;
+				cb = encoder->callbacks.array+(i-1);
+				send_packet(encoder, cb, &shared);
+			}
+
+			obs_encoder_packet_release(&shared);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
@@ -874,6 +926,11 @@ static void receive_video(void *param, struct video_data *frame)
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
 
+	/* frames skipped by a threaded input still take up time */
+	if (encoder->first_received)
+		encoder->cur_pts += (int64_t)frame->skipped_frames *
+			encoder->timebase_num;
+
 	enc_frame.frames = 1;
 	enc_frame.pts    = encoder->cur_pts;
 
@@ -1055,15 +1112,182 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+/* ------------------------------------------------------------------------- */
+/* packet pool
+ *
+ * Packet data keeps the usual layout of a refcount long directly in front of
+ * the data, so obs_encoder_packet_ref/release work the same on pooled and
+ * plain bmalloc'd packets (such as the ones from obs_parse_avc_packet).
+ * Pooled blocks additionally carry a pool_block header in front of the
+ * refcount, and have PACKET_POOL_FLAG set in the refcount so release knows
+ * where to return them. */
+
+#define PACKET_POOL_FLAG        0x40000000L
+#define PACKET_POOL_MIN_SHIFT   9  /* 512 bytes */
+#define PACKET_POOL_MAX_SHIFT   22 /* 4 megabytes */
+#define PACKET_POOL_CLASSES     \
+	(PACKET_POOL_MAX_SHIFT - PACKET_POOL_MIN_SHIFT + 1)
+#define PACKET_POOL_CLASS_BYTES (8 * 1024 * 1024)
+#define PACKET_POOL_CLASS_MIN   4
+
+struct pool_block {
+	struct pool_block *next;
+	size_t            class_idx;
+	long              refs;
+};
+
+struct pool_class {
+	struct pool_block *free_list;
+	size_t            num_free;
+};
+
+static struct {
+	pthread_mutex_t   mutex;
+	struct pool_class classes[PACKET_POOL_CLASSES];
+	bool              shutdown;
+
+	uint64_t          hits;
+	uint64_t          misses;
+	size_t            resident_bytes;
+} packet_pool = {PTHREAD_MUTEX_INITIALIZER};
+
+static inline size_t pool_class_size(size_t class_idx)
+{
+	return (size_t)1 << (class_idx + PACKET_POOL_MIN_SHIFT);
+}
+
+static inline size_t pool_class_max_free(size_t class_idx)
+{
+	size_t max_free = PACKET_POOL_CLASS_BYTES / pool_class_size(class_idx);
+	return max_free > PACKET_POOL_CLASS_MIN ?
+		max_free : PACKET_POOL_CLASS_MIN;
+}
+
+static bool pool_get_class(size_t size, size_t *class_idx)
+{
+	size_t idx = 0;
+
+	size += offsetof(struct pool_block, refs) + sizeof(long);
+
+	while (pool_class_size(idx) < size) {
+		if (++idx == PACKET_POOL_CLASSES)
+			return false;
+	}
+
+	*class_idx = idx;
+	return true;
+}
+
+static long *pool_alloc(size_t size)
+{
+	struct pool_block *block = NULL;
+	size_t class_idx;
+
+	if (!pool_get_class(size, &class_idx)) {
+		long *p_refs = bmalloc(size + sizeof(long));
+		*p_refs = 1;
+
+		pthread_mutex_lock(&packet_pool.mutex);
+		packet_pool.misses++;
+		pthread_mutex_unlock(&packet_pool.mutex);
+		return p_refs;
+	}
+
+	pthread_mutex_lock(&packet_pool.mutex);
+	block = packet_pool.classes[class_idx].free_list;
+	if (block) {
+		packet_pool.classes[class_idx].free_list = block->next;
+		packet_pool.classes[class_idx].num_free--;
+		packet_pool.resident_bytes -= pool_class_size(class_idx);
+		packet_pool.hits++;
+	} else {
+		packet_pool.misses++;
+	}
+	pthread_mutex_unlock(&packet_pool.mutex);
+
+	if (!block) {
+		block = bmalloc(pool_class_size(class_idx));
+		block->class_idx = class_idx;
+	}
+
+	block->next = NULL;
+	block->refs = PACKET_POOL_FLAG | 1;
+	return &block->refs;
+}
+
+static void pool_free(long *p_refs)
+{
+	struct pool_block *block = (struct pool_block*)((uint8_t*)p_refs -
+			offsetof(struct pool_block, refs));
+	size_t class_idx = block->class_idx;
+	struct pool_class *pc = &packet_pool.classes[class_idx];
+
+	pthread_mutex_lock(&packet_pool.mutex);
+	if (!packet_pool.shutdown &&
+	    pc->num_free < pool_class_max_free(class_idx)) {
+		block->next = pc->free_list;
+		pc->free_list = block;
+		pc->num_free++;
+		packet_pool.resident_bytes += pool_class_size(class_idx);
+		block = NULL;
+	}
+	pthread_mutex_unlock(&packet_pool.mutex);
+
+	bfree(block);
+}
+
+void obs_encoder_packet_pool_init(void)
+{
+	pthread_mutex_lock(&packet_pool.mutex);
+	packet_pool.shutdown = false;
+	packet_pool.hits = 0;
+	packet_pool.misses = 0;
+	pthread_mutex_unlock(&packet_pool.mutex);
+}
+
+void obs_encoder_packet_pool_free(void)
+{
+	pthread_mutex_lock(&packet_pool.mutex);
+	packet_pool.shutdown = true;
+
+	for (size_t i = 0; i < PACKET_POOL_CLASSES; i++) {
+		struct pool_block *block = packet_pool.classes[i].free_list;
+
+		while (block) {
+			struct pool_block *next = block->next;
+			bfree(block);
+			block = next;
+		}
+
+		packet_pool.classes[i].free_list = NULL;
+		packet_pool.classes[i].num_free = 0;
+	}
+
+	packet_pool.resident_bytes = 0;
+	pthread_mutex_unlock(&packet_pool.mutex);
+}
+
+void obs_encoder_packet_pool_get_stats(
+		struct obs_encoder_packet_pool_stats *stats)
+{
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&packet_pool.mutex);
+	stats->hits           = packet_pool.hits;
+	stats->misses         = packet_pool.misses;
+	stats->resident_bytes = packet_pool.resident_bytes;
+	pthread_mutex_unlock(&packet_pool.mutex);
+}
+
 void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
 	long *p_refs;
 
 	*dst = *src;
-	p_refs = bmalloc(src->size + sizeof(long));
+	p_refs = pool_alloc(src->size);
 	dst->data = (void*)(p_refs + 1);
-	*p_refs = 1;
 	memcpy(dst->data, src->data, src->size);
 }
 
@@ -1099,8 +1323,14 @@ void obs_encoder_packet_release(struct encoder_packet *pkt)
 
 	if (pkt->data) {
 		long *p_refs = ((long*)pkt->data) - 1;
-		if (os_atomic_dec_long(p_refs) == 0)
-			bfree(p_refs);
+		long refs = os_atomic_dec_long(p_refs);
+
+		if ((refs & ~PACKET_POOL_FLAG) == 0) {
+			if (refs & PACKET_POOL_FLAG)
+				pool_free(p_refs);
+			else
+				bfree(p_refs);
+		}
 	}
 
 	memset(pkt, 0, sizeof(struct encoder_packet));
@@ -0,0 +1,192 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "obs.h"
+#include "util/circlebuf.h"
+
+/*
+ * Output packet interleaver, used by obs-output.c.  Kept in a header of its
+ * own so test/test-interleave can benchmark it.
+ */
+
+/* interleaver tracks, 0 is video and 1 + track_idx is audio */
+#define INTERLEAVE_TRACKS (MAX_AUDIO_MIXES + 1)
+
+struct interleaved_packet {
+	struct encoder_packet packet;
+	uint64_t seq;
+};
+
+/* per-track FIFOs of interleaved_packet, merged through a min-heap of the
+ * non-empty tracks keyed on their front packet */
+struct packet_interleaver {
+	struct circlebuf tracks[INTERLEAVE_TRACKS];
+	size_t heap[INTERLEAVE_TRACKS];
+	size_t heap_size;
+	uint64_t next_seq;
+};
+
+static inline size_t interleave_track(const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO ? 0 : packet->track_idx + 1;
+}
+
+/* lowest dts first, video before audio on equal dts, otherwise in the order
+ * the packets were received */
+static inline bool interleaved_before(const struct interleaved_packet *a,
+		const struct interleaved_packet *b)
+{
+	if (a->packet.dts_usec != b->packet.dts_usec)
+		return a->packet.dts_usec < b->packet.dts_usec;
+	if (a->packet.type != b->packet.type)
+		return a->packet.type == OBS_ENCODER_VIDEO;
+	return a->seq < b->seq;
+}
+
+static inline struct interleaved_packet *track_first(
+		struct packet_interleaver *il, size_t track)
+{
+	struct circlebuf *cb = &il->tracks[track];
+	return cb->size ? circlebuf_data(cb, 0) : NULL;
+}
+
+static inline struct interleaved_packet *track_last(
+		struct packet_interleaver *il, size_t track)
+{
+	struct circlebuf *cb = &il->tracks[track];
+	return cb->size ? circlebuf_data(cb,
+			cb->size - sizeof(struct interleaved_packet)) : NULL;
+}
+
+static inline bool heap_less(struct packet_interleaver *il, size_t a,
+		size_t b)
+{
+	return interleaved_before(track_first(il, il->heap[a]),
+			track_first(il, il->heap[b]));
+}
+
+static inline void heap_swap(struct packet_interleaver *il, size_t a,
+		size_t b)
+{
+	size_t track = il->heap[a];
+	il->heap[a] = il->heap[b];
+	il->heap[b] = track;
+}
+
+static inline void heap_sift_up(struct packet_interleaver *il, size_t idx)
+{
+	while (idx) {
+		size_t parent = (idx - 1) / 2;
+		if (!heap_less(il, idx, parent))
+			break;
+
+		heap_swap(il, idx, parent);
+		idx = parent;
+	}
+}
+
+static inline void heap_sift_down(struct packet_interleaver *il, size_t idx)
+{
+	for (;;) {
+		size_t left  = idx * 2 + 1;
+		size_t right = left + 1;
+		size_t min   = idx;
+
+		if (left < il->heap_size && heap_less(il, left, min))
+			min = left;
+		if (right < il->heap_size && heap_less(il, right, min))
+			min = right;
+		if (min == idx)
+			break;
+
+		heap_swap(il, idx, min);
+		idx = min;
+	}
+}
+
+/* needed whenever the timestamps of queued packets change */
+static inline void interleaver_rebuild(struct packet_interleaver *il)
+{
+	il->heap_size = 0;
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		if (il->tracks[i].size)
+			il->heap[il->heap_size++] = i;
+	}
+
+	for (size_t i = il->heap_size / 2; i > 0; i--)
+		heap_sift_down(il, i - 1);
+}
+
+/* packets of a track are expected in dts order, which every encoder
+ * guarantees, so only the front packet of each track is ever compared */
+static inline void interleaver_push(struct packet_interleaver *il,
+		struct encoder_packet *packet)
+{
+	struct interleaved_packet entry;
+	size_t track = interleave_track(packet);
+	bool was_empty = il->tracks[track].size == 0;
+
+	entry.packet = *packet;
+	entry.seq = il->next_seq++;
+	circlebuf_push_back(&il->tracks[track], &entry, sizeof(entry));
+
+	if (was_empty) {
+		il->heap[il->heap_size] = track;
+		heap_sift_up(il, il->heap_size++);
+	}
+}
+
+static inline struct interleaved_packet *interleaver_peek(
+		struct packet_interleaver *il)
+{
+	return il->heap_size ? track_first(il, il->heap[0]) : NULL;
+}
+
+static inline void interleaver_pop(struct packet_interleaver *il,
+		struct encoder_packet *packet)
+{
+	struct interleaved_packet entry;
+	size_t track = il->heap[0];
+
+	circlebuf_pop_front(&il->tracks[track], &entry, sizeof(entry));
+	*packet = entry.packet;
+
+	if (!il->tracks[track].size)
+		il->heap[0] = il->heap[--il->heap_size];
+	if (il->heap_size)
+		heap_sift_down(il, 0);
+}
+
+static inline void interleaver_free(struct packet_interleaver *il)
+{
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct circlebuf *cb = &il->tracks[i];
+
+		while (cb->size) {
+			struct interleaved_packet entry;
+			circlebuf_pop_front(cb, &entry, sizeof(entry));
+			obs_encoder_packet_release(&entry.packet);
+		}
+
+		circlebuf_free(cb);
+	}
+
+	il->heap_size = 0;
+	il->next_seq = 0;
+}
@@ -35,10 +35,13 @@
 #include "media-io/audio-io.h"
 
 #include "obs.h"
+#include "obs-interleaver.h"
 
 #include "graphics/face_beauty/face_beauty.h"
 #include "graphics/context-partition.h"
 #define NUM_TEXTURES 2
+#define DEFAULT_STAGING_DEPTH 3
+#define MAX_STAGING_DEPTH 8
 #define MICROSECOND_DEN 1000000
 
 static inline int64_t packet_dts_usec(struct encoder_packet *packet)
@@ -224,14 +227,20 @@ struct obs_vframe_info {
 
 struct obs_core_video {
 	graphics_t                      *graphics;
-	gs_stagesurf_t                  *copy_surfaces[NUM_TEXTURES];
 	gs_texture_t                    *render_textures[NUM_TEXTURES];
 	gs_texture_t                    *output_textures[NUM_TEXTURES];
 	gs_texture_t                    *convert_textures[NUM_TEXTURES];
 	bool                            textures_rendered[NUM_TEXTURES];
 	bool                            textures_output[NUM_TEXTURES];
-	bool                            textures_copied[NUM_TEXTURES];
 	bool                            textures_converted[NUM_TEXTURES];
+
+	/* staging surfaces in flight to the CPU, downloaded oldest first as
+	 * soon as their copy has finished, or when the ring is full */
+	gs_stagesurf_t                  *copy_surfaces[MAX_STAGING_DEPTH];
+	uint32_t                        staging_depth_setting;
+	int                             staging_depth;
+	int                             first_staged;
+	int                             num_staged;
 	struct circlebuf                vframe_info_buffer;
 	gs_effect_t                     *default_effect;
 	gs_effect_t                     *default_rect_effect;
@@ -281,6 +290,9 @@ struct obs_core_video {
 	gs_effect_t                     *deinterlace_yadif_2x_effect;
 
 	struct obs_video_info           ovi;
+
+	volatile long                   face_beauty_latency;
+	volatile long                   face_beauty_dropped;
 };
 
 struct audio_monitor;
@@ -288,8 +300,17 @@ struct audio_monitor;
 struct obs_core_audio {
 	audio_t                         *audio;
 
+	/* active trees of the output channels, children first.  cached
+	 * (with a reference to each source) until graph_gen changes */
 	DARRAY(struct obs_source*)      render_order;
 	DARRAY(struct obs_source*)      root_nodes;
+	volatile long                   graph_gen;
+	long                            cached_graph_gen;
+	bool                            graph_valid;
+	uint64_t                        graph_epoch;
+
+	/* audio sources referenced for the current tick */
+	DARRAY(struct obs_source*)      audio_sources;
 
 	uint64_t                        buffered_ts;
 	struct circlebuf                buffered_timestamps;
@@ -396,6 +417,13 @@ struct obs_core {
 
 extern struct obs_core *obs;
 
+/* marks the cached audio render order as stale */
+static inline void obs_audio_graph_changed(void)
+{
+	if (obs)
+		os_atomic_inc_long(&obs->audio.graph_gen);
+}
+
 extern void *obs_video_thread(void *param);
 
 extern gs_effect_t *obs_load_effect(gs_effect_t **effect, const char *file);
@@ -571,6 +599,13 @@ struct obs_source {
 	bool                            audio_failed;
 	bool                            audio_pending;
 	bool                            pending_stop;
+
+	/* output buffers hold only silence this tick (muted, zero volume
+	 * or not routed to any active mix), so mixing can skip the source */
+	bool                            audio_silent;
+
+	/* graph_epoch of the audio render order this source is in */
+	uint64_t                        audio_graph_mark;
 	bool                            user_muted;
 	bool                            muted;
 	struct obs_source               *next_audio_source;
@@ -686,6 +721,26 @@ struct obs_source {
 	
 	//face beauty add by cuijun.qcj
 	struct FACE_BEAUTY_ENGINE* fb_engine;
+	/* frame layout the engine last failed to set up for, so it isn't
+	 * retried on every frame */
+	enum video_format               fb_failed_format;
+	uint32_t                        fb_failed_width;
+	uint32_t                        fb_failed_height;
+
+	/* face beauty worker, keeps the beauty pass off the capture thread */
+	pthread_t                       beauty_thread;
+	pthread_mutex_t                 beauty_mutex;
+	os_sem_t                        *beauty_sem;
+	struct circlebuf                beauty_queue;
+	DARRAY(struct obs_source_frame*)beauty_free_frames;
+	bool                            beauty_thread_active;
+	/* bumped when the queue is flushed, frames of an older generation
+	 * that are still in flight on the worker are not published.  read
+	 * without beauty_mutex when publishing, so it is atomic */
+	volatile long                   beauty_gen;
+	volatile bool                   beauty_stop;
+	volatile long                   beauty_latency;
+	volatile long                   beauty_dropped;
 
 	obs_data_t                      *private_settings;
 
@@ -833,7 +888,7 @@ struct obs_output {
 	pthread_t                       end_data_capture_thread;
 	os_event_t                      *stopping_event;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	struct packet_interleaver       interleaved_packets;
 	int                             stop_code;
 
 	int                             reconnect_retry_sec;
@@ -915,6 +970,8 @@ extern void obs_output_remove_encoder(struct obs_output *output,
 
 extern void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 		const struct encoder_packet *src);
+extern void obs_encoder_packet_pool_init(void);
+extern void obs_encoder_packet_pool_free(void);
 void obs_output_destroy(obs_output_t *output);
 
 
@@ -954,6 +1011,9 @@ struct obs_encoder {
 	volatile bool                   active;
 	bool                            initialized;
 
+	/* video encoders only, receive frames on their own thread */
+	bool                            threaded_video;
+
 	/* indicates ownership of the info.id buffer */
 	bool                            owns_info_id;
 
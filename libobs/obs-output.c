@@ -168,9 +168,7 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_encoder_packet_release(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
+	interleaver_free(&output->interleaved_packets);
 }
 
 void obs_output_destroy(obs_output_t *output)
@@ -1017,15 +1015,20 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct interleaved_packet *next;
+	struct encoder_packet out;
+
+	next = interleaver_peek(&output->interleaved_packets);
+	if (!next)
+		return;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timestamp in the interleave buffer.
 	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
+	if (!has_higher_opposing_ts(output, &next->packet))
 		return;
 
-	da_erase(output->interleaved_packets, 0);
+	interleaver_pop(&output->interleaved_packets, &out);
 
 	if (out.type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
@@ -1070,113 +1073,141 @@ static inline void set_higher_ts(struct obs_output *output,
 	}
 }
 
-static inline struct encoder_packet *find_first_packet_type(
+static inline struct interleaved_packet *find_first_packet_type(
 		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx);
-static int find_first_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx);
+		size_t audio_idx)
+{
+	size_t track = type == OBS_ENCODER_VIDEO ? 0 : audio_idx + 1;
+	return track_first(&output->interleaved_packets, track);
+}
+
+static inline struct interleaved_packet *find_last_packet_type(
+		struct obs_output *output, enum obs_encoder_type type,
+		size_t audio_idx)
+{
+	size_t track = type == OBS_ENCODER_VIDEO ? 0 : audio_idx + 1;
+	return track_last(&output->interleaved_packets, track);
+}
 
 /* gets the point where audio and video are closest together */
-static size_t get_interleaved_start_idx(struct obs_output *output)
+static struct interleaved_packet *get_interleaved_start(
+		struct obs_output *output)
 {
+	struct packet_interleaver *il = &output->interleaved_packets;
 	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
-	struct encoder_packet *first_video = find_first_packet_type(output,
+	struct interleaved_packet *first_video = find_first_packet_type(output,
 			OBS_ENCODER_VIDEO, 0);
-	size_t video_idx = DARRAY_INVALID;
-	size_t idx = 0;
-
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		int64_t diff;
-
-		if (packet->type != OBS_ENCODER_AUDIO) {
-			if (packet == first_video)
-				video_idx = i;
-			continue;
-		}
-
-		diff = llabs(packet->dts_usec - first_video->dts_usec);
-		if (diff < closest_diff) {
-			closest_diff = diff;
-			idx = i;
+	struct interleaved_packet *closest = NULL;
+
+	for (size_t i = 1; i < INTERLEAVE_TRACKS; i++) {
+		struct circlebuf *cb = &il->tracks[i];
+		size_t num = cb->size / sizeof(struct interleaved_packet);
+
+		for (size_t j = 0; j < num; j++) {
+			struct interleaved_packet *packet = circlebuf_data(cb,
+					j * sizeof(struct interleaved_packet));
+			int64_t diff = llabs(packet->packet.dts_usec -
+					first_video->packet.dts_usec);
+
+			if (diff < closest_diff ||
+			    (diff == closest_diff && closest &&
+			     interleaved_before(packet, closest))) {
+				closest_diff = diff;
+				closest = packet;
+			}
 		}
 	}
 
-	return video_idx < idx ? video_idx : idx;
+	if (!closest)
+		return NULL;
+
+	return interleaved_before(first_video, closest) ? first_video : closest;
 }
 
-static int prune_premature_packets(struct obs_output *output)
+/* returns -1 if a track has no packets yet, otherwise 1 if everything up to
+ * and including *last should be pruned */
+static int prune_premature_packets(struct obs_output *output,
+		struct interleaved_packet **last)
 {
 	size_t audio_mixes = num_audio_mixes(output);
-	struct encoder_packet *video;
-	int video_idx;
-	int max_idx;
+	struct interleaved_packet *video;
 	int64_t duration_usec;
 	int64_t max_diff = 0;
 	int64_t diff = 0;
 
-	video_idx = find_first_packet_type_idx(output, OBS_ENCODER_VIDEO, 0);
-	if (video_idx == -1) {
+	video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
+	if (!video) {
 		output->received_video = false;
 		return -1;
 	}
 
-	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
-	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
+	*last = video;
+	duration_usec = video->packet.timebase_num * 1000000LL /
+		video->packet.timebase_den;
 
 	for (size_t i = 0; i < audio_mixes; i++) {
-		struct encoder_packet *audio;
-		int audio_idx;
+		struct interleaved_packet *audio;
 
-		audio_idx = find_first_packet_type_idx(output,
-				OBS_ENCODER_AUDIO, i);
-		if (audio_idx == -1) {
+		audio = find_first_packet_type(output, OBS_ENCODER_AUDIO, i);
+		if (!audio) {
 			output->received_audio = false;
 			return -1;
 		}
 
-		audio = &output->interleaved_packets.array[audio_idx];
-		if (audio_idx > max_idx)
-			max_idx = audio_idx;
+		if (interleaved_before(*last, audio))
+			*last = audio;
 
-		diff = audio->dts_usec - video->dts_usec;
+		diff = audio->packet.dts_usec - video->packet.dts_usec;
 		if (diff > max_diff)
 			max_diff = diff;
 	}
 
-	return diff > duration_usec ? max_idx + 1 : 0;
+	return diff > duration_usec ? 1 : 0;
 }
 
-static void discard_to_idx(struct obs_output *output, size_t idx)
+/* discards every packet sent before the given one (and that one itself if
+ * inclusive is set) */
+static void discard_packets(struct obs_output *output,
+		const struct interleaved_packet *until, bool inclusive)
 {
-	for (size_t i = 0; i < idx; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		obs_encoder_packet_release(packet);
-	}
+	struct packet_interleaver *il = &output->interleaved_packets;
+	struct interleaved_packet key = *until;
+	struct interleaved_packet *next;
 
-	da_erase_range(output->interleaved_packets, 0, idx);
+	while ((next = interleaver_peek(il)) != NULL) {
+		struct encoder_packet packet;
+
+		if (!interleaved_before(next, &key) &&
+		    !(inclusive && next->seq == key.seq))
+			break;
+
+		interleaver_pop(il, &packet);
+		obs_encoder_packet_release(&packet);
+	}
 }
 
 #define DEBUG_STARTING_PACKETS 0
 
 static bool prune_interleaved_packets(struct obs_output *output)
 {
-	size_t start_idx = 0;
-	int prune_start = prune_premature_packets(output);
+	struct interleaved_packet *start = NULL;
+	int prune_start = prune_premature_packets(output, &start);
 
 #if DEBUG_STARTING_PACKETS == 1
 	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
-				packet->type == OBS_ENCODER_AUDIO ?
-				"audio" : "video", (int)packet->track_idx,
-				packet->dts_usec,
-				(int)i < prune_start ? "true" : "false");
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct circlebuf *cb = &output->interleaved_packets.tracks[i];
+		size_t num = cb->size / sizeof(struct interleaved_packet);
+
+		for (size_t j = 0; j < num; j++) {
+			struct interleaved_packet *packet = circlebuf_data(cb,
+					j * sizeof(struct interleaved_packet));
+			blog(LOG_DEBUG, "packet: %s %d, ts: %lld",
+					packet->packet.type ==
+					OBS_ENCODER_AUDIO ? "audio" : "video",
+					(int)packet->packet.track_idx,
+					packet->packet.dts_usec);
+		}
 	}
 #endif
 
@@ -1184,75 +1215,16 @@ static bool prune_interleaved_packets(struct obs_output *output)
 	if (prune_start == -1)
 		return false;
 	else if (prune_start != 0)
-		start_idx = (size_t)prune_start;
-	else
-		start_idx = get_interleaved_start_idx(output);
-
-	if (start_idx)
-		discard_to_idx(output, start_idx);
+		discard_packets(output, start, true);
+	else if ((start = get_interleaved_start(output)) != NULL)
+		discard_packets(output, start, false);
 
 	return true;
 }
 
-static int find_first_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)i;
-		}
-	}
-
-	return -1;
-}
-
-static int find_last_packet_type_idx(struct obs_output *output,
-		enum obs_encoder_type type, size_t audio_idx)
-{
-	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)(i - 1);
-		}
-	}
-
-	return -1;
-}
-
-static inline struct encoder_packet *find_first_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx)
-{
-	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
-static inline struct encoder_packet *find_last_packet_type(
-		struct obs_output *output, enum obs_encoder_type type,
-		size_t audio_idx)
-{
-	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
-}
-
 static bool get_audio_and_video_packets(struct obs_output *output,
-		struct encoder_packet **video,
-		struct encoder_packet **audio, size_t audio_mixes)
+		struct interleaved_packet **video,
+		struct interleaved_packet **audio, size_t audio_mixes)
 {
 	*video = find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
 	if (!*video)
@@ -1275,11 +1247,12 @@ static bool get_audio_and_video_packets(struct obs_output *output,
 
 static bool initialize_interleaved_packets(struct obs_output *output)
 {
-	struct encoder_packet *video;
-	struct encoder_packet *audio[MAX_AUDIO_MIXES];
-	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
+	struct packet_interleaver *il = &output->interleaved_packets;
+	struct interleaved_packet *video;
+	struct interleaved_packet *audio[MAX_AUDIO_MIXES];
+	struct interleaved_packet *last_audio[MAX_AUDIO_MIXES];
+	struct interleaved_packet *start;
 	size_t audio_mixes = num_audio_mixes(output);
-	size_t start_idx;
 
 	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
 		return false;
@@ -1290,29 +1263,29 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 
 	/* ensure that there is audio past the first video packet */
 	for (size_t i = 0; i < audio_mixes; i++) {
-		if (last_audio[i]->dts_usec < video->dts_usec) {
+		if (last_audio[i]->packet.dts_usec < video->packet.dts_usec) {
 			output->received_audio = false;
 			return false;
 		}
 	}
 
 	/* clear out excess starting audio if it hasn't been already */
-	start_idx = get_interleaved_start_idx(output);
-	if (start_idx) {
-		discard_to_idx(output, start_idx);
+	start = get_interleaved_start(output);
+	if (start && start != interleaver_peek(il)) {
+		discard_packets(output, start, false);
 		if (!get_audio_and_video_packets(output, &video, audio,
 					audio_mixes))
 			return false;
 	}
 
 	/* get new offsets */
-	output->video_offset = video->pts;
+	output->video_offset = video->packet.pts;
 	for (size_t i = 0; i < audio_mixes; i++)
-		output->audio_offsets[i] = audio[i]->dts;
+		output->audio_offsets[i] = audio[i]->packet.dts;
 
 #if DEBUG_STARTING_PACKETS == 1
-	int64_t v = video->dts_usec;
-	int64_t a = audio[0]->dts_usec;
+	int64_t v = video->packet.dts_usec;
+	int64_t a = audio[0]->packet.dts_usec;
 	int64_t diff = v - a;
 
 	blog(LOG_DEBUG, "output '%s' offset for video: %lld, audio: %lld, "
@@ -1321,67 +1294,43 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 #endif
 
 	/* subtract offsets from highest TS offset variables */
-	output->highest_audio_ts -= audio[0]->dts_usec;
-	output->highest_video_ts -= video->dts_usec;
+	output->highest_audio_ts -= audio[0]->packet.dts_usec;
+	output->highest_video_ts -= video->packet.dts_usec;
 
 	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
-	}
-
-	return true;
-}
-
-static inline void insert_interleaved_packet(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO) {
-			break;
-		} else if (out->dts_usec < cur_packet->dts_usec) {
-			break;
+	for (size_t i = 0; i < INTERLEAVE_TRACKS; i++) {
+		struct circlebuf *cb = &il->tracks[i];
+		size_t num = cb->size / sizeof(struct interleaved_packet);
+
+		for (size_t j = 0; j < num; j++) {
+			struct interleaved_packet *packet = circlebuf_data(cb,
+					j * sizeof(struct interleaved_packet));
+			apply_interleaved_packet_offset(output,
+					&packet->packet);
 		}
 	}
 
-	da_insert(output->interleaved_packets, idx, out);
+	return true;
 }
 
-static void resort_interleaved_packets(struct obs_output *output)
+/* the offsets change the order between tracks, never within one */
+static inline void resort_interleaved_packets(struct obs_output *output)
 {
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-			sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
-
-	da_free(old_array);
+	interleaver_rebuild(&output->interleaved_packets);
 }
 
 static void discard_unused_audio_packets(struct obs_output *output,
 		int64_t dts_usec)
 {
-	size_t idx = 0;
-
-	for (; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
+	struct packet_interleaver *il = &output->interleaved_packets;
+	struct interleaved_packet *next;
 
-		if (p->dts_usec >= dts_usec)
-			break;
+	while ((next = interleaver_peek(il)) != NULL &&
+	       next->packet.dts_usec < dts_usec) {
+		struct encoder_packet packet;
+		interleaver_pop(il, &packet);
+		obs_encoder_packet_release(&packet);
 	}
-
-	if (idx)
-		discard_to_idx(output, idx);
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
@@ -1415,14 +1364,14 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->active_delay_ns)
 		out = *packet;
 	else
-		obs_encoder_packet_create_instance(&out, packet);
+		obs_encoder_packet_ref(&out, packet);
 
 	if (was_started)
 		apply_interleaved_packet_offset(output, &out);
 	else
 		check_received(output, packet);
 
-	insert_interleaved_packet(output, &out);
+	interleaver_push(&output->interleaved_packets, &out);
 	set_higher_ts(output, &out);
 
 	/* when both video and audio have been received, we're ready
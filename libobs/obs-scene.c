@@ -18,6 +18,7 @@
 
 #include "util/threading.h"
 #include "graphics/math-defs.h"
+#include "media-io/audio-kernels.h"
 #include "obs-scene.h"
 #include "source-type-defines.hpp"
 
@@ -581,6 +582,7 @@ static void set_visibility(struct obs_scene_item *item, bool vis)
 	}
 
 	os_atomic_set_long(&item->active_refs, vis ? 1 : 0);
+	obs_audio_graph_changed();
 	item->visible = vis;
 	item->user_visible = vis;
 
@@ -874,24 +876,13 @@ static void process_all_audio_actions(struct obs_scene_item *item,
 static void mix_audio_with_buf(float *p_out, float *p_in, float *buf_in,
 		size_t pos, size_t count)
 {
-	register float *out = p_out;
-	register float *buf = buf_in + pos;
-	register float *in = p_in + pos;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++) * *(buf++);
+	audio_kernel_add_mul(p_out, p_in + pos, buf_in + pos, count);
 }
 
 static inline void mix_audio(float *p_out, float *p_in,
 		size_t pos, size_t count)
 {
-	register float *out = p_out;
-	register float *in = p_in + pos;
-	register float *end = in + count;
-
-	while (in < end)
-		*(out++) += *(in++);
+	audio_kernel_add(p_out, p_in + pos, count);
 }
 
 static bool scene_audio_render(void *data, uint64_t *ts_out,
@@ -1564,6 +1555,7 @@ obs_sceneitem_t *obs_scene_add(obs_scene_t *scene, obs_source_t *source)
 	}
 
 	full_unlock(scene);
+	obs_audio_graph_changed();
 
 	if (!scene->source->context.private)
 		init_hotkeys(scene, item, obs_source_get_name(source));
@@ -89,6 +89,7 @@ void obs_transition_clear(obs_source_t *transition)
 	transition->transitioning_video = false;
 	transition->transitioning_audio = false;
 	unlock_transition(transition);
+	obs_audio_graph_changed();
 
 	for (size_t i = 0; i < 2; i++) {
 		if (s[i] && active[i])
@@ -255,6 +256,7 @@ static void set_source(obs_source_t *transition,
 	transition->transition_sources[idx] = add_success ? new_child : NULL;
 
 	unlock_transition(transition);
+	obs_audio_graph_changed();
 
 	if (add_success) {
 		if (transition->transition_cx == 0 ||
@@ -315,8 +317,10 @@ static inline bool activate_child(obs_source_t *transition, size_t idx)
 
 		success = obs_source_add_active_child(transition,
 				transition->transition_sources[idx]);
-		if (success)
+		if (success) {
 			transition->transition_source_active[idx] = true;
+			obs_audio_graph_changed();
+		}
 	}
 
 	unlock_transition(transition);
@@ -332,6 +336,7 @@ static bool activate_transition(obs_source_t *transition, size_t idx,
 			return false;
 
 		transition->transition_source_active[idx] = true;
+		obs_audio_graph_changed();
 	}
 
 	transition->transitioning_video = true;
@@ -417,6 +422,7 @@ void obs_transition_set(obs_source_t *transition, obs_source_t *source)
 	transition->transitioning_video = false;
 	transition->transitioning_audio = false;
 	unlock_transition(transition);
+	obs_audio_graph_changed();
 
 	for (size_t i = 0; i < 2; i++) {
 		if (s[i] && active[i])
@@ -573,6 +579,7 @@ void obs_transition_load(obs_source_t *tr, obs_data_t *data)
 	tr->transition_cx = (uint32_t)cx;
 	tr->transition_cy = (uint32_t)cy;
 	unlock_transition(tr);
+	obs_audio_graph_changed();
 
 	recalculate_transition_size(tr);
 	recalculate_transition_matrices(tr);
@@ -655,6 +662,7 @@ static void obs_transition_stop(obs_source_t *transition)
 	transition->transition_source_active[1] = false;
 	transition->transition_sources[0] = transition->transition_sources[1];
 	transition->transition_sources[1] = NULL;
+	obs_audio_graph_changed();
 }
 
 static inline void handle_stop(obs_source_t *transition)
@@ -989,6 +997,7 @@ static inline obs_source_t *copy_source_state(obs_source_t *tr_dest,
 
 	tr_dest->transition_sources[idx] = new_child;
 	tr_dest->transition_source_active[idx] = active;
+	obs_audio_graph_changed();
 
 	if (active && new_child)
 		obs_source_add_active_child(tr_dest, new_child);
@@ -20,6 +20,7 @@
 #include "media-io/format-conversion.h"
 #include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
+#include "media-io/audio-kernels.h"
 #include "util/threading.h"
 #include "util/platform.h"
 #include "callback/calldata.h"
@@ -32,6 +33,7 @@
 #include "graphics/face_beauty/face_beauty.h"
 
 FBEngine face_beauty_create(enum video_format format_src, int video_width, int video_height, char* face_model_file);
+bool face_beauty_reconfigure(FBEngine fb_engine, enum video_format format_src, int video_width, int video_height);
 void face_beauty_release(FBEngine fb_engine);
 void face_beauty(FBEngine fb_engine, unsigned char* y_data, unsigned char* uv_data, int video_width, int video_height);
 
@@ -39,6 +41,8 @@ bool face_beauty_scaler(FBEngine fb_engine,
 	uint8_t *output[], const uint32_t out_linesize[],
 	const uint8_t * input[], const uint32_t in_linesize[]);
 
+static void beauty_worker_stop(obs_source_t *source);
+
 static inline bool data_valid(const struct obs_source *source, const char *f)
 {
 	return obs_source_valid(source, f) && source->context.data;
@@ -155,6 +159,7 @@ bool obs_source_init(struct obs_source *source)
 	pthread_mutex_init_value(&source->audio_mutex);
 	pthread_mutex_init_value(&source->audio_buf_mutex);
 	pthread_mutex_init_value(&source->audio_cb_mutex);
+	pthread_mutex_init_value(&source->beauty_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -172,6 +177,8 @@ bool obs_source_init(struct obs_source *source)
 		return false;
 	if (pthread_mutex_init(&source->async_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&source->beauty_mutex, NULL) != 0)
+		return false;
 
 	if (is_audio_source(source) || is_composite_source(source))
 		allocate_audio_output_buffer(source);
@@ -555,6 +562,7 @@ void obs_source_destroy(struct obs_source *source)
 		source->context.data = NULL;
 	}
 
+	beauty_worker_stop(source);
 	audio_monitor_destroy(source->monitor);
 
 	obs_hotkey_unregister(source->push_to_talk_key);
@@ -600,6 +608,7 @@ void obs_source_destroy(struct obs_source *source)
 	pthread_mutex_destroy(&source->audio_cb_mutex);
 	pthread_mutex_destroy(&source->audio_mutex);
 	pthread_mutex_destroy(&source->async_mutex);
+	pthread_mutex_destroy(&source->beauty_mutex);
 	obs_data_release(source->private_settings);
 	obs_context_data_free(&source->context);
 
@@ -806,6 +815,12 @@ void obs_source_update(obs_source_t *source, obs_data_t *settings)
 	if (settings)
 		obs_data_apply(source->context.settings, settings);
 
+	pthread_mutex_lock(&source->async_mutex);
+	if (source->context_partitioner)
+		update_context_partition(source->context_partitioner,
+				source->context.settings);
+	pthread_mutex_unlock(&source->async_mutex);
+
 	if (source->info.output_flags & OBS_SOURCE_VIDEO) {
 		source->defer_update = true;
 	} else if (source->context.data && source->info.update) {
@@ -2230,7 +2245,7 @@ static inline void copy_frame_data_y800(struct obs_source_frame *dst,
 	}
 }
 
-static void copy_frame_data(struct obs_source_frame *dst,
+static inline void copy_frame_info(struct obs_source_frame *dst,
 		const struct obs_source_frame *src)
 {
 	dst->flip         = src->flip;
@@ -2242,6 +2257,12 @@ static void copy_frame_data(struct obs_source_frame *dst,
 		memcpy(dst->color_range_min, src->color_range_min, size);
 		memcpy(dst->color_range_max, src->color_range_max, size);
 	}
+}
+
+static void copy_frame_data(struct obs_source_frame *dst,
+		const struct obs_source_frame *src)
+{
+	copy_frame_info(dst, src);
 
 	switch (src->format) {
 	case VIDEO_FORMAT_I420:
@@ -2278,14 +2299,14 @@ static void copy_frame_data(struct obs_source_frame *dst,
 }
 
 static inline bool async_texture_changed(struct obs_source *source,
-		const struct obs_source_frame *frame)
+		enum video_format format, uint32_t width, uint32_t height)
 {
 	enum convert_type prev, cur;
 	prev = get_convert_type(source->async_cache_format);
-	cur  = get_convert_type(frame->format);
+	cur  = get_convert_type(format);
 
-	return source->async_cache_width  != frame->width ||
-	       source->async_cache_height != frame->height ||
+	return source->async_cache_width  != width ||
+	       source->async_cache_height != height ||
 	       prev != cur;
 }
 
@@ -2319,8 +2340,11 @@ static void clean_cache(obs_source_t *source)
 
 #define MAX_ASYNC_FRAMES 30
 
-static inline struct obs_source_frame *cache_video(struct obs_source *source,
-		const struct obs_source_frame *frame)
+/* reserves an unused frame of the async cache (allocating one if necessary)
+ * and returns it with an extra reference held for the writer, which must be
+ * released with finish_cache_frame once the frame data has been written */
+static struct obs_source_frame *reserve_cache_frame(struct obs_source *source,
+		enum video_format format, uint32_t width, uint32_t height)
 {
 	struct obs_source_frame *new_frame = NULL;
 
@@ -2333,11 +2357,11 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 		return NULL;
 	}
 
-	if (async_texture_changed(source, frame)) {
+	if (async_texture_changed(source, format, width, height)) {
 		free_async_cache(source);
-		source->async_cache_width  = frame->width;
-		source->async_cache_height = frame->height;
-		source->async_cache_format = frame->format;
+		source->async_cache_width  = width;
+		source->async_cache_height = height;
+		source->async_cache_format = format;
 	}
 
 	for (size_t i = 0; i < source->async_cache.num; i++) {
@@ -2354,13 +2378,11 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 
 	if (!new_frame) {
 		struct async_frame new_af;
-		enum video_format format = frame->format;
 
 		if (format == VIDEO_FORMAT_Y800)
 			format = VIDEO_FORMAT_BGRX;
 
-		new_frame = obs_source_frame_create(format,
-				frame->width, frame->height);
+		new_frame = obs_source_frame_create(format, width, height);
 		new_af.frame = new_frame;
 		new_af.used = true;
 		new_af.unused_count = 0;
@@ -2372,9 +2394,13 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	os_atomic_inc_long(&new_frame->refs);
 
 	pthread_mutex_unlock(&source->async_mutex);
+	return new_frame;
+}
 
-	copy_frame_data(new_frame, frame);
-
+static inline struct obs_source_frame *finish_cache_frame(
+		struct obs_source_frame *new_frame)
+{
+	/* the cache may have been freed while the frame was being written */
 	if (os_atomic_dec_long(&new_frame->refs) == 0) {
 		obs_source_frame_destroy(new_frame);
 		new_frame = NULL;
@@ -2383,133 +2409,439 @@ static inline struct obs_source_frame *cache_video(struct obs_source *source,
 	return new_frame;
 }
 
+/* returns a reserved frame to the cache without publishing it */
+static void cancel_cache_frame(struct obs_source *source,
+		struct obs_source_frame *frame)
+{
+	pthread_mutex_lock(&source->async_mutex);
+	for (size_t i = 0; i < source->async_cache.num; i++) {
+		struct async_frame *af = &source->async_cache.array[i];
+		if (af->frame == frame) {
+			af->used = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&source->async_mutex);
 
+	finish_cache_frame(frame);
+}
 
-
-void UYVYToUVURow(const uint8_t * src_uyvy, int src_stride_uyvy, uint8_t* dst_uv, int width)
+static inline struct obs_source_frame *cache_video(struct obs_source *source,
+		const struct obs_source_frame *frame)
 {
-    for (int x = 0; x < width; x += 2, src_uyvy += 4, dst_uv += 2)
-    {
-        dst_uv[0] = (src_uyvy[0] + src_uyvy[src_stride_uyvy + 0] + 1) >> 1;
-        dst_uv[1] = (src_uyvy[2] + src_uyvy[src_stride_uyvy + 2] + 1) >> 1;
-    }
+	struct obs_source_frame *new_frame;
+
+	new_frame = reserve_cache_frame(source, frame->format,
+			frame->width, frame->height);
+	if (!new_frame)
+		return NULL;
+
+	copy_frame_data(new_frame, frame);
+	return finish_cache_frame(new_frame);
 }
 
- 
-void UYVYToYRow(const uint8_t* src_uyvy, uint8_t* dst_y, int width)
+/* runs the context partition keying on a frame about to be published */
+static void key_async_frame(obs_source_t *source,
+		struct obs_source_frame *output)
 {
+	if (source->allow_video_context_partition) {
+		video_partitioner *partitioner;
 
-    for (int x = 0; x < width - 1; x += 2, src_uyvy += 4)
-    {
-        dst_y[x] = src_uyvy[1];
-        dst_y[x + 1] = src_uyvy[3];
-    }
+		/* frames can be published from the capture thread and the
+		 * beauty worker, so only one of them may create it */
+		pthread_mutex_lock(&source->async_mutex);
+		if (!source->context_partitioner)
+			source->context_partitioner = create_context_partition(
+					source->context.settings);
+		partitioner = source->context_partitioner;
+		pthread_mutex_unlock(&source->async_mutex);
 
+		do_context_partition(partitioner, output);
+	}
 }
 
-int UYVYToNV12(const uint8_t * src_uyvy,
-        uint8_t * dst_y,
-        uint8_t * dst_uv,
-        int src_stride_uyvy,
-        int dst_stride_y,
-        int dst_stride_uv,
-        int width,
-        int height)
+static void publish_async_frame(obs_source_t *source,
+		struct obs_source_frame *output)
 {
+	key_async_frame(source, output);
 
-    for (int y = 0; y < height - 1; y += 2)
-    {
-        UYVYToUVURow(src_uyvy, src_stride_uyvy, dst_uv, width);
-        UYVYToYRow(src_uyvy, dst_y, width);
-        UYVYToYRow(src_uyvy + src_stride_uyvy, dst_y + dst_stride_y, width);
- 
-        src_uyvy += src_stride_uyvy * 2;
-        dst_y    += dst_stride_y * 2;
-        dst_uv   += dst_stride_uv;
-    }
- 
-    return 0;
+	pthread_mutex_lock(&source->async_mutex);
+	da_push_back(source->async_frames, &output);
+	source->async_active = true;
+	pthread_mutex_unlock(&source->async_mutex);
 }
 
+/* ------------------------------------------------------------------------- */
+/* face beauty worker
+ *
+ * The beauty pass takes 15-30 ms per frame, which is longer than the frame
+ * interval of most cameras, so it must never run on the driver's delivery
+ * thread.  Frames are copied into a small bounded queue and processed by a
+ * per-source thread; if the worker falls behind, the oldest queued frame is
+ * dropped so that the newest frame always wins. */
 
-void obs_source_output_video(obs_source_t *source,
+#define MAX_BEAUTY_QUEUE 2
+
+struct beauty_frame {
+	struct obs_source_frame *frame;
+	uint64_t                queued_ts;
+	long                    gen;
+};
+
+/* called with beauty_mutex held */
+static struct obs_source_frame *beauty_get_free_frame(obs_source_t *source,
+		enum video_format format, uint32_t width, uint32_t height)
+{
+	struct obs_source_frame *frame;
+
+	while (source->beauty_free_frames.num) {
+		frame = *(struct obs_source_frame**)
+			da_end(source->beauty_free_frames);
+		da_pop_back(source->beauty_free_frames);
+
+		if (frame->format == format && frame->width == width &&
+		    frame->height == height)
+			return frame;
+
+		obs_source_frame_destroy(frame);
+	}
+
+	return obs_source_frame_create(format, width, height);
+}
+
+static void beauty_release_frame(obs_source_t *source,
 		struct obs_source_frame *frame)
 {
-	if (!obs_source_valid(source, "obs_source_output_video"))
-		return;
+	pthread_mutex_lock(&source->beauty_mutex);
+	da_push_back(source->beauty_free_frames, &frame);
+	pthread_mutex_unlock(&source->beauty_mutex);
+}
 
-	if (!frame) {
-		source->async_active = false;
+/* drops all queued frames, called with beauty_mutex held */
+static void beauty_flush_queue(obs_source_t *source)
+{
+	while (source->beauty_queue.size) {
+		struct beauty_frame bf;
+		circlebuf_pop_front(&source->beauty_queue, &bf, sizeof(bf));
+		da_push_back(source->beauty_free_frames, &bf.frame);
+	}
+
+	os_atomic_inc_long(&source->beauty_gen);
+}
+
+static inline bool beauty_gen_current(obs_source_t *source, long gen)
+{
+	return os_atomic_load_long(&source->beauty_gen) == gen;
+}
+
+/* publishes a reserved cache frame unless the queue has been flushed since
+ * its camera frame was queued.  keying runs without any lock held, so the
+ * capture thread can keep queueing, and the generation is checked again
+ * under async_mutex so that a flush during keying still drops the frame */
+static void beauty_publish_frame(obs_source_t *source,
+		struct obs_source_frame *output, long gen)
+{
+	if (!beauty_gen_current(source, gen)) {
+		cancel_cache_frame(source, output);
 		return;
 	}
 
-#ifdef _WIN32
-    const char *id = "dshow_input";
-#else
-    const char *id = "av_capture_input";
-#endif
+	key_async_frame(source, output);
 
-    //add by cuijun.qcj
-    struct obs_source_frame* frame_tmp = NULL;
+	pthread_mutex_lock(&source->async_mutex);
+	if (beauty_gen_current(source, gen)) {
+		output = finish_cache_frame(output);
+		if (output) {
+			da_push_back(source->async_frames, &output);
+			source->async_active = true;
+		}
+		output = NULL;
+	}
+	pthread_mutex_unlock(&source->async_mutex);
 
-	if(obs->video.ovi.face_beauty_enable
-       && strcmp(source->info.id, id) == 0
-       && frame->width > 128
-       && frame->height > 128)
-	{
-		frame_tmp = obs_source_frame_create(VIDEO_FORMAT_NV12, frame->width, frame->height);
-
-		if(source->fb_engine == NULL || frame->width != (uint32_t)source->fb_engine->width || frame->height != (uint32_t)source->fb_engine->height)
-		{
-			if(source->fb_engine)
-			{
-				face_beauty_release(source->fb_engine);
-				source->fb_engine = NULL;
-			}
-			char* file = "../data/libobs/face_all_data_130.dat";
-			source->fb_engine = face_beauty_create(frame->format,frame->width, frame->height, file);
+	if (output)
+		cancel_cache_frame(source, output);
+}
+
+static inline bool beauty_engine_valid(obs_source_t *source,
+		const struct obs_source_frame *frame)
+{
+	return source->fb_engine &&
+	       frame->width  == (uint32_t)source->fb_engine->width &&
+	       frame->height == (uint32_t)source->fb_engine->height &&
+	       frame->format == source->fb_engine->scaler_info_src.format;
+}
+
+/* packed 422 camera formats go through the SIMD converters, everything else
+ * through the engine's scaler */
+static bool beauty_convert_frame(obs_source_t *source,
+		struct obs_source_frame *output,
+		const struct obs_source_frame *frame)
+{
+	switch (frame->format) {
+	case VIDEO_FORMAT_UYVY:
+	case VIDEO_FORMAT_YUY2:
+		compress_422_to_nv12(frame->data[0], frame->linesize[0],
+				frame->width, 0, frame->height,
+				output->data, output->linesize,
+				frame->format == VIDEO_FORMAT_YUY2);
+		return true;
+
+	default:
+		return face_beauty_scaler(source->fb_engine, output->data,
+				output->linesize, (const uint8_t**)frame->data,
+				frame->linesize);
+	}
+}
+
+/* scales the queued camera frame straight into a reserved NV12 async cache
+ * frame and runs the beauty pass on it in place, so the only full-frame
+ * write per frame is the format conversion itself */
+static void beauty_process_frame(obs_source_t *source,
+		struct obs_source_frame *frame, long gen)
+{
+	struct obs_source_frame *output = NULL;
+
+	if (!beauty_engine_valid(source, frame)) {
+		if (source->fb_engine &&
+		    !face_beauty_reconfigure(source->fb_engine, frame->format,
+				frame->width, frame->height)) {
+			face_beauty_release(source->fb_engine);
+			source->fb_engine = NULL;
 		}
 
-		if(source->fb_engine)
-		{
-			copy_frame_data(frame_tmp, frame);
-			if(face_beauty_scaler(source->fb_engine, frame_tmp->data, frame_tmp->linesize,(const uint8_t**)frame->data, frame->linesize))
-			{
-				int64_t before = os_gettime_ns();
-				face_beauty(source->fb_engine, frame_tmp->data[0], frame_tmp->data[1], frame_tmp->width, frame_tmp->height);
-				int64_t after = os_gettime_ns();
-				os_atomic_set_long(&obs->video.ovi.face_beauty_time, ((after - before) / 1000000.));
+		bool failed_before =
+			source->fb_failed_format == frame->format &&
+			source->fb_failed_width  == frame->width &&
+			source->fb_failed_height == frame->height;
+
+		if (!source->fb_engine && !failed_before) {
+			char *file = "../data/libobs/face_all_data_130.dat";
+			source->fb_engine = face_beauty_create(frame->format,
+					frame->width, frame->height, file);
+
+			if (!source->fb_engine) {
+				blog(LOG_WARNING, "Face beauty unavailable for "
+						"'%s', passing frames through",
+						source->context.name);
+				source->fb_failed_format = frame->format;
+				source->fb_failed_width  = frame->width;
+				source->fb_failed_height = frame->height;
 			}
 		}
 	}
-	else {
-		obs->video.ovi.face_beauty_time = 0;
+
+	if (source->fb_engine) {
+		output = reserve_cache_frame(source, VIDEO_FORMAT_NV12,
+				frame->width, frame->height);
+		if (!output)
+			return;
+
+		copy_frame_info(output, frame);
+
+		if (beauty_convert_frame(source, output, frame)) {
+			uint64_t before = os_gettime_ns();
+			face_beauty(source->fb_engine,
+					output->data[0], output->data[1],
+					output->width, output->height);
+			uint64_t after = os_gettime_ns();
+			os_atomic_set_long(&obs->video.ovi.face_beauty_time,
+					((after - before) / 1000000.));
+
+			beauty_publish_frame(source, output, gen);
+			return;
+		}
+
+		cancel_cache_frame(source, output);
 	}
-	
-	struct obs_source_frame *output = NULL;
-	if(frame_tmp)
-	{
-		//cache video frame
-		output = !!frame ? cache_video(source, frame_tmp) : NULL;
-		obs_source_frame_destroy(frame_tmp);
+
+	output = reserve_cache_frame(source, frame->format,
+			frame->width, frame->height);
+	if (output) {
+		copy_frame_data(output, frame);
+		beauty_publish_frame(source, output, gen);
 	}
-	else
-	{
-		//cache video frame
-		output = !!frame ? cache_video(source, frame) : NULL;
+}
+
+static void *beauty_thread(void *data)
+{
+	obs_source_t *source = data;
+
+	os_set_thread_name("obs-source: face beauty thread");
+
+	while (os_sem_wait(source->beauty_sem) == 0) {
+		struct beauty_frame bf = {0};
+		long latency;
+
+		if (source->beauty_stop)
+			break;
+
+		pthread_mutex_lock(&source->beauty_mutex);
+		if (source->beauty_queue.size)
+			circlebuf_pop_front(&source->beauty_queue, &bf,
+					sizeof(bf));
+		pthread_mutex_unlock(&source->beauty_mutex);
+
+		/* the semaphore is posted once per queued frame, so it runs
+		 * ahead of the queue whenever frames have been dropped */
+		if (!bf.frame)
+			continue;
+
+		beauty_process_frame(source, bf.frame, bf.gen);
+		beauty_release_frame(source, bf.frame);
+
+		latency = (long)((os_gettime_ns() - bf.queued_ts) / 1000000);
+		os_atomic_set_long(&source->beauty_latency, latency);
+		os_atomic_set_long(&obs->video.face_beauty_latency, latency);
 	}
-	/* ------------------------------------------- */
 
-	if (output) {
-		if (source->allow_video_context_partition) {
-			do_context_partition(&(source->context_partitioner), output);
-		}
+	return NULL;
+}
+
+/* called with beauty_mutex held */
+static bool beauty_worker_start(obs_source_t *source)
+{
+	if (os_sem_init(&source->beauty_sem, 0) != 0)
+		goto fail_sem;
+
+	source->beauty_stop = false;
+	if (pthread_create(&source->beauty_thread, NULL, beauty_thread,
+				source) != 0)
+		goto fail_thread;
+
+	source->beauty_thread_active = true;
+	return true;
+
+fail_thread:
+	os_sem_destroy(source->beauty_sem);
+	source->beauty_sem = NULL;
+fail_sem:
+	blog(LOG_WARNING, "Failed to start face beauty thread for '%s'",
+			source->context.name);
+	return false;
+}
+
+static void beauty_worker_stop(obs_source_t *source)
+{
+	if (!source->beauty_thread_active)
+		return;
+
+	source->beauty_stop = true;
+	os_sem_post(source->beauty_sem);
+	pthread_join(source->beauty_thread, NULL);
+
+	while (source->beauty_queue.size) {
+		struct beauty_frame bf;
+		circlebuf_pop_front(&source->beauty_queue, &bf, sizeof(bf));
+		obs_source_frame_destroy(bf.frame);
+	}
+	for (size_t i = 0; i < source->beauty_free_frames.num; i++)
+		obs_source_frame_destroy(source->beauty_free_frames.array[i]);
+
+	circlebuf_free(&source->beauty_queue);
+	da_free(source->beauty_free_frames);
+	os_sem_destroy(source->beauty_sem);
+
+	source->beauty_sem = NULL;
+	source->beauty_thread_active = false;
+}
+
+static void beauty_enqueue_frame(obs_source_t *source,
+		const struct obs_source_frame *frame)
+{
+	struct beauty_frame bf;
+	enum video_format format = frame->format;
+
+	/* copy_frame_data expands Y800 to BGRX */
+	if (format == VIDEO_FORMAT_Y800)
+		format = VIDEO_FORMAT_BGRX;
+
+	pthread_mutex_lock(&source->beauty_mutex);
+	bf.frame = beauty_get_free_frame(source, format,
+			frame->width, frame->height);
+	pthread_mutex_unlock(&source->beauty_mutex);
+
+	copy_frame_data(bf.frame, frame);
+	bf.queued_ts = os_gettime_ns();
+
+	pthread_mutex_lock(&source->beauty_mutex);
+	bf.gen = os_atomic_load_long(&source->beauty_gen);
+	if (source->beauty_queue.size >= MAX_BEAUTY_QUEUE * sizeof(bf)) {
+		struct beauty_frame old;
+		circlebuf_pop_front(&source->beauty_queue, &old, sizeof(old));
+		da_push_back(source->beauty_free_frames, &old.frame);
+
+		os_atomic_inc_long(&source->beauty_dropped);
+		os_atomic_inc_long(&obs->video.face_beauty_dropped);
+	}
+	circlebuf_push_back(&source->beauty_queue, &bf, sizeof(bf));
+	pthread_mutex_unlock(&source->beauty_mutex);
+
+	os_sem_post(source->beauty_sem);
+}
+
+static inline bool beauty_enabled_for(const obs_source_t *source,
+		const struct obs_source_frame *frame)
+{
+#ifdef _WIN32
+	const char *id = "dshow_input";
+#else
+	const char *id = "av_capture_input";
+#endif
+
+	return obs->video.ovi.face_beauty_enable &&
+	       strcmp(source->info.id, id) == 0 &&
+	       frame->width > 128 &&
+	       frame->height > 128;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void obs_source_output_video(obs_source_t *source,
+		struct obs_source_frame *frame)
+{
+	if (!obs_source_valid(source, "obs_source_output_video"))
+		return;
+
+	if (!frame) {
+		/* frames still queued for the beauty pass must not bring the
+		 * output back */
+		pthread_mutex_lock(&source->beauty_mutex);
+		beauty_flush_queue(source);
+		pthread_mutex_unlock(&source->beauty_mutex);
 
 		pthread_mutex_lock(&source->async_mutex);
-		da_push_back(source->async_frames, &output);
+		source->async_active = false;
 		pthread_mutex_unlock(&source->async_mutex);
-		source->async_active = true;
+		return;
 	}
+
+	if (beauty_enabled_for(source, frame)) {
+		bool active;
+
+		pthread_mutex_lock(&source->beauty_mutex);
+		active = source->beauty_thread_active ||
+			beauty_worker_start(source);
+		pthread_mutex_unlock(&source->beauty_mutex);
+
+		if (active) {
+			beauty_enqueue_frame(source, frame);
+			return;
+		}
+	} else {
+		/* beauty was turned off, drop what the worker has so it can't
+		 * publish after the frames that follow */
+		pthread_mutex_lock(&source->beauty_mutex);
+		if (source->beauty_thread_active)
+			beauty_flush_queue(source);
+		pthread_mutex_unlock(&source->beauty_mutex);
+
+		obs->video.ovi.face_beauty_time = 0;
+	}
+
+	struct obs_source_frame *output = cache_video(source, frame);
+	if (output)
+		publish_async_frame(source, output);
 }
 
 static inline bool preload_frame_changed(obs_source_t *source,
@@ -3388,6 +3720,9 @@ bool obs_source_add_active_child(obs_source_t *parent, obs_source_t *child)
 		obs_source_activate(child, type);
 	}
 
+	/* the parent usually links the child after this returns, and bumps
+	 * the generation again once it has */
+	obs_audio_graph_changed();
 	return true;
 }
 
@@ -3403,6 +3738,8 @@ void obs_source_remove_active_child(obs_source_t *parent, obs_source_t *child)
 		type = (i < parent->activate_refs) ? MAIN_VIEW : AUX_VIEW;
 		obs_source_deactivate(child, type);
 	}
+
+	obs_audio_graph_changed();
 }
 
 void obs_source_save(obs_source_t *source)
@@ -3867,24 +4204,16 @@ static float get_source_volume(obs_source_t *source, uint64_t os_time)
 static inline void multiply_output_audio(obs_source_t *source, size_t mix,
 		size_t channels, float vol)
 {
-	register float *out = source->audio_output_buf[mix][0];
-	register float *end = out + AUDIO_OUTPUT_FRAMES * channels;
-
-	while (out < end)
-		*(out++) *= vol;
+	audio_kernel_gain(source->audio_output_buf[mix][0], vol,
+			AUDIO_OUTPUT_FRAMES * channels);
 }
 
 static inline void multiply_vol_data(obs_source_t *source, size_t mix,
 		size_t channels, float *vol_data)
 {
-	for (size_t ch = 0; ch < channels; ch++) {
-		register float *out = source->audio_output_buf[mix][ch];
-		register float *end = out + AUDIO_OUTPUT_FRAMES;
-		register float *vol = vol_data;
-
-		while (out < end)
-			*(out++) *= *(vol++);
-	}
+	for (size_t ch = 0; ch < channels; ch++)
+		audio_kernel_gain_ramp(source->audio_output_buf[mix][ch],
+				vol_data, AUDIO_OUTPUT_FRAMES);
 }
 
 static inline void apply_audio_action(obs_source_t *source,
@@ -3983,6 +4312,7 @@ static void apply_audio_volume(obs_source_t *source, uint32_t mixers,
 		memset(source->audio_output_buf[0][0], 0,
 				AUDIO_OUTPUT_FRAMES * sizeof(float) *
 				MAX_AUDIO_CHANNELS * MAX_AUDIO_MIXES);
+		source->audio_silent = true;
 		return;
 	}
 
@@ -4014,6 +4344,7 @@ static void custom_audio_render(obs_source_t *source, uint32_t mixers,
 			&audio_data, mixers, channels, sample_rate);
 	source->audio_ts = success ? ts : 0;
 	source->audio_pending = !success;
+	source->audio_silent = !mixers;
 
 	if (!success || !source->audio_ts || !mixers)
 		return;
@@ -4030,10 +4361,29 @@ static void custom_audio_render(obs_source_t *source, uint32_t mixers,
 	apply_audio_volume(source, mixers, channels, sample_rate);
 }
 
+/* true if nothing the source outputs this tick can be heard.  volume
+ * changes that are still queued are applied by the normal path */
+static bool audio_source_silent(obs_source_t *source, uint32_t mixers)
+{
+	bool actions_pending;
+
+	if ((source->audio_mixers & mixers) == 0)
+		return true;
+
+	pthread_mutex_lock(&source->audio_actions_mutex);
+	actions_pending = source->audio_actions.num > 0;
+	pthread_mutex_unlock(&source->audio_actions_mutex);
+
+	return !actions_pending &&
+		get_source_volume(source, source->audio_ts) == 0.0f;
+}
+
 static inline void process_audio_source_tick(obs_source_t *source,
 		uint32_t mixers, size_t channels, size_t sample_rate,
 		size_t size)
 {
+	bool silent = audio_source_silent(source, mixers);
+
 	pthread_mutex_lock(&source->audio_buf_mutex);
 
 	if (source->audio_input_buf[0].size < size) {
@@ -4042,6 +4392,23 @@ static inline void process_audio_source_tick(obs_source_t *source,
 		return;
 	}
 
+	/* the buffers only need clearing when the source goes silent */
+	if (silent) {
+		pthread_mutex_unlock(&source->audio_buf_mutex);
+
+		if (!source->audio_silent) {
+			memset(source->audio_output_buf[0][0], 0,
+					AUDIO_OUTPUT_FRAMES * sizeof(float) *
+					MAX_AUDIO_CHANNELS * MAX_AUDIO_MIXES);
+			source->audio_silent = true;
+		}
+
+		source->audio_pending = false;
+		return;
+	}
+
+	source->audio_silent = false;
+
 	for (size_t ch = 0; ch < channels; ch++)
 		circlebuf_peek_front(&source->audio_input_buf[ch],
 				source->audio_output_buf[0][ch],
@@ -290,13 +290,14 @@ end:
 
 static const char *stage_output_texture_name = "stage_output_texture";
 static inline void stage_output_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+		int prev_texture)
 {
 	profile_start(stage_output_texture_name);
 
 	gs_texture_t   *texture;
 	bool        texture_ready;
-	gs_stagesurf_t *copy = video->copy_surfaces[cur_texture];
+	gs_stagesurf_t *copy;
+	int            next;
 
 	if (video->gpu_conversion) {
 		texture = video->convert_textures[prev_texture];
@@ -311,9 +312,14 @@ static inline void stage_output_texture(struct obs_core_video *video,
 	if (!texture_ready)
 		goto end;
 
+	/* never full here, download_frame takes the oldest surface whenever
+	 * all of them are in flight */
+	next = (video->first_staged + video->num_staged) % video->staging_depth;
+	copy = video->copy_surfaces[next];
+
 	gs_stage_texture(copy, texture);
 
-	video->textures_copied[cur_texture] = true;
+	video->num_staged++;
 
 end:
 	profile_end(stage_output_texture_name);
@@ -332,7 +338,7 @@ static inline void render_video(struct obs_core_video *video, int cur_texture,
 	if (video->gpu_conversion)
 		render_convert_texture(video, cur_texture, prev_texture);
 
-	stage_output_texture(video, cur_texture, prev_texture);
+	stage_output_texture(video, prev_texture);
 
 	gs_set_render_target(NULL, NULL);
 	gs_enable_blending(true);
@@ -340,15 +346,61 @@ static inline void render_video(struct obs_core_video *video, int cur_texture,
 	gs_end_scene();
 }
 
+static const char *map_staged_surface_name = "map_staged_surface";
+static const char *map_stalled_surface_name = "map_stalled_surface";
+static inline void pop_staged_surface(struct obs_core_video *video,
+		struct obs_vframe_info *info)
+{
+	circlebuf_pop_front(&video->vframe_info_buffer, info, sizeof(*info));
+
+	if (++video->first_staged == video->staging_depth)
+		video->first_staged = 0;
+	video->num_staged--;
+}
+
 static inline bool download_frame(struct obs_core_video *video,
-		int prev_texture, struct video_data *frame)
+		struct video_data *frame, struct obs_vframe_info *info)
 {
-	gs_stagesurf_t *surface = video->copy_surfaces[prev_texture];
+	gs_stagesurf_t *surface;
+	bool           ready;
+	bool           mapped;
 
-	if (!video->textures_copied[prev_texture])
+	if (!video->num_staged)
 		return false;
 
-	if (!gs_stagesurface_map(surface, &frame->data[0], &frame->linesize[0]))
+	surface = video->copy_surfaces[video->first_staged];
+	ready = gs_stagesurface_is_ready(surface);
+
+	/* leave the copy to finish unless every surface is in flight */
+	if (!ready && video->num_staged < video->staging_depth)
+		return false;
+
+	pop_staged_surface(video, info);
+
+	/* after a late readback the copies behind it finish together, so
+	 * skip to the newest finished one and repeat it for the frames it
+	 * replaces, otherwise the ring would stay that deep from now on */
+	while (video->num_staged) {
+		gs_stagesurf_t *next = video->copy_surfaces[video->first_staged];
+		struct obs_vframe_info next_info;
+
+		if (!gs_stagesurface_is_ready(next))
+			break;
+
+		pop_staged_surface(video, &next_info);
+		info->count += next_info.count;
+		surface = next;
+		ready = true;
+	}
+
+	profile_start(ready ? map_staged_surface_name :
+			map_stalled_surface_name);
+	mapped = gs_stagesurface_map(surface, &frame->data[0],
+			&frame->linesize[0]);
+	profile_end(ready ? map_staged_surface_name :
+			map_stalled_surface_name);
+
+	if (!mapped)
 		return false;
 
 	video->mapped_surface = surface;
@@ -541,6 +593,7 @@ static inline void output_frame(void)
 	struct obs_core_video *video = &obs->video;
 	int cur_texture  = video->cur_texture;
 	int prev_texture = cur_texture == 0 ? NUM_TEXTURES-1 : cur_texture-1;
+	struct obs_vframe_info vframe_info;
 	struct video_data frame;
 	bool frame_ready;
 
@@ -554,7 +607,7 @@ static inline void output_frame(void)
 	profile_end(output_frame_render_video_name);
 
 	profile_start(output_frame_download_frame_name);
-	frame_ready = download_frame(video, prev_texture, &frame);
+	frame_ready = download_frame(video, &frame, &vframe_info);
 	profile_end(output_frame_download_frame_name);
 
 	profile_start(output_frame_gs_flush_name);
@@ -565,10 +618,6 @@ static inline void output_frame(void)
 	profile_end(output_frame_gs_context_name);
 
 	if (frame_ready) {
-		struct obs_vframe_info vframe_info;
-		circlebuf_pop_front(&video->vframe_info_buffer, &vframe_info,
-				sizeof(vframe_info));
-
 		frame.timestamp = vframe_info.timestamp;
 		profile_start(output_frame_output_video_data_name);
 		output_video_data(video, &frame, vframe_info.count);
@@ -183,20 +183,38 @@ static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 	return true;
 }
 
+static inline uint32_t get_staging_depth(void)
+{
+	uint32_t depth = obs->video.staging_depth_setting;
+
+	if (!depth)
+		return DEFAULT_STAGING_DEPTH;
+	else if (depth < 2)
+		return 2;
+	else if (depth > MAX_STAGING_DEPTH)
+		return MAX_STAGING_DEPTH;
+	return depth;
+}
+
 static bool obs_init_textures(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
 	uint32_t output_height = video->gpu_conversion ?
 		video->conversion_height : ovi->output_height;
+	uint32_t staging_depth = get_staging_depth();
 	size_t i;
 
-	for (i = 0; i < NUM_TEXTURES; i++) {
+	for (i = 0; i < staging_depth; i++) {
 		video->copy_surfaces[i] = gs_stagesurface_create(
 				ovi->output_width, output_height, GS_RGBA);
 
 		if (!video->copy_surfaces[i])
 			return false;
+	}
+
+	video->staging_depth = (int)staging_depth;
 
+	for (i = 0; i < NUM_TEXTURES; i++) {
 		video->render_textures[i] = gs_texture_create(
 				ovi->base_width, ovi->base_height,
 				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
@@ -427,13 +445,16 @@ static void obs_free_video(void)
 			video->mapped_surface = NULL;
 		}
 
-		for (size_t i = 0; i < NUM_TEXTURES; i++) {
+		for (size_t i = 0; i < MAX_STAGING_DEPTH; i++) {
 			gs_stagesurface_destroy(video->copy_surfaces[i]);
+			video->copy_surfaces[i] = NULL;
+		}
+
+		for (size_t i = 0; i < NUM_TEXTURES; i++) {
 			gs_texture_destroy(video->render_textures[i]);
 			gs_texture_destroy(video->convert_textures[i]);
 			gs_texture_destroy(video->output_textures[i]);
 
-			video->copy_surfaces[i]    = NULL;
 			video->render_textures[i]  = NULL;
 			video->convert_textures[i] = NULL;
 			video->output_textures[i]  = NULL;
@@ -447,12 +468,13 @@ static void obs_free_video(void)
 				sizeof(video->textures_rendered));
 		memset(&video->textures_output, 0,
 				sizeof(video->textures_output));
-		memset(&video->textures_copied, 0,
-				sizeof(video->textures_copied));
 		memset(&video->textures_converted, 0,
 				sizeof(video->textures_converted));
 
-		video->cur_texture = 0;
+		video->cur_texture   = 0;
+		video->staging_depth = 0;
+		video->first_staged  = 0;
+		video->num_staged    = 0;
 	}
 }
 
@@ -523,8 +545,11 @@ static void obs_free_audio(void)
 		audio_output_close(audio->audio);
 
 	circlebuf_free(&audio->buffered_timestamps);
+	for (size_t i = 0; i < audio->render_order.num; i++)
+		obs_source_release(audio->render_order.array[i]);
 	da_free(audio->render_order);
 	da_free(audio->root_nodes);
+	da_free(audio->audio_sources);
 
 	da_free(audio->monitors);
 	bfree(audio->monitoring_device_name);
@@ -772,6 +797,8 @@ static bool obs_init(const char *locale, const char *module_config_path,
 
 	log_system_info();
 
+	obs_encoder_packet_pool_init();
+
 	if (!obs_init_data())
 		return false;
 	if (!obs_init_handlers())
@@ -855,6 +882,7 @@ void obs_shutdown(void)
 	obs_free_audio();
 	obs_free_data();
 	obs_free_video();
+	obs_encoder_packet_pool_free();
 	obs_free_hotkeys();
 	obs_free_graphics();
 	proc_handler_destroy(obs->procs);
@@ -935,6 +963,13 @@ static inline bool size_valid(uint32_t width, uint32_t height)
 	        width <= OBS_SIZE_MAX && height <= OBS_SIZE_MAX);
 }
 
+void obs_set_video_staging_depth(uint32_t depth)
+{
+	if (!obs) return;
+
+	obs->video.staging_depth_setting = depth;
+}
+
 int obs_reset_face_beauty_enable(bool enable)
 {
 	if(!obs) return OBS_VIDEO_FAIL;
@@ -950,6 +985,18 @@ int64_t obs_get_face_beauty_time() {
 	return os_atomic_load_long(&obs->video.ovi.face_beauty_time);
 }
 
+int64_t obs_get_face_beauty_latency() {
+	if (!obs) return OBS_VIDEO_FAIL;
+
+	return os_atomic_load_long(&obs->video.face_beauty_latency);
+}
+
+int64_t obs_get_face_beauty_dropped_frames() {
+	if (!obs) return OBS_VIDEO_FAIL;
+
+	return os_atomic_load_long(&obs->video.face_beauty_dropped);
+}
+
 int obs_reset_video(struct obs_video_info *ovi)
 {
 	if (!obs) return OBS_VIDEO_FAIL;
@@ -1004,12 +1051,14 @@ int obs_reset_video(struct obs_video_info *ovi)
 	               "\toutput resolution: %dx%d\n"
 	               "\tdownscale filter:  %s\n"
 	               "\tfps:               %d/%d\n"
-	               "\tformat:            %s",
+	               "\tformat:            %s\n"
+	               "\tstaging depth:     %u",
 	               ovi->base_width, ovi->base_height,
 	               ovi->output_width, ovi->output_height,
 	               scale_type_name,
 	               ovi->fps_num, ovi->fps_den,
-		       get_video_format_name(ovi->output_format));
+		       get_video_format_name(ovi->output_format),
+		       get_staging_depth());
 
 	return obs_init_video(ovi);
 }
@@ -1256,6 +1305,8 @@ void obs_set_output_source(uint32_t channel, obs_source_t *source)
 
 	pthread_mutex_unlock(&view->channels_mutex);
 
+	obs_audio_graph_changed();
+
 	if (source)
 		obs_source_activate(source, MAIN_VIEW);
 
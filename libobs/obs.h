@@ -318,9 +318,25 @@ EXPORT profiler_name_store_t *obs_get_profiler_name_store(void);
  */
 EXPORT int obs_reset_video(struct obs_video_info *ovi);
 
+/**
+ * Sets the number of frames that can be in flight from the GPU to the CPU
+ * (2-8, 0 for the default).  Deeper staging avoids stalling the graphics
+ * thread on slow readbacks, at the cost of up to that many frames of output
+ * latency while the readbacks lag.
+ *
+ * @note Takes effect on the next call to obs_reset_video.
+ */
+EXPORT void obs_set_video_staging_depth(uint32_t depth);
+
 EXPORT int obs_reset_face_beauty_enable(bool enable);
 EXPORT int64_t obs_get_face_beauty_time();
 
+/** Time in ms from a camera frame being queued to the face beauty worker to
+ * it being published as an async frame (last processed frame) */
+EXPORT int64_t obs_get_face_beauty_latency();
+/** Frames dropped because the face beauty worker fell behind the camera */
+EXPORT int64_t obs_get_face_beauty_dropped_frames();
+
 /**
  * Sets base audio output format/channels/samples/etc
  *
@@ -1723,6 +1739,17 @@ EXPORT enum obs_encoder_type obs_encoder_get_type(const obs_encoder_t *encoder);
 EXPORT void obs_encoder_set_scaled_size(obs_encoder_t *encoder, uint32_t width,
 		uint32_t height);
 
+/**
+ * Makes a video encoder receive frames on its own thread, so it can encode in
+ * parallel with other encoders.  If it falls behind, frames are skipped for
+ * this encoder only.  Cannot be changed while the encoder is active.
+ */
+EXPORT void obs_encoder_set_threaded(obs_encoder_t *encoder, bool threaded);
+
+/** Gets the frame statistics of an active video encoder */
+EXPORT bool obs_encoder_get_video_stats(const obs_encoder_t *encoder,
+		struct video_input_stats *stats);
+
 /** For video encoders, returns the width of the encoded image */
 EXPORT uint32_t obs_encoder_get_width(const obs_encoder_t *encoder);
 
@@ -1809,6 +1836,16 @@ EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
 		struct encoder_packet *src);
 EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
 
+struct obs_encoder_packet_pool_stats {
+	uint64_t hits;           /**< Allocations served from the pool */
+	uint64_t misses;         /**< Allocations that had to hit the heap */
+	size_t   resident_bytes; /**< Bytes cached in the pool's free lists */
+};
+
+/** Gets statistics of the pool that backs encoder packet data */
+EXPORT void obs_encoder_packet_pool_get_stats(
+		struct obs_encoder_packet_pool_stats *stats);
+
 
 /* ------------------------------------------------------------------------- */
 /* Stream Services */
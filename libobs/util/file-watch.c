@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2016 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "file-watch.h"
+#include "platform.h"
+#include "threading.h"
+#include "bmem.h"
+#include "base.h"
+
+/* how long a file has to stay unchanged before the change is reported */
+#define SETTLE_TIME_NS  250000000ULL
+#define POLL_INTERVAL_NS 1000000000ULL
+
+struct os_file_watch {
+	struct os_file_watch *next;
+
+	char                 *path;
+	const char           *name;
+	os_file_watch_cb_t   callback;
+	void                 *param;
+
+	/* inotify watch of the directory, -1 if the file is polled */
+	int                  wd;
+	time_t               mtime;
+	int64_t              size;
+
+	/* time of the last change not yet reported, 0 if none */
+	uint64_t             changed_ns;
+};
+
+static struct {
+	/* serializes add/remove so the thread is started and stopped once */
+	pthread_mutex_t      control_mutex;
+
+	/* guards the watch list, held while callbacks run */
+	pthread_mutex_t      mutex;
+	struct os_file_watch *first;
+
+	pthread_t            thread;
+	bool                 thread_active;
+	volatile bool        stop;
+
+#ifdef __linux__
+	int                  inotify_fd;
+	int                  wake_fds[2];
+#else
+	os_event_t           *wake;
+#endif
+} file_watch = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER
+};
+
+static void stat_file(struct os_file_watch *watch, time_t *mtime,
+		int64_t *size)
+{
+	struct stat st;
+
+	if (os_stat(watch->path, &st) == 0) {
+		*mtime = st.st_mtime;
+		*size = (int64_t)st.st_size;
+	} else {
+		*mtime = -1;
+		*size = -1;
+	}
+}
+
+static void poll_files(uint64_t now)
+{
+	struct os_file_watch *watch = file_watch.first;
+
+	for (; watch; watch = watch->next) {
+		time_t mtime;
+		int64_t size;
+
+		if (watch->wd != -1)
+			continue;
+
+		stat_file(watch, &mtime, &size);
+		if (mtime != watch->mtime || size != watch->size) {
+			watch->mtime = mtime;
+			watch->size = size;
+			watch->changed_ns = now;
+		}
+	}
+}
+
+/* returns whether any change is still settling */
+static bool report_changes(uint64_t now)
+{
+	struct os_file_watch *watch = file_watch.first;
+	bool settling = false;
+
+	for (; watch; watch = watch->next) {
+		if (!watch->changed_ns)
+			continue;
+
+		if (now - watch->changed_ns < SETTLE_TIME_NS) {
+			settling = true;
+			continue;
+		}
+
+		watch->changed_ns = 0;
+		watch->callback(watch->param);
+	}
+
+	return settling;
+}
+
+#ifdef __linux__
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+		IN_DELETE | IN_ATTRIB)
+
+static bool service_init(void)
+{
+	file_watch.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (file_watch.inotify_fd == -1)
+		blog(LOG_WARNING, "file watch: inotify unavailable (%d), "
+		                  "polling files instead", errno);
+
+	if (pipe(file_watch.wake_fds) != 0) {
+		if (file_watch.inotify_fd != -1)
+			close(file_watch.inotify_fd);
+		return false;
+	}
+
+	fcntl(file_watch.wake_fds[0], F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+static void service_free(void)
+{
+	if (file_watch.inotify_fd != -1)
+		close(file_watch.inotify_fd);
+	close(file_watch.wake_fds[0]);
+	close(file_watch.wake_fds[1]);
+}
+
+static void service_wake(void)
+{
+	char c = 0;
+	ssize_t ret = write(file_watch.wake_fds[1], &c, 1);
+	UNUSED_PARAMETER(ret);
+}
+
+static void service_wait(uint64_t timeout_ns)
+{
+	struct pollfd fds[2] = {
+		{file_watch.wake_fds[0], POLLIN, 0},
+		{file_watch.inotify_fd,  POLLIN, 0}
+	};
+	char buf[64];
+
+	poll(fds, file_watch.inotify_fd != -1 ? 2 : 1,
+			(int)(timeout_ns / 1000000));
+
+	while (read(file_watch.wake_fds[0], buf, sizeof(buf)) > 0);
+}
+
+static void service_watch_dir(struct os_file_watch *watch)
+{
+	char *slash = strrchr(watch->path, '/');
+	char *dir;
+
+	watch->wd = -1;
+	if (file_watch.inotify_fd == -1)
+		return;
+
+	if (slash)
+		dir = bstrdup_n(watch->path, slash == watch->path ?
+				1 : slash - watch->path);
+	else
+		dir = bstrdup(".");
+
+	watch->wd = inotify_add_watch(file_watch.inotify_fd, dir, WATCH_MASK);
+	bfree(dir);
+}
+
+static void service_unwatch_dir(struct os_file_watch *watch)
+{
+	struct os_file_watch *other = file_watch.first;
+
+	if (watch->wd == -1)
+		return;
+
+	/* files in the same directory share the watch */
+	for (; other; other = other->next) {
+		if (other->wd == watch->wd)
+			return;
+	}
+
+	inotify_rm_watch(file_watch.inotify_fd, watch->wd);
+}
+
+static void service_read_events(uint64_t now)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	if (file_watch.inotify_fd == -1)
+		return;
+
+	while ((len = read(file_watch.inotify_fd, buf, sizeof(buf))) > 0) {
+		char *ptr = buf;
+
+		while (ptr < buf + len) {
+			const struct inotify_event *event = (void*)ptr;
+			struct os_file_watch *watch = file_watch.first;
+
+			for (; watch; watch = watch->next) {
+				if (watch->wd != event->wd)
+					continue;
+
+				/* directory is gone, fall back to polling */
+				if (event->mask & IN_IGNORED) {
+					watch->wd = -1;
+					watch->changed_ns = now;
+
+				} else if (event->len &&
+				           strcmp(event->name, watch->name) == 0) {
+					watch->changed_ns = now;
+				}
+			}
+
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+#else
+
+static bool service_init(void)
+{
+	return os_event_init(&file_watch.wake, OS_EVENT_TYPE_AUTO) == 0;
+}
+
+static void service_free(void)
+{
+	os_event_destroy(file_watch.wake);
+}
+
+static void service_wake(void)
+{
+	os_event_signal(file_watch.wake);
+}
+
+static void service_wait(uint64_t timeout_ns)
+{
+	os_event_timedwait(file_watch.wake,
+			(unsigned long)(timeout_ns / 1000000));
+}
+
+static void service_watch_dir(struct os_file_watch *watch)
+{
+	watch->wd = -1;
+}
+
+static void service_unwatch_dir(struct os_file_watch *watch)
+{
+	UNUSED_PARAMETER(watch);
+}
+
+static void service_read_events(uint64_t now)
+{
+	UNUSED_PARAMETER(now);
+}
+
+#endif
+
+static void *file_watch_thread(void *unused)
+{
+	uint64_t last_poll = 0;
+	bool settling = false;
+
+	os_set_thread_name("file watch");
+
+	while (!file_watch.stop) {
+		uint64_t now;
+
+		service_wait(settling ? SETTLE_TIME_NS / 4 : POLL_INTERVAL_NS);
+		now = os_gettime_ns();
+
+		pthread_mutex_lock(&file_watch.mutex);
+
+		service_read_events(now);
+
+		if (now - last_poll >= POLL_INTERVAL_NS) {
+			poll_files(now);
+			last_poll = now;
+		}
+
+		settling = report_changes(now);
+
+		pthread_mutex_unlock(&file_watch.mutex);
+	}
+
+	UNUSED_PARAMETER(unused);
+	return NULL;
+}
+
+os_file_watch_t *os_file_watch_add(const char *path,
+		os_file_watch_cb_t callback, void *param)
+{
+	struct os_file_watch *watch;
+	const char *slash;
+
+	if (!path || !*path || !callback)
+		return NULL;
+
+	pthread_mutex_lock(&file_watch.control_mutex);
+
+	if (!file_watch.thread_active) {
+		file_watch.stop = false;
+
+		if (!service_init()) {
+			pthread_mutex_unlock(&file_watch.control_mutex);
+			return NULL;
+		}
+
+		if (pthread_create(&file_watch.thread, NULL,
+					file_watch_thread, NULL) != 0) {
+			service_free();
+			pthread_mutex_unlock(&file_watch.control_mutex);
+			return NULL;
+		}
+
+		file_watch.thread_active = true;
+	}
+
+	watch = bzalloc(sizeof(*watch));
+	watch->path = bstrdup(path);
+	watch->callback = callback;
+	watch->param = param;
+
+	slash = strrchr(watch->path, '/');
+	watch->name = slash ? slash + 1 : watch->path;
+
+	stat_file(watch, &watch->mtime, &watch->size);
+
+	pthread_mutex_lock(&file_watch.mutex);
+	service_watch_dir(watch);
+	watch->next = file_watch.first;
+	file_watch.first = watch;
+	pthread_mutex_unlock(&file_watch.mutex);
+
+	pthread_mutex_unlock(&file_watch.control_mutex);
+	return watch;
+}
+
+void os_file_watch_remove(os_file_watch_t *watch)
+{
+	struct os_file_watch **cur;
+	bool empty;
+
+	if (!watch)
+		return;
+
+	pthread_mutex_lock(&file_watch.control_mutex);
+
+	pthread_mutex_lock(&file_watch.mutex);
+	for (cur = &file_watch.first; *cur; cur = &(*cur)->next) {
+		if (*cur == watch) {
+			*cur = watch->next;
+			break;
+		}
+	}
+	service_unwatch_dir(watch);
+	empty = !file_watch.first;
+	pthread_mutex_unlock(&file_watch.mutex);
+
+	if (empty && file_watch.thread_active) {
+		file_watch.stop = true;
+		service_wake();
+		pthread_join(file_watch.thread, NULL);
+		service_free();
+		file_watch.thread_active = false;
+	}
+
+	pthread_mutex_unlock(&file_watch.control_mutex);
+
+	bfree(watch->path);
+	bfree(watch);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2016 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared file change notification.
+ *
+ * All watches are serviced by one thread.  On Linux the watched file's
+ * directory is monitored with inotify (so files replaced by a rename are
+ * caught too), elsewhere, or if inotify is unavailable, the files are
+ * polled with stat once a second.  Changes are reported once the file has
+ * stopped changing for a short while, so a file still being written does
+ * not report every write.
+ */
+
+struct os_file_watch;
+typedef struct os_file_watch os_file_watch_t;
+
+/* called from the watch thread.  must not add or remove watches */
+typedef void (*os_file_watch_cb_t)(void *param);
+
+EXPORT os_file_watch_t *os_file_watch_add(const char *path,
+		os_file_watch_cb_t callback, void *param);
+
+/* once this returns the callback will not be called again */
+EXPORT void os_file_watch_remove(os_file_watch_t *watch);
+
+#ifdef __cplusplus
+}
+#endif
@@ -14,8 +14,11 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <errno.h>
 #include <stdio.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "bmem.h"
 #include "pipe.h"
@@ -85,3 +88,59 @@ size_t os_process_pipe_write(os_process_pipe_t *pp, const uint8_t *data,
 
 	return fwrite(data, 1, len, pp->file);
 }
+
+#define MAX_PIPE_IOV 64
+
+size_t os_process_pipe_writev(os_process_pipe_t *pp,
+		const struct os_pipe_buf *bufs, size_t count)
+{
+	struct iovec iov[MAX_PIPE_IOV];
+	size_t total = 0;
+	size_t offset = 0;
+	int fd;
+
+	if (!pp) {
+		return 0;
+	}
+	if (pp->read_pipe) {
+		return 0;
+	}
+
+	/* anything still sitting in the stdio buffer has to go out first */
+	if (fflush(pp->file) != 0) {
+		return 0;
+	}
+
+	fd = fileno(pp->file);
+
+	while (count) {
+		size_t num = count < MAX_PIPE_IOV ? count : MAX_PIPE_IOV;
+		ssize_t ret;
+
+		for (size_t i = 0; i < num; i++) {
+			size_t skip = i == 0 ? offset : 0;
+			iov[i].iov_base = (void*)(bufs[i].data + skip);
+			iov[i].iov_len = bufs[i].len - skip;
+		}
+
+		ret = writev(fd, iov, (int)num);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		total += (size_t)ret;
+
+		/* skip what went out, partial writes resume mid-buffer */
+		ret += (ssize_t)offset;
+		while (count && (size_t)ret >= bufs->len) {
+			ret -= (ssize_t)bufs->len;
+			bufs++;
+			count--;
+		}
+		offset = (size_t)ret;
+	}
+
+	return total;
+}
@@ -25,6 +25,8 @@ struct os_process_pipe {
 	bool read_pipe;
 	HANDLE handle;
 	HANDLE process;
+	uint8_t *write_buf;
+	size_t write_buf_size;
 };
 
 static bool create_pipe(HANDLE *input, HANDLE *output)
@@ -104,7 +106,7 @@ os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
 		goto error;
 	}
 
-	pp = bmalloc(sizeof(*pp));
+	pp = bzalloc(sizeof(*pp));
 	pp->handle = read_pipe ? input : output;
 	pp->read_pipe = read_pipe;
 	pp->process = process;
@@ -132,6 +134,7 @@ int os_process_pipe_destroy(os_process_pipe_t *pp)
 			ret = (int)code;
 
 		CloseHandle(pp->process);
+		bfree(pp->write_buf);
 		bfree(pp);
 	}
 
@@ -179,3 +182,34 @@ size_t os_process_pipe_write(os_process_pipe_t *pp, const uint8_t *data,
 
 	return 0;
 }
+
+size_t os_process_pipe_writev(os_process_pipe_t *pp,
+		const struct os_pipe_buf *bufs, size_t count)
+{
+	size_t total = 0;
+	uint8_t *ptr;
+
+	if (!pp) {
+		return 0;
+	}
+	if (pp->read_pipe) {
+		return 0;
+	}
+
+	/* anonymous pipes have no gather write, coalesce into one WriteFile */
+	for (size_t i = 0; i < count; i++)
+		total += bufs[i].len;
+
+	if (pp->write_buf_size < total) {
+		pp->write_buf = brealloc(pp->write_buf, total);
+		pp->write_buf_size = total;
+	}
+
+	ptr = pp->write_buf;
+	for (size_t i = 0; i < count; i++) {
+		memcpy(ptr, bufs[i].data, bufs[i].len);
+		ptr += bufs[i].len;
+	}
+
+	return os_process_pipe_write(pp, pp->write_buf, total);
+}
@@ -29,3 +29,13 @@ EXPORT size_t os_process_pipe_read(os_process_pipe_t *pp, uint8_t *data,
 		size_t len);
 EXPORT size_t os_process_pipe_write(os_process_pipe_t *pp, const uint8_t *data,
 		size_t len);
+
+struct os_pipe_buf {
+	const uint8_t *data;
+	size_t        len;
+};
+
+/* writes several buffers in order with as few system calls as the platform
+ * allows, returns the total number of bytes written */
+EXPORT size_t os_process_pipe_writev(os_process_pipe_t *pp,
+		const struct os_pipe_buf *bufs, size_t count);
@@ -1,8 +1,9 @@
 #include <obs-module.h>
 #include <graphics/image-file.h>
 #include <util/platform.h>
+#include <util/threading.h>
+#include <util/file-watch.h>
 #include <util/dstr.h>
-#include <sys/stat.h>
 
 #define blog(log_level, format, ...) \
 	blog(log_level, "[image_source: '%s'] " format, \
@@ -20,23 +21,24 @@ struct image_source {
 
 	char         *file;
 	bool         persistent;
-	time_t       file_timestamp;
-	float        update_time_elapsed;
 	uint64_t     last_time;
 	bool         active;
+	uint64_t     cache_budget;
+
+	os_file_watch_t *watch;
+	volatile bool   file_changed;
+
+	/* the changed file is decoded on a worker thread and swapped in
+	 * on the next tick after it's ready */
+	pthread_t       reload_thread;
+	bool            reloading;
+	volatile bool   reload_ready;
+	gs_image_file_t reload_image;
 
 	gs_image_file_t image;
 };
 
 
-static time_t get_modified_timestamp(const char *filename)
-{
-	struct stat stats;
-	if (os_stat(filename, &stats) != 0)
-		return -1;
-	return stats.st_mtime;
-}
-
 static const char *image_source_get_name(void *unused)
 {
 	UNUSED_PARAMETER(unused);
@@ -53,9 +55,8 @@ static void image_source_load(struct image_source *context)
 
 	if (file && *file) {
 		debug("loading texture '%s'", file);
-		context->file_timestamp = get_modified_timestamp(file);
-		gs_image_file_init(&context->image, file);
-		context->update_time_elapsed = 0;
+		gs_image_file_init_with_budget(&context->image, file,
+				context->cache_budget);
 
 		obs_enter_graphics();
 		gs_image_file_init_texture(&context->image);
@@ -77,17 +78,93 @@ static void image_source_unload(struct image_source *context)
 	obs_leave_graphics();
 }
 
+static void *reload_thread(void *data)
+{
+	struct image_source *context = data;
+
+	os_set_thread_name("image source reload");
+
+	gs_image_file_init_with_budget(&context->reload_image, context->file,
+			context->cache_budget);
+	os_atomic_set_bool(&context->reload_ready, true);
+	return NULL;
+}
+
+static void image_source_start_reload(struct image_source *context)
+{
+	debug("file changed, reloading '%s'", context->file);
+
+	context->reload_ready = false;
+	if (pthread_create(&context->reload_thread, NULL, reload_thread,
+				context) == 0)
+		context->reloading = true;
+	else
+		image_source_load(context);
+}
+
+static void image_source_finish_reload(struct image_source *context)
+{
+	gs_image_file_t *image = &context->reload_image;
+
+	pthread_join(context->reload_thread, NULL);
+	context->reloading = false;
+
+	image->enable_loop = context->image.enable_loop;
+	image->element_type = context->image.element_type;
+
+	obs_enter_graphics();
+	gs_image_file_free(&context->image);
+	gs_image_file_init_texture(image);
+	obs_leave_graphics();
+
+	context->image = *image;
+	memset(image, 0, sizeof(*image));
+	context->last_time = 0;
+
+	if (!context->image.loaded)
+		warn("failed to load texture '%s'", context->file);
+}
+
+static void image_source_cancel_reload(struct image_source *context)
+{
+	if (!context->reloading)
+		return;
+
+	pthread_join(context->reload_thread, NULL);
+	context->reloading = false;
+
+	obs_enter_graphics();
+	gs_image_file_free(&context->reload_image);
+	obs_leave_graphics();
+}
+
+static void file_changed(void *data)
+{
+	struct image_source *context = data;
+	os_atomic_set_bool(&context->file_changed, true);
+}
+
 static void image_source_update(void *data, obs_data_t *settings)
 {
 	struct image_source *context = data;
 	const char *file = obs_data_get_string(settings, "file");
 	const bool unload = obs_data_get_bool(settings, "unload");
 
+	image_source_cancel_reload(context);
+	os_file_watch_remove(context->watch);
+
+	context->cache_budget =
+		(uint64_t)obs_data_get_int(settings, "cache_budget_mb") *
+		1024 * 1024;
+
 	if (context->file)
 		bfree(context->file);
 	context->file = bstrdup(file);
 	context->persistent = !unload;
 
+	context->watch = os_file_watch_add(file, file_changed, context);
+	context->file_changed = false;
+
 	/* Load the image if the source is persistent or showing */
 	if (context->persistent || obs_source_showing(context->source))
 		image_source_load(data);
@@ -103,6 +180,8 @@ static void image_source_defaults(obs_data_t *settings)
 	obs_data_set_default_bool(settings, "unload", false);
 	obs_data_set_default_bool(settings, "looping", true);
 	obs_data_set_default_int(settings, "element_type", -1);
+	obs_data_set_default_int(settings, "cache_budget_mb",
+			GS_IMAGE_FILE_CACHE_BUDGET / (1024 * 1024));
 }
 
 static void image_source_show(void *data)
@@ -121,11 +200,22 @@ static void image_source_hide(void *data)
 		image_source_unload(context);
 }
 
+static void get_mem_usage(void *data, calldata_t *cd)
+{
+	struct image_source *context = data;
+	calldata_set_int(cd, "bytes",
+			(long long)gs_image_file_get_mem_usage(&context->image));
+}
+
 static void *image_source_create(obs_data_t *settings, obs_source_t *source)
 {
 	struct image_source *context = bzalloc(sizeof(struct image_source));
+	proc_handler_t *ph = obs_source_get_proc_handler(source);
 	context->source = source;
 
+	proc_handler_add(ph, "void get_mem_usage(out int bytes)",
+			get_mem_usage, context);
+
 	image_source_update(context, settings);
 	return context;
 }
@@ -134,6 +224,8 @@ static void image_source_destroy(void *data)
 {
 	struct image_source *context = data;
 
+	os_file_watch_remove(context->watch);
+	image_source_cancel_reload(context);
 	image_source_unload(context);
 
 	if (context->file)
@@ -174,15 +266,16 @@ static void image_source_tick(void *data, float seconds)
 	struct image_source *context = data;
 	uint64_t frame_time = obs_get_video_frame_time();
 
-	context->update_time_elapsed += seconds;
+	UNUSED_PARAMETER(seconds);
 
-	if (context->update_time_elapsed >= 1.0f) {
-		time_t t = get_modified_timestamp(context->file);
-		context->update_time_elapsed = 0.0f;
+	if (context->reloading) {
+		if (os_atomic_load_bool(&context->reload_ready))
+			image_source_finish_reload(context);
 
-		if (context->file_timestamp != t) {
-			image_source_load(context);
-		}
+	} else if (os_atomic_set_bool(&context->file_changed, false)) {
+		/* hidden unloaded sources load the new file when shown */
+		if (context->persistent || obs_source_showing(context->source))
+			image_source_start_reload(context);
 	}
 
 	if (obs_source_active(context->source)) {
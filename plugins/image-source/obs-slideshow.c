@@ -25,6 +25,8 @@
 #define S_MODE                         "slide_mode"
 #define S_MODE_AUTO                    "mode_auto"
 #define S_MODE_MANUAL                  "mode_manual"
+#define S_PREFETCH                     "prefetch"
+#define S_PREFETCH_WINDOW              "prefetch_window"
 
 #define TR_CUT                         "cut"
 #define TR_FADE                        "fade"
@@ -48,6 +50,8 @@
 #define T_MODE                         T_("SlideMode")
 #define T_MODE_AUTO                    T_("SlideMode.Auto")
 #define T_MODE_MANUAL                  T_("SlideMode.Manual")
+#define T_PREFETCH                     T_("Prefetch")
+#define T_PREFETCH_WINDOW              T_("PrefetchWindow")
 
 #define T_TR_(text) obs_module_text("SlideShow.Transition." text)
 #define T_TR_CUT                       T_TR_("Cut")
@@ -60,6 +64,7 @@
 struct image_file_data {
 	char *path;
 	obs_source_t *source;
+	bool failed;
 };
 
 enum behavior {
@@ -92,8 +97,36 @@ struct slideshow {
 	uint32_t cx;
 	uint32_t cy;
 
+	/* custom size setting, applied to the largest slide */
+	bool size_auto;
+	bool size_aspect_only;
+	int size_cx;
+	int size_cy;
+
 	pthread_mutex_t mutex;
 	DARRAY(struct image_file_data) files;
+	uint64_t files_gen;
+
+	/* in prefetch mode only the slides within prefetch_window of the
+	 * current one (and the next random one) are loaded, on the prefetch
+	 * thread.  files[i].source is NULL for the others */
+	bool prefetch;
+	size_t prefetch_window;
+	size_t random_next;
+	bool transition_pending;
+	bool pending_cut;
+	size_t pending_skips;
+
+	/* largest slide loaded so far, grows as the prefetch thread loads
+	 * slides */
+	uint32_t slides_cx;
+	uint32_t slides_cy;
+	bool slides_size_changed;
+
+	pthread_t prefetch_thread;
+	bool prefetch_thread_active;
+	os_sem_t *prefetch_sem;
+	volatile bool prefetch_stop;
 
 	enum behavior behavior;
 
@@ -167,6 +200,235 @@ static inline size_t random_file(struct slideshow *ss)
 	return (size_t)rand() % ss->files.num;
 }
 
+static obs_source_t *get_slide(struct slideshow *ss, size_t idx)
+{
+	obs_source_t *source = NULL;
+
+	pthread_mutex_lock(&ss->mutex);
+	if (idx < ss->files.num) {
+		source = ss->files.array[idx].source;
+		obs_source_addref(source);
+	}
+	pthread_mutex_unlock(&ss->mutex);
+
+	return source;
+}
+
+/* cur_item is read by the prefetch thread */
+static inline void set_cur_item(struct slideshow *ss, size_t idx)
+{
+	pthread_mutex_lock(&ss->mutex);
+	ss->cur_item = idx;
+	pthread_mutex_unlock(&ss->mutex);
+}
+
+static bool slide_failed(struct slideshow *ss, size_t idx)
+{
+	bool failed = false;
+
+	pthread_mutex_lock(&ss->mutex);
+	if (idx < ss->files.num)
+		failed = ss->files.array[idx].failed;
+	pthread_mutex_unlock(&ss->mutex);
+
+	return failed;
+}
+
+/* ------------------------------------------------------------------------- */
+/* prefetching */
+
+static bool in_window(struct slideshow *ss, size_t idx)
+{
+	size_t num = ss->files.num;
+	size_t ahead = (idx + num - ss->cur_item) % num;
+	size_t behind = (ss->cur_item + num - idx) % num;
+
+	if (ss->randomize && idx == ss->random_next)
+		return true;
+
+	return ahead <= ss->prefetch_window || behind <= ss->prefetch_window;
+}
+
+static inline bool needs_load(struct slideshow *ss, size_t idx)
+{
+	struct image_file_data *file = &ss->files.array[idx];
+	return !file->source && !file->failed;
+}
+
+/* closest slide in the window that still has to be loaded */
+static bool next_prefetch_item(struct slideshow *ss, size_t *idx)
+{
+	size_t num = ss->files.num;
+	size_t cur = ss->cur_item;
+
+	if (!ss->prefetch || cur >= num)
+		return false;
+
+	if (needs_load(ss, cur)) {
+		*idx = cur;
+		return true;
+	}
+
+	if (ss->randomize && ss->random_next < num &&
+	    needs_load(ss, ss->random_next)) {
+		*idx = ss->random_next;
+		return true;
+	}
+
+	for (size_t i = 1; i <= ss->prefetch_window && i < num; i++) {
+		size_t next = (cur + i) % num;
+		size_t prev = (cur + num - i) % num;
+
+		if (needs_load(ss, next)) {
+			*idx = next;
+			return true;
+		}
+		if (needs_load(ss, prev)) {
+			*idx = prev;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* called with the mutex held */
+static void add_slide_size(struct slideshow *ss, obs_source_t *source)
+{
+	uint32_t cx = obs_source_get_width(source);
+	uint32_t cy = obs_source_get_height(source);
+
+	if (cx > ss->slides_cx) {
+		ss->slides_cx = cx;
+		ss->slides_size_changed = true;
+	}
+	if (cy > ss->slides_cy) {
+		ss->slides_cy = cy;
+		ss->slides_size_changed = true;
+	}
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct slideshow *ss = data;
+
+	os_set_thread_name("slideshow prefetch");
+
+	while (os_sem_wait(ss->prefetch_sem) == 0 && !ss->prefetch_stop) {
+		for (;;) {
+			obs_source_t *source;
+			uint64_t gen;
+			size_t idx;
+			char *path;
+
+			pthread_mutex_lock(&ss->mutex);
+			if (!next_prefetch_item(ss, &idx)) {
+				pthread_mutex_unlock(&ss->mutex);
+				break;
+			}
+
+			path = bstrdup(ss->files.array[idx].path);
+			gen = ss->files_gen;
+			pthread_mutex_unlock(&ss->mutex);
+
+			source = create_source_from_file(path);
+
+			/* the list may have changed or moved on meanwhile */
+			pthread_mutex_lock(&ss->mutex);
+			if (gen == ss->files_gen && needs_load(ss, idx) &&
+			    in_window(ss, idx)) {
+				if (source) {
+					ss->files.array[idx].source = source;
+					add_slide_size(ss, source);
+				} else {
+					ss->files.array[idx].failed = true;
+				}
+				source = NULL;
+			}
+			pthread_mutex_unlock(&ss->mutex);
+
+			obs_source_release(source);
+			bfree(path);
+
+			if (ss->prefetch_stop)
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+static void prefetch_thread_stop(struct slideshow *ss)
+{
+	if (!ss->prefetch_thread_active)
+		return;
+
+	ss->prefetch_stop = true;
+	os_sem_post(ss->prefetch_sem);
+	pthread_join(ss->prefetch_thread, NULL);
+	ss->prefetch_thread_active = false;
+}
+
+static void prefetch_thread_start(struct slideshow *ss)
+{
+	if (ss->prefetch_thread_active)
+		return;
+
+	ss->prefetch_stop = false;
+	ss->prefetch_thread_active = pthread_create(&ss->prefetch_thread,
+			NULL, prefetch_thread, ss) == 0;
+	if (!ss->prefetch_thread_active) {
+		blog(LOG_WARNING, "slideshow: Failed to create prefetch "
+				"thread");
+
+		/* nothing will load the pending slide, transition_to won't
+		 * wait for slides without the thread either */
+		ss->transition_pending = false;
+		ss->pending_skips = 0;
+	}
+}
+
+/* releases the slides that left the window and queues the new ones */
+static void prefetch_update(struct slideshow *ss)
+{
+	DARRAY(obs_source_t*) released;
+	size_t num;
+
+	if (!ss->prefetch)
+		return;
+
+	da_init(released);
+
+	pthread_mutex_lock(&ss->mutex);
+
+	num = ss->files.num;
+	if (ss->randomize && num > 1) {
+		while (ss->random_next >= num ||
+		       ss->random_next == ss->cur_item)
+			ss->random_next = random_file(ss);
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		struct image_file_data *file = &ss->files.array[i];
+
+		if (in_window(ss, i))
+			continue;
+
+		if (file->source)
+			da_push_back(released, &file->source);
+		file->source = NULL;
+		file->failed = false;
+	}
+
+	pthread_mutex_unlock(&ss->mutex);
+
+	for (size_t i = 0; i < released.num; i++)
+		obs_source_release(released.array[i]);
+	da_free(released);
+
+	os_sem_post(ss->prefetch_sem);
+}
+
 /* ------------------------------------------------------------------------- */
 
 static const char *ss_getname(void *unused)
@@ -176,7 +438,7 @@ static const char *ss_getname(void *unused)
 }
 
 static void add_file(struct slideshow *ss, struct darray *array,
-		const char *path, uint32_t *cx, uint32_t *cy)
+		const char *path, uint32_t *cx, uint32_t *cy, bool prefetch)
 {
 	DARRAY(struct image_file_data) new_files;
 	struct image_file_data data;
@@ -190,6 +452,27 @@ static void add_file(struct slideshow *ss, struct darray *array,
 
 	if (!new_source)
 		new_source = get_source(&new_files.da, path);
+
+	/* prefetched slides are loaded once they are needed, and are sized
+	 * once loaded */
+	if (prefetch) {
+		if (new_source) {
+			uint32_t new_cx = obs_source_get_width(new_source);
+			uint32_t new_cy = obs_source_get_height(new_source);
+
+			if (new_cx > *cx) *cx = new_cx;
+			if (new_cy > *cy) *cy = new_cy;
+		}
+
+		data.path = bstrdup(path);
+		data.source = new_source;
+		data.failed = false;
+		da_push_back(new_files, &data);
+
+		*array = new_files.da;
+		return;
+	}
+
 	if (!new_source)
 		new_source = create_source_from_file(path);
 
@@ -199,6 +482,7 @@ static void add_file(struct slideshow *ss, struct darray *array,
 
 		data.path = bstrdup(path);
 		data.source = new_source;
+		data.failed = false;
 		da_push_back(new_files, &data);
 
 		if (new_cx > *cx) *cx = new_cx;
@@ -225,26 +509,112 @@ static inline bool item_valid(struct slideshow *ss)
 	return ss->files.num && ss->cur_item < ss->files.num;
 }
 
-static void do_transition(void *data, bool to_null)
+static void transition_to(struct slideshow *ss, bool to_null, bool cut)
 {
-	struct slideshow *ss = data;
 	bool valid = item_valid(ss);
+	obs_source_t *source;
+
+	prefetch_update(ss);
+	source = valid ? get_slide(ss, ss->cur_item) : NULL;
 
-	if (valid && ss->use_cut)
-		obs_transition_set(ss->transition,
-				ss->files.array[ss->cur_item].source);
+	/* slide is still loading, the tick transitions once it's ready */
+	if (ss->prefetch && ss->prefetch_thread_active && valid && !source &&
+	    (cut || !to_null)) {
+		ss->transition_pending = true;
+		ss->pending_cut = cut;
+		return;
+	}
+
+	ss->transition_pending = false;
+	ss->pending_skips = 0;
+
+	if (valid && cut)
+		obs_transition_set(ss->transition, source);
 
 	else if (valid && !to_null)
 		obs_transition_start(ss->transition,
 				OBS_TRANSITION_MODE_AUTO,
 				ss->tr_speed,
-				ss->files.array[ss->cur_item].source);
+				source);
 
 	else
 		obs_transition_start(ss->transition,
 				OBS_TRANSITION_MODE_AUTO,
 				ss->tr_speed,
 				NULL);
+
+	obs_source_release(source);
+}
+
+static void do_transition(void *data, bool to_null)
+{
+	struct slideshow *ss = data;
+	transition_to(ss, to_null, ss->use_cut);
+}
+
+static void try_pending_transition(struct slideshow *ss)
+{
+	obs_source_t *source = get_slide(ss, ss->cur_item);
+
+	if (source) {
+		obs_source_release(source);
+
+		ss->transition_pending = false;
+		transition_to(ss, false, ss->pending_cut);
+		return;
+	}
+
+	if (!slide_failed(ss, ss->cur_item))
+		return;
+
+	/* the slide could not be loaded, move on to the next one, and give up
+	 * once every slide has failed */
+	ss->transition_pending = false;
+
+	if (++ss->pending_skips >= ss->files.num) {
+		ss->pending_skips = 0;
+		transition_to(ss, true, false);
+		return;
+	}
+
+	set_cur_item(ss, (ss->cur_item + 1) % ss->files.num);
+	transition_to(ss, false, ss->pending_cut);
+}
+
+/* sizes the slideshow to the largest slide, or to the custom size */
+static void update_size(struct slideshow *ss)
+{
+	uint32_t cx, cy;
+
+	pthread_mutex_lock(&ss->mutex);
+	cx = ss->slides_cx;
+	cy = ss->slides_cy;
+	ss->slides_size_changed = false;
+	pthread_mutex_unlock(&ss->mutex);
+
+	if (!ss->size_auto) {
+		double cx_f = (double)cx;
+		double cy_f = (double)cy;
+
+		double old_aspect = cx_f / cy_f;
+		double new_aspect = (double)ss->size_cx / (double)ss->size_cy;
+
+		if (ss->size_aspect_only) {
+			if (fabs(old_aspect - new_aspect) > EPSILON) {
+				if (new_aspect > old_aspect)
+					cx = (uint32_t)(cy_f * new_aspect);
+				else
+					cy = (uint32_t)(cx_f / new_aspect);
+			}
+		} else {
+			cx = (uint32_t)ss->size_cx;
+			cy = (uint32_t)ss->size_cy;
+		}
+	}
+
+	ss->cx = cx;
+	ss->cy = cy;
+	obs_transition_set_size(ss->transition, cx, cy);
 }
 
 static void ss_update(void *data, obs_data_t *settings)
@@ -263,6 +633,7 @@ static void ss_update(void *data, obs_data_t *settings)
 	size_t count;
 	const char *behavior;
 	const char *mode;
+	bool prefetch;
 
 	/* ------------------------------------- */
 	/* get settings data */
@@ -295,6 +666,7 @@ static void ss_update(void *data, obs_data_t *settings)
 	ss->randomize = obs_data_get_bool(settings, S_RANDOMIZE);
 	ss->loop = obs_data_get_bool(settings, S_LOOP);
 	ss->hide = obs_data_get_bool(settings, S_HIDE);
+	prefetch = obs_data_get_bool(settings, S_PREFETCH);
 
 	if (!ss->tr_name || strcmp(tr_name, ss->tr_name) != 0)
 		new_tr = obs_source_create_private(tr_name, NULL, NULL);
@@ -334,13 +706,13 @@ static void ss_update(void *data, obs_data_t *settings)
 				dstr_cat_ch(&dir_path, '/');
 				dstr_cat(&dir_path, ent->d_name);
 				add_file(ss, &new_files.da, dir_path.array,
-						&cx, &cy);
+						&cx, &cy, prefetch);
 			}
 
 			dstr_free(&dir_path);
 			os_closedir(dir);
 		} else {
-			add_file(ss, &new_files.da, path, &cx, &cy);
+			add_file(ss, &new_files.da, path, &cx, &cy, prefetch);
 		}
 
 		obs_data_release(item);
@@ -353,6 +725,19 @@ static void ss_update(void *data, obs_data_t *settings)
 
 	old_files.da = ss->files.da;
 	ss->files.da = new_files.da;
+	ss->files_gen++;
+	ss->prefetch = prefetch;
+	ss->prefetch_window =
+		(size_t)obs_data_get_int(settings, S_PREFETCH_WINDOW);
+	ss->random_next = (size_t)-1;
+	ss->transition_pending = false;
+	ss->pending_skips = 0;
+	ss->slides_cx = cx;
+	ss->slides_cy = cy;
+	ss->slides_size_changed = false;
+	ss->cur_item = 0;
+	if (ss->randomize && ss->files.num)
+		ss->cur_item = random_file(ss);
 	if (new_tr) {
 		old_tr = ss->transition;
 		ss->transition = new_tr;
@@ -376,59 +761,44 @@ static void ss_update(void *data, obs_data_t *settings)
 		obs_source_release(old_tr);
 	free_files(&old_files.da);
 
+	if (prefetch)
+		prefetch_thread_start(ss);
+	else
+		prefetch_thread_stop(ss);
+
 	/* ------------------------- */
 
 	const char *res_str = obs_data_get_string(settings, S_CUSTOM_SIZE);
-	bool aspect_only = false, use_auto = true;
 	int cx_in = 0, cy_in = 0;
 
+	ss->size_auto = true;
+	ss->size_aspect_only = false;
+
 	if (strcmp(res_str, T_CUSTOM_SIZE_AUTO) != 0) {
 		int ret = sscanf(res_str, "%dx%d", &cx_in, &cy_in);
 		if (ret == 2) {
-			aspect_only = false;
-			use_auto = false;
+			ss->size_aspect_only = false;
+			ss->size_auto = false;
 		} else {
 			ret = sscanf(res_str, "%d:%d", &cx_in, &cy_in);
 			if (ret == 2) {
-				aspect_only = true;
-				use_auto = false;
+				ss->size_aspect_only = true;
+				ss->size_auto = false;
 			}
 		}
 	}
 
-	if (!use_auto) {
-		double cx_f = (double)cx;
-		double cy_f = (double)cy;
-
-		double old_aspect = cx_f / cy_f;
-		double new_aspect = (double)cx_in / (double)cy_in;
-
-		if (aspect_only) {
-			if (fabs(old_aspect - new_aspect) > EPSILON) {
-				if (new_aspect > old_aspect)
-					cx = (uint32_t)(cy_f * new_aspect);
-				else
-					cy = (uint32_t)(cx_f / new_aspect);
-			}
-		} else {
-			cx = (uint32_t)cx_in;
-			cy = (uint32_t)cy_in;
-		}
-	}
+	ss->size_cx = cx_in;
+	ss->size_cy = cy_in;
 
 	/* ------------------------- */
 
-	ss->cx = cx;
-	ss->cy = cy;
-	ss->cur_item = 0;
 	ss->elapsed = 0.0f;
-	obs_transition_set_size(ss->transition, cx, cy);
+	update_size(ss);
 	obs_transition_set_alignment(ss->transition, OBS_ALIGN_CENTER);
 	obs_transition_set_scale_type(ss->transition,
 			OBS_TRANSITION_SCALE_ASPECT);
 
-	if (ss->randomize && ss->files.num)
-		ss->cur_item = random_file(ss);
 	if (new_tr)
 		obs_source_add_active_child(ss->source, new_tr);
 	if (ss->files.num)
@@ -450,10 +820,9 @@ static void ss_restart(void *data)
 	struct slideshow *ss = data;
 
 	ss->elapsed = 0.0f;
-	ss->cur_item = 0;
+	set_cur_item(ss, 0);
 
-	obs_transition_set(ss->transition,
-			ss->files.array[ss->cur_item].source);
+	transition_to(ss, false, true);
 
 	ss->stop = false;
 	ss->paused = false;
@@ -464,7 +833,7 @@ static void ss_stop(void *data)
 	struct slideshow *ss = data;
 
 	ss->elapsed = 0.0f;
-	ss->cur_item = 0;
+	set_cur_item(ss, 0);
 
 	do_transition(ss, true);
 	ss->stop = true;
@@ -478,8 +847,7 @@ static void ss_next_slide(void *data)
 	if (!ss->files.num)
 		return;
 
-	if (++ss->cur_item >= ss->files.num)
-		ss->cur_item = 0;
+	set_cur_item(ss, (ss->cur_item + 1) % ss->files.num);
 
 	do_transition(ss, false);
 }
@@ -492,9 +860,9 @@ static void ss_previous_slide(void *data)
 		return;
 
 	if (ss->cur_item == 0)
-		ss->cur_item = ss->files.num - 1;
+		set_cur_item(ss, ss->files.num - 1);
 	else
-		--ss->cur_item;
+		set_cur_item(ss, ss->cur_item - 1);
 
 	do_transition(ss, false);
 }
@@ -569,8 +937,11 @@ static void ss_destroy(void *data)
 {
 	struct slideshow *ss = data;
 
+	prefetch_thread_stop(ss);
+
 	obs_source_release(ss->transition);
 	free_files(&ss->files.da);
+	os_sem_destroy(ss->prefetch_sem);
 	pthread_mutex_destroy(&ss->mutex);
 	bfree(ss);
 }
@@ -613,6 +984,8 @@ static void *ss_create(obs_data_t *settings, obs_source_t *source)
 	pthread_mutex_init_value(&ss->mutex);
 	if (pthread_mutex_init(&ss->mutex, NULL) != 0)
 		goto error;
+	if (os_sem_init(&ss->prefetch_sem, 0) != 0)
+		goto error;
 
 	obs_source_update(source, NULL);
 
@@ -644,9 +1017,26 @@ static void ss_video_tick(void *data, float seconds)
 	if (!ss->transition || !ss->slide_time)
 		return;
 
+	if (ss->prefetch) {
+		bool size_changed;
+
+		pthread_mutex_lock(&ss->mutex);
+		size_changed = ss->slides_size_changed;
+		pthread_mutex_unlock(&ss->mutex);
+
+		if (size_changed)
+			update_size(ss);
+	}
+
+	if (ss->transition_pending) {
+		try_pending_transition(ss);
+		if (ss->transition_pending)
+			return;
+	}
+
 	if (ss->restart_on_activate && !ss->randomize && ss->use_cut) {
 		ss->elapsed = 0.0f;
-		ss->cur_item = 0;
+		set_cur_item(ss, 0);
 		do_transition(ss, false);
 		ss->restart_on_activate = false;
 		ss->use_cut = false;
@@ -673,14 +1063,19 @@ static void ss_video_tick(void *data, float seconds)
 
 		if (ss->randomize) {
 			size_t next = ss->cur_item;
-			if (ss->files.num > 1) {
+
+			pthread_mutex_lock(&ss->mutex);
+			if (ss->prefetch && ss->random_next < ss->files.num) {
+				next = ss->random_next;
+			} else if (ss->files.num > 1) {
 				while (next == ss->cur_item)
 					next = random_file(ss);
 			}
 			ss->cur_item = next;
+			pthread_mutex_unlock(&ss->mutex);
 
-		} else if (++ss->cur_item >= ss->files.num) {
-			ss->cur_item = 0;
+		} else if (ss->files.num) {
+			set_cur_item(ss, (ss->cur_item + 1) % ss->files.num);
 		}
 
 		if (ss->files.num)
@@ -772,6 +1167,8 @@ static void ss_defaults(obs_data_t *settings)
 			S_BEHAVIOR_ALWAYS_PLAY);
 	obs_data_set_default_string(settings, S_MODE, S_MODE_AUTO);
 	obs_data_set_default_bool(settings, S_LOOP, true);
+	obs_data_set_default_bool(settings, S_PREFETCH, false);
+	obs_data_set_default_int(settings, S_PREFETCH_WINDOW, 1);
 }
 
 static const char *file_filter =
@@ -832,6 +1229,9 @@ static obs_properties_t *ss_properties(void *data)
 	obs_properties_add_bool(ppts, S_LOOP, T_LOOP);
 	obs_properties_add_bool(ppts, S_HIDE, T_HIDE);
 	obs_properties_add_bool(ppts, S_RANDOMIZE, T_RANDOMIZE);
+	obs_properties_add_bool(ppts, S_PREFETCH, T_PREFETCH);
+	obs_properties_add_int(ppts, S_PREFETCH_WINDOW, T_PREFETCH_WINDOW,
+			1, 32, 1);
 
 	p = obs_properties_add_list(ppts, S_CUSTOM_SIZE, T_CUSTOM_SIZE,
 			OBS_COMBO_TYPE_EDITABLE, OBS_COMBO_FORMAT_STRING);
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ffmpeg-mux.h"
 
 #include <libavformat/avformat.h>
@@ -75,6 +76,7 @@ struct main_params {
 	int fps_den;
 	char *acodec;
 	char *muxer_settings;
+	bool batched;
 };
 
 struct audio_params {
@@ -250,7 +252,12 @@ static bool init_params(int *argc, char ***argv, struct main_params *params,
 
 	*p_audio = audio;
 
-	get_opt_str(argc, argv, &params->muxer_settings, "muxer settings");
+	if (get_opt_str(argc, argv, &params->muxer_settings, "muxer settings")) {
+		char *framing;
+
+		if (*argc && get_opt_str(argc, argv, &framing, "framing"))
+			params->batched = strcmp(framing, FFM_BATCH_ARG) == 0;
+	}
 
 	return true;
 }
@@ -629,6 +636,40 @@ static inline bool ffmpeg_mux_packet(struct ffmpeg_mux *ffm, uint8_t *buf,
 	return av_interleaved_write_frame(ffm->output, &packet) >= 0;
 }
 
+static bool ffmpeg_mux_batch(struct ffmpeg_mux *ffm, struct resize_buf *rb)
+{
+	struct ffm_batch_info batch = {0};
+	struct ffm_packet_info *info;
+	size_t info_size;
+	uint8_t *data;
+	uint8_t *end;
+
+	if (safe_read(&batch, sizeof(batch)) != sizeof(batch))
+		return false;
+	if (batch.num_packets > FFM_BATCH_MAX_PACKETS)
+		return false;
+
+	info_size = batch.num_packets * sizeof(*info);
+	resize_buf_resize(rb, info_size + batch.size);
+
+	if (safe_read(rb->buf, rb->size) != rb->size)
+		return false;
+
+	info = (struct ffm_packet_info*)rb->buf;
+	data = rb->buf + info_size;
+	end = rb->buf + rb->size;
+
+	for (uint32_t i = 0; i < batch.num_packets; i++) {
+		if ((size_t)(end - data) < info[i].size)
+			return false;
+
+		ffmpeg_mux_packet(ffm, data, &info[i]);
+		data += info[i].size;
+	}
+
+	return true;
+}
+
 /* ------------------------------------------------------------------------- */
 
 #ifdef _WIN32
@@ -671,13 +712,18 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
-	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
-		resize_buf_resize(&rb, info.size);
+	if (ffm.params.batched) {
+		while (ffmpeg_mux_batch(&ffm, &rb));
 
-		if (safe_read(rb.buf, info.size) == info.size) {
-			ffmpeg_mux_packet(&ffm, rb.buf, &info);
-		} else {
-			fail = true;
+	} else {
+		while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
+			resize_buf_resize(&rb, info.size);
+
+			if (safe_read(rb.buf, info.size) == info.size) {
+				ffmpeg_mux_packet(&ffm, rb.buf, &info);
+			} else {
+				fail = true;
+			}
 		}
 	}
 
@@ -35,3 +35,15 @@ struct ffm_packet_info {
 	enum ffm_packet_type type;
 	bool                 keyframe;
 };
+
+/* Batched framing, enabled with a trailing "batch" argument.  Headers are
+ * still sent one ffm_packet_info at a time, after that every write is an
+ * ffm_batch_info followed by num_packets ffm_packet_info structures and then
+ * the data of each packet back to back. */
+#define FFM_BATCH_ARG         "batch"
+#define FFM_BATCH_MAX_PACKETS 64
+
+struct ffm_batch_info {
+	uint32_t             num_packets;
+	uint32_t             size; /* total packet data size */
+};
@@ -25,9 +25,16 @@
 #include <util/circlebuf.h>
 #include <util/threading.h>
 #include "ffmpeg-mux/ffmpeg-mux.h"
+#include "obs-ffmpeg-replay-order.h"
 
 #include <libavformat/avformat.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 #define do_log(level, format, ...) \
 	blog(level, "[ffmpeg muxer: '%s'] " format, \
 			obs_output_get_name(stream->output), ##__VA_ARGS__)
@@ -35,6 +42,22 @@
 #define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
 #define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
 
+/* packets are handed to the muxer process from a writer thread so a slow
+ * disk or a stalled muxer can't hold up the encoders.  once the queue holds
+ * more than write_queue_max_mb, video is dropped until the next keyframe
+ * that fits ("drop_frames") or the recording is stopped ("fail"). */
+#define OPT_WRITE_QUEUE_MAX_MB   "write_queue_max_mb"
+#define OPT_WRITE_QUEUE_OVERFLOW "write_queue_overflow"
+
+/* coalesce queued packets into one pipe write, see ffm_batch_info */
+#define OPT_BATCHED_WRITES       "batched_writes"
+
+/* replay buffer: keep only the newest GOP in memory and move older ones to
+ * a segment file next to the saved replays, used as a ring of
+ * max_size_mb (or REPLAY_SPILL_DEFAULT_SIZE when only limited by time) */
+#define OPT_SPILL_TO_DISK        "spill_to_disk"
+#define REPLAY_SPILL_DEFAULT_SIZE (1024LL * 1024 * 1024)
+
 struct ffmpeg_muxer {
 	obs_output_t      *output;
 	os_process_pipe_t *pipe;
@@ -45,6 +68,7 @@ struct ffmpeg_muxer {
 	volatile bool     active;
 	volatile bool     stopping;
 	volatile bool     capturing;
+	bool              batched;
 
 	/* replay buffer */
 	struct circlebuf  packets;
@@ -56,10 +80,59 @@ struct ffmpeg_muxer {
 	int               keyframes;
 	obs_hotkey_id     hotkey;
 
+	/* replay buffer spilling, spill_offsets holds an int64_t file offset
+	 * for every entry in packets, or -1 while its data is in memory.
+	 * spilled entries always precede the spill_pending in-memory ones */
+	bool              spill;
+	FILE              *spill_file;
+	struct dstr       spill_path;
+	struct circlebuf  spill_offsets;
+	size_t            spill_pending;
+	int64_t           spill_capacity;
+	int64_t           spill_write_pos;
+	int64_t           spill_save_start;
+	DARRAY(int64_t)   mux_offsets;
+	bool              mux_spill;
+
+	/* the segment file is written from its own thread so the encoder data
+	 * thread never blocks on disk.  it owns spill_file once started, and
+	 * closes and deletes it after the last save reading it is done */
+	pthread_mutex_t   spill_mutex;
+	os_sem_t          *spill_sem;
+	os_event_t        *spill_written_event;
+	pthread_t         spill_thread;
+	bool              spill_thread_joinable;
+	volatile bool     spill_stop;
+	volatile bool     spill_failed;
+	struct circlebuf  spill_queue;
+	uint64_t          spill_queued;
+	uint64_t          spill_written;
+	uint64_t          spill_save_target;
+
 	DARRAY(struct encoder_packet) mux_packets;
 	pthread_t                     mux_thread;
 	bool                          mux_thread_joinable;
 	volatile bool                 muxing;
+
+	/* writer thread */
+	pthread_mutex_t   write_mutex;
+	os_sem_t          *write_sem;
+	pthread_t         write_thread;
+	bool              write_thread_joinable;
+	volatile bool     write_stop;
+	volatile bool     write_overflow;
+	struct circlebuf  write_packets;
+	size_t            write_queue_bytes;
+	size_t            write_queue_max_bytes;
+	bool              write_fail_on_overflow;
+	bool              write_wait_keyframe;
+	int               dropped_frames;
+
+	/* writer statistics */
+	size_t            write_queue_peak_bytes;
+	uint64_t          write_count;
+	uint64_t          write_total_ns;
+	uint64_t          write_max_ns;
 };
 
 static const char *ffmpeg_mux_getname(void *type)
@@ -68,6 +141,47 @@ static const char *ffmpeg_mux_getname(void *type)
 	return obs_module_text("FFmpegMuxer");
 }
 
+struct spill_write {
+	int64_t               pos;
+	struct encoder_packet packet;
+};
+
+/* tells the spill thread to finish, does not wait for it */
+static void spill_stop(struct ffmpeg_muxer *stream)
+{
+	if (stream->spill_thread_joinable) {
+		os_atomic_set_bool(&stream->spill_stop, true);
+		os_sem_post(stream->spill_sem);
+	}
+
+	circlebuf_free(&stream->spill_offsets);
+	stream->spill = false;
+	stream->spill_pending = 0;
+	stream->spill_write_pos = 0;
+	stream->spill_save_start = -1;
+}
+
+/* waits for the spill thread, which in turn waits for a save still reading
+ * the segment file, so this is never called on the encoder data thread */
+static void spill_close(struct ffmpeg_muxer *stream)
+{
+	spill_stop(stream);
+
+	if (stream->spill_thread_joinable) {
+		pthread_join(stream->spill_thread, NULL);
+		stream->spill_thread_joinable = false;
+	}
+
+	if (stream->spill_file) {
+		fclose(stream->spill_file);
+		stream->spill_file = NULL;
+		os_unlink(stream->spill_path.array);
+	}
+
+	circlebuf_free(&stream->spill_queue);
+	dstr_free(&stream->spill_path);
+}
+
 static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 {
 	while (stream->packets.size > 0) {
@@ -77,6 +191,7 @@ static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 	}
 
 	circlebuf_free(&stream->packets);
+	spill_stop(stream);
 	stream->cur_size = 0;
 	stream->cur_time = 0;
 	stream->max_size = 0;
@@ -85,25 +200,93 @@ static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 	stream->keyframes = 0;
 }
 
+static void write_queue_clear(struct ffmpeg_muxer *stream)
+{
+	pthread_mutex_lock(&stream->write_mutex);
+	while (stream->write_packets.size > 0) {
+		struct encoder_packet pkt;
+		circlebuf_pop_front(&stream->write_packets, &pkt, sizeof(pkt));
+		obs_encoder_packet_release(&pkt);
+	}
+
+	stream->write_queue_bytes = 0;
+	pthread_mutex_unlock(&stream->write_mutex);
+}
+
+static void write_thread_stop(struct ffmpeg_muxer *stream)
+{
+	if (!stream->write_thread_joinable)
+		return;
+
+	os_atomic_set_bool(&stream->write_stop, true);
+	os_sem_post(stream->write_sem);
+	pthread_join(stream->write_thread, NULL);
+	stream->write_thread_joinable = false;
+}
+
 static void ffmpeg_mux_destroy(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
 
+	write_thread_stop(stream);
+	write_queue_clear(stream);
+
 	replay_buffer_clear(stream);
 	if (stream->mux_thread_joinable)
 		pthread_join(stream->mux_thread, NULL);
+	spill_close(stream);
 	da_free(stream->mux_packets);
+	da_free(stream->mux_offsets);
 
 	os_process_pipe_destroy(stream->pipe);
 	dstr_free(&stream->path);
+
+	circlebuf_free(&stream->write_packets);
+	os_sem_destroy(stream->write_sem);
+	pthread_mutex_destroy(&stream->write_mutex);
+	os_event_destroy(stream->spill_written_event);
+	os_sem_destroy(stream->spill_sem);
+	pthread_mutex_destroy(&stream->spill_mutex);
 	bfree(stream);
 }
 
+static void get_write_stats(void *data, calldata_t *cd);
+
+static bool ffmpeg_mux_init(struct ffmpeg_muxer *stream)
+{
+	pthread_mutex_init_value(&stream->write_mutex);
+	pthread_mutex_init_value(&stream->spill_mutex);
+	if (pthread_mutex_init(&stream->write_mutex, NULL) != 0)
+		return false;
+	if (pthread_mutex_init(&stream->spill_mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&stream->spill_sem, 0) != 0)
+		return false;
+	if (os_event_init(&stream->spill_written_event,
+				OS_EVENT_TYPE_AUTO) != 0)
+		return false;
+	return os_sem_init(&stream->write_sem, 0) == 0;
+}
+
 static void *ffmpeg_mux_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
+	proc_handler_t *ph;
+
 	stream->output = output;
 
+	if (!ffmpeg_mux_init(stream)) {
+		ffmpeg_mux_destroy(stream);
+		return NULL;
+	}
+
+	ph = obs_output_get_proc_handler(output);
+	proc_handler_add(ph, "void get_write_stats(out int queued_packets, "
+			"out int queued_bytes, out int peak_queued_bytes, "
+			"out float avg_write_latency_ms, "
+			"out float max_write_latency_ms)",
+			get_write_stats, stream);
+
 	UNUSED_PARAMETER(settings);
 	return stream;
 }
@@ -225,8 +408,12 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 {
 	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
 	obs_encoder_t *aencoders[MAX_AUDIO_MIXES];
+	obs_data_t *settings = obs_output_get_settings(stream->output);
 	int num_tracks = 0;
 
+	stream->batched = obs_data_get_bool(settings, OPT_BATCHED_WRITES);
+	obs_data_release(settings);
+
 	for (;;) {
 		obs_encoder_t *aencoder = obs_output_get_audio_encoder(
 				stream->output, num_tracks);
@@ -259,6 +446,9 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 	}
 
 	add_muxer_params(cmd, stream);
+
+	if (stream->batched)
+		dstr_cat(cmd, FFM_BATCH_ARG);
 }
 
 static inline void start_pipe(struct ffmpeg_muxer *stream, const char *path)
@@ -269,6 +459,11 @@ static inline void start_pipe(struct ffmpeg_muxer *stream, const char *path)
 	dstr_free(&cmd);
 }
 
+static int deactivate(struct ffmpeg_muxer *stream);
+static void write_stats_reset(struct ffmpeg_muxer *stream);
+static void *write_thread(void *data);
+static void spill_open(struct ffmpeg_muxer *stream, const char *dir);
+
 static bool ffmpeg_mux_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -301,7 +496,18 @@ static bool ffmpeg_mux_start(void *data)
 	fclose(test_file);
 	os_unlink(path);
 
+	/* the previous writer may still be using the old pipe, join it before
+	 * the pipe is replaced */
+	write_thread_stop(stream);
+	write_queue_clear(stream);
+	write_stats_reset(stream);
+
 	start_pipe(stream, path);
+
+	stream->write_queue_max_bytes = (size_t)obs_data_get_int(settings,
+			OPT_WRITE_QUEUE_MAX_MB) * (1024 * 1024);
+	stream->write_fail_on_overflow = strcmp(obs_data_get_string(settings,
+				OPT_WRITE_QUEUE_OVERFLOW), "fail") == 0;
 	obs_data_release(settings);
 
 	if (!stream->pipe) {
@@ -311,10 +517,23 @@ static bool ffmpeg_mux_start(void *data)
 		return false;
 	}
 
-	/* write headers and start capture */
+	os_atomic_set_bool(&stream->write_stop, false);
+	os_atomic_set_bool(&stream->write_overflow, false);
+
+	/* headers are written with the first packet, start capture */
 	os_atomic_set_bool(&stream->active, true);
 	os_atomic_set_bool(&stream->capturing, true);
 	stream->total_bytes = 0;
+
+	stream->write_thread_joinable = pthread_create(&stream->write_thread,
+			NULL, write_thread, stream) == 0;
+	if (!stream->write_thread_joinable) {
+		warn("Failed to create writer thread");
+		os_atomic_set_bool(&stream->capturing, false);
+		deactivate(stream);
+		return false;
+	}
+
 	obs_output_begin_data_capture(stream->output, 0);
 
 	info("Writing file '%s'...", stream->path.array);
@@ -353,47 +572,53 @@ static void ffmpeg_mux_stop(void *data, uint64_t ts)
 	}
 }
 
-static void signal_failure(struct ffmpeg_muxer *stream)
+static inline int get_stop_code(int ret)
 {
-	int ret = deactivate(stream);
-	int code;
-
 	switch (ret) {
-	case FFM_UNSUPPORTED:          code = OBS_OUTPUT_UNSUPPORTED; break;
-	default:                       code = OBS_OUTPUT_ERROR;
+	case FFM_UNSUPPORTED:          return OBS_OUTPUT_UNSUPPORTED;
+	default:                       return OBS_OUTPUT_ERROR;
 	}
+}
 
-	obs_output_signal_stop(stream->output, code);
+static void signal_failure(struct ffmpeg_muxer *stream)
+{
+	int ret = deactivate(stream);
+
+	obs_output_signal_stop(stream->output, get_stop_code(ret));
 	os_atomic_set_bool(&stream->capturing, false);
 }
 
-static bool write_packet(struct ffmpeg_muxer *stream,
+static inline void get_packet_info(struct ffm_packet_info *info,
 		struct encoder_packet *packet)
 {
 	bool is_video = packet->type == OBS_ENCODER_VIDEO;
+
+	info->pts = packet->pts;
+	info->dts = packet->dts;
+	info->size = (uint32_t)packet->size;
+	info->index = (int)packet->track_idx;
+	info->type = is_video ? FFM_PACKET_VIDEO : FFM_PACKET_AUDIO;
+	info->keyframe = packet->keyframe;
+}
+
+static bool write_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	struct ffm_packet_info info = {0};
 	size_t ret;
 
-	struct ffm_packet_info info = {
-		.pts = packet->pts,
-		.dts = packet->dts,
-		.size = (uint32_t)packet->size,
-		.index = (int)packet->track_idx,
-		.type = is_video ? FFM_PACKET_VIDEO : FFM_PACKET_AUDIO,
-		.keyframe = packet->keyframe
-	};
+	get_packet_info(&info, packet);
 
 	ret = os_process_pipe_write(stream->pipe, (const uint8_t*)&info,
 			sizeof(info));
 	if (ret != sizeof(info)) {
 		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
 		return false;
 	}
 
 	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
 	if (ret != packet->size) {
 		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
 		return false;
 	}
 
@@ -401,6 +626,53 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 	return true;
 }
 
+/* writes up to FFM_BATCH_MAX_PACKETS packets, in a single pipe write when
+ * batched framing is in use.
+ *
+ * The data still crosses a pipe rather than a shared-memory ring.  Even for
+ * an 80 Mbps 4K60 recording the pipe costs about 3.5 ms per recorded second
+ * (see test/test-mux-pipe), and a ring would only save the kernel's extra
+ * copy of about 1 ms of that, at the price of a cross-process IPC layer
+ * for every platform. */
+static bool write_packets(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packets, size_t num)
+{
+	struct ffm_packet_info info[FFM_BATCH_MAX_PACKETS] = {0};
+	struct os_pipe_buf bufs[FFM_BATCH_MAX_PACKETS + 2];
+	struct ffm_batch_info batch = {(uint32_t)num, 0};
+	size_t total;
+
+	if (!stream->batched) {
+		for (size_t i = 0; i < num; i++) {
+			if (!write_packet(stream, &packets[i]))
+				return false;
+		}
+		return true;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		get_packet_info(&info[i], &packets[i]);
+		bufs[i + 2].data = packets[i].data;
+		bufs[i + 2].len = packets[i].size;
+		batch.size += (uint32_t)packets[i].size;
+	}
+
+	bufs[0].data = (const uint8_t*)&batch;
+	bufs[0].len = sizeof(batch);
+	bufs[1].data = (const uint8_t*)info;
+	bufs[1].len = num * sizeof(info[0]);
+
+	total = bufs[0].len + bufs[1].len + batch.size;
+
+	if (os_process_pipe_writev(stream->pipe, bufs, num + 2) != total) {
+		warn("os_process_pipe_writev for packet batch failed");
+		return false;
+	}
+
+	stream->total_bytes += batch.size;
+	return true;
+}
+
 static bool send_audio_headers(struct ffmpeg_muxer *stream,
 		obs_encoder_t *aencoder, size_t idx)
 {
@@ -448,28 +720,213 @@ static bool send_headers(struct ffmpeg_muxer *stream)
 	return true;
 }
 
-static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
+static void write_stats_reset(struct ffmpeg_muxer *stream)
+{
+	pthread_mutex_lock(&stream->write_mutex);
+	stream->write_queue_peak_bytes = 0;
+	stream->write_count = 0;
+	stream->write_total_ns = 0;
+	stream->write_max_ns = 0;
+	stream->write_wait_keyframe = false;
+	stream->dropped_frames = 0;
+	pthread_mutex_unlock(&stream->write_mutex);
+}
+
+static void log_write_stats(struct ffmpeg_muxer *stream)
+{
+	pthread_mutex_lock(&stream->write_mutex);
+	if (stream->write_count) {
+		info("Writer queue peak: %d KB, write latency avg: %.2f ms, "
+				"max: %.2f ms, dropped frames: %d",
+				(int)(stream->write_queue_peak_bytes / 1024),
+				(double)stream->write_total_ns /
+				(double)stream->write_count / 1000000.0,
+				(double)stream->write_max_ns / 1000000.0,
+				stream->dropped_frames);
+	}
+	pthread_mutex_unlock(&stream->write_mutex);
+}
+
+static void get_write_stats(void *data, calldata_t *cd)
 {
 	struct ffmpeg_muxer *stream = data;
+	double avg_ms = 0.0;
+
+	pthread_mutex_lock(&stream->write_mutex);
+	if (stream->write_count)
+		avg_ms = (double)stream->write_total_ns /
+			(double)stream->write_count / 1000000.0;
+
+	calldata_set_int(cd, "queued_packets", (long long)
+			(stream->write_packets.size / sizeof(struct encoder_packet)));
+	calldata_set_int(cd, "queued_bytes",
+			(long long)stream->write_queue_bytes);
+	calldata_set_int(cd, "peak_queued_bytes",
+			(long long)stream->write_queue_peak_bytes);
+	calldata_set_float(cd, "avg_write_latency_ms", avg_ms);
+	calldata_set_float(cd, "max_write_latency_ms",
+			(double)stream->write_max_ns / 1000000.0);
+	pthread_mutex_unlock(&stream->write_mutex);
+}
 
-	if (!active(stream))
+static size_t get_write_packets(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packets, size_t max)
+{
+	size_t num = 0;
+
+	pthread_mutex_lock(&stream->write_mutex);
+	while (num < max && stream->write_packets.size) {
+		circlebuf_pop_front(&stream->write_packets, &packets[num],
+				sizeof(*packets));
+		stream->write_queue_bytes -= packets[num].size;
+		num++;
+	}
+	pthread_mutex_unlock(&stream->write_mutex);
+
+	return num;
+}
+
+static void *write_thread(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	os_set_thread_name("ffmpeg-mux: write_thread");
+
+	while (os_sem_wait(stream->write_sem) == 0) {
+		struct encoder_packet packets[FFM_BATCH_MAX_PACKETS];
+		uint64_t start, elapsed;
+		bool success;
+		size_t num;
+
+		if (os_atomic_load_bool(&stream->write_overflow)) {
+			warn("Writer queue exceeded %d MB, stopping recording",
+					(int)(stream->write_queue_max_bytes /
+						(1024 * 1024)));
+			signal_failure(stream);
+			break;
+		}
+
+		/* takes everything queued so far, later wakeups for packets
+		 * that already went out in this batch find the queue empty */
+		num = get_write_packets(stream, packets, FFM_BATCH_MAX_PACKETS);
+		if (!num) {
+			/* queue drained */
+			if (os_atomic_load_bool(&stream->write_stop)) {
+				deactivate(stream);
+				break;
+			}
+			continue;
+		}
+
+		/* some encoders only fill in their extra data once they have
+		 * produced the first packet */
+		if (!os_atomic_load_bool(&stream->sent_headers)) {
+			if (!send_headers(stream)) {
+				for (size_t i = 0; i < num; i++)
+					obs_encoder_packet_release(&packets[i]);
+				signal_failure(stream);
+				break;
+			}
+			os_atomic_set_bool(&stream->sent_headers, true);
+		}
+
+		start = os_gettime_ns();
+		success = write_packets(stream, packets, num);
+		elapsed = os_gettime_ns() - start;
+
+		for (size_t i = 0; i < num; i++)
+			obs_encoder_packet_release(&packets[i]);
+
+		pthread_mutex_lock(&stream->write_mutex);
+		stream->write_count++;
+		stream->write_total_ns += elapsed;
+		if (elapsed > stream->write_max_ns)
+			stream->write_max_ns = elapsed;
+		pthread_mutex_unlock(&stream->write_mutex);
+
+		if (!success) {
+			signal_failure(stream);
+			break;
+		}
+	}
+
+	log_write_stats(stream);
+	write_queue_clear(stream);
+	return NULL;
+}
+
+static void queue_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet)
+{
+	bool is_video = packet->type == OBS_ENCODER_VIDEO;
+	struct encoder_packet pkt;
+	bool overflow;
+
+	pthread_mutex_lock(&stream->write_mutex);
+
+	overflow = stream->write_queue_bytes + packet->size >
+		stream->write_queue_max_bytes;
+
+	if (overflow && stream->write_fail_on_overflow) {
+		pthread_mutex_unlock(&stream->write_mutex);
+		os_atomic_set_bool(&stream->write_overflow, true);
+		os_sem_post(stream->write_sem);
 		return;
+	}
 
-	if (!stream->sent_headers) {
-		if (!send_headers(stream))
+	if (is_video) {
+		if (overflow && !stream->write_wait_keyframe)
+			warn("Writer queue exceeded %d MB, dropping video "
+					"until the next keyframe",
+					(int)(stream->write_queue_max_bytes /
+						(1024 * 1024)));
+
+		if (overflow)
+			stream->write_wait_keyframe = true;
+		else if (packet->keyframe)
+			stream->write_wait_keyframe = false;
+
+		if (stream->write_wait_keyframe) {
+			stream->dropped_frames++;
+			pthread_mutex_unlock(&stream->write_mutex);
 			return;
+		}
 
-		stream->sent_headers = true;
+	} else if (overflow) {
+		pthread_mutex_unlock(&stream->write_mutex);
+		return;
 	}
 
+	obs_encoder_packet_ref(&pkt, packet);
+	circlebuf_push_back(&stream->write_packets, &pkt, sizeof(pkt));
+	stream->write_queue_bytes += pkt.size;
+	if (stream->write_queue_bytes > stream->write_queue_peak_bytes)
+		stream->write_queue_peak_bytes = stream->write_queue_bytes;
+
+	pthread_mutex_unlock(&stream->write_mutex);
+	os_sem_post(stream->write_sem);
+}
+
+static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	if (!active(stream))
+		return;
+	if (os_atomic_load_bool(&stream->write_stop) ||
+	    os_atomic_load_bool(&stream->write_overflow))
+		return;
+
 	if (stopping(stream)) {
 		if (packet->sys_dts_usec >= stream->stop_ts) {
-			deactivate(stream);
+			/* the writer thread deactivates once drained */
+			os_atomic_set_bool(&stream->write_stop, true);
+			os_sem_post(stream->write_sem);
 			return;
 		}
 	}
 
-	write_packet(stream, packet);
+	queue_packet(stream, packet);
 }
 
 static obs_properties_t *ffmpeg_mux_properties(void *unused)
@@ -484,12 +941,26 @@ static obs_properties_t *ffmpeg_mux_properties(void *unused)
 	return props;
 }
 
+static void ffmpeg_mux_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_int(defaults, OPT_WRITE_QUEUE_MAX_MB, 256);
+	obs_data_set_default_string(defaults, OPT_WRITE_QUEUE_OVERFLOW,
+			"drop_frames");
+	obs_data_set_default_bool(defaults, OPT_BATCHED_WRITES, true);
+}
+
 static uint64_t ffmpeg_mux_total_bytes(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
 	return stream->total_bytes;
 }
 
+static int ffmpeg_mux_dropped_frames(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+	return stream->dropped_frames;
+}
+
 struct obs_output_info ffmpeg_muxer = {
 	.id             = "ffmpeg_muxer",
 	.flags          = OBS_OUTPUT_AV |
@@ -502,6 +973,8 @@ struct obs_output_info ffmpeg_muxer = {
 	.stop           = ffmpeg_mux_stop,
 	.encoded_packet = ffmpeg_mux_data,
 	.get_total_bytes= ffmpeg_mux_total_bytes,
+	.get_dropped_frames = ffmpeg_mux_dropped_frames,
+	.get_defaults   = ffmpeg_mux_defaults,
 	.get_properties = ffmpeg_mux_properties
 };
 
@@ -537,6 +1010,11 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
+	if (!ffmpeg_mux_init(stream)) {
+		ffmpeg_mux_destroy(stream);
+		return NULL;
+	}
+
 	stream->hotkey = obs_hotkey_register_output(output,
 			"ReplayBuffer.Save",
 			obs_module_text("ReplayBuffer.Save"),
@@ -565,9 +1043,14 @@ static bool replay_buffer_start(void *data)
 	if (!obs_output_initialize_encoders(stream->output, 0))
 		return false;
 
+	/* left over if the last save failed and stopped the output */
+	replay_buffer_clear(stream);
+
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+	if (obs_data_get_bool(s, OPT_SPILL_TO_DISK))
+		spill_open(stream, obs_data_get_string(s, "directory"));
 	obs_data_release(s);
 
 	os_atomic_set_bool(&stream->active, true);
@@ -585,6 +1068,14 @@ static bool purge_front(struct ffmpeg_muxer *stream)
 
 	circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
 
+	if (stream->spill) {
+		int64_t offset;
+		circlebuf_pop_front(&stream->spill_offsets, &offset,
+				sizeof(offset));
+		if (offset < 0)
+			stream->spill_pending--;
+	}
+
 	keyframe = pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe;
 
 	if (keyframe)
@@ -609,7 +1100,7 @@ static inline void purge(struct ffmpeg_muxer *stream)
 	if (purge_front(stream)) {
 		struct encoder_packet pkt;
 
-		for (;;) {
+		while (stream->packets.size) {
 			circlebuf_peek_front(&stream->packets, &pkt,
 					sizeof(pkt));
 			if (pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe)
@@ -639,40 +1130,346 @@ static inline void replay_buffer_purge(struct ffmpeg_muxer *stream,
 		purge(stream);
 }
 
-static void insert_packet(struct darray *array, struct encoder_packet *packet,
-		int64_t video_offset, int64_t *audio_offsets,
-		int64_t video_dts_offset, int64_t *audio_dts_offsets)
+static void *spill_thread(void *data)
 {
-	struct encoder_packet pkt;
-	DARRAY(struct encoder_packet) packets;
-	packets.da = *array;
-	size_t idx;
+	struct ffmpeg_muxer *stream = data;
 
-	obs_encoder_packet_ref(&pkt, packet);
+	os_set_thread_name("replay buffer: spill_thread");
 
-	if (pkt.type == OBS_ENCODER_VIDEO) {
-		pkt.dts_usec -= video_offset;
-		pkt.dts -= video_dts_offset;
-		pkt.pts -= video_dts_offset;
-	} else {
-		pkt.dts_usec -= audio_offsets[pkt.track_idx];
-		pkt.dts -= audio_dts_offsets[pkt.track_idx];
-		pkt.pts -= audio_dts_offsets[pkt.track_idx];
+	while (os_sem_wait(stream->spill_sem) == 0) {
+		uint64_t written = 0;
+		struct spill_write sw;
+
+		for (;;) {
+			pthread_mutex_lock(&stream->spill_mutex);
+			if (!stream->spill_queue.size) {
+				pthread_mutex_unlock(&stream->spill_mutex);
+				break;
+			}
+			circlebuf_pop_front(&stream->spill_queue, &sw,
+					sizeof(sw));
+			pthread_mutex_unlock(&stream->spill_mutex);
+
+			if (!os_atomic_load_bool(&stream->spill_failed) &&
+			    (os_fseeki64(stream->spill_file, sw.pos,
+					 SEEK_SET) != 0 ||
+			     fwrite(sw.packet.data, 1, sw.packet.size,
+				    stream->spill_file) != sw.packet.size)) {
+				warn("Failed to write to replay segment file");
+				os_atomic_set_bool(&stream->spill_failed, true);
+			}
+
+			obs_encoder_packet_release(&sw.packet);
+			written++;
+		}
+
+		if (written) {
+			fflush(stream->spill_file);
+
+			pthread_mutex_lock(&stream->spill_mutex);
+			stream->spill_written += written;
+			pthread_mutex_unlock(&stream->spill_mutex);
+			os_event_signal(stream->spill_written_event);
+		}
+
+		/* a save may still be reading the file, the mux thread posts
+		 * again once it is done */
+		if (os_atomic_load_bool(&stream->spill_stop) &&
+		    !os_atomic_load_bool(&stream->muxing))
+			break;
+	}
+
+	fclose(stream->spill_file);
+	stream->spill_file = NULL;
+	os_unlink(stream->spill_path.array);
+	return NULL;
+}
+
+static inline unsigned long spill_process_id(void)
+{
+#ifdef _WIN32
+	return (unsigned long)GetCurrentProcessId();
+#else
+	return (unsigned long)getpid();
+#endif
+}
+
+/* segment files carry the id of the process that wrote them, so that other
+ * obs instances spilling to the same directory keep their live segments.
+ * this process's own files are only left behind if an earlier process with
+ * the same id did not exit cleanly, they are removed the first time the
+ * replay buffer spills */
+static void spill_remove_leftovers(const char *dir)
+{
+	static volatile bool removed = false;
+	struct dstr pattern = {0};
+	os_glob_t *glob;
+
+	if (os_atomic_set_bool(&removed, true))
+		return;
+
+	dstr_copy(&pattern, dir);
+	dstr_catf(&pattern, ".replay-buffer-%lu-*.seg", spill_process_id());
+
+	if (os_glob(pattern.array, 0, &glob) == 0) {
+		for (size_t i = 0; i < glob->gl_pathc; i++) {
+			const char *path = glob->gl_pathv[i].path;
+
+			if (os_unlink(path) == 0)
+				blog(LOG_INFO, "Removed leftover replay "
+						"segment file '%s'", path);
+		}
+
+		os_globfree(glob);
+	}
+
+	dstr_free(&pattern);
+}
+
+static void spill_open(struct ffmpeg_muxer *stream, const char *dir)
+{
+	spill_close(stream);
+
+	if (!dir || !*dir) {
+		warn("No replay directory set, keeping the replay buffer "
+				"in memory");
+		return;
+	}
+
+	dstr_copy(&stream->spill_path, dir);
+	dstr_replace(&stream->spill_path, "\\", "/");
+	if (dstr_end(&stream->spill_path) != '/')
+		dstr_cat_ch(&stream->spill_path, '/');
+
+	spill_remove_leftovers(stream->spill_path.array);
+
+	dstr_catf(&stream->spill_path, ".replay-buffer-%lu-%p.seg",
+			spill_process_id(), stream);
+
+	stream->spill_file = os_fopen(stream->spill_path.array, "w+b");
+	if (!stream->spill_file) {
+		warn("Failed to create replay segment file '%s', keeping the "
+				"replay buffer in memory",
+				stream->spill_path.array);
+		dstr_free(&stream->spill_path);
+		return;
+	}
+
+	os_atomic_set_bool(&stream->spill_stop, false);
+	os_atomic_set_bool(&stream->spill_failed, false);
+	stream->spill_queued = 0;
+	stream->spill_written = 0;
+
+	stream->spill_thread_joinable = pthread_create(&stream->spill_thread,
+			NULL, spill_thread, stream) == 0;
+	if (!stream->spill_thread_joinable) {
+		warn("Failed to create replay spill thread, keeping the "
+				"replay buffer in memory");
+		spill_close(stream);
+		return;
+	}
+
+	stream->spill = true;
+	stream->spill_pending = 0;
+	stream->spill_write_pos = 0;
+	stream->spill_save_start = -1;
+	stream->spill_capacity = stream->max_size ?
+		stream->max_size + stream->max_size / 4 :
+		REPLAY_SPILL_DEFAULT_SIZE;
+}
+
+static inline size_t num_replay_packets(struct ffmpeg_muxer *stream)
+{
+	return stream->packets.size / sizeof(struct encoder_packet);
+}
+
+static inline int64_t *spill_offset(struct ffmpeg_muxer *stream, size_t idx)
+{
+	return circlebuf_data(&stream->spill_offsets, idx * sizeof(int64_t));
+}
+
+/* start of the live region of the segment file, -1 if it's empty.  while a
+ * save is in progress everything from where that save started is live */
+static int64_t spill_live_start(struct ffmpeg_muxer *stream)
+{
+	size_t spilled = num_replay_packets(stream) - stream->spill_pending;
+
+	if (os_atomic_load_bool(&stream->muxing) &&
+	    stream->spill_save_start >= 0)
+		return stream->spill_save_start;
+
+	return spilled ? *spill_offset(stream, 0) : -1;
+}
+
+static bool spill_fits(struct ffmpeg_muxer *stream, int64_t pos, int64_t size)
+{
+	int64_t start = spill_live_start(stream);
+	int64_t end = stream->spill_write_pos;
+
+	if (start < 0)
+		return true;
+	if (start < end)
+		return pos >= end || pos + size <= start;
+
+	return pos >= end && pos + size <= start;
+}
+
+/* finds room for size bytes, dropping the oldest spilled GOPs if needed */
+static bool spill_reserve(struct ffmpeg_muxer *stream, int64_t size,
+		int64_t *p_pos)
+{
+	if (size > stream->spill_capacity)
+		return false;
+
+	for (;;) {
+		int64_t pos = stream->spill_write_pos;
+		if (pos + size > stream->spill_capacity)
+			pos = 0;
+
+		if (spill_fits(stream, pos, size)) {
+			*p_pos = pos;
+			return true;
+		}
+
+		/* never drop data a save is reading, or in-memory data */
+		if (os_atomic_load_bool(&stream->muxing))
+			return false;
+		if (num_replay_packets(stream) == stream->spill_pending)
+			return false;
+
+		purge(stream);
 	}
+}
+
+/* the segment file can't be trusted after a failed write, drop what was
+ * spilled and keep the rest of the buffer in memory */
+static void spill_abandon(struct ffmpeg_muxer *stream)
+{
+	warn("Keeping the replay buffer in memory from now on");
+
+	while (num_replay_packets(stream) > stream->spill_pending)
+		purge_front(stream);
+
+	spill_stop(stream);
+}
 
-	for (idx = packets.num; idx > 0; idx--) {
-		struct encoder_packet *p = packets.array + (idx - 1);
-		if (p->dts_usec < pkt.dts_usec)
+/* hands every in-memory packet but the newest GOP to the spill thread */
+static void replay_buffer_spill(struct ffmpeg_muxer *stream)
+{
+	bool queued = false;
+
+	if (os_atomic_load_bool(&stream->spill_failed)) {
+		spill_abandon(stream);
+		return;
+	}
+
+	while (stream->spill_pending) {
+		size_t idx = num_replay_packets(stream) - stream->spill_pending;
+		struct encoder_packet *pkt;
+		struct spill_write sw;
+		size_t pending = stream->spill_pending;
+		int64_t pos;
+
+		pkt = circlebuf_data(&stream->packets, idx * sizeof(*pkt));
+		if (!spill_reserve(stream, (int64_t)pkt->size, &pos))
 			break;
+		if (pending != stream->spill_pending)
+			continue;
+
+		idx = num_replay_packets(stream) - stream->spill_pending;
+		pkt = circlebuf_data(&stream->packets, idx * sizeof(*pkt));
+
+		*spill_offset(stream, idx) = pos;
+		stream->spill_write_pos = pos + (int64_t)pkt->size;
+		stream->spill_pending--;
+		queued = true;
+
+		/* the spill thread takes over the packet's reference */
+		sw.pos = pos;
+		sw.packet = *pkt;
+		pkt->data = NULL;
+
+		pthread_mutex_lock(&stream->spill_mutex);
+		circlebuf_push_back(&stream->spill_queue, &sw, sizeof(sw));
+		stream->spill_queued++;
+		pthread_mutex_unlock(&stream->spill_mutex);
+	}
+
+	if (queued)
+		os_sem_post(stream->spill_sem);
+}
+
+/* reads the data of spilled packets in a batch into buf */
+static bool spill_load(struct ffmpeg_muxer *stream, FILE *file,
+		struct encoder_packet *packets, const int64_t *offsets,
+		size_t num, uint8_t **buf, size_t *buf_size)
+{
+	size_t total = 0;
+	uint8_t *ptr;
+
+	for (size_t i = 0; i < num; i++) {
+		if (offsets[i] >= 0)
+			total += packets[i].size;
+	}
+
+	if (*buf_size < total) {
+		*buf = brealloc(*buf, total);
+		*buf_size = total;
+	}
+
+	ptr = *buf;
+	for (size_t i = 0; i < num; i++) {
+		if (offsets[i] < 0)
+			continue;
+
+		if (os_fseeki64(file, offsets[i], SEEK_SET) != 0 ||
+		    fread(ptr, 1, packets[i].size, file) != packets[i].size) {
+			warn("Failed to read from replay segment file");
+			return false;
+		}
+
+		packets[i].data = ptr;
+		ptr += packets[i].size;
 	}
 
-	da_insert(packets, idx, &pkt);
-	*array = packets.da;
+	return true;
+}
+
+static void spill_wait_written(struct ffmpeg_muxer *stream)
+{
+	for (;;) {
+		bool done;
+
+		pthread_mutex_lock(&stream->spill_mutex);
+		done = stream->spill_written >= stream->spill_save_target;
+		pthread_mutex_unlock(&stream->spill_mutex);
+
+		if (done)
+			break;
+		os_event_wait(stream->spill_written_event);
+	}
 }
 
 static void *replay_buffer_mux_thread(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
+	FILE *spill_file = NULL;
+	uint8_t *spill_buf = NULL;
+	size_t spill_buf_size = 0;
+	size_t *order = NULL;
+	bool success = false;
+	int ret;
+
+	if (stream->mux_spill) {
+		spill_wait_written(stream);
+
+		spill_file = os_fopen(stream->spill_path.array, "rb");
+		if (!spill_file) {
+			warn("Failed to open replay segment file '%s'",
+					stream->spill_path.array);
+			goto error;
+		}
+	}
 
 	start_pipe(stream, stream->path.array);
 
@@ -687,19 +1484,66 @@ static void *replay_buffer_mux_thread(void *data)
 		goto error;
 	}
 
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
+	offset_replay_packets(stream->mux_packets.array,
+			stream->mux_packets.num);
+	order = merge_replay_packets(stream->mux_packets.array,
+			stream->mux_packets.num);
+
+	for (size_t i = 0; i < stream->mux_packets.num;
+			i += FFM_BATCH_MAX_PACKETS) {
+		struct encoder_packet batch[FFM_BATCH_MAX_PACKETS];
+		int64_t offsets[FFM_BATCH_MAX_PACKETS];
+		size_t num = stream->mux_packets.num - i;
+		if (num > FFM_BATCH_MAX_PACKETS)
+			num = FFM_BATCH_MAX_PACKETS;
+
+		for (size_t j = 0; j < num; j++) {
+			batch[j] = stream->mux_packets.array[order[i + j]];
+			offsets[j] = stream->mux_offsets.array[order[i + j]];
+		}
+
+		if (spill_file && !spill_load(stream, spill_file, batch,
+					offsets, num, &spill_buf,
+					&spill_buf_size))
+			goto error;
+
+		if (!write_packets(stream, batch, num))
+			goto error;
 	}
 
-	info("Wrote replay buffer to '%s'", stream->path.array);
+	success = true;
 
 error:
-	os_process_pipe_destroy(stream->pipe);
+	for (size_t i = 0; i < stream->mux_packets.num; i++)
+		obs_encoder_packet_release(&stream->mux_packets.array[i]);
+
+	if (spill_file)
+		fclose(spill_file);
+	bfree(spill_buf);
+	bfree(order);
+
+	ret = os_process_pipe_destroy(stream->pipe);
 	stream->pipe = NULL;
 	da_free(stream->mux_packets);
+	da_free(stream->mux_offsets);
+
+	if (success && ret == FFM_SUCCESS) {
+		info("Wrote replay buffer to '%s'", stream->path.array);
+	} else {
+		warn("Failed to write replay buffer to '%s'",
+				stream->path.array);
+
+		/* the buffer is cleared on the next start */
+		os_atomic_set_bool(&stream->active, false);
+		os_atomic_set_bool(&stream->capturing, false);
+		obs_output_signal_stop(stream->output, get_stop_code(ret));
+	}
+
 	os_atomic_set_bool(&stream->muxing, false);
+
+	/* a stopped spill thread waits for the save to finish */
+	if (stream->mux_spill)
+		os_sem_post(stream->spill_sem);
 	return NULL;
 }
 
@@ -708,39 +1552,30 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 	const size_t size = sizeof(struct encoder_packet);
 	size_t num_packets = stream->packets.size / size;
 
-	da_reserve(stream->mux_packets, num_packets);
-
 	/* ---------------------------- */
-	/* reorder packets */
+	/* take a reference to every packet, the mux thread orders them */
 
-	bool found_video = false;
-	bool found_audio[MAX_AUDIO_MIXES] = {0};
-	int64_t video_offset = 0;
-	int64_t video_dts_offset = 0;
-	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
-	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+	da_resize(stream->mux_packets, num_packets);
+	da_resize(stream->mux_offsets, num_packets);
 
 	for (size_t i = 0; i < num_packets; i++) {
 		struct encoder_packet *pkt;
 		pkt = circlebuf_data(&stream->packets, i * size);
 
-		if (pkt->type == OBS_ENCODER_VIDEO) {
-			if (!found_video) {
-				video_offset = pkt->dts_usec;
-				video_dts_offset = pkt->dts;
-				found_video = true;
-			}
-		} else {
-			if (!found_audio[pkt->track_idx]) {
-				found_audio[pkt->track_idx] = true;
-				audio_offsets[pkt->track_idx] = pkt->dts_usec;
-				audio_dts_offsets[pkt->track_idx] = pkt->dts;
-			}
-		}
+		obs_encoder_packet_ref(&stream->mux_packets.array[i], pkt);
+		stream->mux_offsets.array[i] =
+			stream->spill ? *spill_offset(stream, i) : -1;
+	}
 
-		insert_packet(&stream->mux_packets.da, pkt,
-				video_offset, audio_offsets,
-				video_dts_offset, audio_dts_offsets);
+	/* protect the spilled data from being overwritten during the save,
+	 * and have the mux thread wait for the writes queued so far */
+	stream->mux_spill = stream->spill;
+	if (stream->spill) {
+		stream->spill_save_start = spill_live_start(stream);
+
+		pthread_mutex_lock(&stream->spill_mutex);
+		stream->spill_save_target = stream->spill_queued;
+		pthread_mutex_unlock(&stream->spill_mutex);
 	}
 
 	/* ---------------------------- */
@@ -799,12 +1634,24 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 	obs_encoder_packet_ref(&pkt, packet);
 	replay_buffer_purge(stream, &pkt);
 
+	/* a new GOP starts, everything before it goes to disk */
+	if (stream->spill && packet->type == OBS_ENCODER_VIDEO &&
+	    packet->keyframe)
+		replay_buffer_spill(stream);
+
 	if (!stream->packets.size)
 		stream->cur_time = pkt.dts_usec;
 	stream->cur_size += pkt.size;
 
 	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
 
+	if (stream->spill) {
+		int64_t offset = -1;
+		circlebuf_push_back(&stream->spill_offsets, &offset,
+				sizeof(offset));
+		stream->spill_pending++;
+	}
+
 	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
 		stream->keyframes++;
 
@@ -829,6 +1676,8 @@ static void replay_buffer_defaults(obs_data_t *s)
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
+	obs_data_set_default_bool(s, OPT_BATCHED_WRITES, true);
+	obs_data_set_default_bool(s, OPT_SPILL_TO_DISK, false);
 }
 
 struct obs_output_info replay_buffer = {
@@ -0,0 +1,100 @@
+/* orders the buffered packets of a replay buffer save for muxing */
+
+#pragma once
+
+#include <obs.h>
+#include <util/bmem.h>
+
+#define REPLAY_TRACKS (MAX_AUDIO_MIXES + 1)
+
+static inline size_t replay_track(const struct encoder_packet *pkt)
+{
+	return pkt->type == OBS_ENCODER_VIDEO ? 0 : pkt->track_idx + 1;
+}
+
+/* makes every track start at zero */
+static void offset_replay_packets(struct encoder_packet *packets, size_t num)
+{
+	bool found[REPLAY_TRACKS] = {0};
+	int64_t usec_offsets[REPLAY_TRACKS] = {0};
+	int64_t dts_offsets[REPLAY_TRACKS] = {0};
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet *pkt = &packets[i];
+		size_t track = replay_track(pkt);
+
+		if (!found[track]) {
+			usec_offsets[track] = pkt->dts_usec;
+			dts_offsets[track] = pkt->dts;
+			found[track] = true;
+		}
+
+		pkt->dts_usec -= usec_offsets[track];
+		pkt->dts -= dts_offsets[track];
+		pkt->pts -= dts_offsets[track];
+	}
+}
+
+/*
+ * Packets of a single track are already in dts order in the buffer, so the
+ * mux order is a k-way merge of the per-track streams rather than a sorted
+ * insert of every packet.  Equal timestamps keep the newer packet first, as
+ * the sorted insert used to.  Returns the mux order as indices into
+ * packets, to be freed with bfree.
+ */
+static size_t *merge_replay_packets(const struct encoder_packet *packets,
+		size_t num)
+{
+	size_t track_start[REPLAY_TRACKS + 1] = {0};
+	size_t track_cur[REPLAY_TRACKS];
+	size_t *by_track;
+	size_t *order;
+
+	if (!num)
+		return NULL;
+
+	by_track = bmalloc(sizeof(size_t) * num);
+	order = bmalloc(sizeof(size_t) * num);
+
+	for (size_t i = 0; i < num; i++)
+		track_start[replay_track(&packets[i]) + 1]++;
+	for (size_t t = 0; t < REPLAY_TRACKS; t++)
+		track_start[t + 1] += track_start[t];
+
+	memcpy(track_cur, track_start, sizeof(track_cur));
+	for (size_t i = 0; i < num; i++)
+		by_track[track_cur[replay_track(&packets[i])]++] = i;
+
+	memcpy(track_cur, track_start, sizeof(track_cur));
+	for (size_t i = 0; i < num; i++) {
+		size_t best = 0;
+		bool found = false;
+
+		for (size_t t = 0; t < REPLAY_TRACKS; t++) {
+			const struct encoder_packet *head;
+			const struct encoder_packet *cur;
+
+			if (track_cur[t] == track_start[t + 1])
+				continue;
+			if (!found) {
+				best = t;
+				found = true;
+				continue;
+			}
+
+			head = &packets[by_track[track_cur[t]]];
+			cur = &packets[by_track[track_cur[best]]];
+
+			if (head->dts_usec < cur->dts_usec ||
+			    (head->dts_usec == cur->dts_usec &&
+			     by_track[track_cur[t]] >
+			     by_track[track_cur[best]]))
+				best = t;
+		}
+
+		order[i] = by_track[track_cur[best]++];
+	}
+
+	bfree(by_track);
+	return order;
+}
@@ -245,6 +245,25 @@ static void flv_audio(struct serializer *s, int32_t dts_offset,
 	s_wb32(s, (uint32_t)serializer_get_pos(s) - 1);
 }
 
+size_t flv_packet_body_prefix(struct encoder_packet *packet, bool is_header,
+		uint8_t prefix[FLV_BODY_PREFIX_MAX])
+{
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int32_t offset_ms = get_ms_time(packet, packet->pts - packet->dts);
+
+		prefix[0] = packet->keyframe ? 0x17 : 0x27;
+		prefix[1] = is_header ? 0 : 1;
+		prefix[2] = (uint8_t)(offset_ms >> 16);
+		prefix[3] = (uint8_t)(offset_ms >> 8);
+		prefix[4] = (uint8_t)offset_ms;
+		return VIDEO_HEADER_SIZE;
+	}
+
+	prefix[0] = 0xaf;
+	prefix[1] = is_header ? 0 : 1;
+	return 2;
+}
+
 void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
 		uint8_t **output, size_t *size, bool is_header)
 {
@@ -20,6 +20,7 @@
 #include <obs.h>
 
 #define MILLISECOND_DEN   1000
+#define FLV_BODY_PREFIX_MAX 5
 
 static int32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 {
@@ -32,3 +33,9 @@ extern bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 		bool write_header, size_t audio_idx);
 extern void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
 		uint8_t **output, size_t *size, bool is_header);
+
+/* writes the bytes that precede packet->data in an FLV audio/video tag body
+ * (codec/frame type, AVC packet type, composition time) and returns their
+ * count, so the tag body can be sent straight from the packet data */
+extern size_t flv_packet_body_prefix(struct encoder_packet *packet,
+		bool is_header, uint8_t prefix[FLV_BODY_PREFIX_MAX]);
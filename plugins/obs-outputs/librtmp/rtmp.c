@@ -4179,6 +4179,297 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     return TRUE;
 }
 
+#define RTMP_MAX_IOV 64
+
+typedef struct RTMPIOVec
+{
+    const char *base;
+    int len;
+} RTMPIOVec;
+
+/* writes the segments in order.  plain sockets get a single writev/WSASend
+ * per call, the HTTP tunnel gets them coalesced into one POST, everything
+ * else (TLS, RC4, custom send) goes through WriteN segment by segment so
+ * framing and encryption stay intact */
+static int
+WriteV(RTMP *r, RTMPIOVec *iov, int cnt)
+{
+    int i, nBytes;
+
+    if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+        char *buf, *ptr;
+        int len = 0, ret;
+
+        for (i = 0; i < cnt; i++)
+            len += iov[i].len;
+
+        buf = malloc(len);
+        if (!buf)
+            return FALSE;
+
+        ptr = buf;
+        for (i = 0; i < cnt; i++)
+        {
+            memcpy(ptr, iov[i].base, iov[i].len);
+            ptr += iov[i].len;
+        }
+
+        ret = WriteN(r, buf, len);
+        free(buf);
+        return ret;
+    }
+
+    if ((r->m_bCustomSend && r->m_customSendFunc) ||
+#ifdef CRYPTO
+            r->Link.rc4keyOut ||
+#endif
+            r->m_sb.sb_ssl)
+    {
+        for (i = 0; i < cnt; i++)
+        {
+            if (!WriteN(r, iov[i].base, iov[i].len))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    while (cnt)
+    {
+#ifdef _WIN32
+        WSABUF bufs[RTMP_MAX_IOV];
+        DWORD sent = 0;
+        int ret;
+
+        for (i = 0; i < cnt; i++)
+        {
+            bufs[i].buf = (char *)iov[i].base;
+            bufs[i].len = (ULONG)iov[i].len;
+        }
+        ret = WSASend(r->m_sb.sb_socket, bufs, cnt, &sent, 0, NULL, NULL);
+        nBytes = ret == 0 ? (int)sent : -1;
+#else
+        struct iovec bufs[RTMP_MAX_IOV];
+
+        for (i = 0; i < cnt; i++)
+        {
+            bufs[i].iov_base = (void *)iov[i].base;
+            bufs[i].iov_len = (size_t)iov[i].len;
+        }
+        nBytes = (int)writev(r->m_sb.sb_socket, bufs, cnt);
+#endif
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            r->last_error_code = sockerr;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        /* skip what went out, partial writes resume mid-segment */
+        while (cnt && nBytes >= iov->len)
+        {
+            nBytes -= iov->len;
+            iov++;
+            cnt--;
+        }
+        if (cnt)
+        {
+            iov->base += nBytes;
+            iov->len -= nBytes;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Like RTMP_SendPacket, but the body is passed as a list of buffers which
+ * are never copied or written to.  Chunk headers are built separately and
+ * interleaved with slices of the body, so callers can hand over refcounted
+ * encoder data directly.  packet->m_body is ignored, packet->m_nBodySize is
+ * computed from the parts. */
+int
+RTMP_SendPacketV(RTMP *r, RTMPPacket *packet, const AVal *parts, int numParts)
+{
+    const RTMPPacket *prevPacket;
+    uint32_t last = 0;
+    uint32_t t;
+    int nSize, hSize, cSize = 0;
+    char hbuf[RTMP_MAX_HEADER_SIZE], *hptr, *hend = hbuf + sizeof(hbuf);
+    char cbuf[3], c;
+    int cbufSize;
+    RTMPIOVec iov[RTMP_MAX_IOV];
+    int cnt = 0;
+    int part = 0, partOffset = 0;
+    int nChunkSize = r->m_outChunkSize;
+    int i;
+
+    packet->m_nBodySize = 0;
+    for (i = 0; i < numParts; i++)
+        packet->m_nBodySize += parts[i].av_len;
+
+    if (packet->m_nChannel >= r->m_channelsAllocatedOut)
+    {
+        int n = packet->m_nChannel + 10;
+        RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
+        if (!packets)
+        {
+            free(r->m_vecChannelsOut);
+            r->m_vecChannelsOut = NULL;
+            r->m_channelsAllocatedOut = 0;
+            return FALSE;
+        }
+        r->m_vecChannelsOut = packets;
+        memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
+        r->m_channelsAllocatedOut = n;
+    }
+
+    prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
+    if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
+    {
+        if (prevPacket->m_nBodySize == packet->m_nBodySize
+                && prevPacket->m_packetType == packet->m_packetType
+                && packet->m_headerType == RTMP_PACKET_SIZE_MEDIUM)
+            packet->m_headerType = RTMP_PACKET_SIZE_SMALL;
+
+        if (prevPacket->m_nTimeStamp == packet->m_nTimeStamp
+                && packet->m_headerType == RTMP_PACKET_SIZE_SMALL)
+            packet->m_headerType = RTMP_PACKET_SIZE_MINIMUM;
+        last = prevPacket->m_nTimeStamp;
+    }
+
+    if (packet->m_headerType > 3)	/* sanity */
+    {
+        RTMP_Log(RTMP_LOGERROR, "sanity failed!! trying to send header of type: 0x%02x.",
+                 (unsigned char)packet->m_headerType);
+        return FALSE;
+    }
+
+    nSize = packetSize[packet->m_headerType];
+    t = packet->m_nTimeStamp - last;
+
+    if (packet->m_nChannel > 319)
+        cSize = 2;
+    else if (packet->m_nChannel > 63)
+        cSize = 1;
+
+    c = packet->m_headerType << 6;
+    switch (cSize)
+    {
+    case 0:
+        c |= packet->m_nChannel;
+        break;
+    case 1:
+        break;
+    case 2:
+        c |= 1;
+        break;
+    }
+
+    hptr = hbuf;
+    *hptr++ = c;
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        *hptr++ = tmp & 0xff;
+        if (cSize == 2)
+            *hptr++ = tmp >> 8;
+    }
+
+    if (nSize > 1)
+        hptr = AMF_EncodeInt24(hptr, hend, t > 0xffffff ? 0xffffff : t);
+
+    if (nSize > 4)
+    {
+        hptr = AMF_EncodeInt24(hptr, hend, packet->m_nBodySize);
+        *hptr++ = packet->m_packetType;
+    }
+
+    if (nSize > 8)
+        hptr += EncodeInt32LE(hptr, packet->m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+        hptr = AMF_EncodeInt32(hptr, hend, t);
+
+    hSize = (int)(hptr - hbuf);
+
+    /* every continuation chunk uses the same type 3 header */
+    cbuf[0] = (0xc0 | c);
+    cbufSize = 1;
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        cbuf[cbufSize++] = tmp & 0xff;
+        if (cSize == 2)
+            cbuf[cbufSize++] = tmp >> 8;
+    }
+
+    iov[cnt].base = hbuf;
+    iov[cnt++].len = hSize;
+
+    nSize = packet->m_nBodySize;
+    while (nSize)
+    {
+        int chunk = nSize < nChunkSize ? nSize : nChunkSize;
+        nSize -= chunk;
+
+        while (chunk)
+        {
+            int len = parts[part].av_len - partOffset;
+            if (len > chunk)
+                len = chunk;
+
+            if (len)
+            {
+                iov[cnt].base = parts[part].av_val + partOffset;
+                iov[cnt++].len = len;
+            }
+
+            chunk -= len;
+            partOffset += len;
+            if (partOffset == parts[part].av_len)
+            {
+                part++;
+                partOffset = 0;
+            }
+
+            /* leave room for a slice and the next chunk header */
+            if (cnt >= RTMP_MAX_IOV - 2)
+            {
+                if (!WriteV(r, iov, cnt))
+                    return FALSE;
+                cnt = 0;
+            }
+        }
+
+        if (nSize)
+        {
+            iov[cnt].base = cbuf;
+            iov[cnt++].len = cbufSize;
+        }
+    }
+
+    if (cnt && !WriteV(r, iov, cnt))
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    r->m_vecChannelsOut[packet->m_nChannel]->m_body = NULL;
+    return TRUE;
+}
+
 int
 RTMP_Serve(RTMP *r)
 {
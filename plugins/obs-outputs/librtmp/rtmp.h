@@ -365,6 +365,7 @@ extern "C"
 
     int RTMP_ReadPacket(RTMP *r, RTMPPacket *packet);
     int RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue);
+    int RTMP_SendPacketV(RTMP *r, RTMPPacket *packet, const AVal *parts, int numParts);
     int RTMP_SendChunk(RTMP *r, RTMPChunk *chunk);
     int RTMP_IsConnected(RTMP *r);
     SOCKET RTMP_Socket(RTMP *r);
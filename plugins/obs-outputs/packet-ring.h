@@ -0,0 +1,219 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <obs.h>
+#include <util/bmem.h>
+#include <util/threading.h>
+
+/*
+ * Bounded single-producer/single-consumer queue of encoder packets.
+ *
+ * The producer (the thread delivering encoded data) pushes packets and may
+ * drop queued ones in place by marking their slot dead; the consumer (the
+ * send thread) pops packets and skips dead slots.  Each slot's state is the
+ * only thing both sides race on, and it is settled with a compare/swap, so
+ * whichever side wins owns (and releases) the packet.
+ *
+ * The producer also keeps a private index of queued non-keyframe video
+ * packets, so the oldest one's dts can be looked up without walking the
+ * queue.
+ *
+ * Dead slots keep their place in the ring until the consumer passes them,
+ * so the number of slots in use and the number of live packets differ.
+ */
+
+#define PACKET_SLOT_EMPTY 0
+#define PACKET_SLOT_LIVE  1
+#define PACKET_SLOT_DEAD  2
+
+struct packet_slot {
+	volatile long         state;
+	struct encoder_packet packet;
+};
+
+struct packet_ring_video {
+	long                  seq;
+	int64_t               dts_usec;
+};
+
+struct packet_ring {
+	struct packet_slot       *slots;
+	struct packet_ring_video *video;
+	long                     mask;
+
+	volatile long            head; /* written by the producer only */
+	volatile long            tail; /* written by the consumer only */
+	volatile long            live; /* packets not yet popped or dropped */
+
+	/* producer-only index of non-keyframe video packets */
+	long                     video_start;
+	long                     video_end;
+};
+
+static inline long packet_ring_diff(long a, long b)
+{
+	return (long)((unsigned long)a - (unsigned long)b);
+}
+
+/* capacity must be a power of two */
+static inline void packet_ring_init(struct packet_ring *ring, size_t capacity)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->slots = bzalloc(sizeof(struct packet_slot) * capacity);
+	ring->video = bzalloc(sizeof(struct packet_ring_video) * capacity);
+	ring->mask = (long)capacity - 1;
+}
+
+static inline void packet_ring_free(struct packet_ring *ring)
+{
+	bfree(ring->slots);
+	bfree(ring->video);
+	memset(ring, 0, sizeof(*ring));
+}
+
+/* number of live packets, dead slots waiting to be passed are not counted */
+static inline size_t packet_ring_count(struct packet_ring *ring)
+{
+	return (size_t)os_atomic_load_long(&ring->live);
+}
+
+static inline bool packet_ring_full(struct packet_ring *ring)
+{
+	return packet_ring_diff(ring->head,
+			os_atomic_load_long(&ring->tail)) > ring->mask;
+}
+
+/* ------------------------------------------------------------------------- */
+/* producer side */
+
+static inline void packet_ring_prune_video(struct packet_ring *ring)
+{
+	long tail = os_atomic_load_long(&ring->tail);
+
+	while (ring->video_start != ring->video_end) {
+		struct packet_ring_video *v =
+			&ring->video[ring->video_start & ring->mask];
+		struct packet_slot *slot = &ring->slots[v->seq & ring->mask];
+
+		if (packet_ring_diff(v->seq, tail) >= 0 &&
+		    os_atomic_load_long(&slot->state) == PACKET_SLOT_LIVE)
+			break;
+
+		ring->video_start++;
+	}
+}
+
+static inline bool packet_ring_push(struct packet_ring *ring,
+		struct encoder_packet *packet)
+{
+	long head = ring->head;
+	struct packet_slot *slot;
+
+	if (packet_ring_full(ring))
+		return false;
+
+	if (packet->type == OBS_ENCODER_VIDEO && !packet->keyframe) {
+		struct packet_ring_video *v;
+
+		packet_ring_prune_video(ring);
+
+		v = &ring->video[ring->video_end++ & ring->mask];
+		v->seq = head;
+		v->dts_usec = packet->dts_usec;
+	}
+
+	slot = &ring->slots[head & ring->mask];
+	slot->packet = *packet;
+	os_atomic_set_long(&slot->state, PACKET_SLOT_LIVE);
+	os_atomic_inc_long(&ring->live);
+
+	/* full barrier, publishes the slot */
+	os_atomic_inc_long(&ring->head);
+	return true;
+}
+
+/* dts of the oldest queued non-keyframe video packet */
+static inline bool packet_ring_first_video_dts(struct packet_ring *ring,
+		int64_t *dts_usec)
+{
+	packet_ring_prune_video(ring);
+
+	if (ring->video_start == ring->video_end)
+		return false;
+
+	*dts_usec = ring->video[ring->video_start & ring->mask].dts_usec;
+	return true;
+}
+
+/* marks every queued video packet below the given priority as dead and
+ * releases it, returns the number of packets dropped */
+static inline int packet_ring_drop(struct packet_ring *ring,
+		int highest_priority)
+{
+	long head = ring->head;
+	long seq = os_atomic_load_long(&ring->tail);
+	int dropped = 0;
+
+	for (; seq != head; seq++) {
+		struct packet_slot *slot = &ring->slots[seq & ring->mask];
+		struct encoder_packet *packet = &slot->packet;
+
+		/* do not drop audio data or video keyframes */
+		if (packet->type          == OBS_ENCODER_AUDIO ||
+		    packet->drop_priority >= highest_priority)
+			continue;
+
+		if (os_atomic_compare_swap_long(&slot->state,
+					PACKET_SLOT_LIVE, PACKET_SLOT_DEAD)) {
+			os_atomic_dec_long(&ring->live);
+			obs_encoder_packet_release(packet);
+			dropped++;
+		}
+	}
+
+	return dropped;
+}
+
+/* ------------------------------------------------------------------------- */
+/* consumer side */
+
+static inline bool packet_ring_pop(struct packet_ring *ring,
+		struct encoder_packet *packet)
+{
+	long tail = ring->tail;
+
+	while (tail != os_atomic_load_long(&ring->head)) {
+		struct packet_slot *slot = &ring->slots[tail & ring->mask];
+		bool live = os_atomic_compare_swap_long(&slot->state,
+				PACKET_SLOT_LIVE, PACKET_SLOT_EMPTY);
+
+		if (live) {
+			*packet = slot->packet;
+			os_atomic_dec_long(&ring->live);
+		}
+
+		/* full barrier, hands the slot back to the producer */
+		tail = os_atomic_inc_long(&ring->tail);
+
+		if (live)
+			return true;
+	}
+
+	return false;
+}
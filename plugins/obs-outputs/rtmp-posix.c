@@ -0,0 +1,530 @@
+#ifndef _WIN32
+#include "rtmp-stream.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+	defined(__NetBSD__) || defined(__DragonFly__)
+#include <sys/event.h>
+#define USE_KQUEUE
+#else
+#error "No socket event mechanism for this platform"
+#endif
+
+#define SOCK_LOG "socket_thread_posix"
+
+/* ------------------------------------------------------------------------- */
+/* wakeup pipe, written to when data is queued or the thread should exit */
+
+bool socket_wake_init(struct rtmp_stream *stream)
+{
+	if (pipe(stream->socket_wake_fds) != 0) {
+		stream->socket_wake_fds[0] = -1;
+		stream->socket_wake_fds[1] = -1;
+		return false;
+	}
+
+	for (size_t i = 0; i < 2; i++) {
+		int fd = stream->socket_wake_fds[i];
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	return true;
+}
+
+void socket_wake_free(struct rtmp_stream *stream)
+{
+	for (size_t i = 0; i < 2; i++) {
+		if (stream->socket_wake_fds[i] != -1) {
+			close(stream->socket_wake_fds[i]);
+			stream->socket_wake_fds[i] = -1;
+		}
+	}
+}
+
+void socket_thread_wake(struct rtmp_stream *stream)
+{
+	char c = 0;
+
+	/* a full pipe already guarantees a pending wakeup */
+	if (stream->socket_wake_fds[1] != -1)
+		(void)!write(stream->socket_wake_fds[1], &c, 1);
+}
+
+static void drain_wake_pipe(struct rtmp_stream *stream)
+{
+	char discard[64];
+
+	while (read(stream->socket_wake_fds[0], discard, sizeof(discard)) > 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* epoll/kqueue abstraction, the socket is always watched for reads/hangups,
+ * writability is only watched while a previous send would have blocked so
+ * that a writable socket doesn't spin the loop with an empty buffer */
+
+struct sock_poll {
+	int fd;
+	int sock;
+	int wake;
+};
+
+enum poll_event {
+	POLL_EVENT_READ   = 1 << 0,
+	POLL_EVENT_WRITE  = 1 << 1,
+	POLL_EVENT_CLOSE  = 1 << 2,
+	POLL_EVENT_WAKE   = 1 << 3,
+	POLL_EVENT_ERROR  = 1 << 4
+};
+
+#ifdef USE_EPOLL
+static bool sock_poll_init(struct sock_poll *sp, int sock, int wake)
+{
+	struct epoll_event ev = {0};
+
+	sp->sock = sock;
+	sp->wake = wake;
+	sp->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (sp->fd == -1)
+		return false;
+
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = sock;
+	if (epoll_ctl(sp->fd, EPOLL_CTL_ADD, sock, &ev) != 0)
+		goto fail;
+
+	ev.events = EPOLLIN;
+	ev.data.fd = wake;
+	if (epoll_ctl(sp->fd, EPOLL_CTL_ADD, wake, &ev) != 0)
+		goto fail;
+
+	return true;
+
+fail:
+	close(sp->fd);
+	sp->fd = -1;
+	return false;
+}
+
+static void sock_poll_watch_write(struct sock_poll *sp, bool watch)
+{
+	struct epoll_event ev = {0};
+
+	ev.events = EPOLLIN | EPOLLRDHUP | (watch ? EPOLLOUT : 0);
+	ev.data.fd = sp->sock;
+	epoll_ctl(sp->fd, EPOLL_CTL_MOD, sp->sock, &ev);
+}
+
+static int sock_poll_wait(struct sock_poll *sp)
+{
+	struct epoll_event events[2];
+	int flags = 0;
+	int count;
+
+	do {
+		count = epoll_wait(sp->fd, events, 2, -1);
+	} while (count == -1 && errno == EINTR);
+
+	if (count == -1)
+		return POLL_EVENT_ERROR;
+
+	for (int i = 0; i < count; i++) {
+		uint32_t e = events[i].events;
+
+		if (events[i].data.fd == sp->wake) {
+			flags |= POLL_EVENT_WAKE;
+			continue;
+		}
+
+		if (e & EPOLLIN)
+			flags |= POLL_EVENT_READ;
+		if (e & EPOLLOUT)
+			flags |= POLL_EVENT_WRITE;
+		if (e & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			flags |= POLL_EVENT_CLOSE;
+	}
+
+	return flags;
+}
+
+#else
+static bool sock_poll_init(struct sock_poll *sp, int sock, int wake)
+{
+	struct kevent ev[3];
+
+	sp->sock = sock;
+	sp->wake = wake;
+	sp->fd = kqueue();
+	if (sp->fd == -1)
+		return false;
+
+	fcntl(sp->fd, F_SETFD, FD_CLOEXEC);
+
+	EV_SET(&ev[0], sock, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	EV_SET(&ev[1], sock, EVFILT_WRITE, EV_ADD | EV_DISABLE, 0, 0, NULL);
+	EV_SET(&ev[2], wake, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(sp->fd, ev, 3, NULL, 0, NULL) != 0) {
+		close(sp->fd);
+		sp->fd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+static void sock_poll_watch_write(struct sock_poll *sp, bool watch)
+{
+	struct kevent ev;
+
+	EV_SET(&ev, sp->sock, EVFILT_WRITE, watch ? EV_ENABLE : EV_DISABLE,
+			0, 0, NULL);
+	kevent(sp->fd, &ev, 1, NULL, 0, NULL);
+}
+
+static int sock_poll_wait(struct sock_poll *sp)
+{
+	struct kevent events[3];
+	int flags = 0;
+	int count;
+
+	do {
+		count = kevent(sp->fd, NULL, 0, events, 3, NULL);
+	} while (count == -1 && errno == EINTR);
+
+	if (count == -1)
+		return POLL_EVENT_ERROR;
+
+	for (int i = 0; i < count; i++) {
+		if ((int)events[i].ident == sp->wake) {
+			flags |= POLL_EVENT_WAKE;
+			continue;
+		}
+
+		if (events[i].flags & EV_ERROR)
+			flags |= POLL_EVENT_CLOSE;
+		else if (events[i].filter == EVFILT_READ)
+			flags |= POLL_EVENT_READ;
+		else if (events[i].filter == EVFILT_WRITE)
+			flags |= POLL_EVENT_WRITE;
+
+		/* for reads, EOF is reported once pending data is drained */
+		if ((events[i].flags & EV_EOF) &&
+		    events[i].filter == EVFILT_WRITE)
+			flags |= POLL_EVENT_CLOSE;
+	}
+
+	return flags;
+}
+#endif
+
+static void sock_poll_free(struct sock_poll *sp)
+{
+	if (sp->fd != -1)
+		close(sp->fd);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void fatal_sock_shutdown(struct rtmp_stream *stream)
+{
+	close(stream->rtmp.m_sb.sb_socket);
+	stream->rtmp.m_sb.sb_socket = -1;
+	stream->write_buf_len = 0;
+	os_event_signal(stream->buffer_space_available_event);
+}
+
+static void log_close(struct rtmp_stream *stream, uint64_t last_send_time,
+		int err_code)
+{
+	if (last_send_time) {
+		uint32_t diff = (uint32_t)(
+				(os_gettime_ns() / 1000000) - last_send_time);
+
+		blog(LOG_ERROR, SOCK_LOG ": Received close, %u ms since last "
+				"send (buffer: %d / %d)",
+				diff,
+				(int)stream->write_buf_len,
+				(int)stream->write_buf_size);
+	}
+
+	if (os_event_try(stream->stop_event) != EAGAIN)
+		blog(LOG_ERROR, SOCK_LOG ": Aborting due to close during "
+				"shutdown, %d bytes lost, error %d",
+				(int)stream->write_buf_len, err_code);
+	else
+		blog(LOG_ERROR, SOCK_LOG ": Aborting due to close, error %d",
+				err_code);
+}
+
+static int socket_error(int sock)
+{
+	int err_code = 0;
+	socklen_t size = sizeof(err_code);
+
+	getsockopt(sock, SOL_SOCKET, SO_ERROR, &err_code, &size);
+	return err_code;
+}
+
+/* the server rarely sends anything of interest after the handshake, but its
+ * data still has to be consumed so the receive window doesn't stall */
+static bool discard_socket_data(struct rtmp_stream *stream,
+		uint64_t last_send_time)
+{
+	char discard[16384];
+
+	for (;;) {
+		ssize_t ret = recv(stream->rtmp.m_sb.sb_socket,
+				discard, sizeof(discard), 0);
+		int err_code;
+
+		if (ret > 0)
+			continue;
+
+		if (ret == -1) {
+			err_code = errno;
+			if (err_code == EAGAIN || err_code == EWOULDBLOCK)
+				return true;
+			if (err_code == EINTR)
+				continue;
+
+			blog(LOG_ERROR, SOCK_LOG ": Socket error, recv() "
+					"returned %d, errno %d",
+					(int)ret, err_code);
+		} else {
+			err_code = 0;
+			log_close(stream, last_send_time, err_code);
+		}
+
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+}
+
+/* keep the kernel's unsent queue shallow, so that backlog accumulates in
+ * write_buf where the congestion and frame drop logic can see it rather
+ * than in a socket buffer that may have been auto-tuned to megabytes */
+static void set_send_window(struct rtmp_stream *stream)
+{
+#ifdef TCP_NOTSENT_LOWAT
+	int lowat = (int)(stream->write_buf_size / 4);
+
+	if (lowat < 16384)
+		lowat = 16384;
+
+	if (setsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP,
+				TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) == 0)
+		blog(LOG_INFO, SOCK_LOG ": Unsent low water mark set to %d "
+				"(buffer: %d)", lowat,
+				(int)stream->write_buf_size);
+	else
+		blog(LOG_WARNING, SOCK_LOG ": Failed to set unsent low water "
+				"mark, errno %d", errno);
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+}
+
+enum data_ret {
+	RET_BREAK,
+	RET_FATAL,
+	RET_CONTINUE
+};
+
+static enum data_ret write_data(struct rtmp_stream *stream, bool *can_write,
+		uint64_t *last_send_time, size_t latency_packet_size,
+		int delay_time)
+{
+	bool exit_loop = false;
+	size_t send_len;
+	ssize_t ret;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+
+	if (!stream->write_buf_len) {
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return RET_BREAK;
+	}
+
+	send_len = stream->write_buf_len;
+	if (stream->low_latency_mode && latency_packet_size < send_len)
+		send_len = latency_packet_size;
+
+#ifdef MSG_NOSIGNAL
+	ret = send(stream->rtmp.m_sb.sb_socket, stream->write_buf, send_len,
+			MSG_NOSIGNAL);
+#else
+	ret = send(stream->rtmp.m_sb.sb_socket, stream->write_buf, send_len,
+			0);
+#endif
+
+	if (ret > 0) {
+		if (stream->write_buf_len - ret)
+			memmove(stream->write_buf,
+					stream->write_buf + ret,
+					stream->write_buf_len - ret);
+		stream->write_buf_len -= ret;
+
+		*last_send_time = os_gettime_ns() / 1000000;
+
+		os_event_signal(stream->buffer_space_available_event);
+	} else {
+		int err_code = ret == -1 ? errno : 0;
+
+		if (err_code == EINTR) {
+			pthread_mutex_unlock(&stream->write_buf_mutex);
+			return RET_CONTINUE;
+		}
+
+		if (err_code == EAGAIN || err_code == EWOULDBLOCK) {
+			*can_write = false;
+			pthread_mutex_unlock(&stream->write_buf_mutex);
+			return RET_BREAK;
+		}
+
+		/* connection closed, or connection was aborted /
+		 * socket closed / etc, that's a fatal error. */
+		blog(LOG_ERROR, SOCK_LOG ": Socket error, send() returned "
+				"%d, errno %d", (int)ret, err_code);
+
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return RET_FATAL;
+	}
+
+	/* finish writing for now */
+	if (stream->write_buf_len <= 1000)
+		exit_loop = true;
+
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	if (delay_time)
+		os_sleep_ms(delay_time);
+
+	return exit_loop ? RET_BREAK : RET_CONTINUE;
+}
+
+#define LATENCY_FACTOR 20
+
+static inline void socket_thread_posix_internal(struct rtmp_stream *stream)
+{
+	bool can_write = true;
+	bool watching_write = false;
+
+	int delay_time;
+	size_t latency_packet_size;
+	uint64_t last_send_time = 0;
+
+	struct sock_poll sp;
+
+	if (!sock_poll_init(&sp, stream->rtmp.m_sb.sb_socket,
+				stream->socket_wake_fds[0])) {
+		blog(LOG_ERROR, SOCK_LOG ": Aborting due to event queue "
+				"creation failure, errno %d", errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	if (stream->low_latency_mode) {
+		delay_time = 1000 / LATENCY_FACTOR;
+		latency_packet_size = stream->write_buf_size / (LATENCY_FACTOR - 2);
+	} else {
+		latency_packet_size = stream->write_buf_size;
+		delay_time = 0;
+	}
+
+	if (!stream->disable_send_window_optimization)
+		set_send_window(stream);
+	else
+		blog(LOG_INFO, SOCK_LOG ": Send window optimization disabled "
+				"by user.");
+
+	for (;;) {
+		if (os_event_try(stream->send_thread_signaled_exit) != EAGAIN) {
+			pthread_mutex_lock(&stream->write_buf_mutex);
+			if (stream->write_buf_len == 0) {
+				pthread_mutex_unlock(&stream->write_buf_mutex);
+				os_event_reset(stream->send_thread_signaled_exit);
+				break;
+			}
+
+			pthread_mutex_unlock(&stream->write_buf_mutex);
+		}
+
+		if (can_write == watching_write) {
+			watching_write = !can_write;
+			sock_poll_watch_write(&sp, watching_write);
+		}
+
+		int events = sock_poll_wait(&sp);
+		if (events & POLL_EVENT_ERROR) {
+			blog(LOG_ERROR, SOCK_LOG ": Aborting due to event wait "
+					"failure, errno %d", errno);
+			fatal_sock_shutdown(stream);
+			goto exit;
+		}
+
+		if (events & POLL_EVENT_WAKE)
+			drain_wake_pipe(stream);
+
+		if (events & POLL_EVENT_READ) {
+			if (!discard_socket_data(stream, last_send_time))
+				goto exit;
+		}
+
+		if (events & POLL_EVENT_CLOSE) {
+			int err_code = socket_error(stream->rtmp.m_sb.sb_socket);
+
+			log_close(stream, last_send_time, err_code);
+			stream->rtmp.last_error_code = err_code;
+			fatal_sock_shutdown(stream);
+			goto exit;
+		}
+
+		if (events & POLL_EVENT_WRITE)
+			can_write = true;
+
+		if (can_write) {
+			for (;;) {
+				enum data_ret ret = write_data(
+						stream,
+						&can_write,
+						&last_send_time,
+						latency_packet_size,
+						delay_time);
+
+				switch (ret) {
+				case RET_BREAK:
+					goto exit_write_loop;
+				case RET_FATAL:
+					goto exit;
+				case RET_CONTINUE:;
+				}
+			}
+		}
+		exit_write_loop:;
+	}
+
+	blog(LOG_INFO, SOCK_LOG ": Normal exit");
+
+exit:
+	sock_poll_free(&sp);
+}
+
+void *socket_thread_posix(void *data)
+{
+	struct rtmp_stream *stream = data;
+	socket_thread_posix_internal(stream);
+	return NULL;
+}
+#endif
@@ -35,20 +35,15 @@ static inline size_t num_buffered_packets(struct rtmp_stream *stream);
 
 static inline void free_packets(struct rtmp_stream *stream)
 {
+	struct encoder_packet packet;
 	size_t num_packets;
 
-	pthread_mutex_lock(&stream->packets_mutex);
-
 	num_packets = num_buffered_packets(stream);
 	if (num_packets)
 		info("Freeing %d remaining packets", (int)num_packets);
 
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+	while (packet_ring_pop(&stream->packets, &packet))
 		obs_encoder_packet_release(&packet);
-	}
-	pthread_mutex_unlock(&stream->packets_mutex);
 }
 
 static inline bool stopping(struct rtmp_stream *stream)
@@ -100,9 +95,11 @@ static void rtmp_stream_destroy(void *data)
 	dstr_free(&stream->encoder_name);
 	dstr_free(&stream->bind_ip);
 	os_event_destroy(stream->stop_event);
+	os_event_destroy(stream->packet_space_event);
 	os_sem_destroy(stream->send_sem);
-	pthread_mutex_destroy(&stream->packets_mutex);
-	circlebuf_free(&stream->packets);
+	pthread_mutex_destroy(&stream->dbr_mutex);
+	packet_ring_free(&stream->packets);
+	circlebuf_free(&stream->dbr_frames);
 #ifdef TEST_FRAMEDROPS
 	circlebuf_free(&stream->droptest_info);
 #endif
@@ -112,6 +109,9 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->socket_available_event);
 	os_event_destroy(stream->send_thread_signaled_exit);
 	pthread_mutex_destroy(&stream->write_buf_mutex);
+#ifndef _WIN32
+	socket_wake_free(stream);
+#endif
 
 	if (stream->write_buf)
 		bfree(stream->write_buf);
@@ -122,16 +122,23 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
-	pthread_mutex_init_value(&stream->packets_mutex);
+	pthread_mutex_init_value(&stream->dbr_mutex);
+	packet_ring_init(&stream->packets, PACKET_RING_SIZE);
+#ifndef _WIN32
+	stream->socket_wake_fds[0] = -1;
+	stream->socket_wake_fds[1] = -1;
+#endif
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
 
-	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
+	if (pthread_mutex_init(&stream->dbr_mutex, NULL) != 0)
 		goto fail;
 	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
+	if (os_event_init(&stream->packet_space_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
 
 	if (pthread_mutex_init(&stream->write_buf_mutex, NULL) != 0) {
 		warn("Failed to initialize write buffer mutex");
@@ -158,6 +165,12 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize socket exit event");
 		goto fail;
 	}
+#ifndef _WIN32
+	if (!socket_wake_init(stream)) {
+		warn("Failed to initialize socket wakeup pipe");
+		goto fail;
+	}
+#endif
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -185,6 +198,7 @@ static void rtmp_stream_stop(void *data, uint64_t ts)
 
 	if (active(stream)) {
 		os_event_signal(stream->stop_event);
+		os_event_signal(stream->packet_space_event);
 		if (stream->stop_ts == 0)
 			os_sem_post(stream->send_sem);
 	} else {
@@ -209,17 +223,12 @@ static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
 static inline bool get_next_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
-	bool new_packet = false;
-
-	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
-		circlebuf_pop_front(&stream->packets, packet,
-				sizeof(struct encoder_packet));
-		new_packet = true;
-	}
-	pthread_mutex_unlock(&stream->packets_mutex);
+	if (!packet_ring_pop(&stream->packets, packet))
+		return false;
 
-	return new_packet;
+	/* wakes add_packet if it is waiting on a full ring */
+	os_event_signal(stream->packet_space_event);
+	return true;
 }
 
 static bool discard_recv_data(struct rtmp_stream *stream, size_t size)
@@ -323,14 +332,265 @@ retry_send:
 	pthread_mutex_unlock(&stream->write_buf_mutex);
 
 	os_event_signal (stream->buffer_has_data_event);
+#ifndef _WIN32
+	socket_thread_wake(stream);
+#endif
 
 	return len;
 }
 
+/* ------------------------------------------------------------------------- */
+/* dynamic bitrate
+ *
+ * When the send buffer backs up, the video encoder's bitrate is lowered
+ * towards what the connection actually delivered, and raised again in
+ * steps once the buffer has stayed nearly empty for a while.  The two
+ * watermarks and the hold times keep the controller from oscillating.
+ * It reacts at half the drop threshold so frames rarely need dropping,
+ * but the drop threshold still applies while the bitrate is coming down
+ * to keep the latency bounded. */
+
+#define DBR_WINDOW_NS        2000000000ULL
+#define DBR_DEC_HOLD_NS      2000000000ULL
+#define DBR_INC_HOLD_NS      10000000000ULL
+#define DBR_TRIGGER_DIVISOR  2  /* lower at 1/2 of the drop threshold */
+#define DBR_LOW_DIVISOR      10 /* raise below 1/10 of the drop threshold */
+#define DBR_MIN_BITRATE      100
+
+static void dbr_add_frame(struct rtmp_stream *stream, size_t size)
+{
+	struct dbr_frame front;
+	struct dbr_frame frame = {
+		.send_ts = os_gettime_ns(),
+		.size    = size
+	};
+	uint64_t duration;
+
+	pthread_mutex_lock(&stream->dbr_mutex);
+
+	circlebuf_push_back(&stream->dbr_frames, &frame, sizeof(frame));
+	stream->dbr_data_size += size;
+
+	for (;;) {
+		circlebuf_peek_front(&stream->dbr_frames, &front,
+				sizeof(front));
+		if (frame.send_ts - front.send_ts <= DBR_WINDOW_NS)
+			break;
+
+		circlebuf_pop_front(&stream->dbr_frames, NULL, sizeof(front));
+		stream->dbr_data_size -= front.size;
+	}
+
+	/* wait for at least half a window before trusting the estimate */
+	duration = frame.send_ts - front.send_ts;
+	stream->dbr_est_bitrate = duration >= DBR_WINDOW_NS / 2 ?
+		(long)((uint64_t)stream->dbr_data_size * 8000000ULL /
+				duration) : 0;
+
+	pthread_mutex_unlock(&stream->dbr_mutex);
+}
+
+static void dbr_set_bitrate(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t *settings = obs_encoder_get_settings(vencoder);
+
+	obs_data_set_int(settings, "bitrate", stream->dbr_cur_bitrate);
+	obs_encoder_update(vencoder, settings);
+
+	obs_data_release(settings);
+}
+
+static bool dbr_bitrate_lowered(struct rtmp_stream *stream, uint64_t ts)
+{
+	long new_bitrate = stream->dbr_cur_bitrate * 3 / 4;
+	long est_video;
+
+	if (stream->dbr_cur_bitrate <= stream->dbr_min_bitrate)
+		return false;
+	if (ts - stream->dbr_last_change_ts < DBR_DEC_HOLD_NS)
+		return false;
+
+	pthread_mutex_lock(&stream->dbr_mutex);
+	est_video = stream->dbr_est_bitrate - stream->dbr_audio_bitrate;
+	pthread_mutex_unlock(&stream->dbr_mutex);
+
+	/* aim a little below what the link delivered so the backlog drains */
+	if (est_video > 0 && est_video * 9 / 10 < new_bitrate)
+		new_bitrate = est_video * 9 / 10;
+	if (new_bitrate < stream->dbr_min_bitrate)
+		new_bitrate = stream->dbr_min_bitrate;
+
+	stream->dbr_cur_bitrate = new_bitrate;
+	stream->dbr_last_change_ts = ts;
+	stream->dbr_low_since_ts = 0;
+	return true;
+}
+
+static bool dbr_bitrate_raised(struct rtmp_stream *stream, uint64_t ts)
+{
+	long step = stream->dbr_orig_bitrate / 10;
+
+	if (stream->dbr_cur_bitrate >= stream->dbr_max_bitrate)
+		return false;
+
+	if (!stream->dbr_low_since_ts) {
+		stream->dbr_low_since_ts = ts;
+		return false;
+	}
+
+	if (ts - stream->dbr_low_since_ts < DBR_INC_HOLD_NS ||
+	    ts - stream->dbr_last_change_ts < DBR_INC_HOLD_NS)
+		return false;
+
+	if (step < 50)
+		step = 50;
+
+	stream->dbr_cur_bitrate += step;
+	if (stream->dbr_cur_bitrate > stream->dbr_max_bitrate)
+		stream->dbr_cur_bitrate = stream->dbr_max_bitrate;
+
+	stream->dbr_last_change_ts = ts;
+	stream->dbr_low_since_ts = ts;
+	return true;
+}
+
+static void dbr_check_bitrate(struct rtmp_stream *stream,
+		int64_t buffer_duration_usec, int64_t drop_threshold)
+{
+	uint64_t ts = os_gettime_ns();
+	bool changed = false;
+
+	if (buffer_duration_usec >= drop_threshold / DBR_TRIGGER_DIVISOR) {
+		changed = dbr_bitrate_lowered(stream, ts);
+		if (changed)
+			obs_output_set_stream_congest(stream->output, true);
+
+	} else if (buffer_duration_usec <= drop_threshold / DBR_LOW_DIVISOR) {
+		changed = dbr_bitrate_raised(stream, ts);
+
+	} else {
+		stream->dbr_low_since_ts = 0;
+	}
+
+	if (changed) {
+		info("Dynamic bitrate: %ld kbps (buffered %" PRId64 " ms)",
+				stream->dbr_cur_bitrate,
+				buffer_duration_usec / 1000);
+		dbr_set_bitrate(stream);
+	}
+}
+
+static long get_encoder_bitrate(obs_encoder_t *encoder)
+{
+	obs_data_t *settings = obs_encoder_get_settings(encoder);
+	long bitrate = (long)obs_data_get_int(settings, "bitrate");
+
+	obs_data_release(settings);
+	return bitrate;
+}
+
+/* dbr_min_bitrate/dbr_max_bitrate hold the user settings (0 for automatic)
+ * until this resolves them against the encoder's configured bitrate */
+static void dbr_init(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder;
+	obs_encoder_t *aencoder;
+
+	if (!stream->dbr_enabled)
+		return;
+
+	vencoder = obs_output_get_video_encoder(stream->output);
+	aencoder = obs_output_get_audio_encoder(stream->output, 0);
+
+	stream->dbr_orig_bitrate = vencoder ? get_encoder_bitrate(vencoder) : 0;
+	if (!stream->dbr_orig_bitrate) {
+		warn("Video encoder has no bitrate setting, dynamic bitrate "
+		     "disabled");
+		stream->dbr_enabled = false;
+		return;
+	}
+
+	stream->dbr_audio_bitrate = aencoder ?
+		get_encoder_bitrate(aencoder) : 0;
+
+	if (!stream->dbr_max_bitrate)
+		stream->dbr_max_bitrate = stream->dbr_orig_bitrate;
+	if (!stream->dbr_min_bitrate)
+		stream->dbr_min_bitrate = stream->dbr_orig_bitrate / 4;
+	if (stream->dbr_min_bitrate < DBR_MIN_BITRATE)
+		stream->dbr_min_bitrate = DBR_MIN_BITRATE;
+	if (stream->dbr_min_bitrate > stream->dbr_max_bitrate)
+		stream->dbr_min_bitrate = stream->dbr_max_bitrate;
+
+	stream->dbr_cur_bitrate = stream->dbr_orig_bitrate;
+	if (stream->dbr_cur_bitrate > stream->dbr_max_bitrate) {
+		stream->dbr_cur_bitrate = stream->dbr_max_bitrate;
+		dbr_set_bitrate(stream);
+	}
+
+	stream->dbr_est_bitrate = 0;
+	stream->dbr_data_size = 0;
+	stream->dbr_last_change_ts = 0;
+	stream->dbr_low_since_ts = 0;
+	circlebuf_free(&stream->dbr_frames);
+
+	info("Dynamic bitrate enabled: %ld kbps (%ld - %ld kbps)",
+			stream->dbr_cur_bitrate, stream->dbr_min_bitrate,
+			stream->dbr_max_bitrate);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* sends an encoder packet as a single RTMP message.  the tag body prefix is
+ * the only thing built here, the packet data itself is handed to librtmp as
+ * is and interleaved with the chunk headers on the way to the socket. */
+static int write_packet(struct rtmp_stream *stream,
+		struct encoder_packet *packet, bool is_header, size_t idx,
+		size_t *size)
+{
+	int32_t dts_offset = is_header ? 0 : stream->start_dts_offset;
+	uint8_t prefix[FLV_BODY_PREFIX_MAX];
+	RTMPPacket rtmp_packet = {0};
+	AVal parts[2];
+
+	*size = 0;
+
+	if (!packet->data || !packet->size)
+		return 0;
+
+	parts[0].av_val = (char*)prefix;
+	parts[0].av_len = (int)flv_packet_body_prefix(packet, is_header,
+			prefix);
+	parts[1].av_val = (char*)packet->data;
+	parts[1].av_len = (int)packet->size;
+
+	rtmp_packet.m_packetType = packet->type == OBS_ENCODER_VIDEO ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+	rtmp_packet.m_nChannel = 0x04; /* source channel */
+	rtmp_packet.m_nInfoField2 = stream->rtmp.Link.streams[idx].id;
+	rtmp_packet.m_nTimeStamp = (uint32_t)(get_ms_time(packet,
+				packet->dts) - dts_offset) & 0x7FFFFFFF;
+	rtmp_packet.m_headerType = rtmp_packet.m_nTimeStamp ?
+		RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+
+	/* account for the same byte count the FLV tag used to have:
+	 * 11 byte tag header + body + 4 byte trailing tag size */
+	*size = 11 + parts[0].av_len + packet->size + 4;
+
+#ifdef TEST_FRAMEDROPS
+	droptest_cap_data_rate(stream, *size);
+#endif
+
+	if (!RTMP_SendPacketV(&stream->rtmp, &rtmp_packet, parts, 2))
+		return -1;
+
+	return (int)*size;
+}
+
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header, size_t idx)
 {
-	uint8_t *data;
 	size_t  size;
 	int     recv_size = 0;
 	int     ret = 0;
@@ -349,21 +609,16 @@ static int send_packet(struct rtmp_stream *stream,
 		}
 	}
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
-			&data, &size, is_header);
-
-#ifdef TEST_FRAMEDROPS
-	droptest_cap_data_rate(stream, size);
-#endif
-
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size, (int)idx);
-	bfree(data);
+	ret = write_packet(stream, packet, is_header, idx, &size);
 
 	if (is_header)
 		bfree(packet->data);
 	else
 		obs_encoder_packet_release(packet);
 
+	if (stream->dbr_enabled)
+		dbr_add_frame(stream, size);
+
 	stream->total_bytes_sent += size;
 	return ret;
 }
@@ -477,6 +732,9 @@ static void *send_thread(void *data)
 		}
 	}
 
+	/* nothing takes packets from the ring any more */
+	os_event_signal(stream->packet_space_event);
+
 	if (disconnected(stream)) {
 		info("Disconnected from %s", stream->path.array);
 	} else {
@@ -486,11 +744,20 @@ static void *send_thread(void *data)
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
 		os_event_signal(stream->buffer_has_data_event);
+#ifndef _WIN32
+		socket_thread_wake(stream);
+#endif
 		pthread_join(stream->socket_thread, NULL);
 		stream->socket_thread_active = false;
 		stream->rtmp.m_bCustomSend = false;
 	}
 
+	if (stream->dbr_enabled &&
+	    stream->dbr_cur_bitrate != stream->dbr_orig_bitrate) {
+		stream->dbr_cur_bitrate = stream->dbr_orig_bitrate;
+		dbr_set_bitrate(stream);
+	}
+
 	set_output_error(stream);
 	RTMP_Close(&stream->rtmp);
 
@@ -699,8 +966,8 @@ static int init_send(struct rtmp_stream *stream)
 		ret = pthread_create(&stream->socket_thread, NULL,
 				socket_thread_windows, stream);
 #else
-		warn("New socket loop not supported on this platform");
-		return OBS_OUTPUT_ERROR;
+		ret = pthread_create(&stream->socket_thread, NULL,
+				socket_thread_posix, stream);
 #endif
 
 		if (ret != 0) {
@@ -715,6 +982,8 @@ static int init_send(struct rtmp_stream *stream)
 		stream->rtmp.m_customSendParam = stream;
 	}
 
+	dbr_init(stream);
+
 	os_atomic_set_bool(&stream->active, true);
 	while (next) {
 		if (!send_meta_data(stream, idx++, &next)) {
@@ -910,6 +1179,12 @@ static bool init_connect(struct rtmp_stream *stream)
 	stream->low_latency_mode = obs_data_get_bool(settings,
 			OPT_LOWLATENCY_ENABLED);
 
+	stream->dbr_enabled = obs_data_get_bool(settings, OPT_DYN_BITRATE);
+	stream->dbr_min_bitrate =
+		(long)obs_data_get_int(settings, OPT_DYN_BITRATE_MIN);
+	stream->dbr_max_bitrate =
+		(long)obs_data_get_int(settings, OPT_DYN_BITRATE_MAX);
+
 	obs_data_release(settings);
 	return true;
 }
@@ -954,17 +1229,9 @@ static bool rtmp_stream_start(void *data)
 			stream) == 0;
 }
 
-static inline bool add_packet(struct rtmp_stream *stream,
-		struct encoder_packet *packet)
-{
-	circlebuf_push_back(&stream->packets, packet,
-			sizeof(struct encoder_packet));
-	return true;
-}
-
 static inline size_t num_buffered_packets(struct rtmp_stream *stream)
 {
-	return stream->packets.size / sizeof(struct encoder_packet);
+	return packet_ring_count(&stream->packets);
 }
 
 static void drop_frames(struct rtmp_stream *stream, const char *name,
@@ -972,8 +1239,7 @@ static void drop_frames(struct rtmp_stream *stream, const char *name,
 {
 	UNUSED_PARAMETER(pframes);
 
-	struct circlebuf new_buf            = {0};
-	int              num_frames_dropped = 0;
+	int num_frames_dropped;
 
 #ifdef _DEBUG
 	int start_packets = (int)num_buffered_packets(stream);
@@ -981,25 +1247,8 @@ static void drop_frames(struct rtmp_stream *stream, const char *name,
 	UNUSED_PARAMETER(name);
 #endif
 
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
-
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-
-		/* do not drop audio data or video keyframes */
-		if (packet.type          == OBS_ENCODER_AUDIO ||
-		    packet.drop_priority >= highest_priority) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
-		} else {
-			num_frames_dropped++;
-			obs_encoder_packet_release(&packet);
-		}
-	}
-
-	circlebuf_free(&stream->packets);
-	stream->packets = new_buf;
+	num_frames_dropped = packet_ring_drop(&stream->packets,
+			highest_priority);
 
 	if (stream->min_priority < highest_priority)
 		stream->min_priority = highest_priority;
@@ -1015,26 +1264,48 @@ static void drop_frames(struct rtmp_stream *stream, const char *name,
 #endif
 }
 
-static bool find_first_video_packet(struct rtmp_stream *stream,
-		struct encoder_packet *first)
+#define PACKET_SPACE_WAIT_MS 10
+
+/* the ring is full: drop every queued non-keyframe video packet like the
+ * buffer duration check would, then wait for the send thread to free a
+ * slot rather than lose audio or a keyframe.  the send thread signals
+ * packet_space_event for each packet it takes, the timeout only bounds how
+ * long a stop or disconnect can go unnoticed */
+static bool wait_for_space(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
 {
-	size_t count = stream->packets.size / sizeof(*first);
-
-	for (size_t i = 0; i < count; i++) {
-		struct encoder_packet *cur = circlebuf_data(&stream->packets,
-				i * sizeof(*first));
-		if (cur->type == OBS_ENCODER_VIDEO && !cur->keyframe) {
-			*first = *cur;
-			return true;
-		}
+	drop_frames(stream, "overflow", OBS_NAL_PRIORITY_HIGHEST, true);
+	obs_output_set_stream_congest(stream->output, true);
+
+	if (packet->type == OBS_ENCODER_VIDEO &&
+	    packet->drop_priority < stream->min_priority) {
+		stream->dropped_frames++;
+		return false;
+	}
+
+	while (packet_ring_full(&stream->packets)) {
+		if (stopping(stream) || disconnected(stream))
+			return false;
+		os_event_timedwait(stream->packet_space_event,
+				PACKET_SPACE_WAIT_MS);
 	}
 
-	return false;
+	return true;
+}
+
+static inline bool add_packet(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
+{
+	if (packet_ring_full(&stream->packets) &&
+	    !wait_for_space(stream, packet))
+		return false;
+
+	return packet_ring_push(&stream->packets, packet);
 }
 
 static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 {
-	struct encoder_packet first;
+	int64_t first_dts_usec;
 	int64_t buffer_duration_usec;
 	size_t num_packets = num_buffered_packets(stream);
 	const char *name = pframes ? "p-frames" : "b-frames";
@@ -1045,21 +1316,28 @@ static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 		stream->drop_threshold_usec;
 
 	if (num_packets < 5) {
-		if (!pframes)
+		if (!pframes) {
 			stream->congestion = 0.0f;
+			if (stream->dbr_enabled)
+				dbr_check_bitrate(stream, 0, drop_threshold);
+		}
 		return;
 	}
 
-	if (!find_first_video_packet(stream, &first))
+	if (!packet_ring_first_video_dts(&stream->packets, &first_dts_usec))
 		return;
 
 	/* if the amount of time stored in the buffered packets waiting to be
 	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
+	buffer_duration_usec = stream->last_dts_usec - first_dts_usec;
 
 	if (!pframes) {
 		stream->congestion = (float)buffer_duration_usec /
 			(float)drop_threshold;
+
+		if (stream->dbr_enabled)
+			dbr_check_bitrate(stream, buffer_duration_usec,
+					drop_threshold);
 	}
 
 	if (buffer_duration_usec > drop_threshold) {
@@ -1109,16 +1387,12 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 		obs_encoder_packet_ref(&new_packet, packet);
 	}
 
-	pthread_mutex_lock(&stream->packets_mutex);
-
 	if (!disconnected(stream)) {
 		added_packet = (packet->type == OBS_ENCODER_VIDEO) ?
 			add_video_packet(stream, &new_packet) :
 			add_packet(stream, &new_packet);
 	}
 
-	pthread_mutex_unlock(&stream->packets_mutex);
-
 	if (added_packet)
 		os_sem_post(stream->send_sem);
 	else
@@ -1133,6 +1407,9 @@ static void rtmp_stream_defaults(obs_data_t *defaults)
 	obs_data_set_default_string(defaults, OPT_BIND_IP, "default");
 	obs_data_set_default_bool(defaults, OPT_NEWSOCKETLOOP_ENABLED, false);
 	obs_data_set_default_bool(defaults, OPT_LOWLATENCY_ENABLED, false);
+	obs_data_set_default_bool(defaults, OPT_DYN_BITRATE, false);
+	obs_data_set_default_int(defaults, OPT_DYN_BITRATE_MIN, 0);
+	obs_data_set_default_int(defaults, OPT_DYN_BITRATE_MAX, 0);
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -1165,6 +1442,15 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 	obs_properties_add_bool(props, OPT_LOWLATENCY_ENABLED,
 			obs_module_text("RTMPStream.LowLatencyMode"));
 
+	obs_properties_add_bool(props, OPT_DYN_BITRATE,
+			obs_module_text("RTMPStream.DynamicBitrate"));
+	obs_properties_add_int(props, OPT_DYN_BITRATE_MIN,
+			obs_module_text("RTMPStream.DynamicBitrate.Min"),
+			0, 100000, 50);
+	obs_properties_add_int(props, OPT_DYN_BITRATE_MAX,
+			obs_module_text("RTMPStream.DynamicBitrate.Max"),
+			0, 100000, 50);
+
 	return props;
 }
 
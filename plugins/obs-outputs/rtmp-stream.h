@@ -8,6 +8,7 @@
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
 #include "flv-mux.h"
+#include "packet-ring.h"
 #include "net-if.h"
 
 #ifdef _WIN32
@@ -30,9 +31,20 @@
 #define OPT_BIND_IP "bind_ip"
 #define OPT_NEWSOCKETLOOP_ENABLED "new_socket_loop_enabled"
 #define OPT_LOWLATENCY_ENABLED "low_latency_mode_enabled"
+#define OPT_DYN_BITRATE "dyn_bitrate"
+#define OPT_DYN_BITRATE_MIN "dyn_bitrate_min_kbps"
+#define OPT_DYN_BITRATE_MAX "dyn_bitrate_max_kbps"
+
+/* packets queued for the send thread, must be a power of two */
+#define PACKET_RING_SIZE 4096
 
 //#define TEST_FRAMEDROPS
 
+struct dbr_frame {
+	uint64_t         send_ts;
+	size_t           size;
+};
+
 #ifdef TEST_FRAMEDROPS
 
 #define DROPTEST_MAX_KBPS 3000
@@ -47,8 +59,7 @@ struct droptest_info {
 struct rtmp_stream {
 	obs_output_t     *output;
 
-	pthread_mutex_t  packets_mutex;
-	struct circlebuf packets;
+	struct packet_ring packets;
 	bool             sent_headers;
 
 	bool             got_first_video;
@@ -65,6 +76,7 @@ struct rtmp_stream {
 
 	os_sem_t         *send_sem;
 	os_event_t       *stop_event;
+	os_event_t       *packet_space_event;
 	//uint64_t         start_ts;  // add by WeiHe
 	uint64_t         stop_ts;
 	uint64_t         shutdown_timeout_ts;
@@ -85,6 +97,20 @@ struct rtmp_stream {
 	uint64_t         total_bytes_sent;
 	int              dropped_frames;
 
+	/* dynamic bitrate, all rates in kbps */
+	bool             dbr_enabled;
+	pthread_mutex_t  dbr_mutex;
+	struct circlebuf dbr_frames;
+	size_t           dbr_data_size;
+	long             dbr_est_bitrate;
+	long             dbr_orig_bitrate;
+	long             dbr_cur_bitrate;
+	long             dbr_min_bitrate;
+	long             dbr_max_bitrate;
+	long             dbr_audio_bitrate;
+	uint64_t         dbr_last_change_ts;
+	uint64_t         dbr_low_since_ts;
+
 #ifdef TEST_FRAMEDROPS
 	struct circlebuf droptest_info;
 	size_t           droptest_size;
@@ -105,8 +131,16 @@ struct rtmp_stream {
 	os_event_t       *buffer_has_data_event;
 	os_event_t       *socket_available_event;
 	os_event_t       *send_thread_signaled_exit;
+#ifndef _WIN32
+	int              socket_wake_fds[2];
+#endif
 };
 
 #ifdef _WIN32
 void *socket_thread_windows(void *data);
+#else
+void *socket_thread_posix(void *data);
+bool socket_wake_init(struct rtmp_stream *stream);
+void socket_wake_free(struct rtmp_stream *stream);
+void socket_thread_wake(struct rtmp_stream *stream);
 #endif
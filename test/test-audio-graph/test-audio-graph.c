@@ -0,0 +1,241 @@
+/*
+ * Benchmark for building the audio render order.
+ *
+ * Models a scene collection as a tree of nodes: one output channel scene
+ * that nests a number of scenes, every scene holding a share of the audio
+ * sources, and every source shown in several scenes.  The tree is walked
+ * depth-first with children before their parent, as
+ * obs_source_enum_active_tree does, and every node is pushed once into the
+ * render order with a reference.
+ *
+ * The render order is built three ways for every tick: rebuilt with a
+ * da_find de-duplication as audio_callback used to do, rebuilt with the
+ * epoch mark update_audio_graph uses, and taken from the cache while the
+ * graph generation is unchanged, which is what happens on almost every
+ * tick now (its one rebuild is included).
+ *
+ * Reports the cost per tick of all three for a few collection sizes, and
+ * returns non-zero if the two rebuilt orders differ.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define SCENES_PER_SOURCE 3
+#define TICKS             500
+
+struct node {
+	DARRAY(struct node*) children;
+	volatile long        refs;
+	uint64_t             mark;
+};
+
+struct graph {
+	struct node          root;
+	struct node          *scenes;
+	struct node          *sources;
+	size_t               num_scenes;
+	size_t               num_sources;
+};
+
+struct render_order {
+	DARRAY(struct node*) nodes;
+	uint64_t             epoch;
+	long                 cached_gen;
+	bool                 valid;
+};
+
+static uint32_t rand_state = 1;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+static void graph_init(struct graph *graph, size_t num_sources)
+{
+	memset(graph, 0, sizeof(*graph));
+
+	graph->num_sources = num_sources;
+	graph->num_scenes = num_sources / 8 + 1;
+	graph->sources = bzalloc(num_sources * sizeof(struct node));
+	graph->scenes = bzalloc(graph->num_scenes * sizeof(struct node));
+	rand_state = 1;
+
+	for (size_t i = 0; i < graph->num_scenes; i++) {
+		struct node *scene = &graph->scenes[i];
+		da_push_back(graph->root.children, &scene);
+	}
+
+	for (size_t i = 0; i < num_sources; i++) {
+		struct node *source = &graph->sources[i];
+
+		for (size_t s = 0; s < SCENES_PER_SOURCE; s++) {
+			struct node *scene = &graph->scenes[
+				next_rand() % graph->num_scenes];
+			da_push_back(scene->children, &source);
+		}
+	}
+}
+
+static void graph_free(struct graph *graph)
+{
+	for (size_t i = 0; i < graph->num_scenes; i++)
+		da_free(graph->scenes[i].children);
+	da_free(graph->root.children);
+	bfree(graph->scenes);
+	bfree(graph->sources);
+}
+
+static void order_release(struct render_order *order)
+{
+	for (size_t i = 0; i < order->nodes.num; i++)
+		os_atomic_dec_long(&order->nodes.array[i]->refs);
+	da_resize(order->nodes, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* da_find, as before */
+
+static void push_find(struct render_order *order, struct node *node)
+{
+	if (da_find(order->nodes, &node, 0) == DARRAY_INVALID) {
+		os_atomic_inc_long(&node->refs);
+		da_push_back(order->nodes, &node);
+	}
+}
+
+static void walk_find(struct render_order *order, struct node *parent)
+{
+	for (size_t i = 0; i < parent->children.num; i++) {
+		struct node *child = parent->children.array[i];
+
+		walk_find(order, child);
+		push_find(order, child);
+	}
+}
+
+static void build_find(struct render_order *order, struct graph *graph)
+{
+	order_release(order);
+	walk_find(order, &graph->root);
+	push_find(order, &graph->root);
+}
+
+/* ------------------------------------------------------------------------- */
+/* epoch mark */
+
+static void push_mark(struct render_order *order, struct node *node)
+{
+	if (node->mark != order->epoch) {
+		node->mark = order->epoch;
+		os_atomic_inc_long(&node->refs);
+		da_push_back(order->nodes, &node);
+	}
+}
+
+static void walk_mark(struct render_order *order, struct node *parent)
+{
+	for (size_t i = 0; i < parent->children.num; i++) {
+		struct node *child = parent->children.array[i];
+
+		walk_mark(order, child);
+		push_mark(order, child);
+	}
+}
+
+static void build_mark(struct render_order *order, struct graph *graph)
+{
+	order->epoch++;
+	order_release(order);
+	walk_mark(order, &graph->root);
+	push_mark(order, &graph->root);
+}
+
+/* ------------------------------------------------------------------------- */
+/* cached between topology changes */
+
+static void build_cached(struct render_order *order, struct graph *graph,
+		volatile long *graph_gen)
+{
+	long gen = os_atomic_load_long(graph_gen);
+
+	if (order->valid && gen == order->cached_gen)
+		return;
+
+	order->cached_gen = gen;
+	order->valid = true;
+	build_mark(order, graph);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool run(size_t num_sources)
+{
+	struct render_order find = {0};
+	struct render_order mark = {0};
+	struct render_order cached = {0};
+	volatile long graph_gen = 0;
+	uint64_t start, find_ns, mark_ns, cached_ns;
+	struct graph graph;
+	bool same;
+
+	graph_init(&graph, num_sources);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < TICKS; i++)
+		build_find(&find, &graph);
+	find_ns = os_gettime_ns() - start;
+
+	start = os_gettime_ns();
+	for (int i = 0; i < TICKS; i++)
+		build_mark(&mark, &graph);
+	mark_ns = os_gettime_ns() - start;
+
+	start = os_gettime_ns();
+	for (int i = 0; i < TICKS; i++)
+		build_cached(&cached, &graph, &graph_gen);
+	cached_ns = os_gettime_ns() - start;
+
+	same = find.nodes.num == mark.nodes.num &&
+		memcmp(find.nodes.array, mark.nodes.array,
+				find.nodes.num * sizeof(struct node*)) == 0;
+	if (!same)
+		printf("FAIL %zu sources: orders differ\n", num_sources);
+
+	printf("%5zu sources in %4zu scenes, %5zu nodes: da_find %9.2f us, "
+			"epoch mark %7.2f us, cached %5.3f us per tick\n",
+			num_sources, graph.num_scenes, mark.nodes.num,
+			(double)find_ns / TICKS / 1000.0,
+			(double)mark_ns / TICKS / 1000.0,
+			(double)cached_ns / TICKS / 1000.0);
+
+	order_release(&find);
+	order_release(&mark);
+	order_release(&cached);
+	da_free(find.nodes);
+	da_free(mark.nodes);
+	da_free(cached.nodes);
+	graph_free(&graph);
+	return same;
+}
+
+int main(void)
+{
+	static const size_t sizes[] = {20, 100, 500, 2000};
+	bool success = true;
+
+	printf("every source in %d scenes, %d ticks\n", SCENES_PER_SOURCE,
+			TICKS);
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		success = run(sizes[i]) && success;
+
+	return success ? 0 : 1;
+}
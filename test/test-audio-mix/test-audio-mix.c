@@ -0,0 +1,302 @@
+/*
+ * Benchmark for the per-source work of the audio callback.
+ *
+ * Models the sources of a crowded scene collection the way obs-audio.c and
+ * process_audio_source_tick handle them each tick: the source's input is
+ * copied into its per-mix output buffers, volume is applied, every mix it
+ * is routed to is accumulated, and the consumed input is popped.  Two of
+ * the six mixes are active (stream and recording), and the sources are
+ * split evenly into audible ones, muted ones, and ones routed only to an
+ * inactive mix.
+ *
+ * Every tick runs twice: as audio_callback used to, clearing and mixing
+ * all six mixes for every source, and with the mixer mask and the silent
+ * flag, which skip muted and unrouted sources after clearing their buffers
+ * once.
+ *
+ * Reports the cost per tick of both, and returns non-zero if the mixes they
+ * produce differ.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <media-io/audio-io.h>
+#include <media-io/audio-kernels.h>
+
+#define SOURCES       48
+#define TICKS         5000
+#define ACTIVE_MIXES  0x3
+
+#define OUT_FLOATS    (MAX_AUDIO_MIXES * MAX_AUDIO_CHANNELS * \
+		AUDIO_OUTPUT_FRAMES)
+#define MIX_FLOATS    (MAX_AUDIO_CHANNELS * AUDIO_OUTPUT_FRAMES)
+
+struct sim_source {
+	struct circlebuf input[MAX_AUDIO_CHANNELS];
+	float            *output;
+	uint32_t         mixers;
+	float            volume;
+	bool             silent;
+};
+
+struct sim_mixes {
+	float            *buffer[MAX_AUDIO_MIXES];
+	uint32_t         dirty;
+};
+
+static inline float *output_buf(struct sim_source *source, size_t mix,
+		size_t ch)
+{
+	return source->output + (mix * MAX_AUDIO_CHANNELS + ch) *
+		AUDIO_OUTPUT_FRAMES;
+}
+
+static void init_sources(struct sim_source *sources)
+{
+	for (size_t i = 0; i < SOURCES; i++) {
+		struct sim_source *source = &sources[i];
+
+		memset(source, 0, sizeof(*source));
+		source->output = bzalloc(OUT_FLOATS * sizeof(float));
+
+		switch (i % 3) {
+		case 0: /* audible in both active mixes */
+			source->mixers = 0x3;
+			source->volume = 0.8f;
+			break;
+		case 1: /* muted */
+			source->mixers = 0x3;
+			source->volume = 0.0f;
+			break;
+		case 2: /* only routed to an inactive mix */
+			source->mixers = 0x20;
+			source->volume = 1.0f;
+			break;
+		}
+	}
+}
+
+static void free_sources(struct sim_source *sources)
+{
+	for (size_t i = 0; i < SOURCES; i++) {
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			circlebuf_free(&sources[i].input[ch]);
+		bfree(sources[i].output);
+	}
+}
+
+/* what the capture threads push between ticks, not timed */
+static void push_input(struct sim_source *sources, uint32_t tick)
+{
+	float data[AUDIO_OUTPUT_FRAMES];
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		for (size_t f = 0; f < AUDIO_OUTPUT_FRAMES; f++)
+			data[f] = (float)((tick * 7 + i * 13 + f) % 200) /
+				400.0f - 0.25f;
+
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			circlebuf_push_back(&sources[i].input[ch], data,
+					sizeof(data));
+	}
+}
+
+static void discard_input(struct sim_source *source)
+{
+	for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+		circlebuf_pop_front(&source->input[ch], NULL,
+				AUDIO_OUTPUT_FRAMES * sizeof(float));
+}
+
+/* process_audio_source_tick and apply_audio_volume */
+static void render_source(struct sim_source *source, uint32_t mixers)
+{
+	const size_t size = AUDIO_OUTPUT_FRAMES * sizeof(float);
+
+	for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+		circlebuf_peek_front(&source->input[ch],
+				output_buf(source, 0, ch), size);
+
+	for (size_t mix = 1; mix < MAX_AUDIO_MIXES; mix++) {
+		uint32_t mix_and_val = (1 << mix);
+
+		if ((source->mixers & mix_and_val) == 0 ||
+		    (mixers & mix_and_val) == 0) {
+			memset(output_buf(source, mix, 0), 0,
+					size * MAX_AUDIO_CHANNELS);
+			continue;
+		}
+
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			memcpy(output_buf(source, mix, ch),
+					output_buf(source, 0, ch), size);
+	}
+
+	if ((source->mixers & 1) == 0 || (mixers & 1) == 0)
+		memset(output_buf(source, 0, 0), 0,
+				size * MAX_AUDIO_CHANNELS);
+
+	if (source->volume == 1.0f)
+		return;
+
+	if (source->volume == 0.0f || mixers == 0) {
+		memset(source->output, 0, OUT_FLOATS * sizeof(float));
+		source->silent = true;
+		return;
+	}
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		uint32_t mix_and_val = (1 << mix);
+		if ((source->mixers & mix_and_val) != 0 &&
+		    (mixers & mix_and_val) != 0)
+			audio_kernel_gain(output_buf(source, mix, 0),
+					source->volume, MIX_FLOATS);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* every mix for every source, as before */
+
+static void tick_all_mixes(struct sim_source *sources,
+		struct sim_mixes *mixes)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		memset(mixes->buffer[mix], 0, MIX_FLOATS * sizeof(float));
+
+	for (size_t i = 0; i < SOURCES; i++)
+		render_source(&sources[i], ACTIVE_MIXES);
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+			for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+				audio_kernel_add(mixes->buffer[mix] +
+						ch * AUDIO_OUTPUT_FRAMES,
+						output_buf(&sources[i], mix, ch),
+						AUDIO_OUTPUT_FRAMES);
+	}
+
+	for (size_t i = 0; i < SOURCES; i++)
+		discard_input(&sources[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mixer mask and silent sources */
+
+static bool source_silent(struct sim_source *source, uint32_t mixers)
+{
+	return (source->mixers & mixers) == 0 || source->volume == 0.0f;
+}
+
+static void tick_masked(struct sim_source *sources, struct sim_mixes *mixes)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		if ((mixes->dirty | ACTIVE_MIXES) & (1 << mix))
+			memset(mixes->buffer[mix], 0,
+					MIX_FLOATS * sizeof(float));
+	}
+	mixes->dirty = ACTIVE_MIXES;
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		struct sim_source *source = &sources[i];
+
+		if (source_silent(source, ACTIVE_MIXES)) {
+			if (!source->silent) {
+				memset(source->output, 0,
+						OUT_FLOATS * sizeof(float));
+				source->silent = true;
+			}
+			continue;
+		}
+
+		source->silent = false;
+		render_source(source, ACTIVE_MIXES);
+	}
+
+	for (size_t i = 0; i < SOURCES; i++) {
+		struct sim_source *source = &sources[i];
+		uint32_t mixers = ACTIVE_MIXES & source->mixers;
+
+		if (source->silent || !mixers)
+			continue;
+
+		for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+			if ((mixers & (1 << mix)) == 0)
+				continue;
+
+			for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+				audio_kernel_add(mixes->buffer[mix] +
+						ch * AUDIO_OUTPUT_FRAMES,
+						output_buf(source, mix, ch),
+						AUDIO_OUTPUT_FRAMES);
+		}
+	}
+
+	for (size_t i = 0; i < SOURCES; i++)
+		discard_input(&sources[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t run(bool masked, struct sim_mixes *mixes)
+{
+	struct sim_source sources[SOURCES];
+	uint64_t total = 0;
+
+	init_sources(sources);
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		mixes->buffer[mix] = bzalloc(MIX_FLOATS * sizeof(float));
+	mixes->dirty = 0;
+
+	for (uint32_t tick = 0; tick < TICKS; tick++) {
+		uint64_t start;
+
+		push_input(sources, tick);
+
+		start = os_gettime_ns();
+		if (masked)
+			tick_masked(sources, mixes);
+		else
+			tick_all_mixes(sources, mixes);
+		total += os_gettime_ns() - start;
+	}
+
+	free_sources(sources);
+	return total;
+}
+
+int main(void)
+{
+	const double tick_ms = 1000.0 * AUDIO_OUTPUT_FRAMES / 48000.0;
+	struct sim_mixes all = {0};
+	struct sim_mixes masked = {0};
+	uint64_t all_ns, masked_ns;
+	bool same = true;
+
+	all_ns = run(false, &all);
+	masked_ns = run(true, &masked);
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		if (memcmp(all.buffer[mix], masked.buffer[mix],
+					MIX_FLOATS * sizeof(float)) != 0) {
+			printf("FAIL mix %zu differs\n", mix);
+			same = false;
+		}
+		bfree(all.buffer[mix]);
+		bfree(masked.buffer[mix]);
+	}
+
+	printf("%d sources (1/3 audible, 1/3 muted, 1/3 on an inactive mix), "
+			"2 of %d mixes active, %.2f ms ticks:\n", SOURCES,
+			MAX_AUDIO_MIXES, tick_ms);
+	printf("    all mixes:         %.3f ms/tick\n",
+			(double)all_ns / TICKS / 1000000.0);
+	printf("    mask and silence:  %.3f ms/tick\n",
+			(double)masked_ns / TICKS / 1000000.0);
+
+	return same ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/*
+ * Checks the shared file watch service in util/file-watch.
+ *
+ * Watches files in a scratch directory and changes them the ways image
+ * editors and sync tools do: rewriting in place, writing slowly in chunks,
+ * replacing through a rename, and deleting.  Each change has to be reported
+ * exactly once, changes to other files in the same directory not at all,
+ * and nothing after a watch is removed.
+ *
+ * Also reports the delay from the last write to the callback, which
+ * replaces the once-a-second stat in video_tick.
+ *
+ * Returns non-zero if any check fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/file-watch.h>
+
+#define SCRATCH_DIR   "test-file-watch-scratch"
+#define WAIT_MS       3000
+#define QUIET_MS      1500
+#define CHUNK_MS      50
+#define CHUNKS        10
+
+struct watch_data {
+	volatile long     count;
+	volatile uint64_t last_ns;
+};
+
+static int failures = 0;
+
+static void watch_callback(void *param)
+{
+	struct watch_data *data = param;
+
+	data->last_ns = os_gettime_ns();
+	os_atomic_inc_long(&data->count);
+}
+
+static void scratch_path(struct dstr *path, const char *name)
+{
+	dstr_printf(path, "%s/%s", SCRATCH_DIR, name);
+}
+
+static void write_file(const char *name, const char *str)
+{
+	struct dstr path = {0};
+
+	scratch_path(&path, name);
+	os_quick_write_utf8_file(path.array, str, strlen(str), false);
+	dstr_free(&path);
+}
+
+/* waits for the expected count, then makes sure nothing else arrives */
+static void expect_count(const char *check, struct watch_data *data,
+		long expected)
+{
+	uint64_t start = os_gettime_ns();
+	long count;
+
+	while (os_atomic_load_long(&data->count) < expected &&
+	       os_gettime_ns() - start < WAIT_MS * 1000000ULL)
+		os_sleep_ms(10);
+
+	os_sleep_ms(QUIET_MS);
+	count = os_atomic_load_long(&data->count);
+
+	if (count != expected) {
+		printf("FAIL %s: %ld callback(s), expected %ld\n", check,
+				count, expected);
+		failures++;
+	} else {
+		printf("ok   %s\n", check);
+	}
+}
+
+static void report_delay(const char *check, struct watch_data *data,
+		uint64_t last_write_ns)
+{
+	printf("     %s: reported %.0f ms after the last write\n", check,
+			(double)(data->last_ns - last_write_ns) / 1000000.0);
+}
+
+int main(void)
+{
+	struct watch_data image = {0};
+	struct watch_data other = {0};
+	struct dstr image_path = {0};
+	struct dstr other_path = {0};
+	struct dstr temp_path = {0};
+	os_file_watch_t *image_watch;
+	os_file_watch_t *other_watch;
+	uint64_t write_ns;
+	long expected_image = 0;
+	long expected_other = 0;
+
+	os_mkdir(SCRATCH_DIR);
+	scratch_path(&image_path, "image.png");
+	scratch_path(&other_path, "other.png");
+	scratch_path(&temp_path, "image.png.tmp");
+
+	write_file("image.png", "first");
+	write_file("other.png", "first");
+
+	image_watch = os_file_watch_add(image_path.array, watch_callback,
+			&image);
+	other_watch = os_file_watch_add(other_path.array, watch_callback,
+			&other);
+	if (!image_watch || !other_watch) {
+		printf("FAIL could not add the watches\n");
+		return 1;
+	}
+
+	expect_count("no callback without a change", &image, expected_image);
+
+	/* rewritten in place */
+	write_file("image.png", "second");
+	write_ns = os_gettime_ns();
+	expect_count("in-place write", &image, ++expected_image);
+	report_delay("in-place write", &image, write_ns);
+
+	/* written slowly, only the finished file is reported */
+	for (int i = 0; i < CHUNKS; i++) {
+		FILE *f = os_fopen(image_path.array, i ? "ab" : "wb");
+		fwrite("chunk", 1, 5, f);
+		fclose(f);
+		write_ns = os_gettime_ns();
+		os_sleep_ms(CHUNK_MS);
+	}
+	expect_count("chunked write", &image, ++expected_image);
+	report_delay("chunked write", &image, write_ns);
+
+	/* replaced through a rename, as editors and sync tools save */
+	write_file("image.png.tmp", "third");
+	os_rename(temp_path.array, image_path.array);
+	write_ns = os_gettime_ns();
+	expect_count("atomic rename", &image, ++expected_image);
+	report_delay("atomic rename", &image, write_ns);
+
+	/* other files in the directory only notify their own watch */
+	write_file("other.png", "second");
+	write_file("unwatched.png", "first");
+	expect_count("other file, its own watch", &other, ++expected_other);
+	expect_count("other file, this watch", &image, expected_image);
+
+	/* deleted and created again */
+	os_unlink(image_path.array);
+	expect_count("delete", &image, ++expected_image);
+	write_file("image.png", "fourth");
+	expect_count("recreate", &image, ++expected_image);
+
+	/* the directory's other watch keeps working after one is removed */
+	os_file_watch_remove(image_watch);
+	write_file("image.png", "fifth");
+	write_file("other.png", "third");
+	expect_count("removed watch", &image, expected_image);
+	expect_count("remaining watch", &other, ++expected_other);
+
+	os_file_watch_remove(other_watch);
+
+	os_unlink(image_path.array);
+	os_unlink(other_path.array);
+	scratch_path(&temp_path, "unwatched.png");
+	os_unlink(temp_path.array);
+	os_rmdir(SCRATCH_DIR);
+
+	dstr_free(&image_path);
+	dstr_free(&other_path);
+	dstr_free(&temp_path);
+
+	printf("%s: %d check(s) failed\n", failures ? "FAILED" : "passed",
+			failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Checks the packed 422 to NV12/I420 converters in media-io against a plain
+ * per-pixel reference, and measures their throughput against it.
+ *
+ * The converters pick their SIMD kernel at runtime and finish every line
+ * with the C kernel, so the sizes below cover lines shorter than one SIMD
+ * block, block boundaries +-1, odd widths and heights, and padded strides.
+ * Every plane is followed by guard bytes that must stay untouched.
+ *
+ * Returns non-zero if any output differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/format-conversion.h>
+
+#define GUARD_SIZE  64
+#define GUARD_BYTE  0xA5
+#define BENCH_CX    1920
+#define BENCH_CY    1080
+#define BENCH_ITERS 200
+
+struct planes {
+	uint8_t  *data[3];
+	uint32_t linesize[3];
+	size_t   size[3];
+	int      count;
+};
+
+/* the scalar conversion the beauty path did before the SIMD kernels:
+ * luma copied, chroma the rounded average of each pair of lines, and an
+ * odd last line averaged with itself */
+static void reference_422(const uint8_t *input, uint32_t in_linesize,
+		uint32_t width, uint32_t height, struct planes *out,
+		bool nv12, bool leading_lum)
+{
+	const uint32_t lum_ofs    = leading_lum ? 0 : 1;
+	const uint32_t chroma_ofs = leading_lum ? 1 : 0;
+
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t *row = input + y * in_linesize;
+		for (uint32_t x = 0; x < width; x++)
+			out->data[0][y * out->linesize[0] + x] =
+				row[x * 2 + lum_ofs];
+	}
+
+	for (uint32_t y = 0; y < height; y += 2) {
+		const uint8_t *row0 = input + y * in_linesize;
+		const uint8_t *row1 = y + 1 < height ?
+			row0 + in_linesize : row0;
+
+		for (uint32_t x = 0; x < width; x += 2) {
+			const uint8_t *p0 = row0 + x * 2 + chroma_ofs;
+			const uint8_t *p1 = row1 + x * 2 + chroma_ofs;
+			uint8_t u = (uint8_t)((p0[0] + p1[0] + 1) >> 1);
+			uint8_t v = (uint8_t)((p0[2] + p1[2] + 1) >> 1);
+			uint32_t cy = y / 2;
+			uint32_t cx = x / 2;
+
+			if (nv12) {
+				uint8_t *uv = out->data[1] +
+					cy * out->linesize[1] + cx * 2;
+				uv[0] = u;
+				uv[1] = v;
+			} else {
+				out->data[1][cy * out->linesize[1] + cx] = u;
+				out->data[2][cy * out->linesize[2] + cx] = v;
+			}
+		}
+	}
+}
+
+static void planes_init(struct planes *p, uint32_t width, uint32_t height,
+		uint32_t pad, bool nv12)
+{
+	uint32_t chroma_cx = (width + 1) / 2;
+	uint32_t chroma_cy = (height + 1) / 2;
+
+	memset(p, 0, sizeof(*p));
+	p->count = nv12 ? 2 : 3;
+
+	p->linesize[0] = width + pad;
+	p->size[0] = (size_t)p->linesize[0] * height;
+
+	for (int i = 1; i < p->count; i++) {
+		p->linesize[i] = (nv12 ? chroma_cx * 2 : chroma_cx) + pad;
+		p->size[i] = (size_t)p->linesize[i] * chroma_cy;
+	}
+
+	for (int i = 0; i < p->count; i++) {
+		p->data[i] = bmalloc(p->size[i] + GUARD_SIZE);
+		memset(p->data[i], GUARD_BYTE, p->size[i] + GUARD_SIZE);
+	}
+}
+
+static void planes_free(struct planes *p)
+{
+	for (int i = 0; i < p->count; i++)
+		bfree(p->data[i]);
+}
+
+static bool guard_intact(const struct planes *p, int plane)
+{
+	const uint8_t *guard = p->data[plane] + p->size[plane];
+	for (size_t i = 0; i < GUARD_SIZE; i++) {
+		if (guard[i] != GUARD_BYTE)
+			return false;
+	}
+	return true;
+}
+
+/* padding bytes between lines are left alone by both sides, so the planes
+ * can be compared whole */
+static bool planes_equal(const struct planes *a, const struct planes *b,
+		int *bad_plane)
+{
+	for (int i = 0; i < a->count; i++) {
+		if (memcmp(a->data[i], b->data[i], a->size[i]) != 0 ||
+		    !guard_intact(a, i)) {
+			*bad_plane = i;
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint8_t *random_input(uint32_t width, uint32_t height,
+		uint32_t in_linesize)
+{
+	size_t size = (size_t)in_linesize * height;
+	uint8_t *input = bmalloc(size);
+
+	for (size_t i = 0; i < size; i++)
+		input[i] = (uint8_t)rand();
+	return input;
+}
+
+static void convert(const uint8_t *input, uint32_t in_linesize,
+		uint32_t width, uint32_t height, struct planes *out,
+		bool nv12, bool leading_lum)
+{
+	if (nv12)
+		compress_422_to_nv12(input, in_linesize, width, 0, height,
+				out->data, out->linesize, leading_lum);
+	else
+		compress_422_to_i420(input, in_linesize, width, 0, height,
+				out->data, out->linesize, leading_lum);
+}
+
+static bool check_size(uint32_t width, uint32_t height, uint32_t pad)
+{
+	uint32_t in_linesize = width * 2 + pad * 2;
+	uint8_t *input = random_input(width, height, in_linesize);
+	bool success = true;
+
+	for (int mode = 0; mode < 4; mode++) {
+		bool nv12 = (mode & 1) != 0;
+		bool leading_lum = (mode & 2) != 0;
+		struct planes expected, actual;
+		int bad_plane = 0;
+
+		planes_init(&expected, width, height, pad, nv12);
+		planes_init(&actual, width, height, pad, nv12);
+
+		reference_422(input, in_linesize, width, height, &expected,
+				nv12, leading_lum);
+		convert(input, in_linesize, width, height, &actual, nv12,
+				leading_lum);
+
+		if (!planes_equal(&actual, &expected, &bad_plane)) {
+			printf("FAIL %s %s %ux%u pad %u: plane %d differs\n",
+					leading_lum ? "YUY2" : "UYVY",
+					nv12 ? "NV12" : "I420",
+					width, height, pad, bad_plane);
+			success = false;
+		}
+
+		planes_free(&expected);
+		planes_free(&actual);
+	}
+
+	bfree(input);
+	return success;
+}
+
+static void bench(bool nv12)
+{
+	uint32_t in_linesize = BENCH_CX * 2;
+	uint8_t *input = random_input(BENCH_CX, BENCH_CY, in_linesize);
+	struct planes out;
+	uint64_t start, simd_ns, ref_ns;
+
+	planes_init(&out, BENCH_CX, BENCH_CY, 0, nv12);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < BENCH_ITERS; i++)
+		convert(input, in_linesize, BENCH_CX, BENCH_CY, &out, nv12,
+				false);
+	simd_ns = os_gettime_ns() - start;
+
+	start = os_gettime_ns();
+	for (int i = 0; i < BENCH_ITERS; i++)
+		reference_422(input, in_linesize, BENCH_CX, BENCH_CY, &out,
+				nv12, false);
+	ref_ns = os_gettime_ns() - start;
+
+	printf("UYVY to %s %dx%d: %.3f ms/frame, scalar %.3f ms/frame "
+			"(%.1fx)\n",
+			nv12 ? "NV12" : "I420", BENCH_CX, BENCH_CY,
+			(double)simd_ns / BENCH_ITERS / 1000000.0,
+			(double)ref_ns / BENCH_ITERS / 1000000.0,
+			(double)ref_ns / (double)simd_ns);
+
+	planes_free(&out);
+	bfree(input);
+}
+
+int main(void)
+{
+	static const uint32_t widths[] = {
+		1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 641,
+		1279, 1280, 1281
+	};
+	static const uint32_t heights[] = {1, 2, 3, 4, 5, 17, 36};
+	static const uint32_t pads[] = {0, 1, 16, 33};
+	int failures = 0;
+
+	srand(1);
+
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+		for (size_t h = 0; h < sizeof(heights) / sizeof(heights[0]); h++)
+			for (size_t p = 0; p < sizeof(pads) / sizeof(pads[0]); p++)
+				if (!check_size(widths[w], heights[h], pads[p]))
+					failures++;
+
+	printf("%s: %d size/stride combination(s) failed\n",
+			failures ? "FAILED" : "passed", failures);
+
+	bench(true);
+	bench(false);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * Benchmark for the output packet interleaver.
+ *
+ * Feeds one output the packets of a 60 fps video encoder with B-frames and
+ * six audio encoders, in the order they would arrive: every audio packet
+ * shortly after its timestamp and every video packet after the encoder's
+ * lookahead latency.  The higher the latency, the more audio waits in the
+ * interleaver for video to catch up.
+ *
+ * Every packet goes through the interleaver twice: the per-track FIFOs and
+ * min-heap of obs-interleaver.h with a reference to the shared payload, and
+ * the sorted array obs_output used before with a deep copy of the payload.
+ * Packets are sent one per received packet once the opposing type has a
+ * higher timestamp, as send_interleaved does.
+ *
+ * Reports the cost per packet of both, and returns non-zero if their send
+ * orders differ.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <obs-interleaver.h>
+
+#define SIM_SECONDS   120
+#define VIDEO_FPS     60
+#define VIDEO_KBPS    6000
+#define B_FRAMES      2
+#define KEYINT_FRAMES 120
+#define AUDIO_TRACKS  6
+#define AUDIO_KBPS    160
+#define AUDIO_FRAMES  1024
+#define AUDIO_RATE    48000
+#define AUDIO_LATENCY 21333
+
+#define VIDEO_AVG_SIZE (VIDEO_KBPS * 1000 / 8 / VIDEO_FPS)
+#define MAX_PACKET_SIZE (VIDEO_AVG_SIZE * 10)
+
+struct sim_packet {
+	struct encoder_packet packet;
+	int64_t               arrival;
+};
+
+struct send_state {
+	int64_t  highest_video_ts;
+	int64_t  highest_audio_ts;
+	uint64_t order_hash;
+	uint64_t sent;
+};
+
+static uint32_t rand_state = 1;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+/* ------------------------------------------------------------------------- */
+/* packets in arrival order */
+
+static size_t video_packet_size(int64_t frame)
+{
+	if (frame % KEYINT_FRAMES == 0)
+		return VIDEO_AVG_SIZE * 10;
+	return VIDEO_AVG_SIZE / 4 + next_rand() % (VIDEO_AVG_SIZE * 7 / 4);
+}
+
+static void generate(struct darray *array, int64_t video_latency,
+		uint8_t *payload)
+{
+	const int64_t frame_usec = 1000000 / VIDEO_FPS;
+	const int64_t audio_usec = 1000000LL * AUDIO_FRAMES / AUDIO_RATE;
+	const int64_t end_usec = SIM_SECONDS * 1000000LL;
+	int64_t audio_dts[AUDIO_TRACKS] = {0};
+	int64_t audio_pos[AUDIO_TRACKS] = {0};
+	int64_t frame = 0;
+	DARRAY(struct sim_packet) packets;
+
+	packets.da = *array;
+	rand_state = 1;
+
+	for (;;) {
+		int64_t video_dts = frame * frame_usec;
+		int64_t video_arrival = video_dts + video_latency;
+		int64_t best_arrival = video_dts < end_usec ?
+			video_arrival : INT64_MAX;
+		int best = -1;
+		struct sim_packet sp = {0};
+
+		for (int t = 0; t < AUDIO_TRACKS; t++) {
+			int64_t arrival = audio_dts[t] + AUDIO_LATENCY;
+			if (audio_dts[t] < end_usec && arrival < best_arrival) {
+				best_arrival = arrival;
+				best = t;
+			}
+		}
+
+		if (best_arrival == INT64_MAX)
+			break;
+
+		sp.arrival = best_arrival;
+		sp.packet.data = payload;
+
+		if (best < 0) {
+			int64_t gop_pos = frame % (B_FRAMES + 1);
+
+			sp.packet.type         = OBS_ENCODER_VIDEO;
+			sp.packet.timebase_num = 1;
+			sp.packet.timebase_den = VIDEO_FPS;
+			sp.packet.size         = video_packet_size(frame);
+			sp.packet.keyframe     = frame % KEYINT_FRAMES == 0;
+			sp.packet.dts          = frame - B_FRAMES;
+			sp.packet.pts          = gop_pos == 0 ?
+				frame + B_FRAMES : frame - 1;
+			sp.packet.dts_usec     = video_dts;
+			frame++;
+		} else {
+			sp.packet.type         = OBS_ENCODER_AUDIO;
+			sp.packet.track_idx    = best;
+			sp.packet.timebase_num = 1;
+			sp.packet.timebase_den = AUDIO_RATE;
+			sp.packet.size         = AUDIO_KBPS * 1000 / 8 *
+				AUDIO_FRAMES / AUDIO_RATE;
+			sp.packet.dts          = audio_pos[best];
+			sp.packet.pts          = audio_pos[best];
+			sp.packet.dts_usec     = audio_dts[best];
+			audio_dts[best] += audio_usec;
+			audio_pos[best] += AUDIO_FRAMES;
+		}
+
+		da_push_back(packets, &sp);
+	}
+
+	*array = packets.da;
+}
+
+/* ------------------------------------------------------------------------- */
+/* sending, shared by both interleavers */
+
+static inline void set_higher_ts(struct send_state *state,
+		const struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (state->highest_video_ts < packet->dts_usec)
+			state->highest_video_ts = packet->dts_usec;
+	} else {
+		if (state->highest_audio_ts < packet->dts_usec)
+			state->highest_audio_ts = packet->dts_usec;
+	}
+}
+
+static inline bool has_higher_opposing_ts(const struct send_state *state,
+		const struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO)
+		return state->highest_audio_ts > packet->dts_usec;
+	else
+		return state->highest_video_ts > packet->dts_usec;
+}
+
+static inline void record_sent(struct send_state *state,
+		const struct encoder_packet *packet)
+{
+	uint64_t key = (uint64_t)packet->dts_usec * 8 +
+		interleave_track(packet);
+
+	state->order_hash = (state->order_hash ^ key) * 1099511628211ULL;
+	state->sent++;
+}
+
+/* ------------------------------------------------------------------------- */
+/* the sorted array and deep copy obs_output used before */
+
+static void create_heap_instance(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	long *p_refs = bmalloc(src->size + sizeof(long));
+
+	*dst = *src;
+	*p_refs = 1;
+	dst->data = (void*)(p_refs + 1);
+	memcpy(dst->data, src->data, src->size);
+}
+
+static void free_heap_instance(struct encoder_packet *packet)
+{
+	bfree(((long*)packet->data) - 1);
+}
+
+static void insert_interleaved_packet(struct darray *array,
+		struct encoder_packet *out)
+{
+	DARRAY(struct encoder_packet) packets;
+	size_t idx;
+
+	packets.da = *array;
+
+	for (idx = 0; idx < packets.num; idx++) {
+		struct encoder_packet *cur_packet = packets.array + idx;
+
+		if (out->dts_usec == cur_packet->dts_usec &&
+		    out->type == OBS_ENCODER_VIDEO) {
+			break;
+		} else if (out->dts_usec < cur_packet->dts_usec) {
+			break;
+		}
+	}
+
+	da_insert(packets, idx, out);
+	*array = packets.da;
+}
+
+static void send_sorted(struct darray *array, struct send_state *state,
+		bool flush)
+{
+	DARRAY(struct encoder_packet) packets;
+	packets.da = *array;
+
+	while (packets.num) {
+		struct encoder_packet out = packets.array[0];
+
+		if (!flush && !has_higher_opposing_ts(state, &out))
+			break;
+
+		da_erase(packets, 0);
+		record_sent(state, &out);
+		free_heap_instance(&out);
+
+		if (!flush)
+			break;
+	}
+
+	*array = packets.da;
+}
+
+static uint64_t run_sorted(const struct sim_packet *input, size_t num,
+		struct send_state *state)
+{
+	DARRAY(struct encoder_packet) packets = {0};
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet out;
+
+		create_heap_instance(&out, &input[i].packet);
+		insert_interleaved_packet(&packets.da, &out);
+		set_higher_ts(state, &out);
+		send_sorted(&packets.da, state, false);
+	}
+
+	send_sorted(&packets.da, state, true);
+	da_free(packets);
+
+	return os_gettime_ns() - start;
+}
+
+/* ------------------------------------------------------------------------- */
+/* the per-track FIFOs and heap with shared payloads */
+
+static void send_heap(struct packet_interleaver *il, struct send_state *state,
+		bool flush)
+{
+	struct interleaved_packet *next;
+
+	while ((next = interleaver_peek(il)) != NULL) {
+		struct encoder_packet out;
+
+		if (!flush && !has_higher_opposing_ts(state, &next->packet))
+			break;
+
+		interleaver_pop(il, &out);
+		record_sent(state, &out);
+		obs_encoder_packet_release(&out);
+
+		if (!flush)
+			break;
+	}
+}
+
+static uint64_t run_heap(const struct sim_packet *input, size_t num,
+		struct send_state *state)
+{
+	struct packet_interleaver il = {0};
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet out;
+
+		obs_encoder_packet_ref(&out,
+				(struct encoder_packet*)&input[i].packet);
+		interleaver_push(&il, &out);
+		set_higher_ts(state, &out);
+		send_heap(&il, state, false);
+	}
+
+	send_heap(&il, state, true);
+	interleaver_free(&il);
+
+	return os_gettime_ns() - start;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool run(int64_t video_latency, uint8_t *payload)
+{
+	DARRAY(struct sim_packet) input = {0};
+	struct send_state sorted = {0};
+	struct send_state heap = {0};
+	uint64_t sorted_ns, heap_ns;
+
+	generate(&input.da, video_latency, payload);
+
+	sorted_ns = run_sorted(input.array, input.num, &sorted);
+	heap_ns = run_heap(input.array, input.num, &heap);
+
+	printf("video latency %4d ms, %zu packets: sorted array + copy "
+			"%6.0f ns/packet, heap + reference %6.0f ns/packet\n",
+			(int)(video_latency / 1000), input.num,
+			(double)sorted_ns / (double)input.num,
+			(double)heap_ns / (double)input.num);
+
+	da_free(input);
+
+	if (sorted.sent != heap.sent || sorted.order_hash != heap.order_hash) {
+		printf("FAIL: send orders differ\n");
+		return false;
+	}
+	return true;
+}
+
+int main(void)
+{
+	static const int64_t latencies[] = {0, 250000, 1000000};
+	long *p_refs = bzalloc(MAX_PACKET_SIZE + sizeof(long));
+	bool success = true;
+
+	/* the encoder's own reference keeps the shared payload alive */
+	*p_refs = 1;
+
+	printf("%d s of %d fps video with %d B-frames, %d audio tracks\n",
+			SIM_SECONDS, VIDEO_FPS, B_FRAMES, AUDIO_TRACKS);
+
+	for (size_t i = 0; i < sizeof(latencies) / sizeof(latencies[0]); i++)
+		success = run(latencies[i], (uint8_t*)(p_refs + 1)) && success;
+
+	bfree(p_refs);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+/*
+ * Throughput benchmark for the pipe between the ffmpeg-mux output and the
+ * ffmpeg-mux child process.
+ *
+ * Writes a simulated 4K60 recording (80 Mbps video and two 192 kbps audio
+ * tracks) to a copy of this program started through os_process_pipe, once
+ * with the per-packet framing and once with the batched framing for a few
+ * batch sizes.  The child reads it back the way ffmpeg-mux does and throws
+ * the data away, so only the transport is measured.
+ *
+ * For every mode it reports the pipe calls, the write/read system calls
+ * (Linux only, from /proc/self/io) and the bytes crossing the pipe per
+ * recorded second, plus the wall time per recorded second.  It also times a
+ * plain memcpy of one recorded second, which is the copy a shared-memory
+ * ring would save compared to the pipe.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/pipe.h>
+#include <util/platform.h>
+#include <ffmpeg-mux.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#define SIM_SECONDS   60
+#define VIDEO_FPS     60
+#define VIDEO_KBPS    80000
+#define KEYINT_FRAMES 120
+#define AUDIO_TRACKS  2
+#define AUDIO_KBPS    192
+#define AUDIO_FRAMES  1024
+#define AUDIO_RATE    48000
+
+#define VIDEO_AVG_SIZE (VIDEO_KBPS * 1000 / 8 / VIDEO_FPS)
+#define MAX_PACKET_SIZE (VIDEO_AVG_SIZE * 10)
+
+struct io_counts {
+	bool     valid;
+	uint64_t syscr;
+	uint64_t syscw;
+};
+
+static void get_io_counts(struct io_counts *counts)
+{
+	memset(counts, 0, sizeof(*counts));
+
+#ifdef __linux__
+	FILE *f = fopen("/proc/self/io", "r");
+	char line[128];
+
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long val;
+		if (sscanf(line, "syscr: %llu", &val) == 1)
+			counts->syscr = val;
+		else if (sscanf(line, "syscw: %llu", &val) == 1)
+			counts->syscw = val;
+	}
+
+	fclose(f);
+	counts->valid = true;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/* child side, reads like ffmpeg-mux's safe_read loops */
+
+static uint64_t reader_calls = 0;
+
+static size_t safe_read(void *vdata, size_t size)
+{
+	uint8_t *data = vdata;
+	size_t  total = size;
+
+	while (size > 0) {
+		size_t in_size = fread(data, 1, size, stdin);
+		reader_calls++;
+		if (in_size == 0)
+			return 0;
+
+		size -= in_size;
+		data += in_size;
+	}
+
+	return total;
+}
+
+/* grows like ffmpeg-mux's resize_buf */
+static uint8_t *reader_buf(uint8_t *buf, size_t *capacity, size_t size)
+{
+	if (size > *capacity) {
+		*capacity = size;
+		buf = brealloc(buf, size);
+	}
+	return buf;
+}
+
+static int reader(bool batched)
+{
+	struct io_counts start, end;
+	uint8_t *buf = NULL;
+	size_t capacity = 0;
+	uint64_t bytes = 0;
+
+#ifdef _WIN32
+	_setmode(_fileno(stdin), O_BINARY);
+#endif
+	get_io_counts(&start);
+
+	if (batched) {
+		struct ffm_batch_info batch;
+
+		while (safe_read(&batch, sizeof(batch)) == sizeof(batch)) {
+			size_t size = batch.num_packets *
+				sizeof(struct ffm_packet_info) + batch.size;
+
+			buf = reader_buf(buf, &capacity, size);
+			if (safe_read(buf, size) != size)
+				break;
+			bytes += sizeof(batch) + size;
+		}
+	} else {
+		struct ffm_packet_info info;
+
+		while (safe_read(&info, sizeof(info)) == sizeof(info)) {
+			buf = reader_buf(buf, &capacity, info.size);
+			if (safe_read(buf, info.size) != info.size)
+				break;
+			bytes += sizeof(info) + info.size;
+		}
+	}
+
+	get_io_counts(&end);
+
+	if (end.valid)
+		fprintf(stderr, "    reader: %8.0f fread/s, %8.0f read "
+				"syscalls/s, %.2f MB/s\n",
+				(double)reader_calls / SIM_SECONDS,
+				(double)(end.syscr - start.syscr) /
+					SIM_SECONDS,
+				(double)bytes / SIM_SECONDS / 1048576.0);
+	else
+		fprintf(stderr, "    reader: %8.0f fread/s, %.2f MB/s\n",
+				(double)reader_calls / SIM_SECONDS,
+				(double)bytes / SIM_SECONDS / 1048576.0);
+
+	bfree(buf);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* output side, frames packets like obs-ffmpeg-mux's write_packet(s) */
+
+struct writer {
+	os_process_pipe_t      *pipe;
+	size_t                 batch_size;
+	uint8_t                *payload;
+
+	struct ffm_packet_info info[FFM_BATCH_MAX_PACKETS];
+	size_t                 num;
+
+	uint64_t               calls;
+	uint64_t               bytes;
+};
+
+static bool flush_batch(struct writer *w)
+{
+	struct os_pipe_buf bufs[FFM_BATCH_MAX_PACKETS + 2];
+	struct ffm_batch_info batch = {(uint32_t)w->num, 0};
+	size_t total;
+
+	if (!w->num)
+		return true;
+
+	for (size_t i = 0; i < w->num; i++) {
+		bufs[i + 2].data = w->payload;
+		bufs[i + 2].len = w->info[i].size;
+		batch.size += w->info[i].size;
+	}
+
+	bufs[0].data = (const uint8_t*)&batch;
+	bufs[0].len = sizeof(batch);
+	bufs[1].data = (const uint8_t*)w->info;
+	bufs[1].len = w->num * sizeof(w->info[0]);
+	total = bufs[0].len + bufs[1].len + batch.size;
+
+	w->calls++;
+	w->bytes += total;
+	w->num = 0;
+	return os_process_pipe_writev(w->pipe, bufs,
+			batch.num_packets + 2) == total;
+}
+
+static bool write_packet(struct writer *w, const struct ffm_packet_info *info)
+{
+	if (w->batch_size) {
+		w->info[w->num++] = *info;
+		return w->num < w->batch_size || flush_batch(w);
+	}
+
+	w->calls += 2;
+	w->bytes += sizeof(*info) + info->size;
+
+	return os_process_pipe_write(w->pipe, (const uint8_t*)info,
+			sizeof(*info)) == sizeof(*info) &&
+	       os_process_pipe_write(w->pipe, w->payload, info->size) ==
+			info->size;
+}
+
+static uint32_t rand_state = 1;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+static uint32_t video_packet_size(uint64_t frame)
+{
+	if (frame % KEYINT_FRAMES == 0)
+		return VIDEO_AVG_SIZE * 10;
+	return VIDEO_AVG_SIZE / 4 + next_rand() % (VIDEO_AVG_SIZE * 7 / 4);
+}
+
+static bool run(const char *self, size_t batch_size, uint8_t *payload)
+{
+	const int64_t frame_usec = 1000000 / VIDEO_FPS;
+	const int64_t audio_usec = 1000000LL * AUDIO_FRAMES / AUDIO_RATE;
+	const uint32_t audio_size = AUDIO_KBPS * 1000 / 8 *
+		AUDIO_FRAMES / AUDIO_RATE;
+	int64_t next_audio_usec[AUDIO_TRACKS] = {0};
+	struct writer w = {0};
+	struct io_counts start, end;
+	struct dstr cmd = {0};
+	uint64_t start_ns, elapsed_ns;
+	bool success = true;
+
+	dstr_printf(&cmd, "\"%s\" --reader %s", self,
+			batch_size ? FFM_BATCH_ARG : "packet");
+
+	w.pipe = os_process_pipe_create(cmd.array, "w");
+	dstr_free(&cmd);
+	if (!w.pipe) {
+		printf("failed to start the reader process\n");
+		return false;
+	}
+
+	w.batch_size = batch_size;
+	w.payload = payload;
+	rand_state = 1;
+
+	get_io_counts(&start);
+	start_ns = os_gettime_ns();
+
+	for (uint64_t frame = 0; success && frame < SIM_SECONDS * VIDEO_FPS;
+			frame++) {
+		struct ffm_packet_info info = {0};
+		int64_t dts_usec = (int64_t)frame * frame_usec;
+
+		for (uint32_t track = 0; track < AUDIO_TRACKS; track++) {
+			while (success && next_audio_usec[track] <= dts_usec) {
+				info.type  = FFM_PACKET_AUDIO;
+				info.index = track;
+				info.size  = audio_size;
+				info.dts   = next_audio_usec[track];
+				info.pts   = info.dts;
+
+				success = write_packet(&w, &info);
+				next_audio_usec[track] += audio_usec;
+			}
+		}
+
+		info.type     = FFM_PACKET_VIDEO;
+		info.index    = 0;
+		info.size     = video_packet_size(frame);
+		info.keyframe = frame % KEYINT_FRAMES == 0;
+		info.dts      = dts_usec;
+		info.pts      = dts_usec;
+
+		if (success)
+			success = write_packet(&w, &info);
+	}
+
+	if (success)
+		success = flush_batch(&w);
+
+	get_io_counts(&end);
+
+	if (batch_size)
+		printf("batched, up to %2d packets:\n", (int)batch_size);
+	else
+		printf("per packet:\n");
+
+	if (end.valid)
+		printf("    writer: %8.0f calls/s, %8.0f write syscalls/s, "
+				"%.2f MB/s\n",
+				(double)w.calls / SIM_SECONDS,
+				(double)(end.syscw - start.syscw) /
+					SIM_SECONDS,
+				(double)w.bytes / SIM_SECONDS / 1048576.0);
+	else
+		printf("    writer: %8.0f calls/s, %.2f MB/s\n",
+				(double)w.calls / SIM_SECONDS,
+				(double)w.bytes / SIM_SECONDS / 1048576.0);
+	fflush(stdout);
+
+	/* waits for the reader to drain the pipe and report */
+	os_process_pipe_destroy(w.pipe);
+	elapsed_ns = os_gettime_ns() - start_ns;
+
+	printf("    %.3f ms per recorded second%s\n",
+			(double)elapsed_ns / SIM_SECONDS / 1000000.0,
+			success ? "" : " (write failed)");
+	return success;
+}
+
+static void time_copy(uint8_t *payload)
+{
+	const size_t per_second = (size_t)(VIDEO_KBPS + AUDIO_TRACKS *
+			AUDIO_KBPS) * 1000 / 8;
+	uint8_t *dst = bmalloc(MAX_PACKET_SIZE);
+	uint64_t start = os_gettime_ns();
+
+	for (int s = 0; s < SIM_SECONDS; s++) {
+		for (size_t done = 0; done < per_second;
+				done += MAX_PACKET_SIZE) {
+			size_t size = per_second - done;
+			if (size > MAX_PACKET_SIZE)
+				size = MAX_PACKET_SIZE;
+			memcpy(dst, payload, size);
+		}
+	}
+
+	printf("memcpy of one recorded second (%.2f MB): %.3f ms\n",
+			(double)per_second / 1048576.0,
+			(double)(os_gettime_ns() - start) / SIM_SECONDS /
+				1000000.0);
+	bfree(dst);
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t batch_sizes[] = {0, 4, 16, FFM_BATCH_MAX_PACKETS};
+	uint8_t *payload;
+	bool success = true;
+
+	if (argc >= 3 && strcmp(argv[1], "--reader") == 0)
+		return reader(strcmp(argv[2], FFM_BATCH_ARG) == 0);
+
+	payload = bzalloc(MAX_PACKET_SIZE);
+
+	printf("%d s of 4K60 recording, %d kbps video, %d x %d kbps audio\n",
+			SIM_SECONDS, VIDEO_KBPS, AUDIO_TRACKS, AUDIO_KBPS);
+
+	for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]);
+			i++)
+		success = run(argv[0], batch_sizes[i], payload) && success;
+
+	time_copy(payload);
+
+	bfree(payload);
+	return success ? 0 : 1;
+}
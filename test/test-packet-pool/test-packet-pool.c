@@ -0,0 +1,259 @@
+/*
+ * Stress benchmark for the encoder packet pool.
+ *
+ * Simulates one 60 fps video encoder and six audio tracks feeding three
+ * outputs: a stream that keeps half a second of packets queued, a recording
+ * that frees them almost immediately, and a replay buffer that keeps the
+ * last 20 seconds.  Every output gets its own instance of every packet, as
+ * obs_output does, and releases it on its own thread.
+ *
+ * The simulated time runs as fast as the machine allows, once with the
+ * pooled instances and once with a plain bmalloc + memcpy per instance like
+ * before the pool, and reports the cost per packet and the pool statistics.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <obs.h>
+
+#define SIM_SECONDS     300
+#define VIDEO_FPS       60
+#define VIDEO_KBPS      6000
+#define KEYINT_FRAMES   120
+#define AUDIO_TRACKS    6
+#define AUDIO_KBPS      160
+#define AUDIO_FRAMES    1024
+#define AUDIO_RATE      48000
+#define MAX_QUEUED      1024
+
+struct sim_output {
+	const char      *name;
+	int64_t         hold_usec;
+	bool            pooled;
+
+	pthread_t       thread;
+	pthread_mutex_t mutex;
+	os_sem_t        *sem;
+	struct circlebuf queue;
+	volatile bool   done;
+};
+
+static uint32_t rand_state = 1;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+/* the instance libobs made for each output before the pool */
+static void create_heap_instance(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	long *p_refs = bmalloc(src->size + sizeof(long));
+
+	*dst = *src;
+	*p_refs = 1;
+	dst->data = (void*)(p_refs + 1);
+	memcpy(dst->data, src->data, src->size);
+}
+
+static void *output_thread(void *data)
+{
+	struct sim_output *out = data;
+	struct circlebuf held = {0};
+
+	for (;;) {
+		struct encoder_packet pkt;
+		bool have_pkt = false;
+
+		os_sem_wait(out->sem);
+
+		pthread_mutex_lock(&out->mutex);
+		if (out->queue.size) {
+			circlebuf_pop_front(&out->queue, &pkt, sizeof(pkt));
+			have_pkt = true;
+		}
+		pthread_mutex_unlock(&out->mutex);
+
+		if (!have_pkt) {
+			if (os_atomic_load_bool(&out->done))
+				break;
+			continue;
+		}
+
+		circlebuf_push_back(&held, &pkt, sizeof(pkt));
+
+		/* let go of everything older than the output keeps */
+		while (held.size) {
+			struct encoder_packet old;
+			circlebuf_peek_front(&held, &old, sizeof(old));
+			if (pkt.dts_usec - old.dts_usec <= out->hold_usec)
+				break;
+
+			circlebuf_pop_front(&held, NULL, sizeof(old));
+			obs_encoder_packet_release(&old);
+		}
+	}
+
+	while (held.size) {
+		struct encoder_packet old;
+		circlebuf_pop_front(&held, &old, sizeof(old));
+		obs_encoder_packet_release(&old);
+	}
+
+	circlebuf_free(&held);
+	return NULL;
+}
+
+static void send_packet(struct sim_output *outputs, size_t num_outputs,
+		const struct encoder_packet *src)
+{
+	for (size_t i = 0; i < num_outputs; i++) {
+		struct sim_output *out = &outputs[i];
+		struct encoder_packet pkt;
+
+		/* obs_duplicate_encoder_packet is the exported wrapper of
+		 * obs_encoder_packet_create_instance */
+		if (out->pooled)
+			obs_duplicate_encoder_packet(&pkt, src);
+		else
+			create_heap_instance(&pkt, src);
+
+		for (;;) {
+			size_t queued;
+
+			pthread_mutex_lock(&out->mutex);
+			queued = out->queue.size / sizeof(pkt);
+			if (queued < MAX_QUEUED)
+				circlebuf_push_back(&out->queue, &pkt,
+						sizeof(pkt));
+			pthread_mutex_unlock(&out->mutex);
+
+			if (queued < MAX_QUEUED)
+				break;
+			os_sleep_ms(1);
+		}
+
+		os_sem_post(out->sem);
+	}
+}
+
+static size_t video_packet_size(uint64_t frame)
+{
+	size_t avg = VIDEO_KBPS * 1000 / 8 / VIDEO_FPS;
+
+	/* keyframes about ten times an average frame, the rest spread
+	 * between a quarter and twice the average */
+	if (frame % KEYINT_FRAMES == 0)
+		return avg * 10;
+	return avg / 4 + next_rand() % (avg * 7 / 4);
+}
+
+static uint64_t run(bool pooled, uint64_t *num_packets)
+{
+	struct sim_output outputs[] = {
+		{"stream",          500000,   pooled},
+		{"recording",       50000,    pooled},
+		{"replay buffer",   20000000, pooled},
+	};
+	const size_t num_outputs = sizeof(outputs) / sizeof(outputs[0]);
+	const int64_t frame_usec = 1000000 / VIDEO_FPS;
+	const int64_t audio_usec = 1000000LL * AUDIO_FRAMES / AUDIO_RATE;
+	const size_t audio_size = AUDIO_KBPS * 1000 / 8 *
+		AUDIO_FRAMES / AUDIO_RATE;
+	uint8_t *payload = bzalloc(VIDEO_KBPS * 1000 / 8 / VIDEO_FPS * 10);
+	int64_t next_audio_usec[AUDIO_TRACKS] = {0};
+	uint64_t start, count = 0;
+
+	for (size_t i = 0; i < num_outputs; i++) {
+		pthread_mutex_init(&outputs[i].mutex, NULL);
+		os_sem_init(&outputs[i].sem, 0);
+		pthread_create(&outputs[i].thread, NULL, output_thread,
+				&outputs[i]);
+	}
+
+	rand_state = 1;
+	start = os_gettime_ns();
+
+	for (uint64_t frame = 0; frame < SIM_SECONDS * VIDEO_FPS; frame++) {
+		struct encoder_packet pkt = {0};
+		int64_t dts_usec = (int64_t)frame * frame_usec;
+
+		for (size_t track = 0; track < AUDIO_TRACKS; track++) {
+			while (next_audio_usec[track] <= dts_usec) {
+				memset(&pkt, 0, sizeof(pkt));
+				pkt.type      = OBS_ENCODER_AUDIO;
+				pkt.data      = payload;
+				pkt.size      = audio_size;
+				pkt.track_idx = track;
+				pkt.dts_usec  = next_audio_usec[track];
+
+				send_packet(outputs, num_outputs, &pkt);
+				next_audio_usec[track] += audio_usec;
+				count++;
+			}
+		}
+
+		memset(&pkt, 0, sizeof(pkt));
+		pkt.type     = OBS_ENCODER_VIDEO;
+		pkt.data     = payload;
+		pkt.size     = video_packet_size(frame);
+		pkt.keyframe = frame % KEYINT_FRAMES == 0;
+		pkt.dts_usec = dts_usec;
+
+		send_packet(outputs, num_outputs, &pkt);
+		count++;
+	}
+
+	for (size_t i = 0; i < num_outputs; i++) {
+		os_atomic_set_bool(&outputs[i].done, true);
+		os_sem_post(outputs[i].sem);
+		pthread_join(outputs[i].thread, NULL);
+
+		circlebuf_free(&outputs[i].queue);
+		os_sem_destroy(outputs[i].sem);
+		pthread_mutex_destroy(&outputs[i].mutex);
+	}
+
+	bfree(payload);
+
+	*num_packets = count * num_outputs;
+	return os_gettime_ns() - start;
+}
+
+int main(void)
+{
+	struct obs_encoder_packet_pool_stats stats;
+	uint64_t heap_ns, pool_ns, num_packets;
+
+	heap_ns = run(false, &num_packets);
+	printf("bmalloc: %llu packet instances in %.1f ms, %.0f ns each\n",
+			(unsigned long long)num_packets,
+			(double)heap_ns / 1000000.0,
+			(double)heap_ns / (double)num_packets);
+
+	pool_ns = run(true, &num_packets);
+	printf("pool:    %llu packet instances in %.1f ms, %.0f ns each\n",
+			(unsigned long long)num_packets,
+			(double)pool_ns / 1000000.0,
+			(double)pool_ns / (double)num_packets);
+
+	obs_encoder_packet_pool_get_stats(&stats);
+	printf("pool:    %llu hits, %llu misses (%.2f%% hit rate), "
+			"%llu bytes resident\n",
+			(unsigned long long)stats.hits,
+			(unsigned long long)stats.misses,
+			100.0 * (double)stats.hits /
+				(double)(stats.hits + stats.misses),
+			(unsigned long long)stats.resident_bytes);
+
+	printf("%llu simulated seconds, %d audio tracks, 3 outputs\n",
+			(unsigned long long)SIM_SECONDS, AUDIO_TRACKS);
+	return 0;
+}
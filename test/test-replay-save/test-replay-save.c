@@ -0,0 +1,225 @@
+/*
+ * Benchmark for ordering the packets of a replay buffer save.
+ *
+ * Fills a buffer the way the replay buffer receives packets from
+ * obs_output: 60 fps video with B-frames and six 48 kHz audio tracks,
+ * interleaved by dts, every audio track starting a few milliseconds before
+ * the first video keyframe.  A second set of buffers has the last track
+ * start a minute late, like a track whose encoder started after the others.
+ * Every buffer is ordered for muxing twice: with the sorted insert
+ * replay_buffer_save used to do on the encoder data thread, and with the
+ * per-track merge the mux thread does now.
+ *
+ * Reports the time of both for 1, 5 and 10 minute buffers, and returns
+ * non-zero if the two orders differ.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <obs.h>
+#include <obs-ffmpeg-replay-order.h>
+
+#define VIDEO_FPS     60
+#define AUDIO_TRACKS  6
+#define AUDIO_FRAMES  1024
+#define AUDIO_RATE    48000
+#define B_FRAMES      2
+
+/* the sorted insert of the old replay_buffer_save, without the packet
+ * reference and spill offset */
+static void insert_packet(struct darray *array, struct encoder_packet *packet,
+		int64_t video_offset, int64_t *audio_offsets,
+		int64_t video_dts_offset, int64_t *audio_dts_offsets)
+{
+	struct encoder_packet pkt = *packet;
+	DARRAY(struct encoder_packet) packets;
+	packets.da = *array;
+	size_t idx;
+
+	if (pkt.type == OBS_ENCODER_VIDEO) {
+		pkt.dts_usec -= video_offset;
+		pkt.dts -= video_dts_offset;
+		pkt.pts -= video_dts_offset;
+	} else {
+		pkt.dts_usec -= audio_offsets[pkt.track_idx];
+		pkt.dts -= audio_dts_offsets[pkt.track_idx];
+		pkt.pts -= audio_dts_offsets[pkt.track_idx];
+	}
+
+	for (idx = packets.num; idx > 0; idx--) {
+		struct encoder_packet *p = packets.array + (idx - 1);
+		if (p->dts_usec < pkt.dts_usec)
+			break;
+	}
+
+	da_insert(packets, idx, &pkt);
+	*array = packets.da;
+}
+
+static void sorted_insert_order(const struct encoder_packet *buffer,
+		size_t num, struct darray *out)
+{
+	bool found_video = false;
+	bool found_audio[MAX_AUDIO_MIXES] = {0};
+	int64_t video_offset = 0;
+	int64_t video_dts_offset = 0;
+	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
+	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+	DARRAY(struct encoder_packet) packets;
+
+	packets.da = *out;
+	da_reserve(packets, num);
+	*out = packets.da;
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet pkt = buffer[i];
+
+		if (pkt.type == OBS_ENCODER_VIDEO) {
+			if (!found_video) {
+				video_offset = pkt.dts_usec;
+				video_dts_offset = pkt.dts;
+				found_video = true;
+			}
+		} else {
+			if (!found_audio[pkt.track_idx]) {
+				found_audio[pkt.track_idx] = true;
+				audio_offsets[pkt.track_idx] = pkt.dts_usec;
+				audio_dts_offsets[pkt.track_idx] = pkt.dts;
+			}
+		}
+
+		insert_packet(out, &pkt, video_offset, audio_offsets,
+				video_dts_offset, audio_dts_offsets);
+	}
+}
+
+/* packets are tagged with their buffer index through the data pointer so
+ * that both orders can be compared */
+static void fill_buffer(struct darray *array, int minutes, int64_t late_usec)
+{
+	const int64_t frame_usec = 1000000 / VIDEO_FPS;
+	const int64_t audio_usec = 1000000LL * AUDIO_FRAMES / AUDIO_RATE;
+	const int64_t video_start = 5000000;
+	const int64_t num_frames = (int64_t)minutes * 60 * VIDEO_FPS;
+	int64_t next_audio_usec[AUDIO_TRACKS];
+	int64_t audio_pos[AUDIO_TRACKS] = {0};
+	DARRAY(struct encoder_packet) packets;
+
+	packets.da = *array;
+
+	for (int t = 0; t < AUDIO_TRACKS; t++)
+		next_audio_usec[t] = video_start - 3000 * (t + 1);
+	next_audio_usec[AUDIO_TRACKS - 1] += late_usec;
+
+	for (int64_t frame = 0; frame < num_frames; frame++) {
+		struct encoder_packet pkt = {0};
+		int64_t dts_usec = video_start + frame * frame_usec;
+		int64_t gop_pos = frame % (B_FRAMES + 1);
+
+		for (int t = 0; t < AUDIO_TRACKS; t++) {
+			while (next_audio_usec[t] <= dts_usec) {
+				memset(&pkt, 0, sizeof(pkt));
+				pkt.type      = OBS_ENCODER_AUDIO;
+				pkt.track_idx = t;
+				pkt.timebase_num = 1;
+				pkt.timebase_den = AUDIO_RATE;
+				pkt.dts       = audio_pos[t];
+				pkt.pts       = audio_pos[t];
+				pkt.dts_usec  = next_audio_usec[t];
+				pkt.data      = (uint8_t*)(uintptr_t)packets.num;
+				da_push_back(packets, &pkt);
+
+				next_audio_usec[t] += audio_usec;
+				audio_pos[t] += AUDIO_FRAMES;
+			}
+		}
+
+		memset(&pkt, 0, sizeof(pkt));
+		pkt.type         = OBS_ENCODER_VIDEO;
+		pkt.timebase_num = 1;
+		pkt.timebase_den = VIDEO_FPS;
+		pkt.keyframe     = frame % 120 == 0;
+		pkt.dts          = frame - B_FRAMES;
+		pkt.pts          = gop_pos == 0 ? frame + B_FRAMES : frame - 1;
+		pkt.dts_usec     = dts_usec;
+		pkt.data         = (uint8_t*)(uintptr_t)packets.num;
+		da_push_back(packets, &pkt);
+	}
+
+	*array = packets.da;
+}
+
+static bool run(int minutes, int64_t late_usec)
+{
+	DARRAY(struct encoder_packet) buffer = {0};
+	DARRAY(struct encoder_packet) inserted = {0};
+	DARRAY(struct encoder_packet) merged = {0};
+	uint64_t start, insert_ns, copy_ns, merge_ns;
+	size_t *order;
+	bool same = true;
+
+	fill_buffer(&buffer.da, minutes, late_usec);
+
+	start = os_gettime_ns();
+	sorted_insert_order(buffer.array, buffer.num, &inserted.da);
+	insert_ns = os_gettime_ns() - start;
+
+	/* what the data thread still does: one copy per packet */
+	start = os_gettime_ns();
+	da_resize(merged, buffer.num);
+	for (size_t i = 0; i < buffer.num; i++)
+		merged.array[i] = buffer.array[i];
+	copy_ns = os_gettime_ns() - start;
+
+	start = os_gettime_ns();
+	offset_replay_packets(merged.array, merged.num);
+	order = merge_replay_packets(merged.array, merged.num);
+	merge_ns = os_gettime_ns() - start;
+
+	for (size_t i = 0; i < buffer.num; i++) {
+		const struct encoder_packet *a = &inserted.array[i];
+		const struct encoder_packet *b = &merged.array[order[i]];
+
+		if (a->data != b->data || a->dts_usec != b->dts_usec ||
+		    a->dts != b->dts || a->pts != b->pts) {
+			printf("FAIL %d min: orders differ at packet %zu\n",
+					minutes, i);
+			same = false;
+			break;
+		}
+	}
+
+	printf("%2d min %-10s %7zu packets: sorted insert %9.2f ms, "
+			"data thread copy %6.2f ms + merge %6.2f ms\n",
+			minutes, late_usec ? "late track" : "",
+			buffer.num,
+			(double)insert_ns / 1000000.0,
+			(double)copy_ns / 1000000.0,
+			(double)merge_ns / 1000000.0);
+
+	bfree(order);
+	da_free(merged);
+	da_free(inserted);
+	da_free(buffer);
+	return same;
+}
+
+int main(void)
+{
+	static const int minutes[] = {1, 5, 10};
+	bool success = true;
+
+	printf("%d fps video with %d B-frames, %d audio tracks\n",
+			VIDEO_FPS, B_FRAMES, AUDIO_TRACKS);
+
+	for (size_t i = 0; i < sizeof(minutes) / sizeof(minutes[0]); i++)
+		success = run(minutes[i], 0) && success;
+	for (size_t i = 0; i < sizeof(minutes) / sizeof(minutes[0]); i++)
+		success = run(minutes[i], 60000000) && success;
+
+	return success ? 0 : 1;
+}